@@ -44,11 +44,14 @@ void bbox_main_usage()
         "                                                                    \n"
         "COMMANDS:                                                           \n"
         "                                                                    \n"
+        "  delete   Remove a target and reclaim its space in the background. \n"
         "  init     Initialize build box environment for new user.           \n"
         "  login    Chroot into a target.                                    \n"
         "  mount    Mount homedir and special file systems (dev, proc, sys). \n"
         "  umount   Unmount homedir and special file systems.                \n"
+        "  quota    Report and limit the space targets use.                  \n"
         "  run      Execute a command chrooted inside a target.              \n"
+        "  session  Keep a target set up for repeated `run` and `login`.     \n"
         "                                                                    \n"
         "OPTIONS:                                                            \n"
         "                                                                    \n"
@@ -117,6 +120,8 @@ int main(int argc, char *argv[])
      * Check which command was invoked and delegate to the appropriate
      * sub-module.
      */
+    if(strcmp(command, "delete") == 0)
+        return bbox_delete(argc-1, &argv[1]);
     if(strcmp(command, "init") == 0)
         return bbox_init(argc-1, &argv[1]);
     if(strcmp(command, "login") == 0)
@@ -125,8 +130,12 @@ int main(int argc, char *argv[])
         return bbox_mount(argc-1, &argv[1]);
     if(strcmp(command, "umount") == 0)
         return bbox_umount(argc-1, &argv[1]);
+    if(strcmp(command, "quota") == 0)
+        return bbox_quota(argc-1, &argv[1]);
     if(strcmp(command, "run") == 0)
         return bbox_run(argc-1, &argv[1]);
+    if(strcmp(command, "session") == 0)
+        return bbox_session(argc-1, &argv[1]);
 
     bbox_perror("main", "unknown command '%s'.\n", command);
     return BBOX_ERR_INVOCATION;
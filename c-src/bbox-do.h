@@ -1,6 +1,7 @@
 #ifndef BBOX_H_INCLUDED
 #define BBOX_H_INCLUDED
 
+#define BBOX_ERR_BUSY       253
 #define BBOX_ERR_INVOCATION 254
 #define BBOX_ERR_RUNTIME    255
 
@@ -10,21 +11,57 @@
 #define BBOX_DO_MOUNT_PROC 0x02
 #define BBOX_DO_MOUNT_SYS  0x04
 #define BBOX_DO_MOUNT_HOME 0x08
-#define BBOX_DO_MOUNT_ALL  0x0F
+#define BBOX_DO_MOUNT_ALL  (0x0F | BBOX_DO_MOUNT_PKG_CACHE)
 
 #define BBOX_DO_COPY_FILES 0x10
 #define BBOX_DO_ISOLATE    0x20
+#define BBOX_DO_UMOUNT_ALL  0x40
+#define BBOX_DO_UMOUNT_LAZY 0x80
+
+#define BBOX_DO_UMOUNT_FORCE 0x100
+#define BBOX_DO_AUTO_UMOUNT  0x200
+
+#define BBOX_DO_PRIVATE_MOUNTS 0x400
+#define BBOX_DO_NO_SESSION     0x800
+#define BBOX_DO_MOUNT_TMP      0x1000
+#define BBOX_DO_HOST_DEV       0x2000
+#define BBOX_DO_OVERLAY        0x4000
+#define BBOX_DO_OVERLAY_TMPFS  0x8000
+#define BBOX_DO_OVERLAY_COMMIT 0x10000
+#define BBOX_DO_DELETE_WAIT    0x20000
+#define BBOX_DO_QUOTA_ASSIGN   0x40000
+#define BBOX_DO_MOUNT_PKG_CACHE 0x80000
+#define BBOX_DO_MOUNT_OPTIONS   0x100000
+
+#define BBOX_MAX_SCRATCH 8
 
 #define BBOX_GROUP_NAME "build-box"
 #define BBOX_VAR_LIB "/var/lib/build-box"
+#define BBOX_IMAGE_DIR BBOX_VAR_LIB"/images"
 #define BBOX_USER_DIR_TEMPLATE BBOX_VAR_LIB"/users/%lu"
+#define BBOX_RUN_DIR "/run/build-box"
+#define BBOX_SESSION_DIR_TEMPLATE BBOX_RUN_DIR"/%lu"
+#define BBOX_TMPFS_LEDGER_NAME "tmpfs"
+#define BBOX_PKG_CACHE_LINK "/.pkg-cache"
+#define BBOX_PKG_CACHE_DIR "/var/cache/opkg"
 
+#include <stdint.h>
 #include <sys/types.h>
 
+typedef struct {
+    char *path;
+    unsigned long long size;
+} bbox_scratch_t;
+
 typedef struct {
     char *target_dir;
     char *home_dir;
     unsigned int config_bits;
+    unsigned int linger;
+    bbox_scratch_t scratch[BBOX_MAX_SCRATCH];
+    size_t num_scratch;
+    unsigned long long shm_size;
+    unsigned long long quota_limit;
 } bbox_conf_t;
 
 bbox_conf_t *bbox_config_new();
@@ -42,17 +79,40 @@ void bbox_config_set_mount_dev(bbox_conf_t *conf);
 void bbox_config_set_mount_proc(bbox_conf_t *conf);
 void bbox_config_set_mount_sys(bbox_conf_t *conf);
 void bbox_config_set_mount_home(bbox_conf_t *conf);
+void bbox_config_set_mount_tmp(bbox_conf_t *conf);
+void bbox_config_set_mount_pkg_cache(bbox_conf_t *conf);
 
 void bbox_config_unset_mount_dev(bbox_conf_t *conf);
 void bbox_config_unset_mount_proc(bbox_conf_t *conf);
 void bbox_config_unset_mount_sys(bbox_conf_t *conf);
 void bbox_config_unset_mount_home(bbox_conf_t *conf);
+void bbox_config_unset_mount_tmp(bbox_conf_t *conf);
+void bbox_config_unset_mount_pkg_cache(bbox_conf_t *conf);
 
 unsigned int bbox_config_get_mount_any(const bbox_conf_t *conf);
 unsigned int bbox_config_get_mount_dev(const bbox_conf_t *conf);
 unsigned int bbox_config_get_mount_proc(const bbox_conf_t *conf);
 unsigned int bbox_config_get_mount_sys(const bbox_conf_t *conf);
 unsigned int bbox_config_get_mount_home(const bbox_conf_t *conf);
+unsigned int bbox_config_get_mount_tmp(const bbox_conf_t *conf);
+unsigned int bbox_config_get_mount_pkg_cache(const bbox_conf_t *conf);
+
+int bbox_config_add_scratch(bbox_conf_t *conf, const char *spec);
+size_t bbox_config_get_num_scratch(const bbox_conf_t *conf);
+const bbox_scratch_t *bbox_config_get_scratch(const bbox_conf_t *conf,
+        size_t i);
+
+void bbox_config_set_host_dev(bbox_conf_t *conf);
+unsigned int bbox_config_get_host_dev(const bbox_conf_t *conf);
+int bbox_config_set_shm_size(bbox_conf_t *conf, const char *size);
+unsigned long long bbox_config_get_shm_size(const bbox_conf_t *conf);
+
+void bbox_config_set_overlay(bbox_conf_t *conf);
+unsigned int bbox_config_get_overlay(const bbox_conf_t *conf);
+void bbox_config_set_overlay_tmpfs(bbox_conf_t *conf);
+unsigned int bbox_config_get_overlay_tmpfs(const bbox_conf_t *conf);
+void bbox_config_set_overlay_commit(bbox_conf_t *conf);
+unsigned int bbox_config_get_overlay_commit(const bbox_conf_t *conf);
 
 void bbox_config_disable_file_updates(bbox_conf_t *conf);
 void bbox_config_enable_file_updates(bbox_conf_t *conf);
@@ -61,6 +121,33 @@ void bbox_config_set_isolation(bbox_conf_t *conf);
 void bbox_config_unset_isolation(bbox_conf_t *conf);
 unsigned int bbox_config_get_isolation(const bbox_conf_t *conf);
 
+void bbox_config_set_umount_all(bbox_conf_t *conf);
+unsigned int bbox_config_get_umount_all(const bbox_conf_t *conf);
+void bbox_config_set_umount_lazy(bbox_conf_t *conf);
+unsigned int bbox_config_get_umount_lazy(const bbox_conf_t *conf);
+void bbox_config_set_umount_force(bbox_conf_t *conf);
+unsigned int bbox_config_get_umount_force(const bbox_conf_t *conf);
+void bbox_config_set_delete_wait(bbox_conf_t *conf);
+unsigned int bbox_config_get_delete_wait(const bbox_conf_t *conf);
+
+void bbox_config_set_quota_assign(bbox_conf_t *conf);
+unsigned int bbox_config_get_quota_assign(const bbox_conf_t *conf);
+int bbox_config_set_quota_limit(bbox_conf_t *conf, const char *size);
+unsigned long long bbox_config_get_quota_limit(const bbox_conf_t *conf);
+
+void bbox_config_set_auto_umount(bbox_conf_t *conf, unsigned int linger);
+unsigned int bbox_config_get_auto_umount(const bbox_conf_t *conf);
+unsigned int bbox_config_get_linger(const bbox_conf_t *conf);
+
+void bbox_config_set_private_mounts(bbox_conf_t *conf);
+unsigned int bbox_config_get_private_mounts(const bbox_conf_t *conf);
+
+void bbox_config_set_no_session(bbox_conf_t *conf);
+unsigned int bbox_config_get_no_session(const bbox_conf_t *conf);
+
+void bbox_config_set_mount_options(bbox_conf_t *conf);
+unsigned int bbox_config_get_mount_options(const bbox_conf_t *conf);
+
 unsigned int bbox_config_do_file_updates(const bbox_conf_t *conf);
 void bbox_config_free(bbox_conf_t *conf);
 
@@ -71,6 +158,7 @@ void bbox_sep_join(char **buf_ptr, const char *base, const char *sep,
 void bbox_path_join(char **buf_ptr, const char *base, const char *sub,
         size_t *n_ptr);
 void bbox_perror(const char *lead, const char *msg, ...);
+void bbox_pnotice(const char *lead, const char *msg, ...);
 int bbox_login_sh_chrooted(char *sys_root, char *home_dir);
 int bbox_runas_user_chrooted(const char *sys_root, int argc,
         char * const argv[], const bbox_conf_t *conf);
@@ -85,6 +173,7 @@ int bbox_drop_privileges();
 
 int bbox_check_user_in_group_build_box();
 int bbox_isdir_and_owned_by(const char *module, const char *dir, uid_t uid);
+int bbox_is_admin_owned(const char *module, int fd, const char *path);
 int bbox_mkdir_p(const char *module, const char *path);
 int bbox_sysroot_mkdir_p(const char *module, const char *sysroot,
         const char *path);
@@ -93,11 +182,168 @@ int bbox_try_fix_pkg_cache_symlink(char *module);
 
 char *bbox_get_user_dir(uid_t uid, size_t *n_ptr);
 int validate_target_name(const char *module, const char *target_name);
+int bbox_parse_seconds(const char *module, const char *str,
+        unsigned int *seconds_ptr);
+int bbox_parse_size(const char *module, const char *str,
+        unsigned long long *size_ptr);
+unsigned long long bbox_get_phys_mem();
+unsigned long long bbox_get_start_time(pid_t pid);
+
+/* Leases */
+
+int bbox_lease_acquire(const char *module, const char *sys_root,
+        int is_inherited);
+int bbox_lease_try_exclusive(const char *module, const char *sys_root);
+int bbox_lease_supervise(bbox_conf_t *conf, const char *sys_root,
+        int lease_fd, int *status_ptr);
+void bbox_lease_record_use(const char *sys_root);
+
+/* Mount journal */
+
+#define BBOX_STATX_MNT_ID        0x00001000U
+#define BBOX_STATX_MNT_ID_UNIQUE 0x00004000U
+
+typedef struct {
+    char *mnt_dir;
+    uint64_t mnt_id;
+} bbox_journal_entry_t;
+
+typedef struct {
+    char *path;
+    char *sys_root;
+    unsigned int statx_mask;
+    bbox_journal_entry_t *entries;
+    size_t num_entries;
+    size_t max_entries;
+    int is_dirty;
+} bbox_journal_t;
+
+bbox_journal_t *bbox_journal_open(const char *sys_root);
+int bbox_journal_check(bbox_journal_t *journal, const char *mnt_dir);
+int bbox_journal_record(bbox_journal_t *journal, const char *mnt_dir);
+void bbox_journal_forget(bbox_journal_t *journal, const char *mnt_dir);
+int bbox_journal_save(bbox_journal_t *journal);
+void bbox_journal_free(bbox_journal_t *journal);
+
+int bbox_stat_mnt_id(const char *path, unsigned int mask, uint64_t *mnt_id,
+        int *is_mount_root);
+int bbox_fstat_mnt_id(int fd, unsigned int mask, uint64_t *mnt_id);
+
+/* Mount table */
+
+#define BBOX_MTAB_SOURCE_LISTMOUNT 1
+#define BBOX_MTAB_SOURCE_MOUNTINFO 2
+
+typedef struct bbox_mtab_entry {
+    uint64_t mnt_id;
+    uint64_t seq;
+    char *mnt_dir;
+    struct bbox_mtab_entry *next_id;
+    struct bbox_mtab_entry *next_dir;
+} bbox_mtab_entry_t;
+
+typedef struct {
+    int source;
+    unsigned int statx_mask;
+    bbox_mtab_entry_t **id_buckets;
+    bbox_mtab_entry_t **dir_buckets;
+    size_t num_buckets;
+    size_t num_entries;
+    uint64_t seq;
+    int is_loaded;
+    bbox_journal_t *journal;
+} bbox_mtab_t;
+
+bbox_mtab_t *bbox_mtab_new();
+bbox_mtab_t *bbox_mtab_load();
+bbox_mtab_t *bbox_mtab_load_listmount();
+bbox_mtab_t *bbox_mtab_load_mountinfo(const char *path);
+bbox_mtab_t *bbox_mtab_open(const char *sys_root);
+int bbox_mtab_sync(bbox_mtab_t *mtab);
+int bbox_mtab_add(bbox_mtab_t *mtab, const char *mnt_dir);
+int bbox_mtab_contains(bbox_mtab_t *mtab, const char *mnt_dir);
+int bbox_mtab_list_under(bbox_mtab_t *mtab, const char *prefix,
+        char ***mnt_dirs_ptr, size_t *num_ptr);
+int bbox_mtab_list_source(const char *source, char ***mnt_dirs_ptr,
+        size_t *num_ptr);
+void bbox_mtab_remove(bbox_mtab_t *mtab, const char *mnt_dir);
+void bbox_mtab_free(bbox_mtab_t *mtab);
 
 /* Mounting */
 
+#define BBOX_MOUNT_MAX_REQS 16
+
+/*
+ * Scratch space is limited to a share of the physical memory, both per mount
+ * and in total for all targets of a user.
+ */
+#define BBOX_TMPFS_DEFAULT_PERCENT 25
+#define BBOX_TMPFS_QUOTA_PERCENT   50
+#define BBOX_SHM_DEFAULT_PERCENT   10
+
+typedef struct {
+    const char *source;
+    char *target;
+    const char *fstype;
+    unsigned long flags;
+    char *data;
+    dev_t dev;
+    ino_t ino;
+    int is_mounted;
+} bbox_mount_req_t;
+
+typedef struct {
+    bbox_mount_req_t reqs[BBOX_MOUNT_MAX_REQS];
+    size_t num_reqs;
+} bbox_mount_plan_t;
+
+int bbox_mount_plan_bind(bbox_mount_plan_t *plan, bbox_mtab_t *mtab,
+        const char *sys_root, const char *source, int recursive);
+int bbox_mount_plan_special(bbox_mount_plan_t *plan, bbox_mtab_t *mtab,
+        const char *sys_root, const char *filesystemtype);
+const char *bbox_mount_tmpfs_source();
+char *bbox_mount_tmpfs_data(unsigned long long size, int is_shared);
+int bbox_mount_check_tmpfs_quota(unsigned long long requested,
+        int is_private);
+int bbox_mount_plan_tmpfs(bbox_mount_plan_t *plan, bbox_mtab_t *mtab,
+        const char *sys_root, const char *mount_point, const char *data);
+int bbox_mount_plan_image(bbox_mount_plan_t *plan, bbox_mtab_t *mtab,
+        const char *sys_root, const char *source, const char *fstype);
+int bbox_mount_plan_overlay(bbox_mount_plan_t *plan, const char *sys_root,
+        const char *lower_dir, const char *upper_dir, const char *work_dir);
+int bbox_mount_plan_execute(bbox_mount_plan_t *plan, bbox_mtab_t *mtab);
+void bbox_mount_plan_clear(bbox_mount_plan_t *plan);
+int bbox_mount_open_target(const bbox_mount_req_t *req);
+int bbox_mountfd_execute(bbox_mount_plan_t *plan);
+
 int bbox_mount_any(const bbox_conf_t *conf, const char *sys_root);
-int bbox_mount_is_mounted(const char *path);
+int bbox_mount_unshare(const char *module);
+int bbox_mount_is_mounted(bbox_mtab_t *mtab, const char *path);
+int bbox_mount_set_mounted(bbox_mtab_t *mtab, const char *path);
+void bbox_mount_set_unmounted(bbox_mtab_t *mtab, const char *path);
+
+int bbox_umount_any(const bbox_conf_t *conf, const char *sys_root);
+
+/* Overlays */
+
+int bbox_overlay_supervise(bbox_conf_t *conf, const char *sys_root,
+        int *status_ptr);
+int bbox_overlay_remove_at(int dir_fd, const char *name);
+
+/* Layered targets */
+
+int bbox_layer_assemble(const char *module, const char *sys_root);
+int bbox_layer_disassemble(const char *sys_root, int umount_flags);
+char *bbox_layer_find_dir(const char *real_root);
+
+/* Sessions */
+
+int bbox_session_enter(const bbox_conf_t *conf, const char *module,
+        const char *sys_root);
+
+/* Deleting targets */
+
+int bbox_delete_tree(int dir_fd, const char *name);
 
 /* Setup */
 
@@ -105,11 +351,14 @@ int bbox_init_user_directory();
 
 /* Commands */
 
+int bbox_delete(int argc, char * const argv[]);
 int bbox_init(int argc, char * const argv[]);
 int bbox_list(int argc, char * const argv[]);
 int bbox_login(int argc, char * const argv[]);
+int bbox_quota(int argc, char * const argv[]);
 int bbox_run(int argc, char * const argv[]);
 int bbox_mount(int argc, char * const argv[]);
 int bbox_umount(int argc, char * const argv[]);
+int bbox_session(int argc, char * const argv[]);
 
 #endif
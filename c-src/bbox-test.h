@@ -0,0 +1,27 @@
+#ifndef BBOX_TEST_H_INCLUDED
+#define BBOX_TEST_H_INCLUDED
+
+#include <stdio.h>
+
+/*
+ * Minimal helpers for the unit checks run by `make check`. A check that
+ * fails is reported and counted, the program keeps going. Automake treats
+ * exit status 77 as a skipped test.
+ */
+
+#define BBOX_TEST_SKIP 77
+
+static int bbox_test_failures = 0;
+
+#define BBOX_CHECK(cond) \
+    do { \
+        if(!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, \
+                    __LINE__, #cond); \
+            bbox_test_failures++; \
+        } \
+    } while(0)
+
+#define BBOX_TEST_RESULT() (bbox_test_failures ? 1 : 0)
+
+#endif
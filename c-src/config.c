@@ -141,7 +141,7 @@ char *bbox_config_get_home_dir(const bbox_conf_t *conf)
 
 void bbox_config_clear_mount(bbox_conf_t *c)
 {
-    c->config_bits &= ~BBOX_DO_MOUNT_ALL;
+    c->config_bits &= ~(BBOX_DO_MOUNT_ALL | BBOX_DO_MOUNT_TMP);
 }
 
 void bbox_config_set_mount_all(bbox_conf_t *c)
@@ -169,6 +169,16 @@ void bbox_config_set_mount_home(bbox_conf_t *c)
     c->config_bits |= BBOX_DO_MOUNT_HOME;
 }
 
+void bbox_config_set_mount_tmp(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_MOUNT_TMP;
+}
+
+void bbox_config_set_mount_pkg_cache(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_MOUNT_PKG_CACHE;
+}
+
 void bbox_config_unset_mount_dev(bbox_conf_t *c)
 {
     c->config_bits &= ~BBOX_DO_MOUNT_DEV;
@@ -189,6 +199,16 @@ void bbox_config_unset_mount_home(bbox_conf_t *c)
     c->config_bits &= ~BBOX_DO_MOUNT_HOME;
 }
 
+void bbox_config_unset_mount_tmp(bbox_conf_t *c)
+{
+    c->config_bits &= ~BBOX_DO_MOUNT_TMP;
+}
+
+void bbox_config_unset_mount_pkg_cache(bbox_conf_t *c)
+{
+    c->config_bits &= ~BBOX_DO_MOUNT_PKG_CACHE;
+}
+
 unsigned int bbox_config_get_mount_any(const bbox_conf_t *c)
 {
     return (c->config_bits & BBOX_DO_MOUNT_ALL);
@@ -214,6 +234,125 @@ unsigned int bbox_config_get_mount_home(const bbox_conf_t *c)
     return (c->config_bits & BBOX_DO_MOUNT_HOME);
 }
 
+unsigned int bbox_config_get_mount_tmp(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_MOUNT_TMP);
+}
+
+unsigned int bbox_config_get_mount_pkg_cache(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_MOUNT_PKG_CACHE);
+}
+
+/*
+ * Parses a scratch space specification of the form <path>[:size]. The path
+ * is relative to the target root. A size of zero means "use the default".
+ */
+int bbox_config_add_scratch(bbox_conf_t *c, const char *spec)
+{
+    unsigned long long size = 0;
+    char *path = NULL;
+    char *sep = NULL;
+
+    if(c->num_scratch >= BBOX_MAX_SCRATCH) {
+        bbox_perror("bbox_config_add_scratch",
+                "at most %d scratch directories are supported.\n",
+                BBOX_MAX_SCRATCH);
+        return -1;
+    }
+
+    if(!(path = strdup(spec))) {
+        bbox_perror("bbox_config_add_scratch", "out of memory?\n");
+        return -1;
+    }
+
+    if((sep = strrchr(path, ':'))) {
+        *sep = '\0';
+
+        if(bbox_parse_size("bbox_config_add_scratch", sep + 1, &size) == -1)
+            goto failure;
+    }
+
+    if(path[0] != '/' || !strcmp(path, "/") || strstr(path, "/../") ||
+            (strlen(path) >= 3 && !strcmp(path + strlen(path) - 3, "/..")))
+    {
+        bbox_perror("bbox_config_add_scratch",
+                "invalid scratch directory '%s'.\n", path);
+        goto failure;
+    }
+
+    c->scratch[c->num_scratch].path = path;
+    c->scratch[c->num_scratch].size = size;
+    c->num_scratch++;
+    return 0;
+
+failure:
+
+    free(path);
+    return -1;
+}
+
+size_t bbox_config_get_num_scratch(const bbox_conf_t *c)
+{
+    return c->num_scratch;
+}
+
+const bbox_scratch_t *bbox_config_get_scratch(const bbox_conf_t *c,
+        size_t i)
+{
+    return i < c->num_scratch ? &c->scratch[i] : NULL;
+}
+
+void bbox_config_set_host_dev(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_HOST_DEV;
+}
+
+unsigned int bbox_config_get_host_dev(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_HOST_DEV);
+}
+
+int bbox_config_set_shm_size(bbox_conf_t *c, const char *size)
+{
+    return bbox_parse_size("bbox_config_set_shm_size", size, &c->shm_size);
+}
+
+unsigned long long bbox_config_get_shm_size(const bbox_conf_t *c)
+{
+    return c->shm_size;
+}
+
+void bbox_config_set_overlay(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_OVERLAY;
+}
+
+unsigned int bbox_config_get_overlay(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_OVERLAY);
+}
+
+void bbox_config_set_overlay_tmpfs(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_OVERLAY | BBOX_DO_OVERLAY_TMPFS;
+}
+
+unsigned int bbox_config_get_overlay_tmpfs(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_OVERLAY_TMPFS);
+}
+
+void bbox_config_set_overlay_commit(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_OVERLAY | BBOX_DO_OVERLAY_COMMIT;
+}
+
+unsigned int bbox_config_get_overlay_commit(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_OVERLAY_COMMIT);
+}
+
 void bbox_config_enable_file_updates(bbox_conf_t *c)
 {
     c->config_bits |= BBOX_DO_COPY_FILES;
@@ -244,9 +383,133 @@ unsigned int bbox_config_get_isolation(const bbox_conf_t *c)
     return (c->config_bits & BBOX_DO_ISOLATE);
 }
 
+void bbox_config_set_umount_all(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_UMOUNT_ALL;
+}
+
+unsigned int bbox_config_get_umount_all(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_UMOUNT_ALL);
+}
+
+void bbox_config_set_umount_lazy(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_UMOUNT_LAZY;
+}
+
+unsigned int bbox_config_get_umount_lazy(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_UMOUNT_LAZY);
+}
+
+void bbox_config_set_umount_force(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_UMOUNT_FORCE;
+}
+
+unsigned int bbox_config_get_umount_force(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_UMOUNT_FORCE);
+}
+
+void bbox_config_set_delete_wait(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_DELETE_WAIT;
+}
+
+unsigned int bbox_config_get_delete_wait(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_DELETE_WAIT);
+}
+
+void bbox_config_set_quota_assign(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_QUOTA_ASSIGN;
+}
+
+unsigned int bbox_config_get_quota_assign(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_QUOTA_ASSIGN);
+}
+
+/*
+ * A limit only works with a project id, so it implies assigning one.
+ */
+int bbox_config_set_quota_limit(bbox_conf_t *c, const char *size)
+{
+    if(strchr(size, '%')) {
+        bbox_perror("bbox_config_set_quota_limit", "invalid size '%s'.\n",
+                size);
+        return -1;
+    }
+
+    if(bbox_parse_size("bbox_config_set_quota_limit", size,
+                &c->quota_limit) == -1)
+    {
+        return -1;
+    }
+
+    c->config_bits |= BBOX_DO_QUOTA_ASSIGN;
+    return 0;
+}
+
+unsigned long long bbox_config_get_quota_limit(const bbox_conf_t *c)
+{
+    return c->quota_limit;
+}
+
+void bbox_config_set_auto_umount(bbox_conf_t *c, unsigned int linger)
+{
+    c->config_bits |= BBOX_DO_AUTO_UMOUNT;
+    c->linger = linger;
+}
+
+unsigned int bbox_config_get_auto_umount(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_AUTO_UMOUNT);
+}
+
+unsigned int bbox_config_get_linger(const bbox_conf_t *c)
+{
+    return c->linger;
+}
+
+void bbox_config_set_private_mounts(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_PRIVATE_MOUNTS;
+}
+
+unsigned int bbox_config_get_private_mounts(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_PRIVATE_MOUNTS);
+}
+
+void bbox_config_set_no_session(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_NO_SESSION;
+}
+
+unsigned int bbox_config_get_no_session(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_NO_SESSION);
+}
+
+void bbox_config_set_mount_options(bbox_conf_t *c)
+{
+    c->config_bits |= BBOX_DO_MOUNT_OPTIONS;
+}
+
+unsigned int bbox_config_get_mount_options(const bbox_conf_t *c)
+{
+    return (c->config_bits & BBOX_DO_MOUNT_OPTIONS);
+}
+
 void bbox_config_free(bbox_conf_t *conf)
 {
     if(conf) {
+        for(size_t i = 0; i < conf->num_scratch; i++)
+            free(conf->scratch[i].path);
         free(conf->home_dir);
         free(conf->target_dir);
         free(conf);
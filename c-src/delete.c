@@ -0,0 +1,942 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bbox-do.h"
+
+/*
+ * Deleting a target is split in two. The target is renamed into the user's
+ * trash directory, which takes no time at all, and a reaper that runs in the
+ * background removes whatever is in the trash afterwards. Reapers serialize
+ * on an exclusive flock() on the trash directory.
+ *
+ * The reaper walks the tree with a pool of threads. Each directory is a job
+ * that counts the subdirectories it is still waiting for. The last one to
+ * finish removes the directory and reports to its parent in turn. A thread
+ * descends into a subdirectory itself while the others are busy, but only
+ * so deep, before it queues it like any other.
+ */
+
+#define BBOX_DELETE_MAX_THREADS 16
+#define BBOX_DELETE_MAX_DEPTH 64
+#define BBOX_DELETE_BUF_SIZE (64 * 1024)
+
+typedef struct bbox_delete_job {
+    struct bbox_delete_job *parent;
+    struct bbox_delete_job *next;
+    int parent_fd;
+    char *name;
+    size_t num_pending;
+    size_t depth;
+    int has_failed;
+} bbox_delete_job_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bbox_delete_job_t *queue;
+    size_t num_queued;
+    size_t num_busy;
+    size_t num_threads;
+    unsigned int statx_mask;
+    uint64_t mnt_id;
+    dev_t dev;
+    size_t num_errors;
+} bbox_delete_reaper_t;
+
+void bbox_delete_usage()
+{
+    printf(
+        "                                                                          \n"
+        "USAGE:                                                                    \n"
+        "                                                                          \n"
+        "  build-box delete [OPTIONS] <target-name>                                \n"
+        "                                                                          \n"
+        "OPTIONS:                                                                  \n"
+        "                                                                          \n"
+        "  -h, --help             Print this help message and exit immediately.    \n"
+        "                                                                          \n"
+        "  -w, --wait             Remove the files before returning instead of     \n"
+        "                         leaving that to a background process.            \n"
+        "                                                                          \n"
+    );
+}
+
+int bbox_delete_getopt(bbox_conf_t *conf, int argc, char * const argv[])
+{
+    int c;
+    int option_index = 0;
+
+    static struct option long_options[] = {
+        {"help",     no_argument,       0, 'h'},
+        {"targets",  required_argument, 0, 't'},
+        {"wait",     no_argument,       0, 'w'},
+        { 0,         0,                 0,  0 }
+    };
+
+    optind = 1;
+
+    while(1) {
+        c = getopt_long(argc, argv, ":ht:w", long_options, &option_index);
+
+        if(c == -1)
+            break;
+
+        switch(c) {
+            case 'h':
+                bbox_delete_usage();
+                return -1;
+            case 't':
+                if(bbox_config_set_target_dir(conf, optarg) < 0)
+                    return -2;
+                break;
+            case 'w':
+                bbox_config_set_delete_wait(conf);
+                break;
+            case '?':
+            case ':':
+                bbox_delete_usage();
+                return -2;
+            default:
+                /* impossible, ignore */
+                break;
+        }
+    }
+
+    if(argc - 1 > optind) {
+        bbox_delete_usage();
+        return -1;
+    }
+
+    return optind;
+}
+
+/*
+ * Everything the reaper does is relative to directory descriptors it holds
+ * and no symbolic link is ever followed, so it is safe to retry as root when
+ * the user lacks permission. The C library changes the user id of all
+ * threads at once, so the raw system call is used to raise the privileges of
+ * the calling thread alone.
+ */
+static int bbox_delete_set_euid(uid_t euid)
+{
+    return syscall(SYS_setresuid, -1, euid, -1);
+}
+
+static int bbox_delete_unlinkat(int dir_fd, const char *name, int flags)
+{
+    int rval = unlinkat(dir_fd, name, flags);
+
+    if(rval == 0 || (errno != EACCES && errno != EPERM))
+        return rval;
+
+    if(bbox_delete_set_euid(0) == -1)
+        return -1;
+
+    rval = unlinkat(dir_fd, name, flags);
+
+    int saved_errno = errno;
+
+    if(bbox_delete_set_euid(getuid()) == -1) {
+        bbox_perror("delete", "failed to drop privileges: %s.\n",
+                strerror(errno));
+        abort();
+    }
+
+    errno = saved_errno;
+    return rval;
+}
+
+static int bbox_delete_opendir(int dir_fd, const char *name)
+{
+    int flags = O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC;
+    int fd = openat(dir_fd, name, flags);
+
+    if(fd >= 0 || errno != EACCES)
+        return fd;
+
+    if(bbox_delete_set_euid(0) == -1)
+        return -1;
+
+    fd = openat(dir_fd, name, flags);
+
+    int saved_errno = errno;
+
+    if(bbox_delete_set_euid(getuid()) == -1) {
+        bbox_perror("delete", "failed to drop privileges: %s.\n",
+                strerror(errno));
+        abort();
+    }
+
+    errno = saved_errno;
+    return fd;
+}
+
+/*
+ * Returns 1 if `fd` lives on the same mount as the tree that is deleted. The
+ * mounts are gone by the time a target reaches the trash, but it doesn't hurt
+ * to make sure.
+ */
+static int bbox_delete_is_same_mount(bbox_delete_reaper_t *reaper, int fd)
+{
+    struct stat st;
+    uint64_t mnt_id;
+
+    if(reaper->statx_mask) {
+        if(bbox_fstat_mnt_id(fd, reaper->statx_mask, &mnt_id) == -1)
+            return 0;
+        return mnt_id == reaper->mnt_id;
+    }
+
+    if(fstat(fd, &st) == -1)
+        return 0;
+    return st.st_dev == reaper->dev;
+}
+
+static void bbox_delete_fail(bbox_delete_reaper_t *reaper,
+        bbox_delete_job_t *job, const char *name, int error)
+{
+    bbox_perror("delete", "failed to remove '%s': %s.\n", name,
+            strerror(error));
+
+    pthread_mutex_lock(&reaper->lock);
+    job->has_failed = 1;
+    reaper->num_errors++;
+    pthread_mutex_unlock(&reaper->lock);
+}
+
+static bbox_delete_job_t *bbox_delete_job_new(bbox_delete_job_t *parent,
+        int parent_fd, const char *name)
+{
+    bbox_delete_job_t *job = calloc(sizeof(bbox_delete_job_t), 1);
+
+    if(!job) {
+        bbox_perror("delete", "out of memory?\n");
+        return NULL;
+    }
+
+    job->parent = parent;
+    job->num_pending = 1;
+
+    if(!(job->name = strdup(name))) {
+        bbox_perror("delete", "out of memory?\n");
+        free(job);
+        return NULL;
+    }
+
+    if((job->parent_fd = fcntl(parent_fd, F_DUPFD_CLOEXEC, 0)) == -1) {
+        bbox_perror("delete", "failed to duplicate descriptor: %s.\n",
+                strerror(errno));
+        free(job->name);
+        free(job);
+        return NULL;
+    }
+
+    return job;
+}
+
+/*
+ * Called whenever a job or one of its subdirectories is done. The directory
+ * is removed together with the last reference to it, and its parent is
+ * notified in turn.
+ */
+static void bbox_delete_job_finish(bbox_delete_reaper_t *reaper,
+        bbox_delete_job_t *job)
+{
+    while(job) {
+        bbox_delete_job_t *parent = job->parent;
+
+        pthread_mutex_lock(&reaper->lock);
+        size_t num_pending = --job->num_pending;
+        int has_failed = job->has_failed;
+        pthread_mutex_unlock(&reaper->lock);
+
+        if(num_pending > 0)
+            break;
+
+        if(!has_failed) {
+            if(bbox_delete_unlinkat(job->parent_fd, job->name,
+                        AT_REMOVEDIR) == -1 && errno != ENOENT)
+            {
+                bbox_delete_fail(reaper, job, job->name, errno);
+                has_failed = 1;
+            }
+        }
+
+        /*
+         * Once something couldn't be removed, neither can any of the
+         * directories above it. There is no point in saying so every time.
+         */
+        if(has_failed && parent) {
+            pthread_mutex_lock(&reaper->lock);
+            parent->has_failed = 1;
+            pthread_mutex_unlock(&reaper->lock);
+        }
+
+        close(job->parent_fd);
+        free(job->name);
+        free(job);
+
+        job = parent;
+    }
+}
+
+static void bbox_delete_scan(bbox_delete_reaper_t *reaper,
+        bbox_delete_job_t *job);
+
+/*
+ * Hands a subdirectory to an idle thread, or descends into it right away if
+ * there is none. Past BBOX_DELETE_MAX_DEPTH, it is queued in any case, so
+ * that deep trees don't exhaust the stack.
+ */
+static void bbox_delete_descend(bbox_delete_reaper_t *reaper,
+        bbox_delete_job_t *job, int fd, const char *name)
+{
+    bbox_delete_job_t *child = bbox_delete_job_new(job, fd, name);
+
+    if(!child) {
+        pthread_mutex_lock(&reaper->lock);
+        job->has_failed = 1;
+        reaper->num_errors++;
+        pthread_mutex_unlock(&reaper->lock);
+        return;
+    }
+
+    pthread_mutex_lock(&reaper->lock);
+
+    job->num_pending++;
+
+    if(reaper->num_queued + reaper->num_busy < reaper->num_threads ||
+            job->depth >= BBOX_DELETE_MAX_DEPTH)
+    {
+        child->next = reaper->queue;
+        reaper->queue = child;
+        reaper->num_queued++;
+        pthread_cond_signal(&reaper->cond);
+        child = NULL;
+    }
+
+    pthread_mutex_unlock(&reaper->lock);
+
+    if(child) {
+        child->depth = job->depth + 1;
+        bbox_delete_scan(reaper, child);
+    }
+}
+
+/*
+ * Empties the directory of the given job and finishes it.
+ */
+static void bbox_delete_scan(bbox_delete_reaper_t *reaper,
+        bbox_delete_job_t *job)
+{
+    char *buf = NULL;
+    ssize_t num_read;
+    struct stat st;
+    int fd = -1;
+
+    if((fd = bbox_delete_opendir(job->parent_fd, job->name)) == -1) {
+        bbox_delete_fail(reaper, job, job->name, errno);
+        goto cleanup_and_exit;
+    }
+
+    if(!bbox_delete_is_same_mount(reaper, fd)) {
+        bbox_delete_fail(reaper, job, job->name, EXDEV);
+        goto cleanup_and_exit;
+    }
+
+    /*
+     * Directories that are read-only but ours are made writable, so that
+     * their contents can be removed without privileges.
+     */
+    if(fstat(fd, &st) == 0 && st.st_uid == getuid() &&
+            (st.st_mode & 0700) != 0700)
+    {
+        if(fchmod(fd, 0700) == -1) {
+            bbox_delete_fail(reaper, job, job->name, errno);
+            goto cleanup_and_exit;
+        }
+    }
+
+    if(!(buf = malloc(BBOX_DELETE_BUF_SIZE))) {
+        bbox_delete_fail(reaper, job, job->name, ENOMEM);
+        goto cleanup_and_exit;
+    }
+
+    while((num_read = getdents64(fd, buf, BBOX_DELETE_BUF_SIZE)) > 0) {
+        for(ssize_t offset = 0; offset < num_read; ) {
+            struct dirent64 *entry = (struct dirent64 *) (buf + offset);
+            const char *name = entry->d_name;
+
+            offset += entry->d_reclen;
+
+            if(!strcmp(name, ".") || !strcmp(name, ".."))
+                continue;
+
+            if(entry->d_type == DT_DIR) {
+                bbox_delete_descend(reaper, job, fd, name);
+                continue;
+            }
+
+            if(bbox_delete_unlinkat(fd, name, 0) == 0 ||
+                    errno == ENOENT)
+            {
+                continue;
+            }
+
+            /*
+             * Not every file system fills in the type.
+             */
+            if(errno == EISDIR) {
+                bbox_delete_descend(reaper, job, fd, name);
+                continue;
+            }
+
+            bbox_delete_fail(reaper, job, name, errno);
+        }
+    }
+
+    if(num_read == -1)
+        bbox_delete_fail(reaper, job, job->name, errno);
+
+cleanup_and_exit:
+
+    free(buf);
+    if(fd >= 0)
+        close(fd);
+    bbox_delete_job_finish(reaper, job);
+}
+
+static void *bbox_delete_worker(void *arg)
+{
+    bbox_delete_reaper_t *reaper = arg;
+
+    pthread_mutex_lock(&reaper->lock);
+
+    while(1) {
+        while(!reaper->queue && reaper->num_busy > 0)
+            pthread_cond_wait(&reaper->cond, &reaper->lock);
+
+        /*
+         * Nothing queued and nobody left who could queue anything.
+         */
+        if(!reaper->queue)
+            break;
+
+        bbox_delete_job_t *job = reaper->queue;
+
+        reaper->queue = job->next;
+        reaper->num_queued--;
+        reaper->num_busy++;
+
+        pthread_mutex_unlock(&reaper->lock);
+        bbox_delete_scan(reaper, job);
+        pthread_mutex_lock(&reaper->lock);
+
+        reaper->num_busy--;
+
+        if(!reaper->queue && reaper->num_busy == 0)
+            pthread_cond_broadcast(&reaper->cond);
+    }
+
+    pthread_mutex_unlock(&reaper->lock);
+    return NULL;
+}
+
+/*
+ * Removes `name` below the directory `dir_fd`, including everything it
+ * contains, using as many threads as there are CPUs. Nothing on a different
+ * mount than `dir_fd` is touched.
+ */
+int bbox_delete_tree(int dir_fd, const char *name)
+{
+    pthread_t threads[BBOX_DELETE_MAX_THREADS];
+    bbox_delete_reaper_t reaper;
+    bbox_delete_job_t *job = NULL;
+    size_t num_started = 0;
+    struct stat st;
+    int rval = -1;
+
+    if(fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+        if(errno == ENOENT)
+            return 0;
+        bbox_perror("delete", "could not stat '%s': %s.\n", name,
+                strerror(errno));
+        return -1;
+    }
+
+    memset(&reaper, 0, sizeof(reaper));
+
+    pthread_mutex_init(&reaper.lock, NULL);
+    pthread_cond_init(&reaper.cond, NULL);
+
+    if(!S_ISDIR(st.st_mode)) {
+        if(bbox_delete_unlinkat(dir_fd, name, 0) == -1 &&
+                errno != ENOENT)
+        {
+            bbox_perror("delete", "failed to remove '%s': %s.\n", name,
+                    strerror(errno));
+            goto cleanup_and_exit;
+        }
+
+        rval = 0;
+        goto cleanup_and_exit;
+    }
+
+    if(bbox_fstat_mnt_id(dir_fd, BBOX_STATX_MNT_ID_UNIQUE,
+                &reaper.mnt_id) == 0)
+    {
+        reaper.statx_mask = BBOX_STATX_MNT_ID_UNIQUE;
+    } else if(bbox_fstat_mnt_id(dir_fd, BBOX_STATX_MNT_ID,
+                &reaper.mnt_id) == 0)
+    {
+        reaper.statx_mask = BBOX_STATX_MNT_ID;
+    } else if(fstat(dir_fd, &st) == 0) {
+        reaper.dev = st.st_dev;
+    } else {
+        bbox_perror("delete", "could not stat directory: %s.\n",
+                strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    reaper.num_threads = num_cpus < 1 ? 1 : (size_t) num_cpus;
+    if(reaper.num_threads > BBOX_DELETE_MAX_THREADS)
+        reaper.num_threads = BBOX_DELETE_MAX_THREADS;
+
+    if(!(job = bbox_delete_job_new(NULL, dir_fd, name)))
+        goto cleanup_and_exit;
+
+    reaper.queue = job;
+    reaper.num_queued = 1;
+
+    /*
+     * If threads can't be had, the ones we've got do all the work.
+     */
+    while(num_started + 1 < reaper.num_threads) {
+        if(pthread_create(&threads[num_started], NULL, bbox_delete_worker,
+                    &reaper) != 0)
+        {
+            break;
+        }
+        num_started++;
+    }
+
+    bbox_delete_worker(&reaper);
+
+    for(size_t i = 0; i < num_started; i++)
+        pthread_join(threads[i], NULL);
+
+    rval = reaper.num_errors ? -1 : 0;
+
+cleanup_and_exit:
+
+    pthread_cond_destroy(&reaper.cond);
+    pthread_mutex_destroy(&reaper.lock);
+    return rval;
+}
+
+/*
+ * Removes everything that is in the trash directory. If another reaper is at
+ * work, wait for it to finish first.
+ */
+static int bbox_delete_reap(int trash_fd)
+{
+    struct dirent *entry = NULL;
+    DIR *dir = NULL;
+    char **names = NULL;
+    size_t num_names = 0;
+    int fd = -1;
+    int rval = -1;
+
+    while(flock(trash_fd, LOCK_EX) == -1) {
+        if(errno != EINTR) {
+            bbox_perror("delete", "failed to lock trash directory: %s.\n",
+                    strerror(errno));
+            return -1;
+        }
+    }
+
+    if((fd = openat(trash_fd, ".", O_RDONLY | O_DIRECTORY |
+                    O_CLOEXEC)) == -1 || !(dir = fdopendir(fd)))
+    {
+        bbox_perror("delete", "failed to open trash directory: %s.\n",
+                strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        goto cleanup_and_exit;
+    }
+
+    while((entry = readdir(dir))) {
+        if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+
+        char **new_names = realloc(names, sizeof(char*) * (num_names + 1));
+
+        if(!new_names || !(new_names[num_names] = strdup(entry->d_name))) {
+            bbox_perror("delete", "out of memory?\n");
+            if(new_names)
+                names = new_names;
+            goto cleanup_and_exit;
+        }
+
+        names = new_names;
+        num_names++;
+    }
+
+    rval = 0;
+
+    for(size_t i = 0; i < num_names; i++) {
+        if(bbox_delete_tree(trash_fd, names[i]) == -1)
+            rval = -1;
+    }
+
+cleanup_and_exit:
+
+    for(size_t i = 0; i < num_names; i++)
+        free(names[i]);
+    free(names);
+    if(dir)
+        closedir(dir);
+    flock(trash_fd, LOCK_UN);
+    return rval;
+}
+
+/*
+ * Moves `path` into the trash under a name that is unique. Returns -1 and
+ * leaves errno set on failure.
+ */
+static int bbox_delete_move_to_trash(int trash_fd, const char *path,
+        const char *target)
+{
+    char name[NAME_MAX + 1];
+
+    for(unsigned int i = 0; ; i++) {
+        snprintf(name, sizeof(name), "%.200s.%lx.%lx.%x", target,
+                (unsigned long) time(NULL), (unsigned long) getpid(), i);
+
+        if(renameat2(AT_FDCWD, path, trash_fd, name, RENAME_NOREPLACE) == 0)
+            return 0;
+        if(errno != EEXIST)
+            return -1;
+    }
+}
+
+/*
+ * Refuses to go on if anything is still mounted in the target. Deleting
+ * through a bind mount would take out files that aren't the target's.
+ */
+static int bbox_delete_check_mounts(const char *sys_root)
+{
+    bbox_mtab_t *mtab = NULL;
+    char *real_root = NULL;
+    char **mnt_dirs = NULL;
+    size_t num_mnt_dirs = 0;
+    int rval = -1;
+
+    if(!(real_root = realpath(sys_root, NULL))) {
+        bbox_perror("delete", "unable to normalize path %s: %s.\n",
+                sys_root, strerror(errno));
+        return -1;
+    }
+
+    if(!(mtab = bbox_mtab_open(sys_root)))
+        goto cleanup_and_exit;
+
+    int is_mounted = bbox_mtab_contains(mtab, real_root);
+
+    if(is_mounted == -1)
+        goto cleanup_and_exit;
+
+    if(is_mounted) {
+        bbox_perror("delete", "there is something mounted at '%s', "
+                "aborting.\n", real_root);
+        goto cleanup_and_exit;
+    }
+
+    if(bbox_mtab_list_under(mtab, real_root, &mnt_dirs, &num_mnt_dirs) == -1)
+        goto cleanup_and_exit;
+
+    if(num_mnt_dirs > 0) {
+        bbox_perror("delete", "there is something mounted at '%s', "
+                "aborting.\n", mnt_dirs[0]);
+        goto cleanup_and_exit;
+    }
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    for(size_t i = 0; i < num_mnt_dirs; i++)
+        free(mnt_dirs[i]);
+    free(mnt_dirs);
+    bbox_mtab_free(mtab);
+    free(real_root);
+    return rval;
+}
+
+/*
+ * Takes the target and the files that belong to it out of the way.
+ */
+static int bbox_delete_discard(const bbox_conf_t *conf, const char *sys_root,
+        const char *target, int trash_fd)
+{
+    char *real_root = NULL;
+    char *layer_dir = NULL;
+    char *used_path = NULL;
+    size_t used_path_len = 0;
+    int dir_fd = -1;
+    int rval = -1;
+
+    if(!(real_root = realpath(sys_root, NULL))) {
+        bbox_perror("delete", "unable to normalize path %s: %s.\n",
+                sys_root, strerror(errno));
+        return -1;
+    }
+
+    /*
+     * The layers of a layered target live in the user directory, just like
+     * the trash. Layers of a target by the same name in a different location
+     * are left alone.
+     */
+    layer_dir = bbox_layer_find_dir(real_root);
+
+    if(bbox_delete_move_to_trash(trash_fd, sys_root, target) == 0) {
+        rval = 0;
+    } else if(errno == EXDEV) {
+        /*
+         * The target directory is on a different file system than the
+         * trash. Do it the slow way.
+         */
+        const char *target_dir = bbox_config_get_target_dir(conf);
+
+        if((dir_fd = open(target_dir, O_RDONLY | O_DIRECTORY |
+                        O_CLOEXEC)) == -1)
+        {
+            bbox_perror("delete", "failed to open '%s': %s.\n", target_dir,
+                    strerror(errno));
+            goto cleanup_and_exit;
+        }
+
+        if(bbox_delete_tree(dir_fd, target) == -1)
+            goto cleanup_and_exit;
+
+        rval = 0;
+    } else {
+        bbox_perror("delete", "failed to move '%s' to the trash: %s.\n",
+                sys_root, strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    if(layer_dir && bbox_delete_move_to_trash(trash_fd, layer_dir,
+                target) == -1)
+    {
+        bbox_perror("delete", "failed to move '%s' to the trash: %s.\n",
+                layer_dir, strerror(errno));
+        rval = -1;
+    }
+
+    /*
+     * The stamp that `build-box gc` goes by is of no use anymore.
+     */
+    if((used_path = bbox_get_user_dir(getuid(), &used_path_len))) {
+        bbox_path_join(&used_path, used_path, "used", &used_path_len);
+        bbox_path_join(&used_path, used_path, target, &used_path_len);
+
+        if(unlink(used_path) == -1 && errno != ENOENT) {
+            bbox_perror("delete", "failed to remove '%s': %s.\n",
+                    used_path, strerror(errno));
+        }
+    }
+
+cleanup_and_exit:
+
+    if(dir_fd >= 0)
+        close(dir_fd);
+    free(used_path);
+    free(layer_dir);
+    free(real_root);
+    return rval;
+}
+
+/*
+ * Empties the trash in a process of its own, which outlives us.
+ */
+static int bbox_delete_spawn_reaper(int trash_fd)
+{
+    pid_t pid = fork();
+
+    if(pid == -1) {
+        bbox_perror("delete", "failed to fork: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    if(pid > 0)
+        return 0;
+
+    setsid();
+
+    int null_fd = open("/dev/null", O_RDWR);
+
+    if(null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        if(null_fd > STDERR_FILENO)
+            close(null_fd);
+    }
+
+    _exit(bbox_delete_reap(trash_fd) == 0 ? 0 : BBOX_ERR_RUNTIME);
+}
+
+int bbox_delete(int argc, char * const argv[])
+{
+    char *buf = NULL;
+    size_t buf_len = 0;
+    char *trash_dir = NULL;
+    size_t trash_dir_len = 0;
+    int lock_fd = -1;
+    int trash_fd = -1;
+
+    int rval = BBOX_ERR_INVOCATION;
+
+    bbox_conf_t *conf = bbox_config_new();
+    if(!conf) {
+        bbox_perror("delete", "creating configuration context failed.\n");
+        return BBOX_ERR_RUNTIME;
+    }
+
+    int non_optind;
+
+    if((non_optind = bbox_delete_getopt(conf, argc, argv)) < 0) {
+        /* user asked for --help */
+        if(non_optind == -1)
+            rval = 0;
+        goto cleanup_and_exit;
+    }
+
+    if(non_optind >= argc) {
+        bbox_perror("delete", "no target specified.\n");
+        goto cleanup_and_exit;
+    }
+
+    char *target = argv[non_optind];
+
+    if(validate_target_name("delete", target) == -1)
+        goto cleanup_and_exit;
+
+    bbox_path_join(
+        &buf, bbox_config_get_target_dir(conf), target, &buf_len
+    );
+
+    struct stat st;
+
+    if(lstat(buf, &st) == -1) {
+        bbox_perror("delete", "target '%s' not found.\n", target);
+        goto cleanup_and_exit;
+    }
+
+    rval = BBOX_ERR_RUNTIME;
+
+    if(bbox_isdir_and_owned_by("delete", buf, getuid()) == -1)
+        goto cleanup_and_exit;
+
+    /*
+     * Nobody may be using the target while it goes away.
+     */
+    lock_fd = bbox_lease_try_exclusive("delete", buf);
+
+    if(lock_fd == -1)
+        goto cleanup_and_exit;
+
+    if(lock_fd == -2) {
+        bbox_perror("delete", "target '%s' is in use, aborting.\n", target);
+        goto cleanup_and_exit;
+    }
+
+    if(bbox_delete_check_mounts(buf) == -1)
+        goto cleanup_and_exit;
+
+    if(!(trash_dir = bbox_get_user_dir(getuid(), &trash_dir_len)))
+        goto cleanup_and_exit;
+
+    bbox_path_join(&trash_dir, trash_dir, "trash", &trash_dir_len);
+
+    if(mkdir(trash_dir, 0700) == -1 && errno != EEXIST) {
+        bbox_perror("delete", "failed to create '%s': %s.\n", trash_dir,
+                strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    if((trash_fd = open(trash_dir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+                    O_CLOEXEC)) == -1)
+    {
+        bbox_perror("delete", "failed to open '%s': %s.\n", trash_dir,
+                strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    if(bbox_delete_discard(conf, buf, target, trash_fd) == -1)
+        goto cleanup_and_exit;
+
+    close(lock_fd);
+    lock_fd = -1;
+
+    if(bbox_config_get_delete_wait(conf)) {
+        if(bbox_delete_reap(trash_fd) == 0)
+            rval = 0;
+    } else if(bbox_delete_spawn_reaper(trash_fd) == 0) {
+        rval = 0;
+    }
+
+cleanup_and_exit:
+
+    if(trash_fd >= 0)
+        close(trash_fd);
+    if(lock_fd >= 0)
+        close(lock_fd);
+    bbox_config_free(conf);
+    free(trash_dir);
+    free(buf);
+    return rval;
+}
@@ -0,0 +1,389 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bbox-do.h"
+
+/*
+ * The journal remembers which mounts build-box has set up for a target,
+ * together with the id the kernel assigned to each of them. Validating an
+ * entry takes a single statx() call, which is a lot cheaper than reading the
+ * entire mount table on a busy system.
+ *
+ * The journal is a hint, never the source of truth: an entry only counts if
+ * the kernel still reports the recorded mount id at the recorded location.
+ * Everything else is answered from the mount table.
+ *
+ * The file lives at <user dir>/mounts/<target> and looks like this:
+ *
+ *     sysroot /var/lib/build-box/users/1000/targets/foo
+ *     mnt_id_mask 4000
+ *     mount 2147483663 /var/lib/build-box/users/1000/targets/foo/proc
+ *     ...
+ *
+ * Mount points are the last field on a line and may contain spaces.
+ */
+
+#define BBOX_JOURNAL_MIN_ENTRIES 8
+
+static int bbox_journal_probe_mask(unsigned int *mask)
+{
+    uint64_t mnt_id = 0;
+
+    if(bbox_stat_mnt_id("/", BBOX_STATX_MNT_ID_UNIQUE, &mnt_id, NULL) == 0)
+    {
+        *mask = BBOX_STATX_MNT_ID_UNIQUE;
+        return 0;
+    }
+
+    if(bbox_stat_mnt_id("/", BBOX_STATX_MNT_ID, &mnt_id, NULL) == 0) {
+        *mask = BBOX_STATX_MNT_ID;
+        return 0;
+    }
+
+    return -1;
+}
+
+static bbox_journal_entry_t *bbox_journal_find(bbox_journal_t *journal,
+        const char *mnt_dir)
+{
+    for(size_t i = 0; i < journal->num_entries; i++) {
+        if(!strcmp(journal->entries[i].mnt_dir, mnt_dir))
+            return &journal->entries[i];
+    }
+
+    return NULL;
+}
+
+static int bbox_journal_append(bbox_journal_t *journal, const char *mnt_dir,
+        uint64_t mnt_id)
+{
+    if(journal->num_entries == journal->max_entries) {
+        size_t max_entries = journal->max_entries ?
+            journal->max_entries * 2 : BBOX_JOURNAL_MIN_ENTRIES;
+
+        bbox_journal_entry_t *entries = realloc(journal->entries,
+                max_entries * sizeof(bbox_journal_entry_t));
+
+        if(!entries) {
+            bbox_perror("bbox_journal_append", "out of memory?\n");
+            return -1;
+        }
+
+        journal->entries = entries;
+        journal->max_entries = max_entries;
+    }
+
+    char *dup = strdup(mnt_dir);
+
+    if(!dup) {
+        bbox_perror("bbox_journal_append", "out of memory?\n");
+        return -1;
+    }
+
+    journal->entries[journal->num_entries].mnt_dir = dup;
+    journal->entries[journal->num_entries].mnt_id = mnt_id;
+    journal->num_entries++;
+    return 0;
+}
+
+/*
+ * Only mount points within the target are tracked. Names with line breaks
+ * can't be stored and are left to the mount table.
+ */
+static int bbox_journal_covers(const bbox_journal_t *journal,
+        const char *mnt_dir)
+{
+    size_t len = strlen(journal->sys_root);
+
+    if(strncmp(mnt_dir, journal->sys_root, len) || mnt_dir[len] != '/')
+        return 0;
+
+    return strchr(mnt_dir, '\n') ? 0 : 1;
+}
+
+static void bbox_journal_read(bbox_journal_t *journal)
+{
+    char *line = NULL;
+    size_t line_len = 0;
+    ssize_t num_read;
+    int sys_root_matches = 0;
+    unsigned int mask = 0;
+    FILE *fp = NULL;
+
+    if(!(fp = fopen(journal->path, "re")))
+        return;
+
+    while((num_read = getline(&line, &line_len, fp)) != -1)
+    {
+        if(num_read > 0 && line[num_read - 1] == '\n')
+            line[num_read - 1] = '\0';
+
+        if(!strncmp(line, "sysroot ", 8)) {
+            sys_root_matches = !strcmp(line + 8, journal->sys_root);
+        } else if(!strncmp(line, "mnt_id_mask ", 12)) {
+            mask = (unsigned int) strtoul(line + 12, NULL, 16);
+        } else if(!strncmp(line, "mount ", 6)) {
+            char *end_ptr = NULL;
+            uint64_t mnt_id = strtoull(line + 6, &end_ptr, 10);
+
+            if(!sys_root_matches || *end_ptr != ' ')
+                continue;
+            if(!bbox_journal_covers(journal, end_ptr + 1))
+                continue;
+            if(bbox_journal_find(journal, end_ptr + 1))
+                continue;
+            if(bbox_journal_append(journal, end_ptr + 1, mnt_id) == -1)
+                break;
+        }
+    }
+
+    /*
+     * A journal that was written for a different location, or with a kind of
+     * mount id that we can't get from statx(), is useless. It gets replaced
+     * on the next save.
+     */
+    if(!sys_root_matches || mask != journal->statx_mask) {
+        for(size_t i = 0; i < journal->num_entries; i++)
+            free(journal->entries[i].mnt_dir);
+        journal->num_entries = 0;
+        journal->is_dirty = 1;
+    }
+
+    fclose(fp);
+    free(line);
+}
+
+bbox_journal_t *bbox_journal_open(const char *sys_root)
+{
+    bbox_journal_t *journal = NULL;
+    char *user_dir = NULL;
+    size_t user_dir_len = 0;
+    size_t path_len = 0;
+    const char *target = NULL;
+
+    /*
+     * Without mount ids, there is no cheap way to tell whether an entry is
+     * still valid.
+     */
+    unsigned int mask = 0;
+
+    if(bbox_journal_probe_mask(&mask) == -1)
+        return NULL;
+
+    if(!(journal = calloc(sizeof(bbox_journal_t), 1))) {
+        bbox_perror("bbox_journal_open", "out of memory?\n");
+        return NULL;
+    }
+
+    journal->statx_mask = mask;
+
+    if(!(journal->sys_root = realpath(sys_root, NULL)))
+        goto failure;
+
+    if(!(target = strrchr(journal->sys_root, '/')) || !*(++target))
+        goto failure;
+
+    if(!(user_dir = bbox_get_user_dir(getuid(), &user_dir_len)))
+        goto failure;
+
+    bbox_path_join(&user_dir, user_dir, "mounts", &user_dir_len);
+    bbox_path_join(&journal->path, user_dir, target, &path_len);
+
+    bbox_journal_read(journal);
+
+    free(user_dir);
+    return journal;
+
+failure:
+
+    free(user_dir);
+    bbox_journal_free(journal);
+    return NULL;
+}
+
+int bbox_journal_check(bbox_journal_t *journal, const char *mnt_dir)
+{
+    bbox_journal_entry_t *entry = bbox_journal_find(journal, mnt_dir);
+
+    if(!entry)
+        return 0;
+
+    uint64_t mnt_id = 0;
+    int is_mount_root = -1;
+
+    if(bbox_stat_mnt_id(mnt_dir, journal->statx_mask, &mnt_id,
+                &is_mount_root) == -1)
+    {
+        return -1;
+    }
+
+    /*
+     * If the id matches but the kernel says that `mnt_dir` is not the root of
+     * that mount, the mount was moved away and something else now lives at
+     * this location.
+     */
+    if(mnt_id != entry->mnt_id || is_mount_root == 0)
+        return -1;
+
+    return 1;
+}
+
+int bbox_journal_record(bbox_journal_t *journal, const char *mnt_dir)
+{
+    uint64_t mnt_id = 0;
+
+    if(!bbox_journal_covers(journal, mnt_dir))
+        return 0;
+
+    if(bbox_stat_mnt_id(mnt_dir, journal->statx_mask, &mnt_id, NULL) == -1)
+        return -1;
+
+    bbox_journal_entry_t *entry = bbox_journal_find(journal, mnt_dir);
+
+    if(entry) {
+        if(entry->mnt_id == mnt_id)
+            return 0;
+        entry->mnt_id = mnt_id;
+    } else if(bbox_journal_append(journal, mnt_dir, mnt_id) == -1) {
+        return -1;
+    }
+
+    journal->is_dirty = 1;
+    return 0;
+}
+
+void bbox_journal_forget(bbox_journal_t *journal, const char *mnt_dir)
+{
+    bbox_journal_entry_t *entry = bbox_journal_find(journal, mnt_dir);
+
+    if(!entry)
+        return;
+
+    free(entry->mnt_dir);
+    *entry = journal->entries[--journal->num_entries];
+    journal->is_dirty = 1;
+}
+
+int bbox_journal_save(bbox_journal_t *journal)
+{
+    char *tmp_path = NULL;
+    char *journal_dir = NULL;
+    FILE *fp = NULL;
+    int out_fd = -1;
+    int rval = -1;
+
+    if(!journal->is_dirty)
+        return 0;
+
+    if(journal->num_entries == 0) {
+        if(unlink(journal->path) == -1 && errno != ENOENT)
+            goto cleanup_and_exit;
+        journal->is_dirty = 0;
+        return 0;
+    }
+
+    if(!(journal_dir = strdup(journal->path))) {
+        bbox_perror("bbox_journal_save", "out of memory?\n");
+        goto cleanup_and_exit;
+    }
+
+    *strrchr(journal_dir, '/') = '\0';
+
+    if(mkdir(journal_dir, 0755) == -1 && errno != EEXIST) {
+        bbox_perror("bbox_journal_save", "failed to create '%s': %s.\n",
+                journal_dir, strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    if(asprintf(&tmp_path, "%s-XXXXXX", journal->path) == -1) {
+        tmp_path = NULL;
+        bbox_perror("bbox_journal_save", "out of memory?\n");
+        goto cleanup_and_exit;
+    }
+
+    if((out_fd = mkstemp(tmp_path)) == -1) {
+        bbox_perror("bbox_journal_save",
+                "failed to open temporary file '%s' for writing: %s.\n",
+                tmp_path, strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    if(!(fp = fdopen(out_fd, "w"))) {
+        close(out_fd);
+        unlink(tmp_path);
+        goto cleanup_and_exit;
+    }
+
+    fchmod(out_fd, 0644);
+
+    fprintf(fp, "sysroot %s\n", journal->sys_root);
+    fprintf(fp, "mnt_id_mask %x\n", journal->statx_mask);
+
+    for(size_t i = 0; i < journal->num_entries; i++) {
+        fprintf(fp, "mount %" PRIu64 " %s\n", journal->entries[i].mnt_id,
+                journal->entries[i].mnt_dir);
+    }
+
+    if(fclose(fp) == EOF || rename(tmp_path, journal->path) == -1) {
+        bbox_perror("bbox_journal_save", "failed to write '%s': %s.\n",
+                journal->path, strerror(errno));
+        unlink(tmp_path);
+        goto cleanup_and_exit;
+    }
+
+    journal->is_dirty = 0;
+    rval = 0;
+
+cleanup_and_exit:
+
+    free(journal_dir);
+    free(tmp_path);
+    return rval;
+}
+
+void bbox_journal_free(bbox_journal_t *journal)
+{
+    if(!journal)
+        return;
+
+    for(size_t i = 0; i < journal->num_entries; i++)
+        free(journal->entries[i].mnt_dir);
+
+    free(journal->entries);
+    free(journal->sys_root);
+    free(journal->path);
+    free(journal);
+}
@@ -0,0 +1,760 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/loop.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bbox-do.h"
+
+/*
+ * A layered target doesn't carry a sysroot of its own. It is an overlay of a
+ * thin upper layer on top of a base, which is shared by all targets with the
+ * same release, architecture and libc and which is never written to.
+ *
+ * The layers live in the user's directory:
+ *
+ *     <user dir>/bases/<release>-<arch>-<libc>
+ *     <user dir>/layers/<target>/upper
+ *     <user dir>/layers/<target>/work
+ *     <user dir>/layers/<target>/layer
+ *
+ * The file `layer` ties the layers to a target and names the base:
+ *
+ *     sysroot /var/lib/build-box/users/1000/targets/foo
+ *     base 1.0-x86_64-glibc
+ *
+ * The overlay is put together on the target directory the first time the
+ * target is used and stays in place like a regular file system, until the
+ * target is unmounted with `umount --all`.
+ *
+ * Instead of a directory, the base may be a compressed EROFS or squashfs
+ * image. It is attached to a loop device and mounted read-only on the target
+ * directory, and the overlay goes on top of that. A target like that is
+ * quick to start, to hand around and to delete, because it is all in one
+ * file. The kernel parses the image with full privileges, so images are only
+ * taken from BBOX_IMAGE_DIR, where an administrator puts them:
+ *
+ *     /var/lib/build-box/images/<release>-<arch>-<libc>
+ */
+
+#define BBOX_LAYER_EROFS_MAGIC    0xE0F5E1E2
+#define BBOX_LAYER_EROFS_OFFSET   1024
+#define BBOX_LAYER_SQUASHFS_MAGIC 0x73717368
+#define BBOX_LAYER_LOOP_ATTEMPTS  8
+
+/*
+ * Returns the path of the layer directory of the target at `real_root`. The
+ * caller has to free the result.
+ */
+static char *bbox_layer_get_dir(const char *real_root)
+{
+    char *layer_dir = NULL;
+    size_t layer_dir_len = 0;
+    const char *target = strrchr(real_root, '/');
+
+    if(!target || !*(++target))
+        return NULL;
+
+    if(!(layer_dir = bbox_get_user_dir(getuid(), &layer_dir_len)))
+        return NULL;
+
+    bbox_path_join(&layer_dir, layer_dir, "layers", &layer_dir_len);
+    bbox_path_join(&layer_dir, layer_dir, target, &layer_dir_len);
+    return layer_dir;
+}
+
+/*
+ * Reads the name of the base from the layer description. Returns 0 if the
+ * layers belong to a different location, 1 if they belong to `real_root` and
+ * -1 on error.
+ */
+static int bbox_layer_read_base(int layer_fd, const char *layer_dir,
+        const char *real_root, char **base_ptr)
+{
+    char *line = NULL;
+    size_t line_len = 0;
+    ssize_t num_read;
+    int sys_root_matches = 0;
+    int rval = -1;
+    FILE *fp = NULL;
+    int fd = -1;
+
+    *base_ptr = NULL;
+
+    if((fd = openat(layer_fd, "layer", O_RDONLY | O_NOFOLLOW |
+                    O_CLOEXEC)) == -1 || !(fp = fdopen(fd, "r")))
+    {
+        bbox_perror("layer", "failed to open '%s/layer': %s.\n", layer_dir,
+                strerror(errno));
+        if(fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    while((num_read = getline(&line, &line_len, fp)) != -1)
+    {
+        if(num_read > 0 && line[num_read - 1] == '\n')
+            line[num_read - 1] = '\0';
+
+        if(!strncmp(line, "sysroot ", 8)) {
+            sys_root_matches = !strcmp(line + 8, real_root);
+        } else if(!strncmp(line, "base ", 5)) {
+            free(*base_ptr);
+
+            if(!(*base_ptr = strdup(line + 5))) {
+                bbox_perror("layer", "out of memory?\n");
+                goto cleanup_and_exit;
+            }
+        }
+    }
+
+    if(!sys_root_matches) {
+        rval = 0;
+        goto cleanup_and_exit;
+    }
+
+    /*
+     * The base has to be a plain name below <user dir>/bases.
+     */
+    if(!*base_ptr || !strcmp(*base_ptr, ".") || !strcmp(*base_ptr, "..") ||
+            validate_target_name("layer", *base_ptr) == -1)
+    {
+        bbox_perror("layer", "invalid base in '%s/layer'.\n", layer_dir);
+        goto cleanup_and_exit;
+    }
+
+    rval = 1;
+
+cleanup_and_exit:
+
+    if(rval != 1) {
+        free(*base_ptr);
+        *base_ptr = NULL;
+    }
+
+    fclose(fp);
+    free(line);
+    return rval;
+}
+
+/*
+ * Opens and locks the given layer directory. Returns -2 if it doesn't exist,
+ * which means that the target isn't layered.
+ */
+static int bbox_layer_lock(const char *layer_dir)
+{
+    int fd = open(layer_dir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+    if(fd == -1) {
+        if(errno == ENOENT)
+            return -2;
+
+        bbox_perror("layer", "failed to open '%s': %s.\n", layer_dir,
+                strerror(errno));
+        return -1;
+    }
+
+    while(flock(fd, LOCK_EX) == -1) {
+        if(errno == EINTR)
+            continue;
+
+        bbox_perror("layer", "failed to lock '%s': %s.\n", layer_dir,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Returns the layer directory of the target at `real_root`, or NULL if the
+ * target isn't layered. The caller has to free the result.
+ */
+char *bbox_layer_find_dir(const char *real_root)
+{
+    char *layer_dir = NULL;
+    char *base = NULL;
+    int layer_fd = -1;
+    int rval = -1;
+
+    if(!(layer_dir = bbox_layer_get_dir(real_root)))
+        return NULL;
+
+    if((layer_fd = bbox_layer_lock(layer_dir)) < 0)
+        goto cleanup_and_exit;
+
+    if(faccessat(layer_fd, "layer", F_OK, AT_SYMLINK_NOFOLLOW) == -1)
+        goto cleanup_and_exit;
+
+    rval = bbox_layer_read_base(layer_fd, layer_dir, real_root, &base);
+
+cleanup_and_exit:
+
+    if(layer_fd >= 0)
+        close(layer_fd);
+    free(base);
+
+    if(rval != 1) {
+        free(layer_dir);
+        return NULL;
+    }
+
+    return layer_dir;
+}
+
+/*
+ * Returns the normalized path to the given layer, if it is a directory owned
+ * by the user. The caller has to free the result.
+ */
+static char *bbox_layer_resolve(const char *dir, const char *sub)
+{
+    char *path = NULL;
+    char *real_path = NULL;
+    size_t path_len = 0;
+
+    bbox_path_join(&path, dir, sub, &path_len);
+
+    if(bbox_isdir_and_owned_by("layer", path, getuid()) == 0) {
+        if(!(real_path = realpath(path, NULL))) {
+            bbox_perror("layer", "unable to normalize path '%s': %s.\n",
+                    path, strerror(errno));
+        }
+    }
+
+    free(path);
+    return real_path;
+}
+
+/*
+ * Returns 1 if the base is a file system image, 0 if it is a directory of the
+ * user and -1 on error.
+ */
+static int bbox_layer_is_image(const char *bases_dir, const char *base)
+{
+    char *path = NULL;
+    size_t path_len = 0;
+    struct stat st;
+    int rval = -1;
+
+    bbox_path_join(&path, bases_dir, base, &path_len);
+
+    if(lstat(path, &st) == 0) {
+        if(S_ISDIR(st.st_mode)) {
+            rval = 0;
+        } else {
+            bbox_perror("layer", "base '%s' is not a directory, images are "
+                    "only taken from %s.\n", path, BBOX_IMAGE_DIR);
+        }
+        goto cleanup_and_exit;
+    }
+
+    bbox_path_join(&path, BBOX_IMAGE_DIR, base, &path_len);
+
+    if(lstat(path, &st) == -1) {
+        bbox_perror("layer", "base '%s' not found.\n", base);
+    } else {
+        rval = 1;
+    }
+
+cleanup_and_exit:
+
+    free(path);
+    return rval;
+}
+
+/*
+ * Opens the image from BBOX_IMAGE_DIR and tells its file system type from
+ * the superblock. The user must be able to read it, and only root may have
+ * put it there.
+ */
+static int bbox_layer_open_image(const char *base, const char **fstype_ptr)
+{
+    char *path = NULL;
+    size_t path_len = 0;
+    struct stat st;
+    uint32_t magic = 0;
+    int fd = -1;
+
+    int dir_fd = open(BBOX_IMAGE_DIR, O_PATH | O_DIRECTORY | O_NOFOLLOW |
+            O_CLOEXEC);
+
+    if(dir_fd == -1) {
+        bbox_perror("layer", "failed to open '%s': %s.\n", BBOX_IMAGE_DIR,
+                strerror(errno));
+        return -1;
+    }
+
+    bbox_path_join(&path, BBOX_IMAGE_DIR, base, &path_len);
+
+    if(bbox_is_admin_owned("layer", dir_fd, BBOX_IMAGE_DIR) == -1)
+        goto failure;
+
+    if((fd = openat(dir_fd, base, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) == -1) {
+        bbox_perror("layer", "failed to open '%s': %s.\n", path,
+                strerror(errno));
+        goto failure;
+    }
+
+    if(fstat(fd, &st) == -1) {
+        bbox_perror("layer", "could not stat '%s': %s.\n", path,
+                strerror(errno));
+        goto failure;
+    }
+
+    if(!S_ISREG(st.st_mode)) {
+        bbox_perror("layer", "%s is not a regular file.\n", path);
+        goto failure;
+    }
+
+    if(bbox_is_admin_owned("layer", fd, path) == -1)
+        goto failure;
+
+    /*
+     * Both magic numbers are stored in little endian byte order.
+     */
+    if(pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) &&
+            le32toh(magic) == BBOX_LAYER_SQUASHFS_MAGIC)
+    {
+        *fstype_ptr = "squashfs";
+        goto success;
+    }
+
+    if(pread(fd, &magic, sizeof(magic), BBOX_LAYER_EROFS_OFFSET) ==
+            sizeof(magic) && le32toh(magic) == BBOX_LAYER_EROFS_MAGIC)
+    {
+        *fstype_ptr = "erofs";
+        goto success;
+    }
+
+    bbox_perror("layer", "'%s' is neither an EROFS nor a squashfs image.\n",
+            path);
+
+failure:
+
+    if(fd != -1)
+        close(fd);
+    fd = -1;
+
+success:
+
+    close(dir_fd);
+    free(path);
+    return fd;
+}
+
+/*
+ * Binds the image to a free loop device, read-only. The device lets go of
+ * the image by itself once it is neither mounted nor open anymore. Returns a
+ * descriptor for the device, which must be held until the image is mounted.
+ */
+static int bbox_layer_attach_loop(int image_fd, char *loop_dev,
+        size_t loop_dev_size)
+{
+    int ctl_fd = -1;
+    int loop_fd = -1;
+
+    if((ctl_fd = open("/dev/loop-control", O_RDWR | O_CLOEXEC)) == -1) {
+        bbox_perror("layer", "failed to open '/dev/loop-control': %s.\n",
+                strerror(errno));
+        return -1;
+    }
+
+    /*
+     * Somebody else may grab the free device before we get to configure it,
+     * in which case we ask for another one.
+     */
+    for(int i = 0; i < BBOX_LAYER_LOOP_ATTEMPTS; i++) {
+        int loop_nr = ioctl(ctl_fd, LOOP_CTL_GET_FREE);
+
+        if(loop_nr < 0) {
+            bbox_perror("layer", "no free loop device: %s.\n",
+                    strerror(errno));
+            break;
+        }
+
+        snprintf(loop_dev, loop_dev_size, "/dev/loop%d", loop_nr);
+
+        if((loop_fd = open(loop_dev, O_RDONLY | O_CLOEXEC)) == -1) {
+            bbox_perror("layer", "failed to open '%s': %s.\n", loop_dev,
+                    strerror(errno));
+            break;
+        }
+
+#ifdef LOOP_CONFIGURE
+        struct loop_config config;
+
+        memset(&config, 0, sizeof(config));
+        config.fd = image_fd;
+        config.info.lo_flags = LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR;
+
+        if(ioctl(loop_fd, LOOP_CONFIGURE, &config) == 0) {
+            close(ctl_fd);
+            return loop_fd;
+        }
+
+        if(errno != EINVAL && errno != ENOTTY)
+            goto next_device;
+#endif
+
+        /*
+         * Kernels before 5.8 need two steps. The device is read-only, because
+         * the image was opened read-only.
+         */
+        if(ioctl(loop_fd, LOOP_SET_FD, image_fd) == 0) {
+            struct loop_info64 info;
+
+            memset(&info, 0, sizeof(info));
+            info.lo_flags = LO_FLAGS_AUTOCLEAR;
+
+            if(ioctl(loop_fd, LOOP_SET_STATUS64, &info) == 0) {
+                close(ctl_fd);
+                return loop_fd;
+            }
+
+            ioctl(loop_fd, LOOP_CLR_FD, 0);
+        }
+
+#ifdef LOOP_CONFIGURE
+next_device:
+#endif
+
+        close(loop_fd);
+        loop_fd = -1;
+
+        if(errno != EBUSY) {
+            bbox_perror("layer", "failed to set up '%s': %s.\n", loop_dev,
+                    strerror(errno));
+            break;
+        }
+    }
+
+    close(ctl_fd);
+    return -1;
+}
+
+/*
+ * Mounts the image read-only on the target directory.
+ */
+static int bbox_layer_mount_image(bbox_mtab_t *mtab, const char *real_root,
+        const char *base)
+{
+    bbox_mount_plan_t plan = { .num_reqs = 0 };
+    const char *fstype = NULL;
+    char loop_dev[32];
+    int image_fd = -1;
+    int loop_fd = -1;
+    int rval = -1;
+
+    if((image_fd = bbox_layer_open_image(base, &fstype)) == -1)
+        goto cleanup_and_exit;
+
+    if(bbox_raise_privileges() == -1)
+        goto cleanup_and_exit;
+
+    loop_fd = bbox_layer_attach_loop(image_fd, loop_dev, sizeof(loop_dev));
+
+    if(bbox_lower_privileges() == -1 || loop_fd == -1)
+        goto cleanup_and_exit;
+
+    if(bbox_mount_plan_image(&plan, mtab, real_root, loop_dev, fstype) == -1)
+        goto cleanup_and_exit;
+
+    if(bbox_mount_plan_execute(&plan, mtab) == -1)
+        goto cleanup_and_exit;
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    /*
+     * If the mount failed, this also releases the loop device.
+     */
+    if(loop_fd != -1)
+        close(loop_fd);
+    if(image_fd != -1)
+        close(image_fd);
+    bbox_mount_plan_clear(&plan);
+    return rval;
+}
+
+/*
+ * Takes down whatever the layers put on the target directory, starting at the
+ * top. An image below the overlay is recognized by its file system type, so
+ * this works, even if the image itself is gone.
+ */
+static int bbox_layer_umount(const char *real_root, int umount_flags)
+{
+    struct statfs st;
+    int rval = 0;
+
+    if(bbox_raise_privileges() == -1)
+        return -1;
+
+    for(int i = 0; i < 2; i++) {
+        if(umount2(real_root, umount_flags) == -1) {
+            bbox_perror("umount", "failed to unmount %s: %s\n", real_root,
+                    strerror(errno));
+            rval = -1;
+            break;
+        }
+
+        if(statfs(real_root, &st) == -1)
+            break;
+        if((uint32_t) st.f_type != BBOX_LAYER_EROFS_MAGIC &&
+                (uint32_t) st.f_type != BBOX_LAYER_SQUASHFS_MAGIC)
+            break;
+    }
+
+    if(bbox_lower_privileges() == -1)
+        rval = -1;
+
+    return rval;
+}
+
+int bbox_layer_assemble(const char *module, const char *sys_root)
+{
+    bbox_mount_plan_t plan = { .num_reqs = 0 };
+    bbox_mtab_t *mtab = NULL;
+    char *real_root = NULL;
+    char *layer_dir = NULL;
+    char *base = NULL;
+    char *bases_dir = NULL;
+    char *lower_dir = NULL;
+    char *upper_dir = NULL;
+    char *work_dir = NULL;
+    size_t bases_dir_len = 0;
+    int is_image = 0;
+    int layer_fd = -1;
+    int rval = -1;
+
+    if(!(real_root = realpath(sys_root, NULL))) {
+        bbox_perror(module, "unable to normalize path '%s': %s.\n",
+                sys_root, strerror(errno));
+        return -1;
+    }
+
+    if(!(layer_dir = bbox_layer_get_dir(real_root))) {
+        rval = 0;
+        goto cleanup_and_exit;
+    }
+
+    /*
+     * Holding the lock, nobody else can assemble the overlay at the same
+     * time or take it apart under our feet.
+     */
+    if((layer_fd = bbox_layer_lock(layer_dir)) < 0) {
+        rval = layer_fd == -2 ? 0 : -1;
+        goto cleanup_and_exit;
+    }
+
+    switch(bbox_layer_read_base(layer_fd, layer_dir, real_root, &base)) {
+        case 0:
+            rval = 0;
+            /* fall through */
+        case -1:
+            goto cleanup_and_exit;
+        default:
+            break;
+    }
+
+    if(!(mtab = bbox_mtab_load()))
+        goto cleanup_and_exit;
+
+    switch(bbox_mount_is_mounted(mtab, real_root)) {
+        case 0:
+            break;
+        case 1:
+            rval = 0;
+            /* fall through */
+        default:
+            goto cleanup_and_exit;
+    }
+
+    if(!(bases_dir = bbox_get_user_dir(getuid(), &bases_dir_len)))
+        goto cleanup_and_exit;
+
+    bbox_path_join(&bases_dir, bases_dir, "bases", &bases_dir_len);
+
+    if(!(upper_dir = bbox_layer_resolve(layer_dir, "upper")))
+        goto cleanup_and_exit;
+    if(!(work_dir = bbox_layer_resolve(layer_dir, "work")))
+        goto cleanup_and_exit;
+
+    if((is_image = bbox_layer_is_image(bases_dir, base)) == -1)
+        goto cleanup_and_exit;
+
+    /*
+     * An image becomes the lower layer in place. The overlay picks up the
+     * image mount, because the lower directory is looked up after it is
+     * attached.
+     */
+    if(is_image) {
+        if(bbox_layer_mount_image(mtab, real_root, base) == -1)
+            goto cleanup_and_exit;
+
+        if(!(lower_dir = strdup(real_root))) {
+            bbox_perror(module, "out of memory?\n");
+            goto cleanup_and_exit;
+        }
+    } else if(!(lower_dir = bbox_layer_resolve(bases_dir, base))) {
+        goto cleanup_and_exit;
+    }
+
+    if(bbox_mount_plan_overlay(&plan, real_root, lower_dir, upper_dir,
+                work_dir) == -1)
+    {
+        goto cleanup_and_exit;
+    }
+
+    if(bbox_mount_plan_execute(&plan, mtab) == -1)
+        goto cleanup_and_exit;
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    /*
+     * Don't leave a lone image behind, which would make the target look
+     * read-only.
+     */
+    if(rval == -1 && lower_dir && is_image)
+        bbox_layer_umount(real_root, MNT_DETACH);
+
+    bbox_mount_plan_clear(&plan);
+    bbox_mtab_free(mtab);
+    if(layer_fd >= 0)
+        close(layer_fd);
+    free(work_dir);
+    free(upper_dir);
+    free(lower_dir);
+    free(bases_dir);
+    free(base);
+    free(layer_dir);
+    free(real_root);
+    return rval;
+}
+
+int bbox_layer_disassemble(const char *sys_root, int umount_flags)
+{
+    bbox_mtab_t *mtab = NULL;
+    char *real_root = NULL;
+    char *layer_dir = NULL;
+    char *base = NULL;
+    int layer_fd = -1;
+    int rval = -1;
+
+    if(!(real_root = realpath(sys_root, NULL))) {
+        bbox_perror("umount", "unable to normalize path '%s': %s.\n",
+                sys_root, strerror(errno));
+        return -1;
+    }
+
+    if(!(layer_dir = bbox_layer_get_dir(real_root))) {
+        rval = 0;
+        goto cleanup_and_exit;
+    }
+
+    if((layer_fd = bbox_layer_lock(layer_dir)) < 0) {
+        rval = layer_fd == -2 ? 0 : -1;
+        goto cleanup_and_exit;
+    }
+
+    switch(bbox_layer_read_base(layer_fd, layer_dir, real_root, &base)) {
+        case 0:
+            rval = 0;
+            /* fall through */
+        case -1:
+            goto cleanup_and_exit;
+        default:
+            break;
+    }
+
+    if(!(mtab = bbox_mtab_load()))
+        goto cleanup_and_exit;
+
+    switch(bbox_mount_is_mounted(mtab, real_root)) {
+        case 1:
+            break;
+        case 0:
+            rval = 0;
+            /* fall through */
+        default:
+            goto cleanup_and_exit;
+    }
+
+    if(bbox_layer_umount(real_root, umount_flags) == -1)
+        goto cleanup_and_exit;
+
+    if(bbox_raise_privileges() == -1)
+        goto cleanup_and_exit;
+
+    /*
+     * The overlay leaves root-owned entries behind in its work directory,
+     * which would keep the user from deleting the target. Once the overlay is
+     * gone for good, they are of no use. After a lazy unmount, it may still
+     * be in use.
+     */
+    if(!(umount_flags & MNT_DETACH)) {
+        int work_fd = openat(layer_fd, "work", O_RDONLY | O_DIRECTORY |
+                O_NOFOLLOW | O_CLOEXEC);
+
+        if(work_fd != -1) {
+            bbox_overlay_remove_at(work_fd, "work");
+            bbox_overlay_remove_at(work_fd, "index");
+            close(work_fd);
+        }
+    }
+
+    if(bbox_lower_privileges() == -1)
+        goto cleanup_and_exit;
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    bbox_mtab_free(mtab);
+    if(layer_fd >= 0)
+        close(layer_fd);
+    free(base);
+    free(layer_dir);
+    free(real_root);
+    return rval;
+}
@@ -0,0 +1,272 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bbox-do.h"
+
+/*
+ * How old the last-use stamp of a target has to be before it is renewed.
+ */
+#define BBOX_LEASE_USE_INTERVAL 3600
+
+/*
+ * A lease is a shared flock() on the target directory. Everybody who uses the
+ * mounts of a target holds one for as long as they need them, and the kernel
+ * drops it when the last process holding the file descriptor exits. Since the
+ * descriptor is inherited across exec(), a lease taken by `run` or `login`
+ * covers the command and everything it spawns.
+ *
+ * Unmounting requires an exclusive lock, which can only be had when nobody
+ * holds a lease. Mounting takes a shared lock, so it waits for a teardown
+ * that is in progress to finish.
+ */
+
+static pid_t supervised_pid = 0;
+
+static void bbox_lease_forward_signal(int sig)
+{
+    if(supervised_pid > 0)
+        kill(supervised_pid, sig);
+}
+
+static int bbox_lease_open(const char *module, const char *sys_root,
+        int flags)
+{
+    int fd = open(sys_root, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | flags);
+
+    if(fd == -1) {
+        bbox_perror(module, "failed to open '%s': %s.\n", sys_root,
+                strerror(errno));
+    }
+
+    return fd;
+}
+
+int bbox_lease_acquire(const char *module, const char *sys_root,
+        int is_inherited)
+{
+    int fd = bbox_lease_open(module, sys_root, is_inherited ? 0 : O_CLOEXEC);
+
+    if(fd == -1)
+        return -1;
+
+    while(flock(fd, LOCK_SH) == -1) {
+        if(errno == EINTR)
+            continue;
+
+        bbox_perror(module, "failed to lock '%s': %s.\n", sys_root,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int bbox_lease_try_exclusive(const char *module, const char *sys_root)
+{
+    int fd = bbox_lease_open(module, sys_root, O_CLOEXEC);
+
+    if(fd == -1)
+        return -1;
+
+    if(flock(fd, LOCK_EX | LOCK_NB) == -1) {
+        int is_busy = (errno == EWOULDBLOCK);
+
+        if(!is_busy) {
+            bbox_perror(module, "failed to lock '%s': %s.\n", sys_root,
+                    strerror(errno));
+        }
+
+        close(fd);
+        return is_busy ? -2 : -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Remembers when the target was last used, for `build-box gc`. The stamp is
+ * the modification time of <user dir>/used/<target>, which is left alone if
+ * it is recent enough, so that a target that is used all the time doesn't
+ * cost a write every time. Failures are reported, since gc would take the
+ * target for unused, but they don't stop the command.
+ */
+void bbox_lease_record_use(const char *sys_root)
+{
+    char *buf = NULL;
+    size_t buf_len = 0;
+    struct stat st;
+    int fd;
+
+    const char *target = strrchr(sys_root, '/');
+
+    if(!target || !*(++target))
+        return;
+
+    if(!(buf = bbox_get_user_dir(getuid(), &buf_len)))
+        return;
+
+    bbox_path_join(&buf, buf, "used", &buf_len);
+
+    if(mkdir(buf, 0755) == -1 && errno != EEXIST) {
+        bbox_perror("bbox_lease_record_use", "failed to create '%s': %s.\n",
+                buf, strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    bbox_path_join(&buf, buf, target, &buf_len);
+
+    if(lstat(buf, &st) == 0) {
+        if(time(NULL) - st.st_mtime < BBOX_LEASE_USE_INTERVAL)
+            goto cleanup_and_exit;
+
+        if(utimensat(AT_FDCWD, buf, NULL, AT_SYMLINK_NOFOLLOW) == -1) {
+            bbox_perror("bbox_lease_record_use",
+                    "failed to update '%s': %s.\n", buf, strerror(errno));
+        }
+        goto cleanup_and_exit;
+    }
+
+    if((fd = open(buf, O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC,
+                    0644)) == -1)
+    {
+        bbox_perror("bbox_lease_record_use", "failed to create '%s': %s.\n",
+                buf, strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    close(fd);
+
+cleanup_and_exit:
+
+    free(buf);
+}
+
+/*
+ * Gives up the lease and unmounts the target if that was the last one. With a
+ * linger time, this happens in a background process after the given number of
+ * seconds, so that a follow-up job can pick up the mounts as they are.
+ */
+static void bbox_lease_release(bbox_conf_t *conf, const char *sys_root,
+        int lease_fd)
+{
+    unsigned int linger = bbox_config_get_linger(conf);
+
+    close(lease_fd);
+
+    if(linger > 0) {
+        pid_t pid = fork();
+
+        if(pid == -1) {
+            bbox_perror("bbox_lease_release", "fork failed: %s\n",
+                    strerror(errno));
+            return;
+        }
+
+        if(pid > 0)
+            return;
+
+        setsid();
+
+        int null_fd = open("/dev/null", O_RDWR);
+
+        if(null_fd != -1) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            if(null_fd > STDERR_FILENO)
+                close(null_fd);
+        }
+
+        while(linger > 0)
+            linger = sleep(linger);
+    }
+
+    /*
+     * If someone else holds a lease by now, bbox_umount_any leaves
+     * everything in place.
+     */
+    bbox_config_clear_mount(conf);
+    bbox_umount_any(conf, sys_root);
+
+    if(bbox_config_get_linger(conf) > 0)
+        _exit(0);
+}
+
+int bbox_lease_supervise(bbox_conf_t *conf, const char *sys_root,
+        int lease_fd, int *status_ptr)
+{
+    pid_t pid = fork();
+
+    if(pid == -1) {
+        bbox_perror("bbox_lease_supervise", "fork failed: %s\n",
+                strerror(errno));
+        return -1;
+    }
+
+    if(pid == 0)
+        return 0;
+
+    /*
+     * Keyboard signals go to the whole process group, so the child gets them
+     * anyway. We stay around to clean up after it.
+     */
+    supervised_pid = pid;
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTERM, bbox_lease_forward_signal);
+    signal(SIGHUP, bbox_lease_forward_signal);
+
+    int wstatus = 0;
+
+    while(waitpid(pid, &wstatus, 0) == -1) {
+        if(errno != EINTR)
+            break;
+    }
+
+    *status_ptr = BBOX_ERR_RUNTIME;
+
+    if(WIFEXITED(wstatus))
+        *status_ptr = WEXITSTATUS(wstatus);
+
+    bbox_lease_release(conf, sys_root, lease_fd);
+    return 1;
+}
@@ -46,15 +46,46 @@ void bbox_login_usage()
         "                                                                        \n"
         "  -h, --help            Print this help message and exit immediately.   \n"
         "                                                                        \n"
-        "  -m, --mount <fstype>  Mount 'dev', 'proc', 'sys' or 'home'. If this   \n"
-        "                        option is not specified then the default is to  \n"
-        "                        mount all of them.                              \n"
+        "  -m, --mount <fstype>  Mount 'dev', 'proc', 'sys', 'home', 'pkg-cache' \n"
+        "                        or 'tmp'. If this option is not specified then  \n"
+        "                        the default is to mount all of them except      \n"
+        "                        'tmp', which puts a tmpfs on /tmp. 'pkg-cache'  \n"
+        "                        binds the shared package cache to               \n"
+        "                        /var/cache/opkg.                                \n"
+        "                                                                        \n"
+        "  --scratch <path>[:size]                                               \n"
+        "                        Mount a tmpfs on <path> inside the target.      \n"
+        "                        Sizes take a suffix 'k', 'm' or 'g', or '%%'     \n"
+        "                        for a share of RAM. The default is 25%%, and     \n"
+        "                        all tmpfs mounts of a user may use at most      \n"
+        "                        50%% of RAM.                                     \n"
+        "                                                                        \n"
+        "  --shm-size <size>     Size of the tmpfs on /dev/shm, which comes      \n"
+        "                        with 'dev'. The default is 10%% of RAM.          \n"
+        "                                                                        \n"
+        "  --host-dev            Mount the host's /dev only, without a private   \n"
+        "                        /dev/shm and /dev/pts.                          \n"
         "                                                                        \n"
         "  --no-mount            Don't mount any filesystems per default.        \n"
         "                                                                        \n"
         "  --no-file-copy        Don't copy passwd database, group database and  \n"
         "                        resolv.conf from host.                          \n"
         "                                                                        \n"
+        "  --auto-umount         Unmount the target when the last build-box      \n"
+        "                        session using it has ended.                     \n"
+        "                                                                        \n"
+        "  --linger <seconds>    Like --auto-umount, but keep the mounts around  \n"
+        "                        for the given number of seconds, in case another\n"
+        "                        session comes along.                            \n"
+        "                                                                        \n"
+        "  --private-mounts      Mount into a mount namespace of its own, which  \n"
+        "                        goes away when the shell exits. Other           \n"
+        "                        sessions and the host don't see these mounts.   \n"
+        "                                                                        \n"
+        "  --no-session          Set up the target as usual, even if a session is\n"
+        "                        active on it. Mount options are refused while a \n"
+        "                        session is active, unless this is given.        \n"
+        "                                                                        \n"
     );
 }
 
@@ -63,14 +94,22 @@ int bbox_login_getopt(bbox_conf_t *conf, int argc, char * const argv[])
     int c;
     int option_index = 0;
     int do_mount_all = 1;
+    unsigned int linger = 0;
 
     static struct option long_options[] = {
-        {"help",         no_argument,       0, 'h'},
-        {"targets",      required_argument, 0, 't'},
-        {"mount",        required_argument, 0, 'm'},
-        {"no-file-copy", no_argument,       0, '1'},
-        {"no-mount",     no_argument,       0, '2'},
-        { 0,             0,                 0,  0 }
+        {"help",           no_argument,       0, 'h'},
+        {"targets",        required_argument, 0, 't'},
+        {"mount",          required_argument, 0, 'm'},
+        {"no-file-copy",   no_argument,       0, '1'},
+        {"no-mount",       no_argument,       0, '2'},
+        {"auto-umount",    no_argument,       0, '3'},
+        {"linger",         required_argument, 0, '4'},
+        {"private-mounts", no_argument,       0, '5'},
+        {"no-session",     no_argument,       0, '6'},
+        {"scratch",        required_argument, 0, '7'},
+        {"shm-size",       required_argument, 0, '8'},
+        {"host-dev",       no_argument,       0, '9'},
+        { 0,               0,                 0,  0 }
     };
 
     /*
@@ -97,6 +136,7 @@ int bbox_login_getopt(bbox_conf_t *conf, int argc, char * const argv[])
                 break;
             case 'm':
                 do_mount_all = 0;
+                bbox_config_set_mount_options(conf);
 
                 if(!strcmp(optarg, "dev")) {
                     bbox_config_set_mount_dev(conf);
@@ -106,6 +146,10 @@ int bbox_login_getopt(bbox_conf_t *conf, int argc, char * const argv[])
                     bbox_config_set_mount_sys(conf);
                 } else if(!strcmp(optarg, "home")) {
                     bbox_config_set_mount_home(conf);
+                } else if(!strcmp(optarg, "pkg-cache")) {
+                    bbox_config_set_mount_pkg_cache(conf);
+                } else if(!strcmp(optarg, "tmp")) {
+                    bbox_config_set_mount_tmp(conf);
                 } else {
                     bbox_perror("mount", "unknown file system specifier "
                             "'%s'.\n", optarg);
@@ -118,6 +162,36 @@ int bbox_login_getopt(bbox_conf_t *conf, int argc, char * const argv[])
                 break;
             case '2':
                 do_mount_all = 0;
+                bbox_config_set_mount_options(conf);
+                break;
+            case '3':
+                bbox_config_set_auto_umount(conf, 0);
+                break;
+            case '4':
+                if(bbox_parse_seconds("login", optarg, &linger) == -1)
+                    return -2;
+                bbox_config_set_auto_umount(conf, linger);
+                break;
+            case '5':
+                bbox_config_set_mount_options(conf);
+                bbox_config_set_private_mounts(conf);
+                break;
+            case '6':
+                bbox_config_set_no_session(conf);
+                break;
+            case '7':
+                bbox_config_set_mount_options(conf);
+                if(bbox_config_add_scratch(conf, optarg) == -1)
+                    return -2;
+                break;
+            case '8':
+                bbox_config_set_mount_options(conf);
+                if(bbox_config_set_shm_size(conf, optarg) == -1)
+                    return -2;
+                break;
+            case '9':
+                bbox_config_set_mount_options(conf);
+                bbox_config_set_host_dev(conf);
                 break;
             case '?':
             case ':':
@@ -144,6 +218,7 @@ int bbox_login(int argc, char * const argv[])
 {
     char *buf = NULL;
     size_t buf_len = 0;
+    int lease_fd = -1;
 
     int rval = BBOX_ERR_INVOCATION;
 
@@ -186,16 +261,50 @@ int bbox_login(int argc, char * const argv[])
     rval = BBOX_ERR_RUNTIME;
 
     /*
-     * Mount special directories and home if configured (default).
+     * If a session is active on the target, everything has been set up
+     * already and all we have to do is step into it.
      */
-    if(bbox_mount_any(conf, buf) == -1)
-        goto cleanup_and_exit;
+    int in_session = 0;
 
-    /*
-     * Copy passwd, group and hosts information from the host to the target.
-     */
-    if(bbox_config_do_file_updates(conf))
-        bbox_update_chroot_dynamic_config(buf);
+    if(!bbox_config_get_no_session(conf)) {
+        if((in_session = bbox_session_enter(conf, "login", buf)) == -1)
+            goto cleanup_and_exit;
+    }
+
+    if(!in_session) {
+        /*
+         * A layered target has to be put together before anything can be
+         * leased or mounted.
+         */
+        if(bbox_layer_assemble("login", buf) == -1)
+            goto cleanup_and_exit;
+
+        if(bbox_config_get_private_mounts(conf)) {
+            if(bbox_mount_unshare("login") == -1)
+                goto cleanup_and_exit;
+        } else {
+            /*
+             * Hold a lease on the target's mounts for as long as the shell
+             * runs. The descriptor is passed on to the shell on purpose.
+             */
+            if((lease_fd = bbox_lease_acquire("login", buf, 1)) == -1)
+                goto cleanup_and_exit;
+        }
+
+        /*
+         * Mount special directories and home if configured (default).
+         */
+        if(bbox_mount_any(conf, buf) == -1)
+            goto cleanup_and_exit;
+
+        /*
+         * Copy passwd, group and hosts information from the host to the target.
+         */
+        if(bbox_config_do_file_updates(conf))
+            bbox_update_chroot_dynamic_config(buf);
+    }
+
+    bbox_lease_record_use(buf);
 
     /*
      * We clean out most of the environment except for variables starting with
@@ -204,12 +313,29 @@ int bbox_login(int argc, char * const argv[])
      */
     bbox_sanitize_environment();
 
+    /*
+     * To clean up afterwards, we have to stay around while the shell runs.
+     */
+    if(bbox_config_get_auto_umount(conf) && lease_fd >= 0) {
+        switch(bbox_lease_supervise(conf, buf, lease_fd, &rval)) {
+            case -1:
+                goto cleanup_and_exit;
+            case 1:
+                lease_fd = -1;
+                goto cleanup_and_exit;
+            default:
+                break;
+        }
+    }
+
     /* If this succeeds, it doesn't return. */
     if(bbox_login_sh_chrooted(buf, bbox_config_get_home_dir(conf)) == 0)
         rval = 0;
 
 cleanup_and_exit:
 
+    if(lease_fd >= 0)
+        close(lease_fd);
     free(buf);
     bbox_config_free(conf);
     return rval;
@@ -22,21 +22,32 @@
  * THE SOFTWARE.
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
-#include <mntent.h>
+#include <sched.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/vfs.h>
 #include <unistd.h>
 
 #include "bbox-do.h"
 
+#ifndef TMPFS_MAGIC
+#define TMPFS_MAGIC 0x01021994
+#endif
+
+#define BBOX_THP_SHMEM "/sys/kernel/mm/transparent_hugepage/shmem_enabled"
+
 void bbox_mount_usage()
 {
     printf(
@@ -49,9 +60,29 @@ void bbox_mount_usage()
         "                                                                         \n"
         "  -h, --help            Print this help message and exit immediately.    \n"
         "                                                                         \n"
-        "  -m, --mount <fstype>  Mount 'dev', 'proc', 'sys' or 'home'. If this    \n"
-        "                        option is not specified then the default is to   \n"
-        "                        mount all of them.                               \n"
+        "  -m, --mount <fstype>  Mount 'dev', 'proc', 'sys', 'home', 'pkg-cache'  \n"
+        "                        or 'tmp'. If this option is not specified then   \n"
+        "                        the default is to mount all of them except       \n"
+        "                        'tmp', which puts a tmpfs on /tmp. 'pkg-cache'   \n"
+        "                        binds the shared package cache to                \n"
+        "                        /var/cache/opkg.                                 \n"
+        "                                                                         \n"
+        "  --scratch <path>[:size]                                                \n"
+        "                        Mount a tmpfs on <path> inside the target.       \n"
+        "                        Sizes take a suffix 'k', 'm' or 'g', or '%%'      \n"
+        "                        for a share of RAM. The default is 25%%, and      \n"
+        "                        all tmpfs mounts of a user may use at most       \n"
+        "                        50%% of RAM.                                      \n"
+        "                                                                         \n"
+        "  --shm-size <size>     Size of the tmpfs on /dev/shm, which comes       \n"
+        "                        with 'dev'. The default is 10%% of RAM.           \n"
+        "                                                                         \n"
+        "  --host-dev            Mount the host's /dev only, without a private    \n"
+        "                        /dev/shm and /dev/pts.                           \n"
+        "                                                                         \n"
+        "  --no-mount            Don't mount any filesystems per default. The     \n"
+        "                        layers of a layered target are still put         \n"
+        "                        together.                                        \n"
         "                                                                         \n"
     );
 }
@@ -66,6 +97,10 @@ int bbox_mount_getopt(bbox_conf_t *conf, int argc, char * const argv[])
         {"help",      no_argument,       0, 'h'},
         {"targets",   required_argument, 0, 't'},
         {"mount",     required_argument, 0, 'm'},
+        {"scratch",   required_argument, 0, '1'},
+        {"shm-size",  required_argument, 0, '2'},
+        {"host-dev",  no_argument,       0, '3'},
+        {"no-mount",  no_argument,       0, '4'},
         { 0,          0,                 0,  0 }
     };
 
@@ -97,12 +132,30 @@ int bbox_mount_getopt(bbox_conf_t *conf, int argc, char * const argv[])
                     bbox_config_set_mount_sys(conf);
                 } else if(!strcmp(optarg, "home")) {
                     bbox_config_set_mount_home(conf);
+                } else if(!strcmp(optarg, "pkg-cache")) {
+                    bbox_config_set_mount_pkg_cache(conf);
+                } else if(!strcmp(optarg, "tmp")) {
+                    bbox_config_set_mount_tmp(conf);
                 } else {
                     bbox_perror("mount", "unknown file system specifier "
                             "'%s'.\n", optarg);
                     return -2;
                 }
 
+                break;
+            case '1':
+                if(bbox_config_add_scratch(conf, optarg) == -1)
+                    return -2;
+                break;
+            case '2':
+                if(bbox_config_set_shm_size(conf, optarg) == -1)
+                    return -2;
+                break;
+            case '3':
+                bbox_config_set_host_dev(conf);
+                break;
+            case '4':
+                do_mount_all = 0;
                 break;
             case '?':
             case ':':
@@ -125,159 +178,152 @@ int bbox_mount_getopt(bbox_conf_t *conf, int argc, char * const argv[])
     return optind;
 }
 
-int bbox_mount_is_mounted(const char *path)
+int bbox_mount_is_mounted(bbox_mtab_t *mtab, const char *path)
 {
-    struct mntent info;
-    size_t buf_len = 4096;
-    char *buf = NULL;
     char *mount_point = NULL;
     int rval = 0;
-    FILE *fp = NULL;
 
     /*
      * Make sure we use the normalized path to compare against the entries in
-     * /proc/mounts.
+     * the mount table.
      */
     if(!(mount_point = realpath(path, NULL))) {
         bbox_perror("mount", "could not resolve '%s': '%s'.\n",
                 path, strerror(errno));
-        rval = -1;
-        goto cleanup_and_exit;
-    }
-
-    if(!(fp = setmntent("/proc/mounts", "re"))) {
-        bbox_perror("mount", "failed to open /proc/mounts.\n");
-        rval = -1;
-        goto cleanup_and_exit;
+        return -1;
     }
 
-    if(!(buf = malloc(buf_len))) {
-        bbox_perror("mount", "out of memory?\n");
-        rval = -1;
-        goto cleanup_and_exit;
-    }
+    rval = bbox_mtab_contains(mtab, mount_point);
 
-    /*
-     * Loop over the entries in /proc/mounts and compare against the given
-     * directory.
-     */
-    while(1)
-    {
-        struct mntent *tmp_info = getmntent_r(fp, &info, buf, buf_len);
-
-        if(!tmp_info) {
-            if(errno == ERANGE) {
-                buf_len *= 2;
-                buf = realloc(buf, buf_len);
-                if(!buf) {
-                    bbox_perror("mount", "out of memory?\n");
-                    rval = -1;
-                    goto cleanup_and_exit;
-                }
-                continue;
-            }
+    free(mount_point);
+    return rval;
+}
 
-            break;
-        }
+int bbox_mount_set_mounted(bbox_mtab_t *mtab, const char *path)
+{
+    char *mount_point = NULL;
+    int rval = 0;
 
-        if(!strcmp(tmp_info->mnt_dir, mount_point)) {
-            rval = 1;
-            break;
-        }
+    if(!(mount_point = realpath(path, NULL))) {
+        bbox_perror("mount", "could not resolve '%s': '%s'.\n",
+                path, strerror(errno));
+        return -1;
     }
 
-cleanup_and_exit:
+    rval = bbox_mtab_add(mtab, mount_point);
 
-    if(fp)
-        endmntent(fp);
     free(mount_point);
-    free(buf);
-
     return rval;
 }
 
-int bbox_mount_special(const char *sys_root, const char *filesystemtype)
+void bbox_mount_set_unmounted(bbox_mtab_t *mtab, const char *path)
 {
     char *mount_point = NULL;
-    char *target = NULL;
-    size_t buf_len = 0;
 
-    int is_mounted = 0;
+    /*
+     * If the path cannot be resolved anymore, there is nothing left to
+     * match against anyway.
+     */
+    if(!(mount_point = realpath(path, NULL)))
+        return;
 
-    if(!strcmp(filesystemtype, "proc")) {
-        mount_point = "proc";
-    } else if (!strcmp(filesystemtype, "sysfs")) {
-        mount_point = "sys";
-    } else {
-        bbox_perror("mount", "unsupported special filesystem: %s\n",
-            filesystemtype);
-        return -1;
-    }
+    bbox_mtab_remove(mtab, mount_point);
+    free(mount_point);
+}
 
-    bbox_path_join(&target, sys_root, mount_point, &buf_len);
+/*
+ * Appends a request for `target` to the plan. The plan takes ownership of
+ * `target`, also if this fails. The directory is remembered as it is now, so
+ * that nothing else can be put in its place before the mount is attached.
+ */
+static int bbox_mount_plan_push(bbox_mount_plan_t *plan, char *target,
+        const char *source, const char *fstype, unsigned long flags,
+        const char *data)
+{
+    char *data_dup = NULL;
+    struct stat st;
 
-    if((is_mounted = bbox_mount_is_mounted(target)) == -1) {
+    if(plan->num_reqs >= BBOX_MOUNT_MAX_REQS) {
+        bbox_perror("mount", "too many mounts requested.\n");
         free(target);
         return -1;
     }
 
-    if(is_mounted) {
-        free(target);
-        return 0;
-    }
-
-    /*
-     * Require that the normalized mountpoint is a directory owned by the user
-     * who invoked `build-box` to mitigate the risk of misuse.
-     */
-    if(bbox_isdir_and_owned_by("mount", target, getuid()) == -1) {
+    if(lstat(target, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        bbox_perror("mount", "mountpoint %s is not a directory.\n", target);
         free(target);
         return -1;
     }
 
-    /*
-     * We need to be running mount as root, so we briefly raise privileges to
-     * drop them again immediately after.
-     */
-    if(bbox_raise_privileges() == -1) {
+    if(data && !(data_dup = strdup(data))) {
+        bbox_perror("mount", "out of memory?\n");
         free(target);
         return -1;
     }
 
-    int rval = 0;
+    bbox_mount_req_t *req = &plan->reqs[plan->num_reqs++];
 
-    if(mount(NULL, target, filesystemtype, 0, NULL) != 0)
-    {
-        bbox_perror("mount", "failed to mount %s on %s: %s.\n",
-                filesystemtype, target, strerror(errno));
-        rval = -1;
+    req->source = source;
+    req->target = target;
+    req->fstype = fstype;
+    req->flags = flags;
+    req->data = data_dup;
+    req->dev = st.st_dev;
+    req->ino = st.st_ino;
+    req->is_mounted = 0;
+
+    return 0;
+}
+
+/*
+ * Opens the mountpoint of `req` without following symbolic links and makes
+ * sure it is still the directory that was checked when the request was
+ * planned. Mounting onto the descriptor avoids looking up the path again.
+ */
+int bbox_mount_open_target(const bbox_mount_req_t *req)
+{
+    struct stat st;
+
+    int fd = open(req->target, O_PATH | O_NOFOLLOW | O_DIRECTORY | O_CLOEXEC);
+
+    if(fd == -1) {
+        bbox_perror("mount", "could not open mountpoint %s: %s.\n",
+                req->target, strerror(errno));
+        return -1;
     }
-    else if(mount(NULL, target, NULL, MS_PRIVATE, NULL) != 0)
-    {
-        bbox_perror("mount", "failed to make mountpoint %s private: %s.\n",
-                target, strerror(errno));
-        /* Continue anyway. */
+
+    if(fstat(fd, &st) == -1) {
+        bbox_perror("mount", "could not stat mountpoint %s: %s.\n",
+                req->target, strerror(errno));
+        close(fd);
+        return -1;
     }
 
-    /*
-     * We're done with mounting, lower privileges right away.
-     */
-    if(bbox_lower_privileges() == -1)
-        rval = -1;
+    if(st.st_dev != req->dev || st.st_ino != req->ino) {
+        bbox_perror("mount", "mountpoint %s was replaced.\n", req->target);
+        close(fd);
+        return -1;
+    }
 
-    free(target);
-    return rval;
+    return fd;
 }
 
-int bbox_mount_bind(const char *sys_root, const char *source, int recursive)
+/*
+ * Adds a mount request for <sys_root>/<mount_point> to the plan, unless
+ * something is mounted there already. Returns -1 on error.
+ */
+static int bbox_mount_plan_add(bbox_mount_plan_t *plan,
+        bbox_mtab_t *mtab, const char *sys_root, const char *mount_point,
+        const char *source, const char *fstype, unsigned long flags,
+        const char *data)
 {
     char *target = NULL;
     size_t buf_len = 0;
     int is_mounted = 0;
 
-    bbox_path_join(&target, sys_root, source, &buf_len);
+    bbox_path_join(&target, sys_root, mount_point, &buf_len);
 
-    if((is_mounted = bbox_mount_is_mounted(target)) == -1) {
+    if((is_mounted = bbox_mount_is_mounted(mtab, target)) == -1) {
         free(target);
         return -1;
     }
@@ -296,120 +342,993 @@ int bbox_mount_bind(const char *sys_root, const char *source, int recursive)
         return -1;
     }
 
-    /*
-     * We need to be running mount as root, so we briefly raise privileges to
-     * drop them again immediately after.
-     */
-    if(bbox_raise_privileges() == -1) {
-        free(target);
+    return bbox_mount_plan_push(plan, target, source, fstype, flags, data);
+}
+
+int bbox_mount_plan_special(bbox_mount_plan_t *plan, bbox_mtab_t *mtab,
+        const char *sys_root, const char *filesystemtype)
+{
+    char *mount_point = NULL;
+
+    if(!strcmp(filesystemtype, "proc")) {
+        mount_point = "proc";
+    } else if (!strcmp(filesystemtype, "sysfs")) {
+        mount_point = "sys";
+    } else {
+        bbox_perror("mount", "unsupported special filesystem: %s\n",
+            filesystemtype);
         return -1;
     }
 
-    int rval = 0;
+    return bbox_mount_plan_add(plan, mtab, sys_root, mount_point, NULL,
+            filesystemtype, 0, NULL);
+}
 
+int bbox_mount_plan_bind(bbox_mount_plan_t *plan, bbox_mtab_t *mtab,
+        const char *sys_root, const char *source, int recursive)
+{
     unsigned long mountflags = MS_BIND | (recursive ? MS_REC : 0);
 
-    if(mount(source, target, NULL, mountflags, NULL) != 0)
+    return bbox_mount_plan_add(plan, mtab, sys_root, source, source, NULL,
+            mountflags, NULL);
+}
+
+/*
+ * Returns the source name that all tmpfs mounts made for the calling user
+ * carry. It tells them apart from any other tmpfs, wherever they are mounted.
+ */
+const char *bbox_mount_tmpfs_source()
+{
+    static char source[32];
+
+    if(!source[0]) {
+        snprintf(source, sizeof(source), "build-box-%lu",
+                (unsigned long) getuid());
+    }
+
+    return source;
+}
+
+int bbox_mount_plan_tmpfs(bbox_mount_plan_t *plan, bbox_mtab_t *mtab,
+        const char *sys_root, const char *mount_point, const char *data)
+{
+    return bbox_mount_plan_add(plan, mtab, sys_root, mount_point,
+            bbox_mount_tmpfs_source(), "tmpfs", MS_NOSUID | MS_NODEV, data);
+}
+
+/*
+ * Schedules a read-only mount of a file system image, which has already been
+ * attached to the block device `source`. Like the image itself, nothing in
+ * it may grant privileges.
+ */
+int bbox_mount_plan_image(bbox_mount_plan_t *plan, bbox_mtab_t *mtab,
+        const char *sys_root, const char *source, const char *fstype)
+{
+    return bbox_mount_plan_add(plan, mtab, sys_root, "/", source, fstype,
+            MS_RDONLY | MS_NOSUID | MS_NODEV, NULL);
+}
+
+/*
+ * Schedules an overlay on top of the target. The lower directory is looked up
+ * before the overlay is attached, so if it is the target itself, it refers to
+ * what was there before.
+ */
+int bbox_mount_plan_overlay(bbox_mount_plan_t *plan, const char *sys_root,
+        const char *lower_dir, const char *upper_dir, const char *work_dir)
+{
+    char *data = NULL;
+    int rval = -1;
+
+    /*
+     * These characters have a special meaning in the overlay options.
+     */
+    if(strpbrk(lower_dir, ",:\\") || strpbrk(upper_dir, ",:\\") ||
+            strpbrk(work_dir, ",:\\"))
     {
-        bbox_perror("mount", "failed to mount %s on %s: %s.\n",
-                source, target, strerror(errno));
-        rval = -1;
+        bbox_perror("mount", "overlay paths must not contain ',', ':' or "
+                "'\\'.\n");
+        return -1;
     }
-    else if(mount(NULL, target, NULL, MS_PRIVATE, NULL) != 0)
+
+    /*
+     * Without redirects and metacopy, the upper layer holds complete copies
+     * of everything that changed. That makes it easy to merge, and it keeps
+     * the kernel from following anything a user may have planted in it. The
+     * lower layer may be a file system image with files owned by root, so
+     * the overlay never honors set-user-ID bits or device nodes.
+     */
+    if(asprintf(&data, "lowerdir=%s,upperdir=%s,workdir=%s,"
+                "redirect_dir=off,metacopy=off", lower_dir, upper_dir,
+                work_dir) == -1)
     {
-        bbox_perror("mount", "failed to make mountpoint %s private: %s.\n",
-                target, strerror(errno));
-        /* Continue anyway. */
+        bbox_perror("mount", "out of memory?\n");
+        return -1;
     }
 
     /*
-     * We're done with mounting, lower privileges right away.
+     * An overlay may go on top of whatever is mounted at the target already,
+     * so unlike other mounts, it is never skipped.
      */
-    if(bbox_lower_privileges() == -1)
-        rval = -1;
+    if(bbox_isdir_and_owned_by("mount", sys_root, getuid()) == 0) {
+        char *target = strdup(sys_root);
+
+        if(!target) {
+            bbox_perror("mount", "out of memory?\n");
+        } else {
+            rval = bbox_mount_plan_push(plan, target, "overlay", "overlay",
+                    MS_NOSUID | MS_NODEV, data);
+        }
+    }
 
-    free(target);
+    free(data);
     return rval;
 }
 
-int bbox_mount_any(const bbox_conf_t *conf, const char *sys_root)
+/*
+ * Returns the mount options for a tmpfs of the given size. Shared directories
+ * like /tmp are world-writable with the sticky bit set, all others belong to
+ * the user. The caller has to free the result.
+ */
+char *bbox_mount_tmpfs_data(unsigned long long size, int is_shared)
 {
+    char *owner = NULL;
+    char *data = NULL;
+
+    if(is_shared) {
+        owner = strdup("mode=1777,uid=0,gid=0");
+    } else if(asprintf(&owner, "mode=0755,uid=%lu,gid=%lu",
+                (unsigned long) getuid(), (unsigned long) getgid()) == -1)
+    {
+        owner = NULL;
+    }
+
     /*
-     * As an additional precaution, we require the normalized sys-root directory
-     * to be owned by the user who invoked `build-box`.
+     * Back files that fill whole huge pages with huge pages. That saves TLB
+     * misses on large build trees, but never makes a file use more memory
+     * than it would otherwise.
      */
-    if(bbox_isdir_and_owned_by("mount", sys_root, getuid()) == -1)
-        return -1;
+    int has_thp = access(BBOX_THP_SHMEM, F_OK) == 0;
 
-    if(bbox_config_get_mount_dev(conf)) {
-        if(bbox_mount_bind(sys_root, "/dev", 0) < 0)
-            return -1;
+    if(!owner || asprintf(&data, "%s,size=%llu%s", owner, size,
+                has_thp ? ",huge=within_size" : "") == -1)
+    {
+        data = NULL;
+        bbox_perror("mount", "out of memory?\n");
     }
 
-    if(bbox_config_get_mount_proc(conf)) {
-        if(bbox_mount_special(sys_root, "proc") < 0)
-            return -1;
-    }
+    free(owner);
+    return data;
+}
 
-    if(bbox_config_get_mount_sys(conf)) {
-        if(bbox_mount_special(sys_root, "sysfs") < 0)
-            return -1;
+/*
+ * Schedules a tmpfs of the given size on <sys_root>/<mount_point>. The planned
+ * size is added to `total_ptr`, unless the directory is a mount point
+ * already.
+ */
+static int bbox_mount_plan_scratch(bbox_mount_plan_t *plan,
+        bbox_mtab_t *mtab, const char *sys_root, const char *mount_point,
+        unsigned long long size, int is_shared, unsigned long long *total_ptr)
+{
+    char *data = NULL;
+    char *target = NULL;
+    size_t buf_len = 0;
+    size_t num_reqs = plan->num_reqs;
+    int rval = -1;
+
+    if(size == 0)
+        size = bbox_get_phys_mem() / 100 * BBOX_TMPFS_DEFAULT_PERCENT;
+
+    if(size == 0) {
+        bbox_perror("mount", "could not determine size of physical memory.\n");
+        return -1;
     }
 
     /*
-     * Mounting the home directory requires extra pre-caution. The source path
-     * has already been normalized and checked for ownership, so we should be
-     * fine calling `bbox_mount_bind`, which in turn checks the target directory
-     * before executing the mount.
+     * We're not worried about this, because we are currently running with
+     * lowered privileges.
      */
-    if(bbox_config_get_mount_home(conf)) {
-        const char *homedir = bbox_config_get_home_dir(conf);
+    if(bbox_sysroot_mkdir_p("mount", sys_root, mount_point) == -1)
+        return -1;
 
-        /*
-         * We're not worried about this, because we are currently running with
-         * lowered privileges.
-         */
-        if(bbox_sysroot_mkdir_p("mount", sys_root, homedir) == -1)
-            return -1;
+    /*
+     * Symbolic links inside the target must not lead us anywhere else.
+     */
+    bbox_path_join(&target, sys_root, mount_point, &buf_len);
 
-        /*
-         * This internally checks the ownership of <sys_root>/<homedir>.
-         */
-        if(bbox_mount_bind(sys_root, homedir, 0) < 0)
-            return -1;
+    if(bbox_is_subdir_of(sys_root, target) == -1) {
+        bbox_perror("mount", "scratch directory '%s' is outside of the "
+                "target.\n", mount_point);
+        goto cleanup_and_exit;
     }
 
-    return 0;
+    if(!(data = bbox_mount_tmpfs_data(size, is_shared)))
+        goto cleanup_and_exit;
+
+    if(bbox_mount_plan_tmpfs(plan, mtab, sys_root, mount_point, data) == -1)
+        goto cleanup_and_exit;
+
+    if(plan->num_reqs > num_reqs)
+        *total_ptr += size;
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    free(target);
+    free(data);
+    return rval;
 }
 
-int bbox_mount(int argc, char * const argv[])
+/*
+ * Schedules a bind mount of the user's package cache on /var/cache/opkg of the
+ * target. The cache is the host directory that the target's /.pkg-cache link
+ * points to. Targets without such a link are left alone. The directory is
+ * opened with lowered privileges and mounted through /proc/self/fd, so that
+ * nothing can be swapped in after the ownership check. The caller has to
+ * close `*fd_ptr`, once the plan has been executed.
+ */
+static int bbox_mount_plan_pkg_cache(bbox_mount_plan_t *plan,
+        bbox_mtab_t *mtab, const char *sys_root, int *fd_ptr,
+        char *source, size_t source_len)
 {
-    char *buf = NULL;
+    char *link_path = NULL;
+    char cache_dir[PATH_MAX];
     size_t buf_len = 0;
+    struct stat st;
+    int rval = -1;
 
-    int rval = BBOX_ERR_INVOCATION;
-
-    bbox_conf_t *conf = bbox_config_new();
-    if(!conf) {
-        bbox_perror("mount", "creating configuration context failed.\n");
-        return BBOX_ERR_RUNTIME;
-    }
+    bbox_path_join(&link_path, sys_root, BBOX_PKG_CACHE_LINK, &buf_len);
 
-    int non_optind;
+    ssize_t nbytes = readlink(link_path, cache_dir, sizeof(cache_dir));
 
-    if((non_optind = bbox_mount_getopt(conf, argc, argv)) < 0) {
-        /* user asked for --help */
-        if(non_optind == -1)
+    if(nbytes == -1) {
+        if(errno == ENOENT || errno == EINVAL)
             rval = 0;
+        else
+            bbox_perror("mount", "could not read link '%s': %s.\n",
+                    link_path, strerror(errno));
         goto cleanup_and_exit;
     }
 
-    if(non_optind >= argc) {
-        bbox_perror("mount", "no target specified.\n");
+    if(nbytes >= (ssize_t) sizeof(cache_dir)) {
+        bbox_perror("mount", "link '%s' is too long.\n", link_path);
         goto cleanup_and_exit;
     }
 
-    char *target = argv[non_optind];
+    cache_dir[nbytes] = '\0';
+
+    /*
+     * A link into the target itself is a leftover from before the cache was
+     * mounted.
+     */
+    if(cache_dir[0] != '/' || !strcmp(cache_dir, BBOX_PKG_CACHE_DIR)) {
+        rval = 0;
+        goto cleanup_and_exit;
+    }
+
+    if(bbox_mkdir_p("mount", cache_dir) == -1)
+        goto cleanup_and_exit;
+    if(bbox_sysroot_mkdir_p("mount", sys_root, BBOX_PKG_CACHE_DIR) == -1)
+        goto cleanup_and_exit;
+
+    int fd = open(cache_dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+    if(fd == -1) {
+        bbox_perror("mount", "could not open '%s': %s.\n", cache_dir,
+                strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    *fd_ptr = fd;
+
+    if(fstat(fd, &st) == -1) {
+        bbox_perror("mount", "could not stat '%s': %s.\n", cache_dir,
+                strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    if(st.st_uid != getuid()) {
+        bbox_perror("mount", "directory '%s' is not owned by user id "
+                "'%ld'.\n", cache_dir, (long) getuid());
+        goto cleanup_and_exit;
+    }
+
+    snprintf(source, source_len, "/proc/self/fd/%d", fd);
+
+    rval = bbox_mount_plan_add(plan, mtab, sys_root, BBOX_PKG_CACHE_DIR,
+            source, NULL, MS_BIND, NULL);
+
+cleanup_and_exit:
+
+    free(link_path);
+    return rval;
+}
+
+/*
+ * Returns <sys_root>/<mount_point> if it is a directory that is not mounted
+ * on yet, and NULL otherwise. No symbolic links may be involved, because the
+ * path leads into the host's /dev.
+ */
+static char *bbox_mount_dev_dir(bbox_mtab_t *mtab, const char *sys_root,
+        const char *real_root, const char *mount_point, int *error_ptr)
+{
+    char *target = NULL;
+    char *expected = NULL;
+    char *real_target = NULL;
+    size_t buf_len = 0;
+    size_t expected_len = 0;
+    struct stat st;
+
+    bbox_path_join(&target, sys_root, mount_point, &buf_len);
+    bbox_path_join(&expected, real_root, mount_point, &expected_len);
+
+    int is_usable = (real_target = realpath(target, NULL)) &&
+        !strcmp(real_target, expected) &&
+        lstat(target, &st) == 0 && S_ISDIR(st.st_mode);
+
+    free(real_target);
+    free(expected);
+
+    if(is_usable) {
+        int is_mounted = bbox_mount_is_mounted(mtab, target);
+
+        if(is_mounted == 0)
+            return target;
+        if(is_mounted == -1)
+            *error_ptr = 1;
+    }
+
+    free(target);
+    return NULL;
+}
+
+/*
+ * Schedules a tmpfs on /dev/shm and a devpts instance on /dev/pts of the
+ * target, so that its POSIX shared memory and pseudo terminals are separate
+ * from the host's. Since Linux 4.7, /dev/ptmx picks the devpts instance from
+ * the "pts" directory next to it, so the bind-mounted ptmx device works as
+ * is. The directories belong to the host's /dev and can only be checked once
+ * that is bind-mounted.
+ */
+static int bbox_mount_plan_dev_extras(bbox_mount_plan_t *plan,
+        bbox_mtab_t *mtab, const char *sys_root, unsigned long long shm_size,
+        unsigned long long *total_ptr)
+{
+    char *dev_dir = NULL;
+    char *real_root = NULL;
+    char *target = NULL;
+    char *data = NULL;
+    size_t buf_len = 0;
+    int error = 0;
+    int rval = -1;
+
+    bbox_path_join(&dev_dir, sys_root, "/dev", &buf_len);
+
+    /*
+     * Only ever stack these onto our own bind mount of /dev.
+     */
+    int is_mounted = bbox_mount_is_mounted(mtab, dev_dir);
+
+    if(is_mounted <= 0) {
+        rval = is_mounted;
+        goto cleanup_and_exit;
+    }
+
+    if(!(real_root = realpath(sys_root, NULL))) {
+        bbox_perror("mount", "could not resolve '%s': '%s'.\n",
+                sys_root, strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    if(shm_size == 0)
+        shm_size = bbox_get_phys_mem() / 100 * BBOX_SHM_DEFAULT_PERCENT;
+
+    target = bbox_mount_dev_dir(mtab, sys_root, real_root, "/dev/shm",
+            &error);
+
+    if(target) {
+        if(!(data = bbox_mount_tmpfs_data(shm_size, 1)))
+            goto cleanup_and_exit;
+
+        if(bbox_mount_plan_push(plan, target, bbox_mount_tmpfs_source(),
+                    "tmpfs", MS_NOSUID | MS_NODEV, data) == -1)
+        {
+            goto cleanup_and_exit;
+        }
+
+        *total_ptr += shm_size;
+    }
+
+    target = bbox_mount_dev_dir(mtab, sys_root, real_root, "/dev/pts",
+            &error);
+
+    /*
+     * New terminals belong to the tty group, which has gid 5 on all the
+     * distributions we build. Without it, they'd get the group of the
+     * opening process and tools like write/wall would not work.
+     */
+    if(target) {
+        if(bbox_mount_plan_push(plan, target, "devpts", "devpts",
+                    MS_NOSUID | MS_NOEXEC,
+                    "newinstance,ptmxmode=0666,mode=0620,gid=5") == -1)
+        {
+            goto cleanup_and_exit;
+        }
+    }
+
+    rval = error ? -1 : 0;
+
+cleanup_and_exit:
+
+    free(data);
+    free(real_root);
+    free(dev_dir);
+    return rval;
+}
+
+/*
+ * A tmpfs in a private mount namespace doesn't show up in anybody else's
+ * mount table. Whoever mounts one charges it to a ledger in the user's
+ * root-owned run directory, one line per namespace:
+ *
+ *     <pid> <start time> <namespace inode> <bytes>
+ *
+ * The process is the one that set up the namespace, and the entry counts for
+ * as long as it runs. Opens the ledger, locked, and returns the descriptor.
+ */
+static int bbox_mount_open_ledger()
+{
+    char *path = NULL;
+    int fd = -1;
+
+    if(asprintf(&path, BBOX_SESSION_DIR_TEMPLATE "/" BBOX_TMPFS_LEDGER_NAME,
+                (unsigned long) getuid()) == -1)
+    {
+        bbox_perror("mount", "out of memory?\n");
+        return -1;
+    }
+
+    char *dir = strrchr(path, '/');
+
+    if(bbox_raise_privileges() == -1) {
+        free(path);
+        return -1;
+    }
+
+    *dir = '\0';
+
+    if((mkdir(BBOX_RUN_DIR, 0755) == -1 && errno != EEXIST) ||
+            (mkdir(path, 0755) == -1 && errno != EEXIST))
+    {
+        bbox_perror("mount", "failed to create '%s': %s.\n", path,
+                strerror(errno));
+    } else {
+        *dir = '/';
+
+        if((fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC,
+                        0644)) == -1)
+        {
+            bbox_perror("mount", "failed to open '%s': %s.\n", path,
+                    strerror(errno));
+        }
+    }
+
+    if(bbox_lower_privileges() == -1) {
+        if(fd != -1)
+            close(fd);
+        fd = -1;
+    }
+
+    while(fd != -1 && flock(fd, LOCK_EX) == -1) {
+        if(errno != EINTR) {
+            bbox_perror("mount", "failed to lock '%s': %s.\n", path,
+                    strerror(errno));
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    free(path);
+    return fd;
+}
+
+/*
+ * Goes through the ledger, drops the entries of processes that are gone and
+ * sums up the others. What was mounted in our own namespace is in the mount
+ * table, so our own entry isn't counted, but charged `requested` more bytes
+ * if `is_private` is set. The ledger is only rewritten if `do_update` is set.
+ */
+static int bbox_mount_update_ledger(int fd, unsigned long long requested,
+        int is_private, int do_update, unsigned long long *used_ptr)
+{
+    struct stat ns_st;
+    char *buf = NULL;
+    char *out = NULL;
+    size_t buf_size = 0;
+    size_t out_len = 0;
+    unsigned long long own_bytes = 0;
+    int rval = -1;
+
+    FILE *in_fp = NULL;
+    FILE *out_fp = NULL;
+
+    if(stat("/proc/self/ns/mnt", &ns_st) == -1) {
+        bbox_perror("mount", "could not identify mount namespace: %s.\n",
+                strerror(errno));
+        return -1;
+    }
+
+    int in_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+
+    if(in_fd == -1 || lseek(in_fd, 0, SEEK_SET) == -1 ||
+            !(in_fp = fdopen(in_fd, "r")))
+    {
+        bbox_perror("mount", "failed to read tmpfs ledger: %s.\n",
+                strerror(errno));
+        if(in_fd != -1)
+            close(in_fd);
+        return -1;
+    }
+
+    if(!(out_fp = open_memstream(&out, &out_len))) {
+        bbox_perror("mount", "out of memory?\n");
+        goto cleanup_and_exit;
+    }
+
+    while(getline(&buf, &buf_size, in_fp) != -1) {
+        long pid;
+        unsigned long long start_time, ns_ino, bytes;
+
+        if(sscanf(buf, "%ld %llu %llu %llu", &pid, &start_time, &ns_ino,
+                    &bytes) != 4)
+        {
+            continue;
+        }
+
+        if(pid <= 0 || bbox_get_start_time((pid_t) pid) != start_time)
+            continue;
+
+        if(ns_ino == (unsigned long long) ns_st.st_ino) {
+            own_bytes += bytes;
+            continue;
+        }
+
+        *used_ptr += bytes;
+        fprintf(out_fp, "%ld %llu %llu %llu\n", pid, start_time, ns_ino,
+                bytes);
+    }
+
+    if(is_private)
+        own_bytes += requested;
+
+    if(own_bytes) {
+        fprintf(out_fp, "%ld %llu %llu %llu\n", (long) getpid(),
+                bbox_get_start_time(getpid()),
+                (unsigned long long) ns_st.st_ino, own_bytes);
+    }
+
+    if(fclose(out_fp) == EOF) {
+        out_fp = NULL;
+        bbox_perror("mount", "out of memory?\n");
+        goto cleanup_and_exit;
+    }
+
+    out_fp = NULL;
+
+    if(do_update) {
+        if(ftruncate(fd, 0) == -1 ||
+                pwrite(fd, out, out_len, 0) != (ssize_t) out_len)
+        {
+            bbox_perror("mount", "failed to update tmpfs ledger: %s.\n",
+                    strerror(errno));
+            goto cleanup_and_exit;
+        }
+    }
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    if(out_fp)
+        fclose(out_fp);
+    fclose(in_fp);
+    free(out);
+    free(buf);
+    return rval;
+}
+
+/*
+ * Makes sure that the tmpfs mounts a user has across all of their targets
+ * stay within BBOX_TMPFS_QUOTA_PERCENT of the physical memory, including the
+ * `requested` bytes that are about to be mounted. Visible mounts are found by
+ * their source name, so targets outside of the user directory count, too.
+ * Those in private namespaces come from the ledger, and if `is_private` is
+ * set, the new ones are charged to it.
+ */
+int bbox_mount_check_tmpfs_quota(unsigned long long requested,
+        int is_private)
+{
+    char **mnt_dirs = NULL;
+    size_t num_mnt_dirs = 0;
+    unsigned long long used = 0;
+    int ledger_fd = -1;
+    int rval = -1;
+
+    if(requested == 0)
+        return 0;
+
+    unsigned long long quota =
+        bbox_get_phys_mem() / 100 * BBOX_TMPFS_QUOTA_PERCENT;
+
+    if((ledger_fd = bbox_mount_open_ledger()) == -1)
+        goto cleanup_and_exit;
+
+    if(bbox_mtab_list_source(bbox_mount_tmpfs_source(), &mnt_dirs,
+                &num_mnt_dirs) == -1)
+    {
+        goto cleanup_and_exit;
+    }
+
+    for(size_t i = 0; i < num_mnt_dirs; i++) {
+        struct statfs st;
+
+        if(statfs(mnt_dirs[i], &st) == -1 || st.f_type != TMPFS_MAGIC)
+            continue;
+
+        used += (unsigned long long) st.f_blocks * st.f_bsize;
+    }
+
+    if(bbox_mount_update_ledger(ledger_fd, requested, 0, 0, &used) == -1)
+        goto cleanup_and_exit;
+
+    if(used + requested > quota) {
+        bbox_perror("mount", "scratch space of %llu MiB would exceed the "
+                "limit of %llu MiB per user (%llu MiB in use).\n",
+                requested >> 20, quota >> 20, used >> 20);
+        goto cleanup_and_exit;
+    }
+
+    if(is_private) {
+        used = 0;
+
+        if(bbox_mount_update_ledger(ledger_fd, requested, 1, 1,
+                    &used) == -1)
+        {
+            goto cleanup_and_exit;
+        }
+    }
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    if(ledger_fd != -1)
+        close(ledger_fd);
+    for(size_t i = 0; i < num_mnt_dirs; i++)
+        free(mnt_dirs[i]);
+    free(mnt_dirs);
+    return rval;
+}
+
+/*
+ * Mounts a single request with mount(2). This is what we fall back to on
+ * kernels that don't support the new mount API.
+ */
+static int bbox_mount_legacy(bbox_mount_req_t *req)
+{
+    char target_path[32];
+    int target_fd = -1;
+
+    if((target_fd = bbox_mount_open_target(req)) == -1)
+        return -1;
+
+    snprintf(target_path, sizeof(target_path), "/proc/self/fd/%d",
+            target_fd);
+
+    int rval = mount(req->source, target_path, req->fstype, req->flags,
+            req->data);
+    int saved_errno = errno;
+
+    close(target_fd);
+
+    if(rval != 0) {
+        bbox_perror("mount", "failed to mount %s on %s: %s.\n",
+                req->fstype ? req->fstype : req->source, req->target,
+                strerror(saved_errno));
+        return -1;
+    }
+
+    req->is_mounted = 1;
+
+    /*
+     * mount(2) ignores the per-mount flags of a bind request, they only take
+     * effect on a remount.
+     */
+    unsigned long attr_flags =
+        req->flags & (MS_RDONLY | MS_NOSUID | MS_NODEV | MS_NOEXEC);
+
+    if((req->flags & MS_BIND) && attr_flags &&
+            mount(NULL, req->target, NULL, MS_REMOUNT | MS_BIND | attr_flags,
+                NULL) != 0)
+    {
+        bbox_perror("mount", "failed to remount %s: %s.\n", req->target,
+                strerror(errno));
+        return -1;
+    }
+
+    if(mount(NULL, req->target, NULL, MS_PRIVATE, NULL) != 0)
+    {
+        bbox_perror("mount", "failed to make mountpoint %s private: %s.\n",
+                req->target, strerror(errno));
+        /* Continue anyway. */
+    }
+
+    return 0;
+}
+
+int bbox_mount_plan_execute(bbox_mount_plan_t *plan, bbox_mtab_t *mtab)
+{
+    int rval = 0;
+
+    if(plan->num_reqs == 0)
+        return 0;
+
+    /*
+     * We need to be running mount as root, so we briefly raise privileges to
+     * drop them again immediately after.
+     */
+    if(bbox_raise_privileges() == -1)
+        return -1;
+
+    /*
+     * Prefer preparing all mounts detached and attaching them afterwards. If
+     * the kernel is too old for that, mount them one by one.
+     */
+    if((rval = bbox_mountfd_execute(plan)) == -2) {
+        rval = 0;
+
+        for(size_t i = 0; i < plan->num_reqs; i++) {
+            if(bbox_mount_legacy(&plan->reqs[i]) == -1) {
+                rval = -1;
+                break;
+            }
+        }
+    }
+
+    /*
+     * We're done with mounting, lower privileges right away.
+     */
+    if(bbox_lower_privileges() == -1)
+        rval = -1;
+
+    for(size_t i = 0; i < plan->num_reqs; i++) {
+        bbox_mount_req_t *req = &plan->reqs[i];
+
+        if(req->is_mounted && bbox_mount_set_mounted(mtab, req->target) == -1)
+            rval = -1;
+    }
+
+    return rval;
+}
+
+void bbox_mount_plan_clear(bbox_mount_plan_t *plan)
+{
+    for(size_t i = 0; i < plan->num_reqs; i++) {
+        free(plan->reqs[i].target);
+        free(plan->reqs[i].data);
+    }
+    plan->num_reqs = 0;
+}
+
+/*
+ * Moves the calling process into a mount namespace of its own. Mounts made
+ * afterwards are invisible to the host and go away with the last process in
+ * the namespace. Changes on the host still propagate into the namespace.
+ */
+int bbox_mount_unshare(const char *module)
+{
+    int rval = 0;
+
+    if(bbox_raise_privileges() == -1)
+        return -1;
+
+    if(unshare(CLONE_NEWNS) == -1) {
+        bbox_perror(module, "failed to create mount namespace: %s.\n",
+                strerror(errno));
+        rval = -1;
+    } else if(mount(NULL, "/", NULL, MS_REC | MS_SLAVE, NULL) == -1) {
+        bbox_perror(module, "failed to change mount propagation: %s.\n",
+                strerror(errno));
+        rval = -1;
+    }
+
+    if(bbox_lower_privileges() == -1)
+        rval = -1;
+
+    return rval;
+}
+
+int bbox_mount_any(const bbox_conf_t *conf, const char *sys_root)
+{
+    bbox_mount_plan_t plan = { .num_reqs = 0 };
+    bbox_mtab_t *mtab = NULL;
+    unsigned long long tmpfs_bytes = 0;
+    char pkg_cache_source[64];
+    int pkg_cache_fd = -1;
+    int lock_fd = -1;
+    int rval = -1;
+
+    /*
+     * As an additional precaution, we require the normalized sys-root directory
+     * to be owned by the user who invoked `build-box`.
+     */
+    if(bbox_isdir_and_owned_by("mount", sys_root, getuid()) == -1)
+        return -1;
+
+    /*
+     * Mounts in a private namespace are nobody else's business, so there is
+     * no need for coordination or for a journal.
+     */
+    int is_private = bbox_config_get_private_mounts(conf) ? 1 : 0;
+
+    /*
+     * Wait for a teardown of the target that may be in progress.
+     */
+    if(!is_private) {
+        if((lock_fd = bbox_lease_acquire("mount", sys_root, 0)) == -1)
+            return -1;
+    }
+
+    /*
+     * Mounts recorded in the target's journal are verified individually. The
+     * mount table is read at most once, and only if the journal can't answer
+     * a check. It is kept up to date as we go.
+     */
+    if(!(mtab = is_private ? bbox_mtab_load() : bbox_mtab_open(sys_root)))
+        goto cleanup_and_exit;
+
+    /*
+     * Collect everything that needs mounting first, while still running with
+     * lowered privileges. Only then raise privileges once to do the actual
+     * mounting.
+     */
+    if(bbox_config_get_mount_dev(conf)) {
+        if(bbox_mount_plan_bind(&plan, mtab, sys_root, "/dev", 0) < 0)
+            goto cleanup_and_exit;
+    }
+
+    if(bbox_config_get_mount_proc(conf)) {
+        if(bbox_mount_plan_special(&plan, mtab, sys_root, "proc") < 0)
+            goto cleanup_and_exit;
+    }
+
+    if(bbox_config_get_mount_sys(conf)) {
+        if(bbox_mount_plan_special(&plan, mtab, sys_root, "sysfs") < 0)
+            goto cleanup_and_exit;
+    }
+
+    if(bbox_config_get_mount_pkg_cache(conf)) {
+        if(bbox_mount_plan_pkg_cache(&plan, mtab, sys_root, &pkg_cache_fd,
+                    pkg_cache_source, sizeof(pkg_cache_source)) < 0)
+        {
+            goto cleanup_and_exit;
+        }
+    }
+
+    /*
+     * Mounting the home directory requires extra pre-caution. The source path
+     * has already been normalized and checked for ownership, so we should be
+     * fine calling `bbox_mount_plan_bind`, which in turn checks the target
+     * directory before scheduling the mount.
+     */
+    if(bbox_config_get_mount_home(conf)) {
+        const char *homedir = bbox_config_get_home_dir(conf);
+
+        /*
+         * We're not worried about this, because we are currently running with
+         * lowered privileges.
+         */
+        if(bbox_sysroot_mkdir_p("mount", sys_root, homedir) == -1)
+            goto cleanup_and_exit;
+
+        /*
+         * This internally checks the ownership of <sys_root>/<homedir>.
+         */
+        if(bbox_mount_plan_bind(&plan, mtab, sys_root, homedir, 0) < 0)
+            goto cleanup_and_exit;
+    }
+
+    /*
+     * Scratch space goes last, so that it can live below the home directory.
+     */
+    if(bbox_config_get_mount_tmp(conf)) {
+        if(bbox_mount_plan_scratch(&plan, mtab, sys_root, "/tmp", 0, 1,
+                    &tmpfs_bytes) < 0)
+        {
+            goto cleanup_and_exit;
+        }
+    }
+
+    for(size_t i = 0; i < bbox_config_get_num_scratch(conf); i++) {
+        const bbox_scratch_t *scratch = bbox_config_get_scratch(conf, i);
+
+        if(bbox_mount_plan_scratch(&plan, mtab, sys_root, scratch->path,
+                    scratch->size, 0, &tmpfs_bytes) < 0)
+        {
+            goto cleanup_and_exit;
+        }
+    }
+
+    if(bbox_mount_check_tmpfs_quota(tmpfs_bytes, is_private) < 0)
+        goto cleanup_and_exit;
+
+    if(bbox_mount_plan_execute(&plan, mtab) < 0)
+        goto cleanup_and_exit;
+
+    /*
+     * The target's own /dev/shm and /dev/pts go on top of /dev once it is in
+     * place.
+     */
+    if(bbox_config_get_mount_dev(conf) && !bbox_config_get_host_dev(conf)) {
+        bbox_mount_plan_clear(&plan);
+        tmpfs_bytes = 0;
+
+        if(bbox_mount_plan_dev_extras(&plan, mtab, sys_root,
+                    bbox_config_get_shm_size(conf), &tmpfs_bytes) < 0)
+        {
+            goto cleanup_and_exit;
+        }
+
+        if(bbox_mount_check_tmpfs_quota(tmpfs_bytes, is_private) < 0)
+            goto cleanup_and_exit;
+
+        if(bbox_mount_plan_execute(&plan, mtab) < 0)
+            goto cleanup_and_exit;
+    }
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    bbox_mount_plan_clear(&plan);
+    if(mtab)
+        bbox_mtab_sync(mtab);
+    bbox_mtab_free(mtab);
+    if(pkg_cache_fd >= 0)
+        close(pkg_cache_fd);
+    if(lock_fd >= 0)
+        close(lock_fd);
+    return rval;
+}
+
+int bbox_mount(int argc, char * const argv[])
+{
+    char *buf = NULL;
+    size_t buf_len = 0;
+
+    int rval = BBOX_ERR_INVOCATION;
+
+    bbox_conf_t *conf = bbox_config_new();
+    if(!conf) {
+        bbox_perror("mount", "creating configuration context failed.\n");
+        return BBOX_ERR_RUNTIME;
+    }
+
+    int non_optind;
+
+    if((non_optind = bbox_mount_getopt(conf, argc, argv)) < 0) {
+        /* user asked for --help */
+        if(non_optind == -1)
+            rval = 0;
+        goto cleanup_and_exit;
+    }
+
+    if(non_optind >= argc) {
+        bbox_perror("mount", "no target specified.\n");
+        goto cleanup_and_exit;
+    }
+
+    char *target = argv[non_optind];
 
     if(validate_target_name("mount", target) == -1)
         goto cleanup_and_exit;
@@ -427,6 +1346,9 @@ int bbox_mount(int argc, char * const argv[])
 
     rval = BBOX_ERR_RUNTIME;
 
+    if(bbox_layer_assemble("mount", buf) == -1)
+        goto cleanup_and_exit;
+
     if(bbox_mount_any(conf, buf) == 0)
         rval = 0;
 
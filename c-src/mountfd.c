@@ -0,0 +1,369 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bbox-do.h"
+
+/*
+ * The constants and structures of the new mount API are spelled out here,
+ * because depending on the C library version they are either missing or
+ * clash with the kernel headers.
+ */
+#define BBOX_OPEN_TREE_CLONE         0x00000001
+#define BBOX_FSOPEN_CLOEXEC          0x00000001
+#define BBOX_FSMOUNT_CLOEXEC         0x00000001
+#define BBOX_FSCONFIG_SET_FLAG       0
+#define BBOX_FSCONFIG_SET_STRING     1
+#define BBOX_FSCONFIG_CMD_CREATE     6
+#define BBOX_MOVE_MOUNT_F_EMPTY_PATH 0x00000004
+#define BBOX_MOVE_MOUNT_T_EMPTY_PATH 0x00000040
+#define BBOX_AT_RECURSIVE            0x8000
+#define BBOX_MOUNT_ATTR_RDONLY       0x00000001
+#define BBOX_MOUNT_ATTR_NOSUID       0x00000002
+#define BBOX_MOUNT_ATTR_NODEV        0x00000004
+#define BBOX_MOUNT_ATTR_NOEXEC       0x00000008
+
+struct bbox_mount_attr {
+    uint64_t attr_set;
+    uint64_t attr_clr;
+    uint64_t propagation;
+    uint64_t userns_fd;
+};
+
+static int bbox_sys_open_tree(int dfd, const char *path, unsigned int flags)
+{
+#ifdef SYS_open_tree
+    return syscall(SYS_open_tree, dfd, path, flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int bbox_sys_fsopen(const char *fs_name, unsigned int flags)
+{
+#ifdef SYS_fsopen
+    return syscall(SYS_fsopen, fs_name, flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int bbox_sys_fsconfig(int fd, unsigned int cmd, const char *key,
+        const void *value, int aux)
+{
+#ifdef SYS_fsconfig
+    return syscall(SYS_fsconfig, fd, cmd, key, value, aux);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int bbox_sys_fsmount(int fd, unsigned int flags,
+        unsigned int attr_flags)
+{
+#ifdef SYS_fsmount
+    return syscall(SYS_fsmount, fd, flags, attr_flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int bbox_sys_move_mount(int from_dfd, const char *from_path,
+        int to_dfd, const char *to_path, unsigned int flags)
+{
+#ifdef SYS_move_mount
+    return syscall(SYS_move_mount, from_dfd, from_path, to_dfd, to_path,
+            flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int bbox_sys_mount_setattr(int dfd, const char *path,
+        unsigned int flags, struct bbox_mount_attr *attr, size_t size)
+{
+#ifdef SYS_mount_setattr
+    return syscall(SYS_mount_setattr, dfd, path, flags, attr, size);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * Translates the per-mount flags of mount(2) into their fsmount counterparts.
+ */
+static unsigned int bbox_mountfd_attr_flags(unsigned long flags)
+{
+    unsigned int attr_flags = 0;
+
+    if(flags & MS_RDONLY)
+        attr_flags |= BBOX_MOUNT_ATTR_RDONLY;
+    if(flags & MS_NOSUID)
+        attr_flags |= BBOX_MOUNT_ATTR_NOSUID;
+    if(flags & MS_NODEV)
+        attr_flags |= BBOX_MOUNT_ATTR_NODEV;
+    if(flags & MS_NOEXEC)
+        attr_flags |= BBOX_MOUNT_ATTR_NOEXEC;
+
+    return attr_flags;
+}
+
+/*
+ * Hands the source and the comma-separated mount options of a request to the
+ * file system context one by one. Options without a value are flags. A
+ * read-only mount needs a read-only superblock, too, or the kernel tries to
+ * open the source device for writing.
+ */
+static int bbox_mountfd_configure(int fs_fd, const bbox_mount_req_t *req)
+{
+    char *data = NULL;
+    char *save_ptr = NULL;
+    int rval = 0;
+
+    if(req->source && bbox_sys_fsconfig(fs_fd, BBOX_FSCONFIG_SET_STRING,
+                "source", req->source, 0) == -1)
+    {
+        return -1;
+    }
+
+    if((req->flags & MS_RDONLY) && bbox_sys_fsconfig(fs_fd,
+                BBOX_FSCONFIG_SET_FLAG, "ro", NULL, 0) == -1)
+    {
+        return -1;
+    }
+
+    if(!req->data)
+        return 0;
+
+    if(!(data = strdup(req->data)))
+        return -1;
+
+    for(char *key = strtok_r(data, ",", &save_ptr); key;
+            key = strtok_r(NULL, ",", &save_ptr))
+    {
+        char *value = strchr(key, '=');
+
+        if(value)
+            *value++ = '\0';
+
+        if(bbox_sys_fsconfig(fs_fd, value ? BBOX_FSCONFIG_SET_STRING :
+                    BBOX_FSCONFIG_SET_FLAG, key, value, 0) == -1)
+        {
+            rval = -1;
+            break;
+        }
+    }
+
+    int saved_errno = errno;
+    free(data);
+    errno = saved_errno;
+
+    return rval;
+}
+
+/*
+ * Clones the source tree of a bind request. A bind mount made with mount(2)
+ * takes its per-mount flags from a remount, here they are set on the
+ * detached tree instead. If the kernel has `open_tree` but not
+ * `mount_setattr`, this fails with ENOSYS and the caller falls back to
+ * mount(2), which can apply the flags.
+ */
+static int bbox_mountfd_clone(const bbox_mount_req_t *req)
+{
+    unsigned int flags = BBOX_OPEN_TREE_CLONE | O_CLOEXEC;
+    int mnt_fd = -1;
+
+    if(req->flags & MS_REC)
+        flags |= BBOX_AT_RECURSIVE;
+
+    if((mnt_fd = bbox_sys_open_tree(AT_FDCWD, req->source, flags)) == -1)
+        return -1;
+
+    struct bbox_mount_attr attr = {
+        .attr_set = bbox_mountfd_attr_flags(req->flags)
+    };
+
+    if(attr.attr_set && bbox_sys_mount_setattr(mnt_fd, "",
+                AT_EMPTY_PATH | ((req->flags & MS_REC) ?
+                    BBOX_AT_RECURSIVE : 0), &attr, sizeof(attr)) == -1)
+    {
+        int saved_errno = errno;
+        close(mnt_fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    return mnt_fd;
+}
+
+/*
+ * Creates a detached mount for the given request and returns a file
+ * descriptor referring to it. Nothing becomes visible in the file system
+ * until the descriptor is attached with `move_mount`.
+ */
+static int bbox_mountfd_create(const bbox_mount_req_t *req)
+{
+    int fs_fd = -1;
+    int mnt_fd = -1;
+
+    if(req->flags & MS_BIND)
+        return bbox_mountfd_clone(req);
+
+    if((fs_fd = bbox_sys_fsopen(req->fstype, BBOX_FSOPEN_CLOEXEC)) == -1)
+        return -1;
+
+    if(bbox_mountfd_configure(fs_fd, req) == 0 &&
+            bbox_sys_fsconfig(fs_fd, BBOX_FSCONFIG_CMD_CREATE, NULL, NULL,
+                0) == 0)
+    {
+        mnt_fd = bbox_sys_fsmount(fs_fd, BBOX_FSMOUNT_CLOEXEC,
+                bbox_mountfd_attr_flags(req->flags));
+    }
+
+    int saved_errno = errno;
+    close(fs_fd);
+    errno = saved_errno;
+
+    return mnt_fd;
+}
+
+int bbox_mountfd_execute(bbox_mount_plan_t *plan)
+{
+    int mnt_fds[BBOX_MOUNT_MAX_REQS];
+    int rval = -1;
+    size_t i;
+
+    for(i = 0; i < plan->num_reqs; i++)
+        mnt_fds[i] = -1;
+
+    /*
+     * First set up every mount of the plan detached from the file system
+     * tree. If anything goes wrong here, nothing has been attached yet and we
+     * can bail out cleanly.
+     */
+    for(i = 0; i < plan->num_reqs; i++) {
+        bbox_mount_req_t *req = &plan->reqs[i];
+
+        if((mnt_fds[i] = bbox_mountfd_create(req)) != -1)
+            continue;
+
+        /*
+         * The kernel does not know the new mount API. Let the caller fall
+         * back to mount(2).
+         */
+        if(errno == ENOSYS) {
+            rval = -2;
+            goto cleanup_and_exit;
+        }
+
+        bbox_perror("mount", "failed to prepare mount on %s: %s.\n",
+                req->target, strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    /*
+     * Now attach the prepared mounts one after the other. Each one shows up
+     * fully set up in a single step, on exactly the directory that was
+     * checked when the plan was made.
+     */
+    for(i = 0; i < plan->num_reqs; i++) {
+        bbox_mount_req_t *req = &plan->reqs[i];
+
+        int target_fd = bbox_mount_open_target(req);
+
+        if(target_fd == -1)
+            goto cleanup_and_exit;
+
+        int move_rval = bbox_sys_move_mount(mnt_fds[i], "", target_fd, "",
+                BBOX_MOVE_MOUNT_F_EMPTY_PATH | BBOX_MOVE_MOUNT_T_EMPTY_PATH);
+        int saved_errno = errno;
+
+        close(target_fd);
+
+        if(move_rval == -1) {
+            bbox_perror("mount", "failed to mount %s on %s: %s.\n",
+                    req->fstype ? req->fstype : req->source, req->target,
+                    strerror(saved_errno));
+            goto cleanup_and_exit;
+        }
+
+        req->is_mounted = 1;
+
+        /*
+         * Propagation can only be changed after attaching, because a mount
+         * placed below a shared mount joins its peer group. The descriptor
+         * still refers to the new mount, so no path lookup is needed.
+         */
+        struct bbox_mount_attr attr = {
+            .propagation = MS_PRIVATE
+        };
+
+        char mnt_path[32];
+
+        snprintf(mnt_path, sizeof(mnt_path), "/proc/self/fd/%d", mnt_fds[i]);
+
+        if(bbox_sys_mount_setattr(mnt_fds[i], "", AT_EMPTY_PATH, &attr,
+                    sizeof(attr)) == -1)
+        {
+            if(errno != ENOSYS ||
+                    mount(NULL, mnt_path, NULL, MS_PRIVATE, NULL) != 0)
+            {
+                bbox_perror("mount",
+                        "failed to make mountpoint %s private: %s.\n",
+                        req->target, strerror(errno));
+                /* Continue anyway. */
+            }
+        }
+    }
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    for(i = 0; i < plan->num_reqs; i++) {
+        if(mnt_fds[i] != -1)
+            close(mnt_fds[i]);
+    }
+
+    return rval;
+}
@@ -0,0 +1,206 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Compares the listmount() and /proc/self/mountinfo backends of the mount
+ * table snapshot on a synthetic mount table. Must be run as root. All mounts
+ * are created in a private mount namespace and vanish when the program exits.
+ *
+ *   make mtab-bench && sudo ./mtab-bench [num-mounts] [num-queries]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bbox-do.h"
+
+#define BBOX_BENCH_ITERATIONS 10
+
+static double bbox_bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int bbox_bench_setup(const char *base_dir, size_t num_mounts)
+{
+    char *src = NULL;
+    char *buf = NULL;
+    size_t src_len = 0;
+    size_t buf_len = 0;
+    char name[32];
+
+    if(unshare(CLONE_NEWNS) == -1) {
+        bbox_perror("mtab-bench", "unshare failed: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    if(mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) == -1 ||
+            mount("none", base_dir, "tmpfs", 0, NULL) == -1)
+    {
+        bbox_perror("mtab-bench", "failed to set up %s: %s.\n", base_dir,
+                strerror(errno));
+        return -1;
+    }
+
+    bbox_path_join(&src, base_dir, "src", &src_len);
+
+    if(mkdir(src, 0755) == -1) {
+        buf = src;
+        src = NULL;
+        goto failure;
+    }
+
+    for(size_t i = 0; i < num_mounts; i++) {
+        /* Every mounted directory gets an unmounted sibling. */
+        snprintf(name, sizeof(name), "u%zu", i);
+        bbox_path_join(&buf, base_dir, name, &buf_len);
+
+        if(mkdir(buf, 0755) == -1)
+            goto failure;
+
+        snprintf(name, sizeof(name), "m%zu", i);
+        bbox_path_join(&buf, base_dir, name, &buf_len);
+
+        if(mkdir(buf, 0755) == -1 || mount(src, buf, NULL, MS_BIND, NULL) == -1)
+            goto failure;
+    }
+
+    free(src);
+    free(buf);
+    return 0;
+
+failure:
+
+    bbox_perror("mtab-bench", "failed to create mount %s: %s.\n", buf,
+            strerror(errno));
+    free(src);
+    free(buf);
+    return -1;
+}
+
+static int bbox_bench_run(const char *label, bbox_mtab_t *(*load)(),
+        const char *base_dir, size_t num_mounts, size_t num_queries)
+{
+    char *buf = NULL;
+    size_t buf_len = 0;
+    char name[32];
+    double load_ms = 0, query_ms = 0;
+    size_t hits = 0;
+
+    for(int iter = 0; iter < BBOX_BENCH_ITERATIONS; iter++) {
+        double start = bbox_bench_now();
+
+        bbox_mtab_t *mtab = load();
+
+        if(!mtab) {
+            printf("%-10s not supported on this kernel (%s)\n", label,
+                    strerror(errno));
+            free(buf);
+            return -1;
+        }
+
+        double loaded = bbox_bench_now();
+
+        for(size_t i = 0; i < num_queries; i++) {
+            size_t n = (i * 7919) % num_mounts;
+
+            snprintf(name, sizeof(name), "%c%zu", (i & 1) ? 'u' : 'm', n);
+            bbox_path_join(&buf, base_dir, name, &buf_len);
+
+            if(bbox_mtab_contains(mtab, buf) == 1)
+                hits++;
+        }
+
+        double done = bbox_bench_now();
+
+        load_ms += loaded - start;
+        query_ms += done - loaded;
+
+        bbox_mtab_free(mtab);
+    }
+
+    printf("%-10s load %9.3f ms   %zu queries %9.3f ms   hits %zu/%zu\n",
+            label, load_ms / BBOX_BENCH_ITERATIONS, num_queries,
+            query_ms / BBOX_BENCH_ITERATIONS,
+            hits / BBOX_BENCH_ITERATIONS, (num_queries + 1) / 2);
+
+    free(buf);
+    return 0;
+}
+
+static bbox_mtab_t *bbox_bench_load_mountinfo()
+{
+    return bbox_mtab_load_mountinfo("/proc/self/mountinfo");
+}
+
+int main(int argc, char *argv[])
+{
+    size_t num_mounts = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+    size_t num_queries = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+    char base_dir[] = "/tmp/mtab-bench-XXXXXX";
+
+    if(num_mounts == 0) {
+        bbox_perror("mtab-bench", "need at least one mount.\n");
+        return BBOX_ERR_INVOCATION;
+    }
+
+    if(!mkdtemp(base_dir)) {
+        bbox_perror("mtab-bench", "mkdtemp failed: %s.\n", strerror(errno));
+        return BBOX_ERR_RUNTIME;
+    }
+
+    int rval = BBOX_ERR_RUNTIME;
+
+    if(bbox_bench_setup(base_dir, num_mounts) == 0) {
+        printf("%zu synthetic mounts, average over %d runs:\n\n",
+                num_mounts, BBOX_BENCH_ITERATIONS);
+
+        bbox_bench_run("listmount", bbox_mtab_load_listmount, base_dir,
+                num_mounts, num_queries);
+        bbox_bench_run("mountinfo", bbox_bench_load_mountinfo, base_dir,
+                num_mounts, num_queries);
+        rval = 0;
+    }
+
+    /*
+     * The mounts go away with the namespace, only the directory itself is
+     * left over in the parent namespace.
+     */
+    umount2(base_dir, MNT_DETACH);
+    rmdir(base_dir);
+    return rval;
+}
@@ -0,0 +1,1114 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bbox-do.h"
+
+#define BBOX_MTAB_MIN_BUCKETS 64
+#define BBOX_MTAB_LISTMOUNT_BATCH 4096
+#define BBOX_MTAB_STATMOUNT_BUF_SIZE 4096
+
+#define BBOX_STATX_ATTR_MOUNT_ROOT 0x00002000ULL
+
+#define BBOX_LSMT_ROOT             0xffffffffffffffffULL
+#define BBOX_STATMOUNT_MNT_POINT   0x00000010ULL
+#define BBOX_MNT_ID_REQ_SIZE_VER0  24
+
+/*
+ * listmount() and statmount() are too new to be known by most C libraries.
+ * Their numbers are at a fixed distance from open_tree() on all
+ * architectures, including those that number their system calls with an
+ * offset.
+ */
+#if !defined(SYS_listmount) && defined(SYS_open_tree)
+#define SYS_statmount (SYS_open_tree + 29)
+#define SYS_listmount (SYS_open_tree + 30)
+#endif
+
+/*
+ * This is the kernel's `struct statx` up to the mount id. The C library
+ * version only has `stx_mnt_id` when built against recent kernel headers.
+ */
+struct bbox_statx_timestamp {
+    int64_t tv_sec;
+    uint32_t tv_nsec;
+    int32_t __reserved;
+};
+
+struct bbox_statx {
+    uint32_t stx_mask;
+    uint32_t stx_blksize;
+    uint64_t stx_attributes;
+    uint32_t stx_nlink;
+    uint32_t stx_uid;
+    uint32_t stx_gid;
+    uint16_t stx_mode;
+    uint16_t __spare0[1];
+    uint64_t stx_ino;
+    uint64_t stx_size;
+    uint64_t stx_blocks;
+    uint64_t stx_attributes_mask;
+    struct bbox_statx_timestamp stx_atime;
+    struct bbox_statx_timestamp stx_btime;
+    struct bbox_statx_timestamp stx_ctime;
+    struct bbox_statx_timestamp stx_mtime;
+    uint32_t stx_rdev_major;
+    uint32_t stx_rdev_minor;
+    uint32_t stx_dev_major;
+    uint32_t stx_dev_minor;
+    uint64_t stx_mnt_id;
+    uint64_t __spare3[13];
+};
+
+struct bbox_mnt_id_req {
+    uint32_t size;
+    uint32_t spare;
+    uint64_t mnt_id;
+    uint64_t param;
+};
+
+struct bbox_statmount {
+    uint32_t size;
+    uint32_t __spare1;
+    uint64_t mask;
+    uint32_t sb_dev_major;
+    uint32_t sb_dev_minor;
+    uint64_t sb_magic;
+    uint32_t sb_flags;
+    uint32_t fs_type;
+    uint64_t mnt_id;
+    uint64_t mnt_parent_id;
+    uint32_t mnt_id_old;
+    uint32_t mnt_parent_id_old;
+    uint64_t mnt_attr;
+    uint64_t mnt_propagation;
+    uint64_t mnt_peer_group;
+    uint64_t mnt_master;
+    uint64_t propagate_from;
+    uint32_t mnt_root;
+    uint32_t mnt_point;
+    uint64_t __spare2[50];
+    char str[];
+};
+
+static int bbox_sys_statx(int dfd, const char *path, int flags,
+        unsigned int mask, struct bbox_statx *stx)
+{
+#ifdef SYS_statx
+    return syscall(SYS_statx, dfd, path, flags, mask, stx);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static ssize_t bbox_sys_listmount(const struct bbox_mnt_id_req *req,
+        uint64_t *mnt_ids, size_t nr_mnt_ids, unsigned int flags)
+{
+#ifdef SYS_listmount
+    return syscall(SYS_listmount, req, mnt_ids, nr_mnt_ids, flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int bbox_sys_statmount(const struct bbox_mnt_id_req *req,
+        struct bbox_statmount *buf, size_t bufsize, unsigned int flags)
+{
+#ifdef SYS_statmount
+    return syscall(SYS_statmount, req, buf, bufsize, flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*
+ * FNV-1a, which is plenty good for spreading path names over the buckets.
+ */
+static size_t bbox_mtab_hash_dir(const char *mnt_dir)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for(const unsigned char *p = (const unsigned char*) mnt_dir; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+
+    return (size_t) hash;
+}
+
+/*
+ * Mount ids are handed out sequentially, a multiplicative hash spreads
+ * them out well enough.
+ */
+static size_t bbox_mtab_hash_id(uint64_t mnt_id)
+{
+    return (size_t) ((mnt_id * 11400714819323198485ULL) >> 32);
+}
+
+static void bbox_mtab_link_dir(bbox_mtab_t *mtab, bbox_mtab_entry_t *entry)
+{
+    size_t index = bbox_mtab_hash_dir(entry->mnt_dir) &
+        (mtab->num_buckets - 1);
+
+    entry->next_dir = mtab->dir_buckets[index];
+    mtab->dir_buckets[index] = entry;
+}
+
+static void bbox_mtab_link_id(bbox_mtab_t *mtab, bbox_mtab_entry_t *entry)
+{
+    size_t index = bbox_mtab_hash_id(entry->mnt_id) &
+        (mtab->num_buckets - 1);
+
+    entry->next_id = mtab->id_buckets[index];
+    mtab->id_buckets[index] = entry;
+}
+
+static int bbox_mtab_resize(bbox_mtab_t *mtab, size_t num_buckets)
+{
+    bbox_mtab_entry_t **old_id_buckets = mtab->id_buckets;
+    size_t old_num_buckets = mtab->num_buckets;
+
+    bbox_mtab_entry_t **id_buckets = calloc(num_buckets,
+            sizeof(bbox_mtab_entry_t*));
+    bbox_mtab_entry_t **dir_buckets = calloc(num_buckets,
+            sizeof(bbox_mtab_entry_t*));
+
+    if(!id_buckets || !dir_buckets) {
+        bbox_perror("bbox_mtab_resize", "out of memory?\n");
+        free(id_buckets);
+        free(dir_buckets);
+        return -1;
+    }
+
+    free(mtab->dir_buckets);
+    mtab->id_buckets = id_buckets;
+    mtab->dir_buckets = dir_buckets;
+    mtab->num_buckets = num_buckets;
+
+    /*
+     * Every entry is on exactly one id chain, so rehash from there. The order
+     * within chains doesn't matter, stacked mounts are told apart by their
+     * sequence numbers.
+     */
+    for(size_t i = 0; i < old_num_buckets; i++) {
+        bbox_mtab_entry_t *entry = old_id_buckets[i];
+
+        while(entry) {
+            bbox_mtab_entry_t *next = entry->next_id;
+
+            bbox_mtab_link_id(mtab, entry);
+            if(entry->mnt_dir)
+                bbox_mtab_link_dir(mtab, entry);
+
+            entry = next;
+        }
+    }
+
+    free(old_id_buckets);
+    return 0;
+}
+
+static bbox_mtab_entry_t *bbox_mtab_find_id(const bbox_mtab_t *mtab,
+        uint64_t mnt_id)
+{
+    size_t index = bbox_mtab_hash_id(mnt_id) & (mtab->num_buckets - 1);
+
+    for(bbox_mtab_entry_t *entry = mtab->id_buckets[index]; entry;
+            entry = entry->next_id)
+    {
+        if(entry->mnt_id == mnt_id)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/*
+ * Returns the topmost, i.e. most recent, mount on the given directory.
+ */
+static bbox_mtab_entry_t *bbox_mtab_find_dir(const bbox_mtab_t *mtab,
+        const char *mnt_dir)
+{
+    size_t index = bbox_mtab_hash_dir(mnt_dir) & (mtab->num_buckets - 1);
+    bbox_mtab_entry_t *topmost = NULL;
+
+    for(bbox_mtab_entry_t *entry = mtab->dir_buckets[index]; entry;
+            entry = entry->next_dir)
+    {
+        if(strcmp(entry->mnt_dir, mnt_dir))
+            continue;
+        if(!topmost || entry->seq > topmost->seq)
+            topmost = entry;
+    }
+
+    return topmost;
+}
+
+/*
+ * Adds an entry to the table. The mount directory may be NULL, if it isn't
+ * known yet.
+ */
+static int bbox_mtab_insert(bbox_mtab_t *mtab, uint64_t mnt_id,
+        const char *mnt_dir)
+{
+    if(mtab->num_entries >= mtab->num_buckets) {
+        if(bbox_mtab_resize(mtab, mtab->num_buckets * 2) == -1)
+            return -1;
+    }
+
+    bbox_mtab_entry_t *entry = calloc(sizeof(bbox_mtab_entry_t), 1);
+
+    if(!entry || (mnt_dir && !(entry->mnt_dir = strdup(mnt_dir)))) {
+        bbox_perror("bbox_mtab_insert", "out of memory?\n");
+        free(entry);
+        return -1;
+    }
+
+    entry->mnt_id = mnt_id;
+    entry->seq = mtab->seq++;
+
+    bbox_mtab_link_id(mtab, entry);
+    if(entry->mnt_dir)
+        bbox_mtab_link_dir(mtab, entry);
+
+    mtab->num_entries++;
+    return 0;
+}
+
+static int bbox_mtab_set_dir(bbox_mtab_t *mtab, bbox_mtab_entry_t *entry,
+        const char *mnt_dir)
+{
+    if(!(entry->mnt_dir = strdup(mnt_dir))) {
+        bbox_perror("bbox_mtab_set_dir", "out of memory?\n");
+        return -1;
+    }
+
+    bbox_mtab_link_dir(mtab, entry);
+    return 0;
+}
+
+/*
+ * Looks up the id of the mount that `path` lives on. `mask` selects the kind
+ * of id (BBOX_STATX_MNT_ID or BBOX_STATX_MNT_ID_UNIQUE). Returns 0 on success
+ * and -1 if the kernel can't tell. If `is_mount_root` is given, it is set to
+ * 1 or 0 if the kernel knows whether `path` is the root of that mount, and to
+ * -1 otherwise.
+ */
+int bbox_stat_mnt_id(const char *path, unsigned int mask, uint64_t *mnt_id,
+        int *is_mount_root)
+{
+    struct bbox_statx stx;
+
+    if(!mask) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    memset(&stx, 0, sizeof(stx));
+
+    if(bbox_sys_statx(AT_FDCWD, path, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                mask, &stx) == -1)
+    {
+        return -1;
+    }
+
+    if(!(stx.stx_mask & mask)) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    *mnt_id = stx.stx_mnt_id;
+
+    if(is_mount_root) {
+        if(stx.stx_attributes_mask & BBOX_STATX_ATTR_MOUNT_ROOT) {
+            *is_mount_root =
+                (stx.stx_attributes & BBOX_STATX_ATTR_MOUNT_ROOT) ? 1 : 0;
+        } else {
+            *is_mount_root = -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Same as bbox_stat_mnt_id, for the file that `fd` refers to.
+ */
+int bbox_fstat_mnt_id(int fd, unsigned int mask, uint64_t *mnt_id)
+{
+    struct bbox_statx stx;
+
+    if(!mask) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    memset(&stx, 0, sizeof(stx));
+
+    if(bbox_sys_statx(fd, "", AT_EMPTY_PATH, mask, &stx) == -1)
+        return -1;
+
+    if(!(stx.stx_mask & mask)) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    *mnt_id = stx.stx_mnt_id;
+    return 0;
+}
+
+/*
+ * Fetches the mount point of the given mount with statmount().
+ */
+static char *bbox_mtab_statmount_dir(uint64_t mnt_id)
+{
+    size_t buf_size = BBOX_MTAB_STATMOUNT_BUF_SIZE;
+    struct bbox_statmount *sm = NULL;
+    char *mnt_dir = NULL;
+
+    struct bbox_mnt_id_req req = {
+        .size = BBOX_MNT_ID_REQ_SIZE_VER0,
+        .mnt_id = mnt_id,
+        .param = BBOX_STATMOUNT_MNT_POINT
+    };
+
+    while(1) {
+        if(!(sm = malloc(buf_size))) {
+            bbox_perror("bbox_mtab_statmount_dir", "out of memory?\n");
+            return NULL;
+        }
+
+        if(bbox_sys_statmount(&req, sm, buf_size, 0) == 0)
+            break;
+
+        free(sm);
+        sm = NULL;
+
+        if(errno != EOVERFLOW)
+            return NULL;
+
+        buf_size *= 2;
+    }
+
+    if(sm->mask & BBOX_STATMOUNT_MNT_POINT) {
+        if(!(mnt_dir = strdup(sm->str + sm->mnt_point)))
+            bbox_perror("bbox_mtab_statmount_dir", "out of memory?\n");
+    }
+
+    free(sm);
+    return mnt_dir;
+}
+
+/*
+ * Drops all entries, but keeps the table itself.
+ */
+static void bbox_mtab_clear(bbox_mtab_t *mtab)
+{
+    for(size_t i = 0; i < mtab->num_buckets; i++) {
+        bbox_mtab_entry_t *entry = mtab->id_buckets[i];
+
+        while(entry) {
+            bbox_mtab_entry_t *next = entry->next_id;
+            free(entry->mnt_dir);
+            free(entry);
+            entry = next;
+        }
+
+        mtab->id_buckets[i] = NULL;
+        mtab->dir_buckets[i] = NULL;
+    }
+
+    mtab->num_entries = 0;
+    mtab->is_loaded = 0;
+}
+
+bbox_mtab_t *bbox_mtab_new()
+{
+    bbox_mtab_t *mtab = calloc(sizeof(bbox_mtab_t), 1);
+
+    if(!mtab) {
+        bbox_perror("bbox_mtab_new", "out of memory?\n");
+        return NULL;
+    }
+
+    if(bbox_mtab_resize(mtab, BBOX_MTAB_MIN_BUCKETS) == -1) {
+        free(mtab);
+        return NULL;
+    }
+
+    return mtab;
+}
+
+static int bbox_mtab_fill_listmount(bbox_mtab_t *mtab)
+{
+    uint64_t *mnt_ids = NULL;
+    ssize_t count = 0;
+
+    mtab->source = BBOX_MTAB_SOURCE_LISTMOUNT;
+    mtab->statx_mask = BBOX_STATX_MNT_ID_UNIQUE;
+
+    if(!(mnt_ids = malloc(BBOX_MTAB_LISTMOUNT_BATCH * sizeof(uint64_t)))) {
+        bbox_perror("bbox_mtab_load_listmount", "out of memory?\n");
+        goto failure;
+    }
+
+    struct bbox_mnt_id_req req = {
+        .size = BBOX_MNT_ID_REQ_SIZE_VER0,
+        .mnt_id = BBOX_LSMT_ROOT,
+        .param = 0
+    };
+
+    /*
+     * Only the ids are fetched here. Mount points are looked up lazily and
+     * only for the mounts we actually get asked about.
+     */
+    do {
+        count = bbox_sys_listmount(&req, mnt_ids, BBOX_MTAB_LISTMOUNT_BATCH,
+                0);
+
+        if(count == -1)
+            goto failure;
+
+        for(ssize_t i = 0; i < count; i++) {
+            if(bbox_mtab_insert(mtab, mnt_ids[i], NULL) == -1) {
+                /* Don't let the caller mistake this for ENOSYS. */
+                errno = ENOMEM;
+                goto failure;
+            }
+        }
+
+        if(count > 0)
+            req.param = mnt_ids[count - 1];
+    } while(count == BBOX_MTAB_LISTMOUNT_BATCH);
+
+    /*
+     * The kernel supports listmount(), but make sure statx() knows about
+     * unique mount ids as well. Otherwise we have nothing to match against.
+     */
+    uint64_t root_id = 0;
+
+    if(bbox_stat_mnt_id("/", mtab->statx_mask, &root_id, NULL) == -1) {
+        errno = ENOSYS;
+        goto failure;
+    }
+
+    free(mnt_ids);
+    mtab->is_loaded = 1;
+    return 0;
+
+failure:
+
+    free(mnt_ids);
+    int saved_errno = errno;
+    bbox_mtab_clear(mtab);
+    errno = saved_errno;
+    return -1;
+}
+
+bbox_mtab_t *bbox_mtab_load_listmount()
+{
+    bbox_mtab_t *mtab = bbox_mtab_new();
+    if(!mtab)
+        return NULL;
+
+    if(bbox_mtab_fill_listmount(mtab) == -1) {
+        int saved_errno = errno;
+        bbox_mtab_free(mtab);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    return mtab;
+}
+
+/*
+ * Decodes the octal escapes the kernel uses for white space and backslashes
+ * in /proc/self/mountinfo. Works in place.
+ */
+static void bbox_mtab_unescape(char *str)
+{
+    char *src = str;
+    char *dst = str;
+
+    while(*src) {
+        if(src[0] == '\\' &&
+                src[1] >= '0' && src[1] <= '3' &&
+                src[2] >= '0' && src[2] <= '7' &&
+                src[3] >= '0' && src[3] <= '7')
+        {
+            *dst++ = (char) (((src[1] - '0') << 6) | ((src[2] - '0') << 3) |
+                (src[3] - '0'));
+            src += 4;
+        } else {
+            *dst++ = *src++;
+        }
+    }
+
+    *dst = '\0';
+}
+
+static int bbox_mtab_fill_mountinfo(bbox_mtab_t *mtab, const char *path)
+{
+    char *line = NULL;
+    size_t line_len = 0;
+    FILE *fp = NULL;
+
+    mtab->source = BBOX_MTAB_SOURCE_MOUNTINFO;
+    mtab->statx_mask = BBOX_STATX_MNT_ID;
+
+    if(!(fp = fopen(path, "re"))) {
+        bbox_perror("bbox_mtab_load", "failed to open %s: %s.\n", path,
+                strerror(errno));
+        goto failure;
+    }
+
+    /*
+     * Each line starts with the mount id, the parent id, the device, the root
+     * of the mount and the mount point, separated by single spaces. We don't
+     * need anything beyond that.
+     */
+    while(getline(&line, &line_len, fp) != -1)
+    {
+        char *fields[5];
+        char *save_ptr = NULL;
+        char *token = line;
+        int i;
+
+        for(i = 0; i < 5; i++) {
+            if(!(fields[i] = strtok_r(token, " ", &save_ptr)))
+                break;
+            token = NULL;
+        }
+
+        if(i < 5)
+            continue;
+
+        bbox_mtab_unescape(fields[4]);
+
+        if(bbox_mtab_insert(mtab, strtoull(fields[0], NULL, 10),
+                    fields[4]) == -1)
+        {
+            goto failure;
+        }
+    }
+
+    /*
+     * Kernels before 5.8 don't report mount ids via statx(). Lookups then
+     * compare mount points by name.
+     */
+    uint64_t root_id = 0;
+
+    if(bbox_stat_mnt_id("/", mtab->statx_mask, &root_id, NULL) == -1)
+        mtab->statx_mask = 0;
+
+    fclose(fp);
+    free(line);
+    mtab->is_loaded = 1;
+    return 0;
+
+failure:
+
+    if(fp)
+        fclose(fp);
+    free(line);
+    bbox_mtab_clear(mtab);
+    return -1;
+}
+
+bbox_mtab_t *bbox_mtab_load_mountinfo(const char *path)
+{
+    bbox_mtab_t *mtab = bbox_mtab_new();
+    if(!mtab)
+        return NULL;
+
+    if(bbox_mtab_fill_mountinfo(mtab, path) == -1) {
+        bbox_mtab_free(mtab);
+        return NULL;
+    }
+
+    return mtab;
+}
+
+static int bbox_mtab_fill(bbox_mtab_t *mtab)
+{
+    /*
+     * Prefer listmount() (Linux 6.8+), which hands out binary mount ids
+     * without the kernel having to format, and us having to parse, the entire
+     * mount table.
+     */
+    if(bbox_mtab_fill_listmount(mtab) == 0)
+        return 0;
+
+    if(errno != ENOSYS && errno != EINVAL) {
+        bbox_perror("bbox_mtab_load", "failed to list mounts: %s.\n",
+                strerror(errno));
+        return -1;
+    }
+
+    return bbox_mtab_fill_mountinfo(mtab, "/proc/self/mountinfo");
+}
+
+bbox_mtab_t *bbox_mtab_load()
+{
+    bbox_mtab_t *mtab = bbox_mtab_new();
+    if(!mtab)
+        return NULL;
+
+    if(bbox_mtab_fill(mtab) == -1) {
+        bbox_mtab_free(mtab);
+        return NULL;
+    }
+
+    return mtab;
+}
+
+bbox_mtab_t *bbox_mtab_open(const char *sys_root)
+{
+    bbox_mtab_t *mtab = bbox_mtab_new();
+    if(!mtab)
+        return NULL;
+
+    /*
+     * Without a journal, we might as well read the table right away.
+     */
+    if(!(mtab->journal = bbox_journal_open(sys_root))) {
+        if(bbox_mtab_fill(mtab) == -1) {
+            bbox_mtab_free(mtab);
+            return NULL;
+        }
+    }
+
+    return mtab;
+}
+
+int bbox_mtab_sync(bbox_mtab_t *mtab)
+{
+    if(!mtab->journal)
+        return 0;
+    return bbox_journal_save(mtab->journal);
+}
+
+int bbox_mtab_add(bbox_mtab_t *mtab, const char *mnt_dir)
+{
+    uint64_t mnt_id = 0;
+
+    if(mtab->journal)
+        bbox_journal_record(mtab->journal, mnt_dir);
+
+    /*
+     * If the table hasn't been read yet, it will pick up the new mount once
+     * it is.
+     */
+    if(!mtab->is_loaded)
+        return 0;
+
+    if(bbox_stat_mnt_id(mnt_dir, mtab->statx_mask, &mnt_id, NULL) == -1) {
+        /*
+         * Without mount ids, lookups fall back to comparing mount points by
+         * name. An id of zero never matches anything the kernel reports.
+         */
+        if(mtab->statx_mask) {
+            bbox_perror("bbox_mtab_add", "could not stat '%s': %s.\n",
+                    mnt_dir, strerror(errno));
+            return -1;
+        }
+    }
+
+    return bbox_mtab_insert(mtab, mnt_id, mnt_dir);
+}
+
+static int bbox_mtab_table_contains(bbox_mtab_t *mtab, const char *mnt_dir)
+{
+    uint64_t mnt_id = 0;
+    int is_mount_root = -1;
+
+    if(bbox_stat_mnt_id(mnt_dir, mtab->statx_mask, &mnt_id,
+                &is_mount_root) == -1)
+    {
+        return bbox_mtab_find_dir(mtab, mnt_dir) ? 1 : 0;
+    }
+
+    /*
+     * If the kernel tells us that `mnt_dir` is not the root of a mount, we
+     * are done without looking at the table at all.
+     */
+    if(is_mount_root == 0)
+        return 0;
+
+    bbox_mtab_entry_t *entry = bbox_mtab_find_id(mtab, mnt_id);
+
+    /*
+     * Mounted after the snapshot was taken (by someone else).
+     */
+    if(!entry)
+        return 0;
+
+    if(entry->mnt_dir)
+        return strcmp(entry->mnt_dir, mnt_dir) ? 0 : 1;
+
+    /*
+     * The mount is in the table, and the kernel says that `mnt_dir` is its
+     * root. Remember the directory so that it can be removed by name later.
+     */
+    if(is_mount_root == 1)
+        return bbox_mtab_set_dir(mtab, entry, mnt_dir) == -1 ? -1 : 1;
+
+    char *statmount_dir = bbox_mtab_statmount_dir(mnt_id);
+
+    if(!statmount_dir)
+        return -1;
+
+    int rval = 0;
+
+    if(!strcmp(statmount_dir, mnt_dir))
+        rval = bbox_mtab_set_dir(mtab, entry, mnt_dir) == -1 ? -1 : 1;
+
+    free(statmount_dir);
+    return rval;
+}
+
+int bbox_mtab_contains(bbox_mtab_t *mtab, const char *mnt_dir)
+{
+    int rval = 0;
+
+    /*
+     * If the journal vouches for the mount, we don't need to look at the
+     * mount table at all. On a miss or if the journal is out of date, fall
+     * back to reading the whole table.
+     */
+    if(mtab->journal) {
+        if((rval = bbox_journal_check(mtab->journal, mnt_dir)) == 1)
+            return 1;
+        if(rval == -1)
+            bbox_journal_forget(mtab->journal, mnt_dir);
+    }
+
+    if(!mtab->is_loaded && bbox_mtab_fill(mtab) == -1)
+        return -1;
+
+    rval = bbox_mtab_table_contains(mtab, mnt_dir);
+
+    /*
+     * Adopt mounts that are there but not in the journal (yet), so that next
+     * time around we can skip the scan.
+     */
+    if(rval == 1 && mtab->journal)
+        bbox_journal_record(mtab->journal, mnt_dir);
+
+    return rval;
+}
+
+typedef struct {
+    const char *mnt_dir;
+    size_t depth;
+    uint64_t seq;
+} bbox_mtab_sort_key_t;
+
+static int bbox_mtab_compare_depth(const void *a, const void *b)
+{
+    const bbox_mtab_sort_key_t *key_a = a;
+    const bbox_mtab_sort_key_t *key_b = b;
+
+    if(key_a->depth != key_b->depth)
+        return key_a->depth > key_b->depth ? -1 : 1;
+    if(key_a->seq != key_b->seq)
+        return key_a->seq > key_b->seq ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Collects the mount points of all mounts strictly below `prefix`, deepest
+ * first. Mounts stacked on the same directory are listed topmost first, so
+ * that the result can be unmounted in order. The caller has to free the
+ * strings and the array.
+ */
+int bbox_mtab_list_under(bbox_mtab_t *mtab, const char *prefix,
+        char ***mnt_dirs_ptr, size_t *num_ptr)
+{
+    bbox_mtab_sort_key_t *keys = NULL;
+    char **mnt_dirs = NULL;
+    size_t prefix_len = strlen(prefix);
+    size_t num_keys = 0;
+    int rval = -1;
+
+    *mnt_dirs_ptr = NULL;
+    *num_ptr = 0;
+
+    while(prefix_len > 1 && prefix[prefix_len - 1] == '/')
+        prefix_len--;
+
+    if(!mtab->is_loaded && bbox_mtab_fill(mtab) == -1)
+        return -1;
+
+    if(!(keys = calloc(sizeof(bbox_mtab_sort_key_t), mtab->num_entries + 1)))
+    {
+        bbox_perror("bbox_mtab_list_under", "out of memory?\n");
+        return -1;
+    }
+
+    for(size_t i = 0; i < mtab->num_buckets; i++) {
+        for(bbox_mtab_entry_t *entry = mtab->id_buckets[i]; entry;
+                entry = entry->next_id)
+        {
+            /*
+             * Mounts that went away after the table was read don't matter.
+             */
+            if(!entry->mnt_dir) {
+                char *mnt_dir = bbox_mtab_statmount_dir(entry->mnt_id);
+
+                if(!mnt_dir)
+                    continue;
+
+                int rc = bbox_mtab_set_dir(mtab, entry, mnt_dir);
+                free(mnt_dir);
+
+                if(rc == -1)
+                    goto cleanup_and_exit;
+            }
+
+            if(strncmp(entry->mnt_dir, prefix, prefix_len) ||
+                    entry->mnt_dir[prefix_len] != '/' ||
+                    !entry->mnt_dir[prefix_len + 1])
+            {
+                continue;
+            }
+
+            size_t depth = 0;
+
+            for(const char *c = entry->mnt_dir; *c; c++) {
+                if(*c == '/')
+                    depth++;
+            }
+
+            keys[num_keys].mnt_dir = entry->mnt_dir;
+            keys[num_keys].depth = depth;
+            keys[num_keys].seq = entry->seq;
+            num_keys++;
+        }
+    }
+
+    qsort(keys, num_keys, sizeof(bbox_mtab_sort_key_t),
+            bbox_mtab_compare_depth);
+
+    if(!(mnt_dirs = calloc(sizeof(char*), num_keys + 1))) {
+        bbox_perror("bbox_mtab_list_under", "out of memory?\n");
+        goto cleanup_and_exit;
+    }
+
+    for(size_t i = 0; i < num_keys; i++) {
+        if(!(mnt_dirs[i] = strdup(keys[i].mnt_dir))) {
+            bbox_perror("bbox_mtab_list_under", "out of memory?\n");
+
+            for(size_t j = 0; j < i; j++)
+                free(mnt_dirs[j]);
+            free(mnt_dirs);
+            goto cleanup_and_exit;
+        }
+    }
+
+    *mnt_dirs_ptr = mnt_dirs;
+    *num_ptr = num_keys;
+    rval = 0;
+
+cleanup_and_exit:
+
+    free(keys);
+    return rval;
+}
+
+/*
+ * Collects the mount points of all mounts in the caller's namespace that were
+ * made with the given source name, no matter where they are. Neither
+ * listmount() nor the index keep the source around, so this always reads
+ * /proc/self/mountinfo. The caller has to free the strings and the array.
+ */
+int bbox_mtab_list_source(const char *source, char ***mnt_dirs_ptr,
+        size_t *num_ptr)
+{
+    char **mnt_dirs = NULL;
+    size_t num_mnt_dirs = 0;
+    size_t max_mnt_dirs = 0;
+    char *line = NULL;
+    size_t line_len = 0;
+    FILE *fp = NULL;
+    int rval = -1;
+
+    *mnt_dirs_ptr = NULL;
+    *num_ptr = 0;
+
+    if(!(fp = fopen("/proc/self/mountinfo", "re"))) {
+        bbox_perror("bbox_mtab_list_source", "failed to open "
+                "/proc/self/mountinfo: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    /*
+     * The mount point is the fifth field. The optional fields that follow
+     * are terminated by a single "-", then come the file system type and the
+     * source.
+     */
+    while(getline(&line, &line_len, fp) != -1)
+    {
+        char *save_ptr = NULL;
+        char *token = NULL;
+        char *mnt_dir = NULL;
+        char *mnt_source = NULL;
+        int i;
+
+        for(i = 0; (token = strtok_r(i ? NULL : line, " \n", &save_ptr));
+                i++)
+        {
+            if(i == 4)
+                mnt_dir = token;
+            if(i > 4 && !strcmp(token, "-"))
+                break;
+        }
+
+        if(!mnt_dir || !token || !strtok_r(NULL, " \n", &save_ptr) ||
+                !(mnt_source = strtok_r(NULL, " \n", &save_ptr)))
+        {
+            continue;
+        }
+
+        bbox_mtab_unescape(mnt_source);
+
+        if(strcmp(mnt_source, source))
+            continue;
+
+        if(num_mnt_dirs == max_mnt_dirs) {
+            size_t new_max = max_mnt_dirs ? max_mnt_dirs * 2 : 8;
+            char **new_dirs = realloc(mnt_dirs, new_max * sizeof(char*));
+
+            if(!new_dirs) {
+                bbox_perror("bbox_mtab_list_source", "out of memory?\n");
+                goto cleanup_and_exit;
+            }
+
+            mnt_dirs = new_dirs;
+            max_mnt_dirs = new_max;
+        }
+
+        bbox_mtab_unescape(mnt_dir);
+
+        if(!(mnt_dirs[num_mnt_dirs] = strdup(mnt_dir))) {
+            bbox_perror("bbox_mtab_list_source", "out of memory?\n");
+            goto cleanup_and_exit;
+        }
+
+        num_mnt_dirs++;
+    }
+
+    *mnt_dirs_ptr = mnt_dirs;
+    *num_ptr = num_mnt_dirs;
+    mnt_dirs = NULL;
+    num_mnt_dirs = 0;
+    rval = 0;
+
+cleanup_and_exit:
+
+    for(size_t i = 0; i < num_mnt_dirs; i++)
+        free(mnt_dirs[i]);
+    free(mnt_dirs);
+    free(line);
+    fclose(fp);
+    return rval;
+}
+
+static void bbox_mtab_unlink(bbox_mtab_t *mtab, bbox_mtab_entry_t *entry)
+{
+    size_t index = bbox_mtab_hash_id(entry->mnt_id) &
+        (mtab->num_buckets - 1);
+    bbox_mtab_entry_t **link = &mtab->id_buckets[index];
+
+    while(*link) {
+        if(*link == entry) {
+            *link = entry->next_id;
+            break;
+        }
+        link = &(*link)->next_id;
+    }
+
+    if(entry->mnt_dir) {
+        index = bbox_mtab_hash_dir(entry->mnt_dir) & (mtab->num_buckets - 1);
+        link = &mtab->dir_buckets[index];
+
+        while(*link) {
+            if(*link == entry) {
+                *link = entry->next_dir;
+                break;
+            }
+            link = &(*link)->next_dir;
+        }
+    }
+
+    mtab->num_entries--;
+}
+
+void bbox_mtab_remove(bbox_mtab_t *mtab, const char *mnt_dir)
+{
+    if(mtab->journal)
+        bbox_journal_forget(mtab->journal, mnt_dir);
+
+    if(!mtab->is_loaded)
+        return;
+
+    /*
+     * Unmounting only ever removes the topmost mount on a directory.
+     */
+    bbox_mtab_entry_t *entry = bbox_mtab_find_dir(mtab, mnt_dir);
+
+    if(!entry)
+        return;
+
+    bbox_mtab_unlink(mtab, entry);
+    free(entry->mnt_dir);
+    free(entry);
+}
+
+void bbox_mtab_free(bbox_mtab_t *mtab)
+{
+    if(!mtab)
+        return;
+
+    bbox_mtab_clear(mtab);
+    bbox_journal_free(mtab->journal);
+    free(mtab->id_buckets);
+    free(mtab->dir_buckets);
+    free(mtab);
+}
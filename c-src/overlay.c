@@ -0,0 +1,757 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "bbox-do.h"
+
+/*
+ * An overlay run puts an overlayfs on top of the target inside a mount
+ * namespace of its own. The target serves as the read-only lower layer, and
+ * everything the command changes ends up in an upper directory that belongs
+ * to this run alone. That way, several runs can share one pristine target
+ * without seeing each other's changes.
+ *
+ * The upper and work directories live in a scratch area below
+ * <user dir>/overlays, optionally on a tmpfs. Once the command has finished,
+ * the changes are either merged back into the target or thrown away together
+ * with the scratch area.
+ */
+
+#define BBOX_OVERLAY_OPAQUE_XATTR "trusted.overlay.opaque"
+#define BBOX_OVERLAY_TMP_NAME ".bbox-commit"
+#define BBOX_OVERLAY_BUF_SIZE 65536
+
+static pid_t overlay_pid = 0;
+
+static void bbox_overlay_forward_signal(int sig)
+{
+    if(overlay_pid > 0)
+        kill(overlay_pid, sig);
+}
+
+/*
+ * Removes `name` below the directory `dir_fd`, including everything it
+ * contains. Symbolic links are never followed.
+ */
+int bbox_overlay_remove_at(int dir_fd, const char *name)
+{
+    struct dirent *entry = NULL;
+    DIR *dir = NULL;
+    int fd = -1;
+
+    if(unlinkat(dir_fd, name, 0) == 0 || errno == ENOENT)
+        return 0;
+    if(errno != EISDIR)
+        goto failure;
+
+    fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+            O_CLOEXEC);
+
+    if(fd == -1)
+        goto failure;
+
+    /*
+     * Directories that were copied up read-only have to be made writable
+     * before they can be emptied. This may fail, if they aren't ours, and
+     * then emptying them fails with a better message.
+     */
+    (void) fchmod(fd, 0700);
+
+    if(!(dir = fdopendir(fd))) {
+        close(fd);
+        goto failure;
+    }
+
+    while((entry = readdir(dir))) {
+        if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+
+        if(bbox_overlay_remove_at(dirfd(dir), entry->d_name) == -1) {
+            closedir(dir);
+            return -1;
+        }
+    }
+
+    closedir(dir);
+
+    if(unlinkat(dir_fd, name, AT_REMOVEDIR) == 0)
+        return 0;
+
+failure:
+
+    bbox_perror("overlay", "failed to remove '%s': %s.\n", name,
+            strerror(errno));
+    return -1;
+}
+
+/*
+ * Returns 1 if the given directory of the upper layer hides the contents of
+ * the lower one. The attribute is only visible to root.
+ */
+static int bbox_overlay_is_opaque(int fd)
+{
+    char value = '\0';
+
+    if(bbox_raise_privileges() == -1)
+        return -1;
+
+    ssize_t rval = fgetxattr(fd, BBOX_OVERLAY_OPAQUE_XATTR, &value, 1);
+
+    if(bbox_lower_privileges() == -1)
+        return -1;
+
+    return rval == 1 && value == 'y' ? 1 : 0;
+}
+
+static int bbox_overlay_copy_data(int src_fd, int dst_fd)
+{
+    char buf[BBOX_OVERLAY_BUF_SIZE];
+    size_t num_copied = 0;
+    ssize_t num_read;
+
+    /*
+     * Let the kernel do it, or even share the blocks, where possible.
+     */
+    while((num_read = copy_file_range(src_fd, NULL, dst_fd, NULL,
+                    SSIZE_MAX, 0)) > 0)
+    {
+        num_copied += num_read;
+    }
+
+    if(num_read == 0)
+        return 0;
+    if(num_copied > 0 || (errno != EXDEV && errno != ENOSYS &&
+                errno != EINVAL && errno != EOPNOTSUPP))
+    {
+        return -1;
+    }
+
+    while((num_read = read(src_fd, buf, sizeof(buf))) > 0) {
+        for(ssize_t offset = 0; offset < num_read; ) {
+            ssize_t num_written = write(dst_fd, buf + offset,
+                    num_read - offset);
+
+            if(num_written == -1)
+                return -1;
+
+            offset += num_written;
+        }
+    }
+
+    return num_read == -1 ? -1 : 0;
+}
+
+/*
+ * Copies a file, symbolic link or fifo from the upper into the lower layer.
+ * It is created under a temporary name and then renamed into place, so that
+ * the target never contains a partial file.
+ */
+static int bbox_overlay_copy_entry(int upper_fd, int lower_fd,
+        const char *name, const struct stat *st)
+{
+    char link_buf[PATH_MAX];
+    int src_fd = -1;
+    int dst_fd = -1;
+    int rval = -1;
+
+    const struct timespec times[2] = { st->st_atim, st->st_mtim };
+
+    unlinkat(lower_fd, BBOX_OVERLAY_TMP_NAME, 0);
+
+    if(S_ISREG(st->st_mode)) {
+        src_fd = openat(upper_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+
+        if(src_fd == -1)
+            goto cleanup_and_exit;
+
+        dst_fd = openat(lower_fd, BBOX_OVERLAY_TMP_NAME,
+                O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+
+        if(dst_fd == -1)
+            goto cleanup_and_exit;
+
+        if(bbox_overlay_copy_data(src_fd, dst_fd) == -1 ||
+                fchmod(dst_fd, st->st_mode & 07777) == -1 ||
+                futimens(dst_fd, times) == -1)
+        {
+            goto cleanup_and_exit;
+        }
+    } else if(S_ISLNK(st->st_mode)) {
+        ssize_t len = readlinkat(upper_fd, name, link_buf,
+                sizeof(link_buf) - 1);
+
+        if(len == -1)
+            goto cleanup_and_exit;
+
+        link_buf[len] = '\0';
+
+        if(symlinkat(link_buf, lower_fd, BBOX_OVERLAY_TMP_NAME) == -1)
+            goto cleanup_and_exit;
+
+        utimensat(lower_fd, BBOX_OVERLAY_TMP_NAME, times,
+                AT_SYMLINK_NOFOLLOW);
+    } else if(S_ISFIFO(st->st_mode)) {
+        if(mkfifoat(lower_fd, BBOX_OVERLAY_TMP_NAME,
+                    st->st_mode & 07777) == -1)
+        {
+            goto cleanup_and_exit;
+        }
+    } else {
+        /*
+         * Sockets don't survive the command anyway, and device nodes can't
+         * be created by the user.
+         */
+        return 0;
+    }
+
+    if(renameat(lower_fd, BBOX_OVERLAY_TMP_NAME, lower_fd, name) == -1)
+        goto cleanup_and_exit;
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    if(rval == -1) {
+        bbox_perror("overlay", "failed to copy '%s': %s.\n", name,
+                strerror(errno));
+        unlinkat(lower_fd, BBOX_OVERLAY_TMP_NAME, 0);
+    }
+
+    if(src_fd != -1)
+        close(src_fd);
+    if(dst_fd != -1)
+        close(dst_fd);
+    return rval;
+}
+
+static int bbox_overlay_merge_dir(int upper_fd, int lower_fd, int same_fs);
+
+/*
+ * Merges the directory `name` of the upper layer into the lower one. If the
+ * lower layer has nothing by that name, the whole tree is moved over in one
+ * go, where possible.
+ */
+static int bbox_overlay_merge_subdir(int upper_fd, int lower_fd,
+        const char *name, const struct stat *st, int has_lower, int same_fs)
+{
+    int upper_sub_fd = -1;
+    int lower_sub_fd = -1;
+    int rval = -1;
+
+    const struct timespec times[2] = { st->st_atim, st->st_mtim };
+
+    upper_sub_fd = openat(upper_fd, name, O_RDONLY | O_DIRECTORY |
+            O_NOFOLLOW | O_CLOEXEC);
+
+    if(upper_sub_fd == -1)
+        goto failure;
+
+    if(has_lower) {
+        int is_opaque = bbox_overlay_is_opaque(upper_sub_fd);
+
+        if(is_opaque == -1)
+            goto cleanup_and_exit;
+
+        if(is_opaque) {
+            if(bbox_overlay_remove_at(lower_fd, name) == -1)
+                goto cleanup_and_exit;
+            has_lower = 0;
+        }
+    }
+
+    if(!has_lower) {
+        if(same_fs && renameat(upper_fd, name, lower_fd, name) == 0) {
+            rval = 0;
+            goto cleanup_and_exit;
+        }
+
+        if(mkdirat(lower_fd, name, 0700) == -1)
+            goto failure;
+    }
+
+    lower_sub_fd = openat(lower_fd, name, O_RDONLY | O_DIRECTORY |
+            O_NOFOLLOW | O_CLOEXEC);
+
+    if(lower_sub_fd == -1)
+        goto failure;
+
+    /*
+     * Both sides must be writable for the merge. The final permissions are
+     * applied afterwards.
+     */
+    if(fchmod(upper_sub_fd, st->st_mode | 0700) == -1 ||
+            fchmod(lower_sub_fd, st->st_mode | 0700) == -1)
+    {
+        goto failure;
+    }
+
+    if(bbox_overlay_merge_dir(upper_sub_fd, lower_sub_fd, same_fs) == -1)
+        goto cleanup_and_exit;
+
+    if(fchmod(lower_sub_fd, st->st_mode & 07777) == -1 ||
+            futimens(lower_sub_fd, times) == -1)
+    {
+        goto failure;
+    }
+
+    rval = 0;
+    goto cleanup_and_exit;
+
+failure:
+
+    bbox_perror("overlay", "failed to merge directory '%s': %s.\n", name,
+            strerror(errno));
+
+cleanup_and_exit:
+
+    if(upper_sub_fd != -1)
+        close(upper_sub_fd);
+    if(lower_sub_fd != -1)
+        close(lower_sub_fd);
+    return rval;
+}
+
+/*
+ * Applies the contents of a directory of the upper layer to the matching
+ * directory of the lower one. Whiteouts delete, opaque directories replace
+ * and everything else is moved or copied over. If both layers are on the same
+ * file system, files are simply renamed.
+ */
+static int bbox_overlay_merge_dir(int upper_fd, int lower_fd, int same_fs)
+{
+    struct dirent *entry = NULL;
+    DIR *dir = NULL;
+    int fd = -1;
+    int rval = -1;
+
+    if((fd = dup(upper_fd)) == -1 || !(dir = fdopendir(fd))) {
+        bbox_perror("overlay", "failed to read directory: %s.\n",
+                strerror(errno));
+        if(fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    while((entry = readdir(dir))) {
+        const char *name = entry->d_name;
+        struct stat st, lower_st;
+
+        if(!strcmp(name, ".") || !strcmp(name, ".."))
+            continue;
+
+        if(fstatat(upper_fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            bbox_perror("overlay", "could not stat '%s': %s.\n", name,
+                    strerror(errno));
+            goto cleanup_and_exit;
+        }
+
+        int has_lower = fstatat(lower_fd, name, &lower_st,
+                AT_SYMLINK_NOFOLLOW) == 0;
+
+        /*
+         * A whiteout hides the entry of the lower layer.
+         */
+        if(S_ISCHR(st.st_mode) && st.st_rdev == makedev(0, 0)) {
+            if(has_lower && bbox_overlay_remove_at(lower_fd, name) == -1)
+                goto cleanup_and_exit;
+            continue;
+        }
+
+        /*
+         * Replacing something with something of a different kind means
+         * removing the old thing first.
+         */
+        if(has_lower && (S_ISDIR(st.st_mode) != S_ISDIR(lower_st.st_mode))) {
+            if(bbox_overlay_remove_at(lower_fd, name) == -1)
+                goto cleanup_and_exit;
+            has_lower = 0;
+        }
+
+        if(S_ISDIR(st.st_mode)) {
+            if(bbox_overlay_merge_subdir(upper_fd, lower_fd, name, &st,
+                        has_lower, same_fs) == -1)
+            {
+                goto cleanup_and_exit;
+            }
+            continue;
+        }
+
+        if(same_fs && renameat(upper_fd, name, lower_fd, name) == 0)
+            continue;
+
+        if(bbox_overlay_copy_entry(upper_fd, lower_fd, name, &st) == -1)
+            goto cleanup_and_exit;
+    }
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    closedir(dir);
+    return rval;
+}
+
+static int bbox_overlay_commit(const char *sys_root, const char *upper_dir)
+{
+    int upper_fd = -1;
+    int lower_fd = -1;
+    int rval = -1;
+    struct stat upper_st, lower_st;
+
+    upper_fd = open(upper_dir, O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+            O_CLOEXEC);
+    lower_fd = open(sys_root, O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+            O_CLOEXEC);
+
+    if(upper_fd == -1 || lower_fd == -1 || fstat(upper_fd, &upper_st) == -1
+            || fstat(lower_fd, &lower_st) == -1)
+    {
+        bbox_perror("overlay", "failed to open layers: %s.\n",
+                strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    rval = bbox_overlay_merge_dir(upper_fd, lower_fd,
+            upper_st.st_dev == lower_st.st_dev);
+
+cleanup_and_exit:
+
+    if(upper_fd != -1)
+        close(upper_fd);
+    if(lower_fd != -1)
+        close(lower_fd);
+    return rval;
+}
+
+/*
+ * Creates a fresh scratch area for the layers below <user dir>/overlays and
+ * returns its path. The caller has to free the result.
+ */
+static char *bbox_overlay_create_area(const char *sys_root)
+{
+    char *user_dir = NULL;
+    char *area = NULL;
+    size_t user_dir_len = 0;
+    const char *target = strrchr(sys_root, '/');
+
+    target = target ? target + 1 : sys_root;
+
+    if(!(user_dir = bbox_get_user_dir(getuid(), &user_dir_len)))
+        return NULL;
+
+    bbox_path_join(&user_dir, user_dir, "overlays", &user_dir_len);
+
+    if(mkdir(user_dir, 0755) == -1 && errno != EEXIST) {
+        bbox_perror("overlay", "failed to create '%s': %s.\n", user_dir,
+                strerror(errno));
+        goto failure;
+    }
+
+    if(asprintf(&area, "%s/%s.XXXXXX", user_dir, target) == -1) {
+        area = NULL;
+        bbox_perror("overlay", "out of memory?\n");
+        goto failure;
+    }
+
+    if(!mkdtemp(area)) {
+        bbox_perror("overlay", "failed to create '%s': %s.\n", area,
+                strerror(errno));
+        goto failure;
+    }
+
+    free(user_dir);
+    return area;
+
+failure:
+
+    free(user_dir);
+    free(area);
+    return NULL;
+}
+
+static void bbox_overlay_remove_area(const char *area, int is_tmpfs)
+{
+    char *parent = NULL;
+    const char *name = NULL;
+    int parent_fd = -1;
+
+    if(is_tmpfs) {
+        if(bbox_raise_privileges() == -1)
+            return;
+
+        umount2(area, MNT_DETACH);
+
+        if(bbox_lower_privileges() == -1)
+            return;
+    }
+
+    if(!(parent = strdup(area))) {
+        bbox_perror("overlay", "out of memory?\n");
+        return;
+    }
+
+    *strrchr(parent, '/') = '\0';
+    name = strrchr(area, '/') + 1;
+
+    parent_fd = open(parent, O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+            O_CLOEXEC);
+
+    if(parent_fd == -1) {
+        bbox_perror("overlay", "failed to open '%s': %s.\n", parent,
+                strerror(errno));
+        free(parent);
+        return;
+    }
+
+    /*
+     * The overlay leaves root-owned entries behind in its work directory,
+     * which only root can clean up. Everything is accessed relative to
+     * directories opened without following symbolic links, so this can't be
+     * redirected elsewhere.
+     */
+    int area_fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY |
+            O_NOFOLLOW | O_CLOEXEC);
+
+    if(area_fd != -1) {
+        if(bbox_raise_privileges() == 0) {
+            bbox_overlay_remove_at(area_fd, "work");
+            bbox_lower_privileges();
+        }
+        close(area_fd);
+    }
+
+    if(bbox_overlay_remove_at(parent_fd, name) == -1)
+        bbox_perror("overlay", "changes were left behind in '%s'.\n", area);
+
+    close(parent_fd);
+    free(parent);
+}
+
+/*
+ * Prepares the scratch area, mounts the overlay over the target and forks.
+ * Returns 0 in the child, which continues in the private mount namespace,
+ * and 1 in the parent, once the command has finished and the changes have
+ * been dealt with. The exit status of the command is passed back in
+ * `status_ptr`.
+ */
+int bbox_overlay_supervise(bbox_conf_t *conf, const char *sys_root,
+        int *status_ptr)
+{
+    bbox_mount_plan_t plan = { .num_reqs = 0 };
+    bbox_mtab_t *mtab = NULL;
+    char *area = NULL;
+    char *upper_dir = NULL;
+    char *work_dir = NULL;
+    size_t upper_len = 0;
+    size_t work_len = 0;
+    int is_tmpfs = bbox_config_get_overlay_tmpfs(conf) ? 1 : 0;
+    int is_mounted = 0;
+    int lease_fd = -1;
+    int rval = -1;
+
+    if(bbox_isdir_and_owned_by("overlay", sys_root, getuid()) == -1)
+        return -1;
+
+    /*
+     * Keep the target from being torn down while we use it as a layer.
+     */
+    if((lease_fd = bbox_lease_acquire("overlay", sys_root, 0)) == -1)
+        return -1;
+
+    if(!(area = bbox_overlay_create_area(sys_root)))
+        goto cleanup_and_exit;
+
+    /*
+     * The tmpfs ends up in a namespace of its own, where nobody else can see
+     * it. So it is charged to the ledger up front, and it gets the same size
+     * as any scratch mount.
+     */
+    unsigned long long tmpfs_size =
+        bbox_get_phys_mem() / 100 * BBOX_TMPFS_DEFAULT_PERCENT;
+
+    if(is_tmpfs && tmpfs_size == 0) {
+        bbox_perror("overlay", "could not determine size of physical "
+                "memory.\n");
+        goto cleanup_and_exit;
+    }
+
+    if(bbox_mount_unshare("overlay") == -1)
+        goto cleanup_and_exit;
+
+    if(is_tmpfs && bbox_mount_check_tmpfs_quota(tmpfs_size, 1) == -1)
+        goto cleanup_and_exit;
+
+    if(is_tmpfs) {
+        char *data = NULL;
+
+        if(!(data = bbox_mount_tmpfs_data(tmpfs_size, 0)))
+            goto cleanup_and_exit;
+
+        if(bbox_raise_privileges() == -1) {
+            free(data);
+            goto cleanup_and_exit;
+        }
+
+        if(mount(bbox_mount_tmpfs_source(), area, "tmpfs",
+                    MS_NOSUID | MS_NODEV, data) == -1)
+        {
+            bbox_perror("overlay", "failed to mount tmpfs on '%s': %s.\n",
+                    area, strerror(errno));
+            free(data);
+            bbox_lower_privileges();
+            goto cleanup_and_exit;
+        }
+
+        free(data);
+
+        if(bbox_lower_privileges() == -1)
+            goto cleanup_and_exit;
+    }
+
+    bbox_path_join(&upper_dir, area, "upper", &upper_len);
+    bbox_path_join(&work_dir, area, "work", &work_len);
+
+    if(mkdir(upper_dir, 0755) == -1 || mkdir(work_dir, 0755) == -1) {
+        bbox_perror("overlay", "failed to create layers in '%s': %s.\n",
+                area, strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    if(!(mtab = bbox_mtab_load()))
+        goto cleanup_and_exit;
+
+    if(bbox_mount_plan_overlay(&plan, sys_root, sys_root, upper_dir,
+                work_dir) == -1)
+    {
+        goto cleanup_and_exit;
+    }
+
+    if(bbox_mount_plan_execute(&plan, mtab) == -1)
+        goto cleanup_and_exit;
+
+    is_mounted = 1;
+
+    /*
+     * Everything else happens inside of the namespace and on top of the
+     * overlay, without any coordination with other users of the target.
+     */
+    bbox_config_set_private_mounts(conf);
+
+    pid_t pid = fork();
+
+    if(pid == -1) {
+        bbox_perror("overlay", "fork failed: %s\n", strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    if(pid == 0) {
+        close(lease_fd);
+        bbox_mount_plan_clear(&plan);
+        bbox_mtab_free(mtab);
+        free(upper_dir);
+        free(work_dir);
+        free(area);
+        return 0;
+    }
+
+    overlay_pid = pid;
+
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTERM, bbox_overlay_forward_signal);
+    signal(SIGHUP, bbox_overlay_forward_signal);
+
+    int wstatus = 0;
+
+    while(waitpid(pid, &wstatus, 0) == -1) {
+        if(errno != EINTR)
+            break;
+    }
+
+    *status_ptr = BBOX_ERR_RUNTIME;
+
+    if(WIFEXITED(wstatus))
+        *status_ptr = WEXITSTATUS(wstatus);
+
+    rval = 1;
+
+cleanup_and_exit:
+
+    /*
+     * Take the overlay down with everything that was mounted on top of it.
+     * After that, the target is visible again at its usual location.
+     */
+    if(is_mounted && bbox_raise_privileges() == 0) {
+        if(umount2(sys_root, MNT_DETACH) == -1) {
+            bbox_perror("overlay", "failed to unmount overlay: %s.\n",
+                    strerror(errno));
+            is_mounted = -1;
+        }
+
+        if(bbox_lower_privileges() == -1)
+            is_mounted = -1;
+    }
+
+    /*
+     * Only a command that succeeded gets its changes merged.
+     */
+    if(rval == 1 && is_mounted == 1 && *status_ptr == 0 &&
+            bbox_config_get_overlay_commit(conf))
+    {
+        if(bbox_overlay_commit(sys_root, upper_dir) == -1) {
+            bbox_perror("overlay", "changes were only partly merged into "
+                    "the target.\n");
+            *status_ptr = BBOX_ERR_RUNTIME;
+        }
+    }
+
+    if(area && is_mounted != -1)
+        bbox_overlay_remove_area(area, is_tmpfs);
+
+    bbox_mount_plan_clear(&plan);
+    bbox_mtab_free(mtab);
+    free(upper_dir);
+    free(work_dir);
+    free(area);
+    close(lease_fd);
+    return rval;
+}
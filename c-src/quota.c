@@ -0,0 +1,618 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/fs.h>
+#include <linux/quota.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bbox-do.h"
+
+/*
+ * Each target gets a project id of its own, so that the file system keeps
+ * track of the space it uses. Reading that back is a single quotactl() call,
+ * no matter how large the target is. The id is the inode number of the target
+ * directory, which is unique on the file system for as long as the directory
+ * exists. The layer directory of a layered target shares the id.
+ *
+ * Accounting requires project quotas to be enabled on the file system. Where
+ * they aren't, usage is reported as unknown and it is up to the caller to
+ * find out some other way.
+ *
+ * Setting a limit takes privileges, and project ids are shared with whatever
+ * an administrator set up on the same file system. So limits are only set up
+ * to the maximum an administrator put into BBOX_QUOTA_MAX_FILE, never on a
+ * project that is in use by others and never above a limit that is in place
+ * already.
+ */
+
+#define BBOX_QUOTA_MAX_FILE BBOX_VAR_LIB"/quota-max"
+
+void bbox_quota_usage()
+{
+    printf(
+        "                                                                          \n"
+        "USAGE:                                                                    \n"
+        "                                                                          \n"
+        "  build-box quota [OPTIONS] <target-name> ...                             \n"
+        "                                                                          \n"
+        "OPTIONS:                                                                  \n"
+        "                                                                          \n"
+        "  -h, --help             Print this help message and exit immediately.    \n"
+        "                                                                          \n"
+        "  -a, --assign           Give the targets a project id of their own, so   \n"
+        "                         that the file system accounts the space they     \n"
+        "                         use.                                             \n"
+        "                                                                          \n"
+        "  -l, --limit <size>     Don't let the targets grow beyond <size> bytes.  \n"
+        "                         The suffixes K, M, G and T are understood.       \n"
+        "                         Implies --assign. Limits can only be lowered and \n"
+        "                         not beyond the maximum an administrator put into \n"
+        "                         /var/lib/build-box/quota-max.                    \n"
+        "                                                                          \n"
+        "Without options, print the space and number of inodes each target uses    \n"
+        "and its limit, or '-' where the file system doesn't keep track.           \n"
+        "                                                                          \n"
+    );
+}
+
+int bbox_quota_getopt(bbox_conf_t *conf, int argc, char * const argv[])
+{
+    int c;
+    int option_index = 0;
+
+    static struct option long_options[] = {
+        {"help",     no_argument,       0, 'h'},
+        {"targets",  required_argument, 0, 't'},
+        {"assign",   no_argument,       0, 'a'},
+        {"limit",    required_argument, 0, 'l'},
+        { 0,         0,                 0,  0 }
+    };
+
+    optind = 1;
+
+    while(1) {
+        c = getopt_long(argc, argv, ":ht:al:", long_options, &option_index);
+
+        if(c == -1)
+            break;
+
+        switch(c) {
+            case 'h':
+                bbox_quota_usage();
+                return -1;
+            case 't':
+                if(bbox_config_set_target_dir(conf, optarg) < 0)
+                    return -2;
+                break;
+            case 'a':
+                bbox_config_set_quota_assign(conf);
+                break;
+            case 'l':
+                if(bbox_config_set_quota_limit(conf, optarg) == -1)
+                    return -2;
+                break;
+            case '?':
+            case ':':
+                bbox_quota_usage();
+                return -2;
+            default:
+                /* impossible, ignore */
+                break;
+        }
+    }
+
+    return optind;
+}
+
+static int bbox_sys_quotactl_fd(int fd, unsigned int cmd, int id, void *addr)
+{
+#ifdef SYS_quotactl_fd
+    return syscall(SYS_quotactl_fd, fd, cmd, id, addr);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int bbox_quota_get_projid(int fd, uint32_t *projid)
+{
+    struct fsxattr fsx;
+
+    if(ioctl(fd, FS_IOC_FSGETXATTR, &fsx) == -1)
+        return -1;
+
+    *projid = fsx.fsx_projid;
+    return 0;
+}
+
+/*
+ * The owner of a file may change its project id, no privileges needed.
+ */
+static int bbox_quota_set_projid(int fd, uint32_t projid, int is_dir)
+{
+    struct fsxattr fsx;
+
+    if(ioctl(fd, FS_IOC_FSGETXATTR, &fsx) == -1)
+        return -1;
+
+    if(fsx.fsx_projid == projid &&
+            (!is_dir || (fsx.fsx_xflags & FS_XFLAG_PROJINHERIT)))
+    {
+        return 0;
+    }
+
+    fsx.fsx_projid = projid;
+    if(is_dir)
+        fsx.fsx_xflags |= FS_XFLAG_PROJINHERIT;
+
+    return ioctl(fd, FS_IOC_FSSETXATTR, &fsx);
+}
+
+/*
+ * Puts everything below the directory `fd` into the project. New files
+ * inherit the id from their directory, so this only matters for targets that
+ * already have contents. Files that can't be changed are left as they are,
+ * and so are files with more than one link, which may belong to a different
+ * target, too.
+ */
+static void bbox_quota_assign_tree(int fd, uint32_t projid, dev_t dev)
+{
+    struct dirent *entry = NULL;
+    struct stat st;
+    DIR *dir = NULL;
+    int dir_fd;
+
+    if((dir_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) == -1)
+        return;
+
+    if(!(dir = fdopendir(dir_fd))) {
+        close(dir_fd);
+        return;
+    }
+
+    while((entry = readdir(dir))) {
+        if(!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+
+        if(fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+            continue;
+
+        /*
+         * Mounts aren't part of the target.
+         */
+        if(st.st_dev != dev)
+            continue;
+
+        int is_dir = S_ISDIR(st.st_mode);
+
+        if(!is_dir && !(S_ISREG(st.st_mode) && st.st_nlink == 1))
+            continue;
+
+        int sub_fd = openat(fd, entry->d_name, O_RDONLY | O_NOFOLLOW |
+                O_NOCTTY | O_NONBLOCK | O_CLOEXEC |
+                (is_dir ? O_DIRECTORY : 0));
+
+        if(sub_fd == -1)
+            continue;
+
+        if(bbox_quota_set_projid(sub_fd, projid, is_dir) == 0 && is_dir)
+            bbox_quota_assign_tree(sub_fd, projid, dev);
+
+        close(sub_fd);
+    }
+
+    closedir(dir);
+}
+
+/*
+ * Gives the directory `path` and everything in it the project id `projid`.
+ */
+static int bbox_quota_assign_dir(const char *path, uint32_t projid)
+{
+    struct stat st;
+    int rval = -1;
+    int fd;
+
+    if((fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+                    O_CLOEXEC)) == -1)
+    {
+        bbox_perror("quota", "failed to open '%s': %s.\n", path,
+                strerror(errno));
+        return -1;
+    }
+
+    if(fstat(fd, &st) == -1) {
+        bbox_perror("quota", "could not stat '%s': %s.\n", path,
+                strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    if(bbox_quota_set_projid(fd, projid, 1) == -1) {
+        bbox_perror("quota", "failed to set project id on '%s': %s.\n",
+                path, strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    bbox_quota_assign_tree(fd, projid, st.st_dev);
+    rval = 0;
+
+cleanup_and_exit:
+
+    close(fd);
+    return rval;
+}
+
+/*
+ * Reads the largest limit users may set from BBOX_QUOTA_MAX_FILE. Without
+ * that file, users can't set limits at all.
+ */
+static int bbox_quota_get_max(unsigned long long *max_ptr)
+{
+    char buf[64];
+    ssize_t nbytes;
+    int rval = -1;
+
+    int fd = open(BBOX_QUOTA_MAX_FILE, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+
+    if(fd == -1) {
+        if(errno == ENOENT) {
+            bbox_perror("quota", "size limits are not enabled, an "
+                    "administrator has to put the maximum into %s.\n",
+                    BBOX_QUOTA_MAX_FILE);
+        } else {
+            bbox_perror("quota", "failed to open '%s': %s.\n",
+                    BBOX_QUOTA_MAX_FILE, strerror(errno));
+        }
+        return -1;
+    }
+
+    if(bbox_is_admin_owned("quota", fd, BBOX_QUOTA_MAX_FILE) == -1)
+        goto cleanup_and_exit;
+
+    if((nbytes = read(fd, buf, sizeof(buf) - 1)) == -1) {
+        bbox_perror("quota", "failed to read '%s': %s.\n",
+                BBOX_QUOTA_MAX_FILE, strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    buf[nbytes] = '\0';
+    buf[strcspn(buf, " \t\n")] = '\0';
+
+    if(strchr(buf, '%') || bbox_parse_size("quota", buf, max_ptr) == -1) {
+        bbox_perror("quota", "invalid maximum in '%s'.\n",
+                BBOX_QUOTA_MAX_FILE);
+        goto cleanup_and_exit;
+    }
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    close(fd);
+    return rval;
+}
+
+/*
+ * Looks up the quota of the project. Returns -1 if the file system doesn't
+ * tell, with errno set, and -2 if privileges couldn't be changed.
+ */
+static int bbox_quota_get(int fd, uint32_t projid, struct if_dqblk *dqblk)
+{
+    memset(dqblk, 0, sizeof(*dqblk));
+
+    if(bbox_raise_privileges() == -1)
+        return -2;
+
+    int rval = bbox_sys_quotactl_fd(fd, QCMD(Q_GETQUOTA, PRJQUOTA), projid,
+            dqblk);
+
+    int saved_errno = errno;
+
+    if(bbox_lower_privileges() == -1)
+        return -2;
+
+    errno = saved_errno;
+    return rval;
+}
+
+/*
+ * Checks the requested limit against the administrator's maximum and against
+ * what is known about the project already. `is_assigned` tells whether the
+ * target carried the project id before.
+ */
+static int bbox_quota_check_limit(int fd, uint32_t projid, int is_assigned,
+        unsigned long long limit, const char *target)
+{
+    struct if_dqblk dqblk;
+    unsigned long long max = 0;
+
+    if(bbox_quota_get_max(&max) == -1)
+        return -1;
+
+    if(limit > max) {
+        bbox_perror("quota", "limit of %llu bytes exceeds the maximum of "
+                "%llu bytes.\n", limit, max);
+        return -1;
+    }
+
+    switch(bbox_quota_get(fd, projid, &dqblk)) {
+        case 0:
+            break;
+        case -1:
+            bbox_perror("quota", "failed to look up project of target "
+                    "'%s': %s.\n", target, strerror(errno));
+            /* fall through */
+        default:
+            return -1;
+    }
+
+    if(!is_assigned && (dqblk.dqb_curspace || dqblk.dqb_curinodes)) {
+        bbox_perror("quota", "project id %lu is in use already.\n",
+                (unsigned long) projid);
+        return -1;
+    }
+
+    unsigned long long old_limit =
+        (unsigned long long) dqblk.dqb_bhardlimit << QIF_DQBLKSIZE_BITS;
+
+    if(is_assigned && old_limit && limit > old_limit) {
+        bbox_perror("quota", "target '%s' is limited to %llu bytes, which "
+                "can't be raised.\n", target, old_limit);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int bbox_quota_set_limit(int fd, uint32_t projid,
+        unsigned long long limit)
+{
+    struct if_dqblk dqblk;
+    int rval = -1;
+
+    memset(&dqblk, 0, sizeof(dqblk));
+
+    /*
+     * Limits are counted in quota blocks.
+     */
+    dqblk.dqb_bhardlimit = (limit + QIF_DQBLKSIZE - 1) >> QIF_DQBLKSIZE_BITS;
+    dqblk.dqb_valid = QIF_BLIMITS;
+
+    if(bbox_raise_privileges() == -1)
+        return -1;
+
+    rval = bbox_sys_quotactl_fd(fd, QCMD(Q_SETQUOTA, PRJQUOTA), projid,
+            &dqblk);
+
+    int saved_errno = errno;
+
+    if(bbox_lower_privileges() == -1)
+        return -1;
+
+    errno = saved_errno;
+    return rval;
+}
+
+/*
+ * Sets up the project of the given target and, optionally, its limit.
+ */
+static int bbox_quota_assign(const bbox_conf_t *conf, const char *sys_root,
+        const char *target)
+{
+    char *real_root = NULL;
+    char *layer_dir = NULL;
+    struct stat st;
+    int rval = -1;
+    int fd = -1;
+
+    if(!(real_root = realpath(sys_root, NULL))) {
+        bbox_perror("quota", "unable to normalize path %s: %s.\n",
+                sys_root, strerror(errno));
+        return -1;
+    }
+
+    if((fd = open(real_root, O_RDONLY | O_DIRECTORY | O_NOFOLLOW |
+                    O_CLOEXEC)) == -1 || fstat(fd, &st) == -1)
+    {
+        bbox_perror("quota", "failed to open '%s': %s.\n", real_root,
+                strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    /*
+     * Project ids are 32 bits wide.
+     */
+    uint32_t projid = (uint32_t) st.st_ino;
+
+    if(projid == 0 || projid != st.st_ino) {
+        bbox_perror("quota", "no project id for target '%s'.\n", target);
+        goto cleanup_and_exit;
+    }
+
+    unsigned long long limit = bbox_config_get_quota_limit(conf);
+    uint32_t old_projid = 0;
+
+    if(limit) {
+        int is_assigned = bbox_quota_get_projid(fd, &old_projid) == 0 &&
+            old_projid == projid;
+
+        if(bbox_quota_check_limit(fd, projid, is_assigned, limit,
+                    target) == -1)
+        {
+            goto cleanup_and_exit;
+        }
+    }
+
+    if(bbox_quota_assign_dir(real_root, projid) == -1)
+        goto cleanup_and_exit;
+
+    if((layer_dir = bbox_layer_find_dir(real_root)) &&
+            bbox_quota_assign_dir(layer_dir, projid) == -1)
+    {
+        goto cleanup_and_exit;
+    }
+
+    if(limit && bbox_quota_set_limit(fd, projid, limit) == -1) {
+        bbox_perror("quota", "failed to set limit on target '%s': %s.\n",
+                target, strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    if(fd >= 0)
+        close(fd);
+    free(layer_dir);
+    free(real_root);
+    return rval;
+}
+
+/*
+ * Prints a line of the form "<target> <bytes> <inodes> <limit>". A limit of
+ * zero means there is none.
+ */
+static int bbox_quota_report(const char *sys_root, const char *target)
+{
+    struct if_dqblk dqblk;
+    struct stat st;
+    uint32_t projid = 0;
+    int rc = -1;
+    int fd;
+
+    if((fd = open(sys_root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1 ||
+            fstat(fd, &st) == -1)
+    {
+        bbox_perror("quota", "failed to open '%s': %s.\n", sys_root,
+                strerror(errno));
+        if(fd != -1)
+            close(fd);
+        return -1;
+    }
+
+    memset(&dqblk, 0, sizeof(dqblk));
+
+    /*
+     * The owner can put any project id on the directory. Only look up the
+     * one that belongs to the target.
+     */
+    if(bbox_quota_get_projid(fd, &projid) == 0 && projid != 0 &&
+            projid == st.st_ino)
+    {
+        if((rc = bbox_quota_get(fd, projid, &dqblk)) == -2) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    close(fd);
+
+    if(rc == -1 || !(dqblk.dqb_valid & QIF_USAGE)) {
+        printf("%s - - -\n", target);
+        return 0;
+    }
+
+    printf("%s %llu %llu %llu\n", target,
+            (unsigned long long) dqblk.dqb_curspace,
+            (unsigned long long) dqblk.dqb_curinodes,
+            (unsigned long long) dqblk.dqb_bhardlimit << QIF_DQBLKSIZE_BITS);
+    return 0;
+}
+
+int bbox_quota(int argc, char * const argv[])
+{
+    char *buf = NULL;
+    size_t buf_len = 0;
+
+    int rval = BBOX_ERR_INVOCATION;
+
+    bbox_conf_t *conf = bbox_config_new();
+    if(!conf) {
+        bbox_perror("quota", "creating configuration context failed.\n");
+        return BBOX_ERR_RUNTIME;
+    }
+
+    int non_optind;
+
+    if((non_optind = bbox_quota_getopt(conf, argc, argv)) < 0) {
+        /* user asked for --help */
+        if(non_optind == -1)
+            rval = 0;
+        goto cleanup_and_exit;
+    }
+
+    if(non_optind >= argc) {
+        bbox_perror("quota", "no target specified.\n");
+        goto cleanup_and_exit;
+    }
+
+    for(int i = non_optind; i < argc; i++) {
+        if(validate_target_name("quota", argv[i]) == -1)
+            goto cleanup_and_exit;
+    }
+
+    rval = BBOX_ERR_RUNTIME;
+
+    for(int i = non_optind; i < argc; i++) {
+        const char *target = argv[i];
+
+        bbox_path_join(
+            &buf, bbox_config_get_target_dir(conf), target, &buf_len
+        );
+
+        if(bbox_isdir_and_owned_by("quota", buf, getuid()) == -1)
+            goto cleanup_and_exit;
+
+        if(bbox_config_get_quota_assign(conf)) {
+            if(bbox_quota_assign(conf, buf, target) == -1)
+                goto cleanup_and_exit;
+        } else if(bbox_quota_report(buf, target) == -1) {
+            goto cleanup_and_exit;
+        }
+    }
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    bbox_config_free(conf);
+    free(buf);
+    return rval;
+}
@@ -0,0 +1,727 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bbox-do.h"
+
+#define BBOX_SESSION_SUFFIX ".session"
+
+/*
+ * A session keeps a target mounted inside a mount namespace of its own. The
+ * namespace is pinned by a keeper process, which does nothing but wait for
+ * the session to be stopped. Commands running in the session enter the
+ * keeper's namespace with setns(), where everything has already been set up.
+ *
+ * Sessions are registered in a root-owned directory below BBOX_RUN_DIR, so
+ * that users can't point build-box at the namespace of an arbitrary process.
+ * A record holds the pid and start time of the keeper, which guards against
+ * pids being reused after the keeper is gone.
+ */
+
+void bbox_session_usage()
+{
+    printf(
+        "                                                                         \n"
+        "USAGE:                                                                   \n"
+        "                                                                         \n"
+        "  build-box session start [OPTIONS] <target-name>                        \n"
+        "  build-box session stop <target-name>                                   \n"
+        "  build-box session list                                                 \n"
+        "                                                                         \n"
+        "Set up a target once and keep it mounted in a mount namespace of its     \n"
+        "own. While the session is active, `run` and `login` enter it directly    \n"
+        "and skip all setup.                                                      \n"
+        "                                                                         \n"
+        "OPTIONS:                                                                 \n"
+        "                                                                         \n"
+        "  -h, --help            Print this help message and exit immediately.    \n"
+        "                                                                         \n"
+        "  -m, --mount <fstype>  Mount 'dev', 'proc', 'sys', 'home', 'pkg-cache'  \n"
+        "                        or 'tmp'. If this option is not specified then   \n"
+        "                        the default is to mount all of them except       \n"
+        "                        'tmp', which puts a tmpfs on /tmp. 'pkg-cache'   \n"
+        "                        binds the shared package cache to                \n"
+        "                        /var/cache/opkg.                                 \n"
+        "                                                                         \n"
+        "  --scratch <path>[:size]                                                \n"
+        "                        Mount a tmpfs on <path> inside the target.       \n"
+        "                        Sizes take a suffix 'k', 'm' or 'g', or '%%'      \n"
+        "                        for a share of RAM. The default is 25%%, and      \n"
+        "                        all tmpfs mounts of a user may use at most       \n"
+        "                        50%% of RAM.                                      \n"
+        "                                                                         \n"
+        "  --shm-size <size>     Size of the tmpfs on /dev/shm, which comes       \n"
+        "                        with 'dev'. The default is 10%% of RAM.           \n"
+        "                                                                         \n"
+        "  --host-dev            Mount the host's /dev only, without a private    \n"
+        "                        /dev/shm and /dev/pts.                           \n"
+        "                                                                         \n"
+        "  --no-file-copy        Don't copy passwd database, group database and   \n"
+        "                        resolv.conf from host.                           \n"
+        "                                                                         \n"
+        "  --no-mount            Don't mount any filesystems per default.         \n"
+        "                                                                         \n"
+    );
+}
+
+int bbox_session_getopt(bbox_conf_t *conf, int argc, char * const argv[])
+{
+    int c;
+    int option_index = 0;
+    int do_mount_all = 1;
+
+    static struct option long_options[] = {
+        {"help",         no_argument,       0, 'h'},
+        {"targets",      required_argument, 0, 't'},
+        {"mount",        required_argument, 0, 'm'},
+        {"no-file-copy", no_argument,       0, '1'},
+        {"no-mount",     no_argument,       0, '2'},
+        {"scratch",      required_argument, 0, '3'},
+        {"shm-size",     required_argument, 0, '4'},
+        {"host-dev",     no_argument,       0, '5'},
+        { 0,             0,                 0,  0 }
+    };
+
+    bbox_config_clear_mount(conf);
+    bbox_config_enable_file_updates(conf);
+    optind = 1;
+
+    while(1) {
+        c = getopt_long(argc, argv, ":ht:m:", long_options, &option_index);
+
+        if(c == -1)
+            break;
+
+        switch(c) {
+            case 'h':
+                bbox_session_usage();
+                return -1;
+            case 't':
+                if(bbox_config_set_target_dir(conf, optarg) == -1)
+                    return -2;
+                break;
+            case 'm':
+                do_mount_all = 0;
+
+                if(!strcmp(optarg, "dev")) {
+                    bbox_config_set_mount_dev(conf);
+                } else if(!strcmp(optarg, "proc")) {
+                    bbox_config_set_mount_proc(conf);
+                } else if(!strcmp(optarg, "sys")) {
+                    bbox_config_set_mount_sys(conf);
+                } else if(!strcmp(optarg, "home")) {
+                    bbox_config_set_mount_home(conf);
+                } else if(!strcmp(optarg, "pkg-cache")) {
+                    bbox_config_set_mount_pkg_cache(conf);
+                } else if(!strcmp(optarg, "tmp")) {
+                    bbox_config_set_mount_tmp(conf);
+                } else {
+                    bbox_perror("session", "unknown file system specifier "
+                            "'%s'.\n", optarg);
+                    return -2;
+                }
+
+                break;
+            case '1':
+                bbox_config_disable_file_updates(conf);
+                break;
+            case '2':
+                do_mount_all = 0;
+                break;
+            case '3':
+                if(bbox_config_add_scratch(conf, optarg) == -1)
+                    return -2;
+                break;
+            case '4':
+                if(bbox_config_set_shm_size(conf, optarg) == -1)
+                    return -2;
+                break;
+            case '5':
+                bbox_config_set_host_dev(conf);
+                break;
+            case '?':
+            case ':':
+                bbox_session_usage();
+                return -2;
+            default:
+                /* impossible, ignore */
+                break;
+        }
+    }
+
+    if(do_mount_all)
+        bbox_config_set_mount_all(conf);
+
+    return optind;
+}
+
+/*
+ * Returns the directory holding the session records of the calling user.
+ */
+static char *bbox_session_get_dir()
+{
+    char *session_dir = NULL;
+
+    if(asprintf(&session_dir, BBOX_SESSION_DIR_TEMPLATE,
+                (unsigned long) getuid()) == -1)
+    {
+        bbox_perror("bbox_session_get_dir", "out of memory!\n");
+        abort();
+    }
+
+    return session_dir;
+}
+
+/*
+ * Records are named after a hash of the target's real path, because targets
+ * with the same name can live in different --targets directories. Each record
+ * also holds the path itself, which settles the unlikely case of a clash.
+ */
+static char *bbox_session_get_record(const char *real_root)
+{
+    char *session_dir = bbox_session_get_dir();
+    char *record = NULL;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for(const char *c = real_root; *c; c++) {
+        hash ^= (unsigned char) *c;
+        hash *= 0x100000001b3ULL;
+    }
+
+    if(asprintf(&record, "%s/%016" PRIx64 "%s", session_dir, hash,
+                BBOX_SESSION_SUFFIX) == -1)
+    {
+        bbox_perror("bbox_session_get_record", "out of memory!\n");
+        abort();
+    }
+
+    free(session_dir);
+    return record;
+}
+
+/*
+ * Looks up the keeper of the session on `real_root`. Returns the keeper's pid
+ * if the session is alive and 0 otherwise.
+ */
+static pid_t bbox_session_find(const char *real_root)
+{
+    char *record = bbox_session_get_record(real_root);
+    char *line = NULL;
+    size_t line_len = 0;
+    ssize_t num_read;
+    pid_t pid = 0;
+    unsigned long long start_time = 0;
+    int sys_root_matches = 0;
+    FILE *fp = NULL;
+
+    if(!(fp = fopen(record, "re")))
+        goto cleanup_and_exit;
+
+    while((num_read = getline(&line, &line_len, fp)) != -1)
+    {
+        if(num_read > 0 && line[num_read - 1] == '\n')
+            line[num_read - 1] = '\0';
+
+        if(!strncmp(line, "pid ", 4)) {
+            pid = (pid_t) strtol(line + 4, NULL, 10);
+        } else if(!strncmp(line, "starttime ", 10)) {
+            start_time = strtoull(line + 10, NULL, 10);
+        } else if(!strncmp(line, "sysroot ", 8)) {
+            sys_root_matches = !strcmp(line + 8, real_root);
+        }
+    }
+
+    if(!sys_root_matches || pid <= 0 || start_time == 0 ||
+            bbox_get_start_time(pid) != start_time)
+    {
+        pid = 0;
+    }
+
+cleanup_and_exit:
+
+    if(fp)
+        fclose(fp);
+    free(line);
+    free(record);
+    return pid;
+}
+
+int bbox_session_enter(const bbox_conf_t *conf, const char *module,
+        const char *sys_root)
+{
+    char path[64];
+    char *real_root = NULL;
+    int ns_fd = -1;
+    int rval = 0;
+
+    if(!(real_root = realpath(sys_root, NULL)))
+        return 0;
+
+    pid_t pid = bbox_session_find(real_root);
+
+    if(pid == 0)
+        goto cleanup_and_exit;
+
+    /*
+     * The session's mounts were set up when it was started, and anything
+     * asked for on the command line would silently not happen.
+     */
+    if(bbox_config_get_mount_options(conf)) {
+        bbox_perror(module, "target '%s' has an active session, its mounts "
+                "can't be changed (use --no-session).\n",
+                strrchr(real_root, '/') + 1);
+        rval = -1;
+        goto cleanup_and_exit;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%ld/ns/mnt", (long) pid);
+
+    rval = -1;
+
+    if(bbox_raise_privileges() == -1)
+        goto cleanup_and_exit;
+
+    if((ns_fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+        bbox_perror(module, "failed to open session namespace: %s.\n",
+                strerror(errno));
+    } else if(setns(ns_fd, CLONE_NEWNS) == -1) {
+        bbox_perror(module, "failed to enter session namespace: %s.\n",
+                strerror(errno));
+    } else {
+        rval = 1;
+    }
+
+    if(bbox_lower_privileges() == -1)
+        rval = -1;
+
+cleanup_and_exit:
+
+    if(ns_fd != -1)
+        close(ns_fd);
+    free(real_root);
+    return rval;
+}
+
+static int bbox_session_write_record(const char *real_root, pid_t pid)
+{
+    char *session_dir = bbox_session_get_dir();
+    char *record = bbox_session_get_record(real_root);
+    char *tmp_record = NULL;
+    FILE *fp = NULL;
+    int out_fd = -1;
+    int rval = -1;
+
+    if(asprintf(&tmp_record, "%s-XXXXXX", record) == -1) {
+        bbox_perror("bbox_session_write_record", "out of memory!\n");
+        abort();
+    }
+
+    if(bbox_raise_privileges() == -1)
+        goto cleanup_and_exit;
+
+    if(mkdir(BBOX_RUN_DIR, 0755) == -1 && errno != EEXIST)
+        goto failure;
+    if(mkdir(session_dir, 0755) == -1 && errno != EEXIST)
+        goto failure;
+    if((out_fd = mkstemp(tmp_record)) == -1)
+        goto failure;
+
+    fchmod(out_fd, 0644);
+
+    if(!(fp = fdopen(out_fd, "w"))) {
+        close(out_fd);
+        unlink(tmp_record);
+        goto failure;
+    }
+
+    fprintf(fp, "pid %ld\n", (long) pid);
+    fprintf(fp, "starttime %llu\n", bbox_get_start_time(pid));
+    fprintf(fp, "sysroot %s\n", real_root);
+
+    if(fclose(fp) == EOF || rename(tmp_record, record) == -1) {
+        unlink(tmp_record);
+        goto failure;
+    }
+
+    rval = 0;
+
+failure:
+
+    if(rval == -1) {
+        bbox_perror("session", "failed to register session: %s.\n",
+                strerror(errno));
+    }
+
+    if(bbox_lower_privileges() == -1)
+        rval = -1;
+
+cleanup_and_exit:
+
+    free(tmp_record);
+    free(record);
+    free(session_dir);
+    return rval;
+}
+
+/*
+ * This is what the keeper does after it has set everything up. It waits for
+ * a request to terminate and unregisters the session on the way out.
+ */
+static void bbox_session_keep(const char *real_root)
+{
+    sigset_t sigset;
+    int sig = 0;
+
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGTERM);
+    sigaddset(&sigset, SIGINT);
+    sigaddset(&sigset, SIGHUP);
+
+    while(sigwait(&sigset, &sig) != 0 || sig == 0)
+        ;
+
+    char *record = bbox_session_get_record(real_root);
+
+    if(bbox_raise_privileges() == 0) {
+        unlink(record);
+        bbox_lower_privileges();
+    }
+
+    free(record);
+}
+
+static int bbox_session_start(bbox_conf_t *conf, const char *sys_root)
+{
+    char *real_root = NULL;
+    int pipe_fds[2] = {-1, -1};
+    int rval = -1;
+
+    if(!(real_root = realpath(sys_root, NULL))) {
+        bbox_perror("session", "unable to normalize path %s: %s.\n",
+                sys_root, strerror(errno));
+        return -1;
+    }
+
+    if(bbox_isdir_and_owned_by("session", real_root, getuid()) == -1)
+        goto cleanup_and_exit;
+
+    if(bbox_session_find(real_root) != 0) {
+        bbox_perror("session", "a session is already active on '%s'.\n",
+                real_root);
+        goto cleanup_and_exit;
+    }
+
+    /*
+     * The overlay of a layered target goes into the host's namespace, where
+     * it stays after the session has ended.
+     */
+    if(bbox_layer_assemble("session", real_root) == -1)
+        goto cleanup_and_exit;
+
+    if(pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        bbox_perror("session", "failed to create pipe: %s.\n",
+                strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    /*
+     * Block the signals the keeper waits for before forking, so that none of
+     * them get lost in between.
+     */
+    sigset_t sigset;
+
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGTERM);
+    sigaddset(&sigset, SIGINT);
+    sigaddset(&sigset, SIGHUP);
+    sigprocmask(SIG_BLOCK, &sigset, NULL);
+
+    pid_t pid = fork();
+
+    if(pid == -1) {
+        bbox_perror("session", "fork failed: %s.\n", strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    if(pid == 0) {
+        close(pipe_fds[0]);
+        setsid();
+
+        bbox_config_set_private_mounts(conf);
+
+        if(bbox_mount_unshare("session") == -1)
+            _exit(BBOX_ERR_RUNTIME);
+        if(bbox_mount_any(conf, real_root) == -1)
+            _exit(BBOX_ERR_RUNTIME);
+        if(bbox_config_do_file_updates(conf))
+            bbox_update_chroot_dynamic_config(real_root);
+        if(bbox_session_write_record(real_root, getpid()) == -1)
+            _exit(BBOX_ERR_RUNTIME);
+
+        int null_fd = open("/dev/null", O_RDWR);
+
+        if(null_fd != -1) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            if(null_fd > STDERR_FILENO)
+                close(null_fd);
+        }
+
+        /*
+         * Tell the parent that we're up and get out of the way of the
+         * invoking directory. If the write fails, the parent sees the pipe
+         * close and reports the session as failed, and "/" always exists.
+         */
+        (void) !write(pipe_fds[1], "", 1);
+        close(pipe_fds[1]);
+        (void) !chdir("/");
+
+        bbox_session_keep(real_root);
+        _exit(0);
+    }
+
+    close(pipe_fds[1]);
+    pipe_fds[1] = -1;
+
+    char ready = 1;
+
+    while(read(pipe_fds[0], &ready, 1) == -1) {
+        if(errno != EINTR)
+            break;
+    }
+
+    /*
+     * If the keeper failed, it has already said why.
+     */
+    if(ready == 0)
+        rval = 0;
+
+cleanup_and_exit:
+
+    if(pipe_fds[0] != -1)
+        close(pipe_fds[0]);
+    if(pipe_fds[1] != -1)
+        close(pipe_fds[1]);
+    free(real_root);
+    return rval;
+}
+
+static int bbox_session_stop(const char *sys_root)
+{
+    char *real_root = NULL;
+    int rval = -1;
+
+    if(!(real_root = realpath(sys_root, NULL))) {
+        bbox_perror("session", "unable to normalize path %s: %s.\n",
+                sys_root, strerror(errno));
+        return -1;
+    }
+
+    pid_t pid = bbox_session_find(real_root);
+
+    if(pid == 0) {
+        bbox_perror("session", "no session is active on '%s'.\n",
+                real_root);
+        goto cleanup_and_exit;
+    }
+
+    if(kill(pid, SIGTERM) == -1) {
+        bbox_perror("session", "failed to stop session: %s.\n",
+                strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    /*
+     * Wait a moment for the keeper to unregister, so that a session can be
+     * started again right away.
+     */
+    for(int i = 0; i < 100 && bbox_session_find(real_root) != 0; i++)
+        usleep(50000);
+
+    rval = 0;
+
+cleanup_and_exit:
+
+    free(real_root);
+    return rval;
+}
+
+static int bbox_session_list()
+{
+    char *session_dir = bbox_session_get_dir();
+    struct dirent *entry = NULL;
+    char *record = NULL;
+    char *line = NULL;
+    size_t line_len = 0;
+    ssize_t num_read;
+    DIR *dir = NULL;
+
+    if(!(dir = opendir(session_dir))) {
+        free(session_dir);
+        return 0;
+    }
+
+    while((entry = readdir(dir)) != NULL) {
+        size_t name_len = strlen(entry->d_name);
+        size_t suffix_len = strlen(BBOX_SESSION_SUFFIX);
+
+        if(name_len <= suffix_len || strcmp(entry->d_name + name_len -
+                    suffix_len, BBOX_SESSION_SUFFIX))
+        {
+            continue;
+        }
+
+        free(record);
+        record = NULL;
+
+        if(asprintf(&record, "%s/%s", session_dir, entry->d_name) == -1) {
+            bbox_perror("session", "out of memory!\n");
+            abort();
+        }
+
+        FILE *fp = fopen(record, "re");
+
+        if(!fp)
+            continue;
+
+        while((num_read = getline(&line, &line_len, fp)) != -1) {
+            if(num_read > 0 && line[num_read - 1] == '\n')
+                line[num_read - 1] = '\0';
+            if(strncmp(line, "sysroot ", 8))
+                continue;
+            if(bbox_session_find(line + 8) != 0)
+                printf("%s\n", strrchr(line + 8, '/') + 1);
+            break;
+        }
+
+        fclose(fp);
+    }
+
+    closedir(dir);
+    free(line);
+    free(record);
+    free(session_dir);
+    return 0;
+}
+
+int bbox_session(int argc, char * const argv[])
+{
+    char *buf = NULL;
+    size_t buf_len = 0;
+
+    int rval = BBOX_ERR_INVOCATION;
+
+    if(argc < 2) {
+        bbox_session_usage();
+        return BBOX_ERR_INVOCATION;
+    }
+
+    const char *action = argv[1];
+
+    if(!strcmp(action, "-h") || !strcmp(action, "--help")) {
+        bbox_session_usage();
+        return 0;
+    }
+
+    bbox_conf_t *conf = bbox_config_new();
+    if(!conf) {
+        bbox_perror("session", "creating configuration context failed.\n");
+        return BBOX_ERR_RUNTIME;
+    }
+
+    int non_optind;
+
+    if((non_optind = bbox_session_getopt(conf, argc - 1, &argv[1])) < 0) {
+        /* user asked for --help */
+        if(non_optind == -1)
+            rval = 0;
+        goto cleanup_and_exit;
+    }
+
+    non_optind++;
+
+    if(!strcmp(action, "list")) {
+        rval = bbox_session_list() == 0 ? 0 : BBOX_ERR_RUNTIME;
+        goto cleanup_and_exit;
+    }
+
+    if(strcmp(action, "start") && strcmp(action, "stop")) {
+        bbox_perror("session", "unknown action '%s'.\n", action);
+        goto cleanup_and_exit;
+    }
+
+    if(non_optind >= argc) {
+        bbox_perror("session", "no target specified.\n");
+        goto cleanup_and_exit;
+    }
+
+    char *target = argv[non_optind];
+
+    if(validate_target_name("session", target) == -1)
+        goto cleanup_and_exit;
+
+    bbox_path_join(
+        &buf, bbox_config_get_target_dir(conf), target, &buf_len
+    );
+
+    struct stat st;
+
+    if(lstat(buf, &st) == -1) {
+        bbox_perror("session", "target '%s' not found.\n", target);
+        goto cleanup_and_exit;
+    }
+
+    rval = BBOX_ERR_RUNTIME;
+
+    if(!strcmp(action, "start")) {
+        if(bbox_session_start(conf, buf) == 0)
+            rval = 0;
+    } else {
+        if(bbox_session_stop(buf) == 0)
+            rval = 0;
+    }
+
+cleanup_and_exit:
+
+    bbox_config_free(conf);
+    free(buf);
+    return rval;
+}
@@ -0,0 +1,105 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Unit checks for the parsing of --scratch arguments.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <string.h>
+
+#include "bbox-do.h"
+#include "bbox-test.h"
+
+static void bbox_test_scratch_valid(bbox_conf_t *conf)
+{
+    const bbox_scratch_t *scratch = NULL;
+
+    BBOX_CHECK(bbox_config_add_scratch(conf, "/build") == 0);
+    BBOX_CHECK(bbox_config_add_scratch(conf, "/var/cache:2g") == 0);
+
+    /* Only the last colon separates the size. */
+    BBOX_CHECK(bbox_config_add_scratch(conf, "/a:b:1m") == 0);
+
+    BBOX_CHECK(bbox_config_get_num_scratch(conf) == 3);
+
+    BBOX_CHECK((scratch = bbox_config_get_scratch(conf, 0)) &&
+            !strcmp(scratch->path, "/build") && scratch->size == 0);
+    BBOX_CHECK((scratch = bbox_config_get_scratch(conf, 1)) &&
+            !strcmp(scratch->path, "/var/cache") &&
+            scratch->size == 2ULL << 30);
+    BBOX_CHECK((scratch = bbox_config_get_scratch(conf, 2)) &&
+            !strcmp(scratch->path, "/a:b") && scratch->size == 1ULL << 20);
+    BBOX_CHECK(bbox_config_get_scratch(conf, 3) == NULL);
+}
+
+static void bbox_test_scratch_invalid(bbox_conf_t *conf)
+{
+    size_t num_scratch = bbox_config_get_num_scratch(conf);
+
+    BBOX_CHECK(bbox_config_add_scratch(conf, "build") == -1);
+    BBOX_CHECK(bbox_config_add_scratch(conf, "") == -1);
+    BBOX_CHECK(bbox_config_add_scratch(conf, "/") == -1);
+    BBOX_CHECK(bbox_config_add_scratch(conf, "/:1g") == -1);
+    BBOX_CHECK(bbox_config_add_scratch(conf, "/build/../etc") == -1);
+    BBOX_CHECK(bbox_config_add_scratch(conf, "/build/..") == -1);
+    BBOX_CHECK(bbox_config_add_scratch(conf, "/build:") == -1);
+    BBOX_CHECK(bbox_config_add_scratch(conf, "/build:0") == -1);
+    BBOX_CHECK(bbox_config_add_scratch(conf, "/build:lots") == -1);
+
+    BBOX_CHECK(bbox_config_get_num_scratch(conf) == num_scratch);
+}
+
+static void bbox_test_scratch_limit(bbox_conf_t *conf)
+{
+    while(bbox_config_get_num_scratch(conf) < BBOX_MAX_SCRATCH) {
+        if(bbox_config_add_scratch(conf, "/build") == -1) {
+            BBOX_CHECK(!"adding a scratch directory failed");
+            return;
+        }
+    }
+
+    BBOX_CHECK(bbox_config_add_scratch(conf, "/build") == -1);
+    BBOX_CHECK(bbox_config_get_num_scratch(conf) == BBOX_MAX_SCRATCH);
+}
+
+int main()
+{
+    bbox_conf_t *conf = bbox_config_new();
+
+    if(!conf)
+        return BBOX_ERR_RUNTIME;
+
+    bbox_test_scratch_valid(conf);
+    bbox_test_scratch_invalid(conf);
+    bbox_test_scratch_limit(conf);
+
+    bbox_config_free(conf);
+    return BBOX_TEST_RESULT();
+}
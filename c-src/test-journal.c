@@ -0,0 +1,259 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Unit checks for the mount journal. Runs in a private mount namespace on
+ * a tmpfs that hides the real build-box state, so nothing outside of the
+ * test is touched. Skipped where namespaces are not available.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "bbox-do.h"
+#include "bbox-test.h"
+
+static int bbox_test_write_file(const char *path, const char *contents)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if(fd == -1)
+        return -1;
+
+    size_t len = strlen(contents);
+    ssize_t num_written = write(fd, contents, len);
+
+    close(fd);
+    return num_written == (ssize_t) len ? 0 : -1;
+}
+
+/*
+ * Enters a private mount namespace, as an unprivileged user via a user
+ * namespace, and puts a tmpfs on the parent of BBOX_VAR_LIB.
+ */
+static int bbox_test_setup()
+{
+    char buf[64];
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+
+    if(geteuid() == 0) {
+        if(unshare(CLONE_NEWNS) == -1)
+            return -1;
+    } else {
+        if(unshare(CLONE_NEWUSER | CLONE_NEWNS) == -1)
+            return -1;
+
+        snprintf(buf, sizeof(buf), "0 %lu 1", (unsigned long) uid);
+        if(bbox_test_write_file("/proc/self/uid_map", buf) == -1)
+            return -1;
+        if(bbox_test_write_file("/proc/self/setgroups", "deny") == -1)
+            return -1;
+        snprintf(buf, sizeof(buf), "0 %lu 1", (unsigned long) gid);
+        if(bbox_test_write_file("/proc/self/gid_map", buf) == -1)
+            return -1;
+    }
+
+    if(mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) == -1)
+        return -1;
+
+    char *var_dir = strdup(BBOX_VAR_LIB);
+    if(!var_dir)
+        return -1;
+
+    *strrchr(var_dir, '/') = '\0';
+
+    int rval = mount("none", var_dir, "tmpfs", 0, NULL);
+    free(var_dir);
+    return rval;
+}
+
+static void bbox_test_record_and_check(const char *sys_root)
+{
+    char *proc_dir = NULL;
+    char *dev_dir = NULL;
+    size_t proc_dir_len = 0;
+    size_t dev_dir_len = 0;
+
+    bbox_path_join(&proc_dir, sys_root, "proc", &proc_dir_len);
+    bbox_path_join(&dev_dir, sys_root, "dev", &dev_dir_len);
+
+    bbox_journal_t *journal = bbox_journal_open(sys_root);
+    BBOX_CHECK(journal != NULL);
+
+    if(!journal)
+        goto cleanup_and_exit;
+
+    BBOX_CHECK(journal->num_entries == 0);
+
+    /* Unknown locations are left to the mount table. */
+    BBOX_CHECK(bbox_journal_check(journal, proc_dir) == 0);
+
+    BBOX_CHECK(mkdir(proc_dir, 0755) == 0);
+    BBOX_CHECK(mkdir(dev_dir, 0755) == 0);
+    BBOX_CHECK(mount("none", proc_dir, "tmpfs", 0, NULL) == 0);
+
+    BBOX_CHECK(bbox_journal_record(journal, proc_dir) == 0);
+    BBOX_CHECK(bbox_journal_check(journal, proc_dir) == 1);
+
+    /* A directory that isn't the root of a mount never validates. */
+    BBOX_CHECK(bbox_journal_record(journal, dev_dir) == 0);
+    BBOX_CHECK(bbox_journal_check(journal, dev_dir) == -1);
+    bbox_journal_forget(journal, dev_dir);
+    BBOX_CHECK(bbox_journal_check(journal, dev_dir) == 0);
+
+    /* Mounts outside of the target are not tracked. */
+    BBOX_CHECK(bbox_journal_record(journal, BBOX_VAR_LIB) == 0);
+    BBOX_CHECK(bbox_journal_check(journal, BBOX_VAR_LIB) == 0);
+    BBOX_CHECK(journal->num_entries == 1);
+
+    BBOX_CHECK(bbox_journal_save(journal) == 0);
+    bbox_journal_free(journal);
+
+    /* The entry survives a round trip through the file. */
+    journal = bbox_journal_open(sys_root);
+    BBOX_CHECK(journal && journal->num_entries == 1);
+
+    if(!journal)
+        goto cleanup_and_exit;
+
+    BBOX_CHECK(bbox_journal_check(journal, proc_dir) == 1);
+
+    /* A new mount in the same place gets a new id. */
+    BBOX_CHECK(umount(proc_dir) == 0);
+    BBOX_CHECK(mount("none", proc_dir, "tmpfs", 0, NULL) == 0);
+    BBOX_CHECK(bbox_journal_check(journal, proc_dir) == -1);
+
+    BBOX_CHECK(bbox_journal_record(journal, proc_dir) == 0);
+    BBOX_CHECK(bbox_journal_check(journal, proc_dir) == 1);
+
+    bbox_journal_forget(journal, proc_dir);
+    BBOX_CHECK(bbox_journal_check(journal, proc_dir) == 0);
+
+    /* An empty journal removes the file. */
+    char *journal_path = strdup(journal->path);
+
+    BBOX_CHECK(bbox_journal_save(journal) == 0);
+    BBOX_CHECK(journal_path && access(journal_path, F_OK) == -1);
+    free(journal_path);
+
+cleanup_and_exit:
+
+    bbox_journal_free(journal);
+    free(proc_dir);
+    free(dev_dir);
+}
+
+static void bbox_test_discard(const char *sys_root, const char *contents)
+{
+    bbox_journal_t *journal = bbox_journal_open(sys_root);
+    BBOX_CHECK(journal != NULL);
+
+    if(!journal)
+        return;
+
+    BBOX_CHECK(bbox_test_write_file(journal->path, contents) == 0);
+    bbox_journal_free(journal);
+
+    journal = bbox_journal_open(sys_root);
+    BBOX_CHECK(journal != NULL);
+
+    if(journal) {
+        BBOX_CHECK(journal->num_entries == 0);
+        BBOX_CHECK(journal->is_dirty);
+        unlink(journal->path);
+        bbox_journal_free(journal);
+    }
+}
+
+int main()
+{
+    char *user_dir = NULL;
+    char *sys_root = NULL;
+    char *mounts_dir = NULL;
+    char *contents = NULL;
+    size_t user_dir_len = 0;
+    size_t sys_root_len = 0;
+    size_t mounts_dir_len = 0;
+
+    if(bbox_test_setup() == -1) {
+        fprintf(stderr, "test-journal: no private mount namespace: %s.\n",
+                strerror(errno));
+        return BBOX_TEST_SKIP;
+    }
+
+    if(!(user_dir = bbox_get_user_dir(getuid(), &user_dir_len)))
+        return BBOX_ERR_RUNTIME;
+
+    bbox_path_join(&sys_root, user_dir, "targets/t1", &sys_root_len);
+    bbox_path_join(&mounts_dir, user_dir, "mounts", &mounts_dir_len);
+
+    if(bbox_mkdir_p("test-journal", sys_root) == -1 ||
+            bbox_mkdir_p("test-journal", mounts_dir) == -1)
+    {
+        return BBOX_ERR_RUNTIME;
+    }
+
+    bbox_test_record_and_check(sys_root);
+
+    /*
+     * Journals written for a different location, or with a different kind
+     * of mount id, are thrown away.
+     */
+    if(asprintf(&contents, "sysroot %s/targets/t2\nmnt_id_mask %x\n"
+                "mount 1 %s/proc\n", user_dir, BBOX_STATX_MNT_ID_UNIQUE,
+                sys_root) == -1)
+    {
+        return BBOX_ERR_RUNTIME;
+    }
+
+    bbox_test_discard(sys_root, contents);
+    free(contents);
+
+    if(asprintf(&contents, "sysroot %s\nmnt_id_mask 0\nmount 1 %s/proc\n",
+                sys_root, sys_root) == -1)
+    {
+        return BBOX_ERR_RUNTIME;
+    }
+
+    bbox_test_discard(sys_root, contents);
+    free(contents);
+
+    free(mounts_dir);
+    free(sys_root);
+    free(user_dir);
+    return BBOX_TEST_RESULT();
+}
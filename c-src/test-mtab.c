@@ -0,0 +1,175 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Unit checks for reading the mount table from a mountinfo file and for
+ * listing the mounts below a directory in unmount order.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bbox-do.h"
+#include "bbox-test.h"
+
+static const char *bbox_test_mountinfo =
+    "21 1 0:20 / /srv/t rw,relatime shared:1 - ext4 /dev/sda1 rw\n"
+    "22 21 0:21 / /srv/t/proc rw,nosuid - proc proc rw\n"
+    "23 21 0:5 / /srv/t/dev rw,nosuid - devtmpfs udev rw\n"
+    "24 23 0:22 / /srv/t/dev/pts rw - devpts devpts rw\n"
+    "25 21 0:23 / /srv/t/home\\040dir rw - ext4 /dev/sda2 rw\n"
+    "26 21 0:24 / /srv/t/proc rw - tmpfs tmpfs rw\n"
+    "27 1 0:25 / /srv/tt rw - tmpfs tmpfs rw\n"
+    "28 1 0:26 / /srv/back\\134slash rw - tmpfs tmpfs rw\n"
+    "29 1\n";
+
+static int bbox_test_write_fixture(char *path, const char *contents)
+{
+    int fd = mkstemp(path);
+
+    if(fd == -1) {
+        bbox_perror("test-mtab", "mkstemp failed: %s.\n", strerror(errno));
+        return -1;
+    }
+
+    size_t len = strlen(contents);
+
+    if(write(fd, contents, len) != (ssize_t) len) {
+        bbox_perror("test-mtab", "failed to write %s.\n", path);
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+static bbox_mtab_entry_t *bbox_test_find_id(bbox_mtab_t *mtab,
+        uint64_t mnt_id)
+{
+    for(size_t i = 0; i < mtab->num_buckets; i++) {
+        for(bbox_mtab_entry_t *entry = mtab->id_buckets[i]; entry;
+                entry = entry->next_id)
+        {
+            if(entry->mnt_id == mnt_id)
+                return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void bbox_test_parse(bbox_mtab_t *mtab)
+{
+    bbox_mtab_entry_t *entry = NULL;
+
+    BBOX_CHECK(mtab->source == BBOX_MTAB_SOURCE_MOUNTINFO);
+    BBOX_CHECK(mtab->num_entries == 8);
+
+    BBOX_CHECK((entry = bbox_test_find_id(mtab, 21)) &&
+            !strcmp(entry->mnt_dir, "/srv/t"));
+    BBOX_CHECK((entry = bbox_test_find_id(mtab, 24)) &&
+            !strcmp(entry->mnt_dir, "/srv/t/dev/pts"));
+
+    /* Octal escapes are decoded. */
+    BBOX_CHECK((entry = bbox_test_find_id(mtab, 25)) &&
+            !strcmp(entry->mnt_dir, "/srv/t/home dir"));
+    BBOX_CHECK((entry = bbox_test_find_id(mtab, 28)) &&
+            !strcmp(entry->mnt_dir, "/srv/back\\slash"));
+
+    /* Both mounts stacked on /srv/t/proc are kept. */
+    BBOX_CHECK((entry = bbox_test_find_id(mtab, 22)) &&
+            !strcmp(entry->mnt_dir, "/srv/t/proc"));
+    BBOX_CHECK((entry = bbox_test_find_id(mtab, 26)) &&
+            !strcmp(entry->mnt_dir, "/srv/t/proc"));
+
+    /* Truncated lines are skipped. */
+    BBOX_CHECK(!bbox_test_find_id(mtab, 29));
+}
+
+static void bbox_test_list_under(bbox_mtab_t *mtab)
+{
+    static const char *expected[] = {
+        "/srv/t/dev/pts",
+        "/srv/t/proc",
+        "/srv/t/home dir",
+        "/srv/t/dev",
+        "/srv/t/proc"
+    };
+
+    char **mnt_dirs = NULL;
+    size_t num_dirs = 0;
+
+    /*
+     * Deepest first, then topmost first. Neither the prefix itself nor its
+     * siblings with a common prefix are listed.
+     */
+    BBOX_CHECK(bbox_mtab_list_under(mtab, "/srv/t/", &mnt_dirs,
+                &num_dirs) == 0);
+    BBOX_CHECK(num_dirs == sizeof(expected) / sizeof(expected[0]));
+
+    for(size_t i = 0; i < num_dirs; i++) {
+        if(i < sizeof(expected) / sizeof(expected[0]))
+            BBOX_CHECK(!strcmp(mnt_dirs[i], expected[i]));
+        free(mnt_dirs[i]);
+    }
+
+    free(mnt_dirs);
+
+    BBOX_CHECK(bbox_mtab_list_under(mtab, "/srv/none", &mnt_dirs,
+                &num_dirs) == 0);
+    BBOX_CHECK(num_dirs == 0);
+    free(mnt_dirs);
+}
+
+int main()
+{
+    char path[] = "/tmp/test-mtab-XXXXXX";
+
+    if(bbox_test_write_fixture(path, bbox_test_mountinfo) == -1)
+        return BBOX_ERR_RUNTIME;
+
+    bbox_mtab_t *mtab = bbox_mtab_load_mountinfo(path);
+    unlink(path);
+
+    BBOX_CHECK(mtab != NULL);
+
+    if(mtab) {
+        bbox_test_parse(mtab);
+        bbox_test_list_under(mtab);
+        bbox_mtab_free(mtab);
+    }
+
+    BBOX_CHECK(!bbox_mtab_load_mountinfo("/nonexistent/mountinfo"));
+
+    return BBOX_TEST_RESULT();
+}
@@ -0,0 +1,107 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+/*
+ * Unit checks for the helpers that parse command line arguments.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <limits.h>
+
+#include "bbox-do.h"
+#include "bbox-test.h"
+
+static void bbox_test_parse_seconds()
+{
+    unsigned int seconds = 1;
+
+    BBOX_CHECK(bbox_parse_seconds("test-util", "0", &seconds) == 0);
+    BBOX_CHECK(seconds == 0);
+    BBOX_CHECK(bbox_parse_seconds("test-util", "300", &seconds) == 0);
+    BBOX_CHECK(seconds == 300);
+    BBOX_CHECK(bbox_parse_seconds("test-util", "4294967295", &seconds) == 0);
+    BBOX_CHECK(seconds == UINT_MAX);
+
+    /* Failures leave the result alone. */
+    BBOX_CHECK(bbox_parse_seconds("test-util", "4294967296", &seconds) == -1);
+    BBOX_CHECK(bbox_parse_seconds("test-util", "-1", &seconds) == -1);
+    BBOX_CHECK(bbox_parse_seconds("test-util", "", &seconds) == -1);
+    BBOX_CHECK(bbox_parse_seconds("test-util", "5s", &seconds) == -1);
+    BBOX_CHECK(bbox_parse_seconds("test-util", "abc", &seconds) == -1);
+    BBOX_CHECK(seconds == UINT_MAX);
+}
+
+static void bbox_test_parse_size()
+{
+    unsigned long long size = 1;
+
+    BBOX_CHECK(bbox_parse_size("test-util", "4096", &size) == 0);
+    BBOX_CHECK(size == 4096ULL);
+    BBOX_CHECK(bbox_parse_size("test-util", "64k", &size) == 0);
+    BBOX_CHECK(size == 64ULL << 10);
+    BBOX_CHECK(bbox_parse_size("test-util", "512M", &size) == 0);
+    BBOX_CHECK(size == 512ULL << 20);
+    BBOX_CHECK(bbox_parse_size("test-util", "2g", &size) == 0);
+    BBOX_CHECK(size == 2ULL << 30);
+    BBOX_CHECK(bbox_parse_size("test-util", "16777215T", &size) == 0);
+    BBOX_CHECK(size == 16777215ULL << 40);
+
+    unsigned long long phys_mem = bbox_get_phys_mem();
+
+    if(phys_mem >= 100) {
+        BBOX_CHECK(bbox_parse_size("test-util", "25%", &size) == 0);
+        BBOX_CHECK(size == phys_mem / 100 * 25);
+        BBOX_CHECK(bbox_parse_size("test-util", "100%", &size) == 0);
+        BBOX_CHECK(size == phys_mem / 100 * 100);
+    }
+
+    /* Failures leave the result alone. */
+    size = 1;
+
+    BBOX_CHECK(bbox_parse_size("test-util", "0", &size) == -1);
+    BBOX_CHECK(bbox_parse_size("test-util", "0k", &size) == -1);
+    BBOX_CHECK(bbox_parse_size("test-util", "0%", &size) == -1);
+    BBOX_CHECK(bbox_parse_size("test-util", "101%", &size) == -1);
+    BBOX_CHECK(bbox_parse_size("test-util", "16777216T", &size) == -1);
+    BBOX_CHECK(bbox_parse_size("test-util", "99999999999999999999", &size)
+            == -1);
+    BBOX_CHECK(bbox_parse_size("test-util", "-1", &size) == -1);
+    BBOX_CHECK(bbox_parse_size("test-util", "", &size) == -1);
+    BBOX_CHECK(bbox_parse_size("test-util", "k", &size) == -1);
+    BBOX_CHECK(bbox_parse_size("test-util", "1kb", &size) == -1);
+    BBOX_CHECK(bbox_parse_size("test-util", "1x", &size) == -1);
+    BBOX_CHECK(size == 1);
+}
+
+int main()
+{
+    bbox_test_parse_seconds();
+    bbox_test_parse_size();
+    return BBOX_TEST_RESULT();
+}
@@ -28,7 +28,6 @@
 #include <errno.h>
 #include <getopt.h>
 #include <limits.h>
-#include <mntent.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/mount.h>
@@ -50,9 +49,23 @@ void bbox_umount_usage()
         "                                                                          \n"
         "  -h, --help             Print this help message and exit immediately.    \n"
         "                                                                          \n"
-        "  -m, --umount <fstype>  Unmount 'dev', 'proc', 'sys' or 'home'. If this  \n"
-        "                         option is not specified, then the default is to  \n"
-        "                         unmount all of them.                             \n"
+        "  -m, --umount <fstype>  Unmount 'dev', 'proc', 'sys', 'home', 'pkg-cache'\n"
+        "                         or 'tmp'. If this option is not specified, then  \n"
+        "                         the default is to unmount all of them.           \n"
+        "                                                                          \n"
+        "  --scratch <path>       Unmount the scratch space on <path>.             \n"
+        "                                                                          \n"
+        "  -a, --all              Unmount everything that is mounted anywhere      \n"
+        "                         inside the target, deepest mounts first.         \n"
+        "                                                                          \n"
+        "  -l, --lazy             Detach mounts that are still busy instead of     \n"
+        "                         failing. They are cleaned up by the kernel once  \n"
+        "                         they are no longer in use.                       \n"
+        "                                                                          \n"
+        "  -f, --force            Unmount even if other build-box sessions are     \n"
+        "                         still using the target. Without this option,     \n"
+        "                         the mounts are left to the last of them and the  \n"
+        "                         command exits with status 253.                   \n"
         "                                                                          \n"
     );
 }
@@ -67,14 +80,19 @@ int bbox_umount_getopt(bbox_conf_t *conf, int argc, char * const argv[])
         {"help",     no_argument,       0, 'h'},
         {"targets",  required_argument, 0, 't'},
         {"umount",   required_argument, 0, 'm'},
+        {"all",      no_argument,       0, 'a'},
+        {"lazy",     no_argument,       0, 'l'},
+        {"force",    no_argument,       0, 'f'},
+        {"scratch",  required_argument, 0, 's'},
         { 0,         0,                 0,  0 }
     };
 
     bbox_config_set_mount_all(conf);
+    bbox_config_set_mount_tmp(conf);
     optind = 1;
 
     while(1) {
-        c = getopt_long(argc, argv, ":ht:m:", long_options, &option_index);
+        c = getopt_long(argc, argv, ":ht:m:alf", long_options, &option_index);
 
         if(c == -1)
             break;
@@ -98,6 +116,10 @@ int bbox_umount_getopt(bbox_conf_t *conf, int argc, char * const argv[])
                     bbox_config_unset_mount_sys(conf);
                 } else if(!strcmp(optarg, "home")) {
                     bbox_config_unset_mount_home(conf);
+                } else if(!strcmp(optarg, "pkg-cache")) {
+                    bbox_config_unset_mount_pkg_cache(conf);
+                } else if(!strcmp(optarg, "tmp")) {
+                    bbox_config_unset_mount_tmp(conf);
                 } else {
                     bbox_perror("umount", "unknown file system specifier "
                             "'%s'.\n", optarg);
@@ -105,6 +127,21 @@ int bbox_umount_getopt(bbox_conf_t *conf, int argc, char * const argv[])
                 }
 
                 break;
+            case 'a':
+                bbox_config_set_umount_all(conf);
+                break;
+            case 'l':
+                bbox_config_set_umount_lazy(conf);
+                break;
+            case 'f':
+                bbox_config_set_umount_force(conf);
+                break;
+            case 's':
+                do_umount_all = 0;
+
+                if(bbox_config_add_scratch(conf, optarg) == -1)
+                    return -2;
+                break;
             case '?':
             case ':':
                 bbox_umount_usage();
@@ -115,6 +152,12 @@ int bbox_umount_getopt(bbox_conf_t *conf, int argc, char * const argv[])
         }
     }
 
+    if(bbox_config_get_umount_all(conf) && !do_umount_all) {
+        bbox_perror("umount", "option '--all' can't be combined with "
+                "'--umount' or '--scratch'.\n");
+        return -2;
+    }
+
     if(do_umount_all)
         bbox_config_clear_mount(conf);
 
@@ -126,7 +169,8 @@ int bbox_umount_getopt(bbox_conf_t *conf, int argc, char * const argv[])
     return optind;
 }
 
-int bbox_umount_unbind(const char *sys_root, const char *mount_point)
+int bbox_umount_unbind(bbox_mtab_t *mtab, const char *sys_root,
+        const char *mount_point, int umount_flags)
 {
     char *buf = NULL;
     size_t buf_len = 0;
@@ -146,6 +190,14 @@ int bbox_umount_unbind(const char *sys_root, const char *mount_point)
         return -1;
     }
 
+    /*
+     * We never mount on top of symbolic links, so there is nothing to do.
+     */
+    if(S_ISLNK(st.st_mode)) {
+        free(buf);
+        return 0;
+    }
+
     /*
      * At this point, we have already checked that sys_root belongs to the user
      * who launched build box. Now we have to ensure that the given mountpoint
@@ -158,7 +210,7 @@ int bbox_umount_unbind(const char *sys_root, const char *mount_point)
         return -1;
     }
 
-    is_mounted = bbox_mount_is_mounted(buf);
+    is_mounted = bbox_mount_is_mounted(mtab, buf);
 
     if(is_mounted <= 0) {
         free(buf);
@@ -178,7 +230,7 @@ int bbox_umount_unbind(const char *sys_root, const char *mount_point)
         return -1;
     }
 
-    if(umount(buf) != 0) {
+    if(umount2(buf, umount_flags) != 0) {
         bbox_perror("umount", "failed to unmount %s: %s\n", buf,
                 strerror(errno));
         rval = -1;
@@ -187,15 +239,127 @@ int bbox_umount_unbind(const char *sys_root, const char *mount_point)
     if(bbox_lower_privileges() == -1)
         rval = -1;
 
+    if(rval == 0)
+        bbox_mount_set_unmounted(mtab, buf);
+
     free(buf);
     return rval;
 }
 
+/*
+ * Unmounts everything below `sys_root`, deepest mounts first. The list of
+ * mounts is taken from the mount table in one go, so that submounts created
+ * from inside the chroot are caught, too.
+ *
+ * A mount may be hidden by another one stacked on top of a parent directory,
+ * or may be kept busy by its submounts. Such mounts are retried after the
+ * others have been unmounted, as long as there is progress.
+ */
+int bbox_umount_recursive(bbox_mtab_t *mtab, const char *sys_root,
+        int umount_flags)
+{
+    char *real_root = NULL;
+    char **mnt_dirs = NULL;
+    int *last_errno = NULL;
+    size_t num_mnt_dirs = 0;
+    size_t num_left = 0;
+    int rval = -1;
+
+    if(!(real_root = realpath(sys_root, NULL))) {
+        bbox_perror("umount", "unable to normalize path %s: %s.\n",
+                sys_root, strerror(errno));
+        return -1;
+    }
+
+    if(bbox_mtab_list_under(mtab, real_root, &mnt_dirs, &num_mnt_dirs) == -1)
+        goto cleanup_and_exit;
+
+    if(!(last_errno = calloc(sizeof(int), num_mnt_dirs + 1))) {
+        bbox_perror("umount", "out of memory?\n");
+        goto cleanup_and_exit;
+    }
+
+    if(bbox_raise_privileges() == -1)
+        goto cleanup_and_exit;
+
+    num_left = num_mnt_dirs;
+
+    while(num_left > 0) {
+        size_t num_done = 0;
+
+        for(size_t i = 0; i < num_mnt_dirs; i++) {
+            if(!mnt_dirs[i])
+                continue;
+
+            /*
+             * The chroot is writable by the user, so make sure that the path
+             * still resolves to exactly the mount point the kernel reported.
+             */
+            char *real_dir = realpath(mnt_dirs[i], NULL);
+            int is_same = real_dir && !strcmp(real_dir, mnt_dirs[i]);
+
+            last_errno[i] = real_dir ? EXDEV : errno;
+            free(real_dir);
+
+            if(!is_same)
+                continue;
+
+            if(umount2(mnt_dirs[i], umount_flags | UMOUNT_NOFOLLOW) != 0) {
+                last_errno[i] = errno;
+                continue;
+            }
+
+            bbox_mtab_remove(mtab, mnt_dirs[i]);
+            free(mnt_dirs[i]);
+            mnt_dirs[i] = NULL;
+            num_done++;
+        }
+
+        if(num_done == 0)
+            break;
+
+        num_left -= num_done;
+    }
+
+    rval = 0;
+
+    if(bbox_lower_privileges() == -1)
+        rval = -1;
+
+    for(size_t i = 0; i < num_mnt_dirs; i++) {
+        if(!mnt_dirs[i])
+            continue;
+
+        /*
+         * Not a mount point anymore or gone altogether. This happens to
+         * submounts of mounts that were detached.
+         */
+        if(last_errno[i] == EINVAL || last_errno[i] == ENOENT)
+            continue;
+
+        bbox_perror("umount", "failed to unmount %s: %s\n", mnt_dirs[i],
+                strerror(last_errno[i]));
+        rval = -1;
+    }
+
+cleanup_and_exit:
+
+    for(size_t i = 0; i < num_mnt_dirs; i++)
+        free(mnt_dirs[i]);
+    free(mnt_dirs);
+    free(last_errno);
+    free(real_root);
+    return rval;
+}
+
 int bbox_umount_any(const bbox_conf_t *conf, const char *sys_root)
 {
     struct stat st;
     char *buf = NULL;
     size_t buf_len = 0;
+    bbox_mtab_t *mtab = NULL;
+    int lock_fd = -1;
+    int rval = -1;
 
     uid_t uid = getuid();
 
@@ -206,17 +370,81 @@ int bbox_umount_any(const bbox_conf_t *conf, const char *sys_root)
     if(bbox_isdir_and_owned_by("umount", sys_root, uid) == -1)
         return -1;
 
+    /*
+     * Leave the mounts in place as long as anybody else holds a lease on the
+     * target. The last one to let go will clean up. Tell the caller with -2.
+     */
+    lock_fd = bbox_lease_try_exclusive("umount", sys_root);
+
+    if(lock_fd == -1)
+        return -1;
+    if(lock_fd == -2 && !bbox_config_get_umount_force(conf))
+        return -2;
+
+    /*
+     * Answer the checks below from the target's journal where possible, and
+     * from a single snapshot of the mount table otherwise.
+     */
+    if(!(mtab = bbox_mtab_open(sys_root)))
+        goto cleanup_and_exit;
+
+    int umount_flags = bbox_config_get_umount_lazy(conf) ? MNT_DETACH : 0;
+
+    if(bbox_config_get_umount_all(conf)) {
+        if(bbox_umount_recursive(mtab, sys_root, umount_flags) == -1)
+            goto cleanup_and_exit;
+
+        /*
+         * Our own lock would keep the overlay of a layered target busy.
+         */
+        close(lock_fd);
+        lock_fd = -1;
+
+        rval = bbox_layer_disassemble(sys_root, umount_flags);
+        goto cleanup_and_exit;
+    }
+
+    /*
+     * Scratch space may live below any of the other mount points, so it goes
+     * first, in the reverse order of mounting.
+     */
+    for(size_t i = bbox_config_get_num_scratch(conf); i > 0; i--) {
+        const bbox_scratch_t *scratch = bbox_config_get_scratch(conf, i - 1);
+
+        if(bbox_umount_unbind(mtab, sys_root, scratch->path,
+                    umount_flags) < 0)
+        {
+            goto cleanup_and_exit;
+        }
+    }
+
+    if(!bbox_config_get_mount_tmp(conf)) {
+        if(bbox_umount_unbind(mtab, sys_root, "/tmp", umount_flags) < 0)
+            goto cleanup_and_exit;
+    }
+
     if(!bbox_config_get_mount_dev(conf)) {
-        if(bbox_umount_unbind(sys_root, "/dev") < 0)
-            return -1;
+        if(bbox_umount_unbind(mtab, sys_root, "/dev/pts", umount_flags) < 0)
+            goto cleanup_and_exit;
+        if(bbox_umount_unbind(mtab, sys_root, "/dev/shm", umount_flags) < 0)
+            goto cleanup_and_exit;
+        if(bbox_umount_unbind(mtab, sys_root, "/dev", umount_flags) < 0)
+            goto cleanup_and_exit;
     }
     if(!bbox_config_get_mount_proc(conf)) {
-        if(bbox_umount_unbind(sys_root, "/proc") < 0)
-            return -1;
+        if(bbox_umount_unbind(mtab, sys_root, "/proc", umount_flags) < 0)
+            goto cleanup_and_exit;
     }
     if(!bbox_config_get_mount_sys(conf)) {
-        if(bbox_umount_unbind(sys_root, "/sys") < 0)
-            return -1;
+        if(bbox_umount_unbind(mtab, sys_root, "/sys", umount_flags) < 0)
+            goto cleanup_and_exit;
+    }
+    if(!bbox_config_get_mount_pkg_cache(conf)) {
+        if(bbox_umount_unbind(mtab, sys_root, BBOX_PKG_CACHE_DIR,
+                    umount_flags) < 0)
+        {
+            goto cleanup_and_exit;
+        }
     }
 
     /*
@@ -233,13 +461,12 @@ int bbox_umount_any(const bbox_conf_t *conf, const char *sys_root)
         if(lstat(buf, &st) == -1) {
             /* ...unless it doesn't exist. */
             if(errno == ENOENT) {
-                free(buf);
-                return 0;
+                rval = 0;
+                goto cleanup_and_exit;
             }
             bbox_perror("umount", "could not stat '%s': %s.\n", buf,
                     strerror(errno));
-            free(buf);
-            return -1;
+            goto cleanup_and_exit;
         }
 
         /* 
@@ -247,8 +474,7 @@ int bbox_umount_any(const bbox_conf_t *conf, const char *sys_root)
          */
         if(S_ISLNK(st.st_mode) || !S_ISDIR(st.st_mode)) {
             bbox_perror("umount", "%s is not a directory.\n", buf);
-            free(buf);
-            return -1;
+            goto cleanup_and_exit;
         }
 
         /* 
@@ -260,18 +486,24 @@ int bbox_umount_any(const bbox_conf_t *conf, const char *sys_root)
                 "directory '%s' is not owned by user id '%ld'.\n",
                 buf, (long) uid
             );
-            free(buf);
-            return -1;
+            goto cleanup_and_exit;
         }
 
-        if(bbox_umount_unbind(sys_root, homedir) < 0) {
-            free(buf);
-            return -1;
-        }
+        if(bbox_umount_unbind(mtab, sys_root, homedir, umount_flags) < 0)
+            goto cleanup_and_exit;
     }
 
+    rval = 0;
+
+cleanup_and_exit:
+
+    if(mtab)
+        bbox_mtab_sync(mtab);
+    bbox_mtab_free(mtab);
+    if(lock_fd >= 0)
+        close(lock_fd);
     free(buf);
-    return 0;
+    return rval;
 }
 
 int bbox_umount(int argc, char * const argv[])
@@ -317,10 +549,19 @@ int bbox_umount(int argc, char * const argv[])
         goto cleanup_and_exit;
     }
 
-    rval = BBOX_ERR_RUNTIME;
-
-    if(bbox_umount_any(conf, buf) == 0)
-        rval = 0;
+    switch(bbox_umount_any(conf, buf)) {
+        case 0:
+            rval = 0;
+            break;
+        case -2:
+            bbox_pnotice("umount", "target '%s' is still in use, leaving it "
+                "mounted.\n", target);
+            rval = BBOX_ERR_BUSY;
+            break;
+        default:
+            rval = BBOX_ERR_RUNTIME;
+            break;
+    }
 
 cleanup_and_exit:
 
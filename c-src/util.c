@@ -288,6 +288,25 @@ void bbox_perror(const char *lead, const char *format, ...)
     va_end(ap);
 }
 
+void bbox_pnotice(const char *lead, const char *format, ...)
+{
+    va_list ap;
+    va_start(ap, format);
+
+    char *bold = "\033[1m";
+    char *rst  = "\033[0m";
+
+    if(isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "%sbuild-box %s%s: %snotice%s: ",
+            bold, lead, rst, bold, rst);
+    } else {
+        fprintf(stderr, "build-box-do %s: notice: ", lead);
+    }
+    vfprintf(stderr, format, ap);
+
+    va_end(ap);
+}
+
 int bbox_login_sh_chrooted(char *sys_root, char *home_dir)
 {
     static char *shells[] = {"/tools/bin/sh", "/usr/bin/sh", NULL};
@@ -771,26 +790,80 @@ int bbox_isdir_and_owned_by(const char *module, const char *dir, uid_t uid)
     return 0;
 }
 
+/*
+ * Makes sure that `fd` refers to a file that only root can change. That's
+ * what we require of anything an administrator provides and we use with
+ * privileges.
+ */
+int bbox_is_admin_owned(const char *module, int fd, const char *path)
+{
+    struct stat st;
+
+    if(fstat(fd, &st) == -1) {
+        bbox_perror(module, "could not stat '%s': %s.\n", path,
+                strerror(errno));
+        return -1;
+    }
+
+    if(st.st_uid != 0 || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        bbox_perror(module, "'%s' must belong to root and must not be "
+                "writable by anyone else.\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Creates `path` and any missing parents, like `mkdir -p` would. This runs
+ * with the privileges the caller has at the moment.
+ */
 int bbox_mkdir_p(const char *module, const char *path)
 {
-    char *out_buf = NULL;
-    size_t out_buf_len = 0;
-    char * const argv[] = {"mkdir", "-p", (char*) path, NULL};
+    struct stat st;
+    char *buf = NULL;
+    int rval = -1;
+
+    if((buf = strdup(path)) == NULL) {
+        bbox_perror(module, "out of memory!\n");
+        abort();
+    }
+
+    for(char *p = buf + 1; ; p++) {
+        if(*p != '/' && *p != '\0')
+            continue;
 
-    int rval = bbox_run_command_capture(getuid(), "mkdir", argv, &out_buf,
-            &out_buf_len);
+        char c = *p;
+        *p = '\0';
 
-    if(rval != 0) {
-        if(out_buf) {
-            bbox_perror(
-                module, "failed to create directory %s: \"%s\".\n",
-                path, out_buf
-            );
+        if(p[-1] != '/' && mkdir(buf, 0777) == -1 && errno != EEXIST) {
+            bbox_perror(module, "failed to create directory %s: %s.\n",
+                    buf, strerror(errno));
+            goto cleanup_and_exit;
         }
 
-        rval = -1;
+        *p = c;
+
+        if(c == '\0')
+            break;
+    }
+
+    if(stat(path, &st) == -1) {
+        bbox_perror(module, "failed to create directory %s: %s.\n", path,
+                strerror(errno));
+        goto cleanup_and_exit;
+    }
+
+    if(!S_ISDIR(st.st_mode)) {
+        bbox_perror(module, "%s is not a directory.\n", path);
+        goto cleanup_and_exit;
     }
 
+    rval = 0;
+
+cleanup_and_exit:
+
+    free(buf);
     return rval;
 }
 
@@ -856,55 +929,53 @@ cleanup_and_exit:
     return rval;
 }
 
-int bbox_try_fix_pkg_cache_symlink(char *module) {
-    int rval = 0;
-    struct stat link_st;
-    char *out_buf = NULL;
-    size_t out_buf_len = 0;
+/*
+ * Runs at the root of the target. opkg keeps its cache in /var/cache/opkg,
+ * where `build-box mount` puts the user's package cache. Older targets point
+ * opkg at /.pkg-cache instead, which links to the cache directory on the
+ * host. That path is made a link to /var/cache/opkg, so that these targets
+ * use the mounted cache, too.
+ */
+int bbox_try_fix_pkg_cache_symlink(char *module)
+{
+    char buf[PATH_MAX];
+    struct stat st;
+
+    ssize_t nbytes = readlink(BBOX_PKG_CACHE_LINK, buf, sizeof(buf));
 
-    if(lstat("/.pkg-cache", &link_st) == -1) {
-        return symlink("/var/cache/opkg", "/.pkg-cache");
+    if(nbytes == -1) {
+        if(errno == ENOENT)
+            return symlink(BBOX_PKG_CACHE_DIR, BBOX_PKG_CACHE_LINK);
+        return -1;
     }
 
-    size_t bufsize = link_st.st_size ? link_st.st_size + 1 : PATH_MAX;
-    char *buf = malloc(bufsize);
+    if(nbytes >= (ssize_t) sizeof(buf))
+        return -1;
 
-    if(buf == NULL) {
-        bbox_perror(module, "out of memory?\n");
-        abort();
-    }
+    buf[nbytes] = '\0';
 
-    int nbytes = readlink("/.pkg-cache", buf, bufsize);
+    if(buf[0] != '/' || lstat(buf, &st) == 0)
+        return 0;
 
-    if(nbytes < 0 || nbytes >= bufsize) {
-        rval = -1;
-        goto cleanup_and_exit;
-    }
+    if(!strcmp(buf, BBOX_PKG_CACHE_DIR))
+        return bbox_mkdir_p(module, buf);
 
-    buf[bufsize - 1] = '\0';
+    char *slash = strrchr(buf, '/');
 
-    char * const argv[] = {"mkdir", "-p", (char*const) buf, NULL};
-    if(bbox_run_command_capture(getuid(), "mkdir", argv, &out_buf,
-            &out_buf_len) != 0)
-    {
-        if(out_buf) {
-            bbox_perror(
-                module,
-                "warning: failed to fix /.pkg-cache symlink: %s\n",
-                out_buf
-            );
-        } else {
-            bbox_perror(
-                module, "warning: failed to fix /.pkg-cache symlink.\n"
-            );
-        }
+    if(slash != buf) {
+        *slash = '\0';
+        if(bbox_mkdir_p(module, buf) == -1)
+            return -1;
+        *slash = '/';
     }
 
-cleanup_and_exit:
+    if(symlink(BBOX_PKG_CACHE_DIR, buf) == -1 && errno != EEXIST) {
+        bbox_perror(module, "warning: failed to fix %s symlink: %s.\n",
+                BBOX_PKG_CACHE_LINK, strerror(errno));
+        return -1;
+    }
 
-    free(buf);
-    free(out_buf);
-    return rval;
+    return 0;
 }
 
 char *bbox_get_user_dir(uid_t uid, size_t *n_ptr)
@@ -972,3 +1043,135 @@ int validate_target_name(const char *module, const char *target_name)
 
     return 0;
 }
+
+int bbox_parse_seconds(const char *module, const char *str,
+        unsigned int *seconds_ptr)
+{
+    char *end_ptr = NULL;
+
+    errno = 0;
+    unsigned long seconds = strtoul(str, &end_ptr, 10);
+
+    if(errno || !*str || *end_ptr || str[0] == '-' || seconds > UINT_MAX) {
+        bbox_perror(module, "invalid number of seconds '%s'.\n", str);
+        return -1;
+    }
+
+    *seconds_ptr = (unsigned int) seconds;
+    return 0;
+}
+
+unsigned long long bbox_get_phys_mem()
+{
+    long num_pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    if(num_pages <= 0 || page_size <= 0)
+        return 0;
+
+    return (unsigned long long) num_pages * (unsigned long long) page_size;
+}
+
+/*
+ * Reads the start time of a process in clock ticks since boot. Returns 0 if
+ * the process doesn't exist or has already terminated.
+ */
+unsigned long long bbox_get_start_time(pid_t pid)
+{
+    char path[64];
+    char buf[1024];
+    unsigned long long start_time = 0;
+
+    snprintf(path, sizeof(path), "/proc/%ld/stat", (long) pid);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if(fd == -1)
+        return 0;
+
+    ssize_t num_read = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+
+    if(num_read <= 0)
+        return 0;
+
+    buf[num_read] = '\0';
+
+    /*
+     * The command name may contain anything, so skip past its closing
+     * parenthesis. The start time is the 22nd field.
+     */
+    char *ptr = strrchr(buf, ')');
+
+    if(!ptr)
+        return 0;
+
+    if(ptr[1] != ' ' || ptr[2] == 'Z' || ptr[2] == 'X')
+        return 0;
+
+    for(int field = 2; field < 22 && ptr; field++)
+        ptr = strchr(ptr + 1, ' ');
+
+    if(ptr)
+        start_time = strtoull(ptr + 1, NULL, 10);
+
+    return start_time;
+}
+
+/*
+ * Parses a size in bytes with an optional suffix 'k', 'm', 'g' or 't', or a
+ * percentage of the physical memory with the suffix '%'.
+ */
+int bbox_parse_size(const char *module, const char *str,
+        unsigned long long *size_ptr)
+{
+    char *end_ptr = NULL;
+    unsigned int shift = 0;
+
+    errno = 0;
+    unsigned long long size = strtoull(str, &end_ptr, 10);
+
+    if(errno || !*str || str[0] == '-' || end_ptr == str)
+        goto failure;
+
+    switch(*end_ptr) {
+        case '\0':
+            break;
+        case 't':
+        case 'T':
+            shift += 10;
+            /* fall through */
+        case 'g':
+        case 'G':
+            shift += 10;
+            /* fall through */
+        case 'm':
+        case 'M':
+            shift += 10;
+            /* fall through */
+        case 'k':
+        case 'K':
+            shift += 10;
+            end_ptr++;
+            break;
+        case '%':
+            if(size > 100)
+                goto failure;
+            size = bbox_get_phys_mem() / 100 * size;
+            end_ptr++;
+            break;
+        default:
+            goto failure;
+    }
+
+    if(*end_ptr || size == 0 || size > (ULLONG_MAX >> shift))
+        goto failure;
+
+    *size_ptr = size << shift;
+    return 0;
+
+failure:
+
+    bbox_perror(module, "invalid size '%s'.\n", str);
+    return -1;
+}
@@ -0,0 +1,448 @@
+# -*- encoding: utf-8 -*-
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+import concurrent.futures
+import decimal
+import gzip
+import json
+import logging
+import os
+import tarfile
+import threading
+
+from yaybondi.buildbox.error import BuildBoxError
+
+LOGGER = logging.getLogger(__name__)
+
+XATTR_PREFIX = "SCHILY.xattr."
+
+# Remembers what the entries of an imported target really are, where the
+# user can't make them so: owners other than the user, device nodes and
+# attributes outside of the user name space. `build-box export` puts them
+# back into the archive, so nothing needs privileges on either end. The
+# manifest is tied to the inode of the target directory and is ignored once
+# that has changed.
+class ArchiveManifest:
+
+    @classmethod
+    def load(cls, path, target_dir):
+        try:
+            with gzip.open(path, "rt", encoding="utf-8") as f:
+                manifest = json.load(f)
+        except FileNotFoundError:
+            return {}
+
+        if manifest.get("inode") != os.stat(target_dir).st_ino:
+            return {}
+        return manifest["entries"]
+    #end function
+
+    @classmethod
+    def save(cls, path, target_dir, entries):
+        if not entries:
+            cls.remove(path)
+            return
+
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        tmp_path = path + ".tmp"
+
+        with gzip.open(tmp_path, "wt", encoding="utf-8") as f:
+            json.dump({
+                "inode": os.stat(target_dir).st_ino, "entries": entries
+            }, f)
+
+        os.rename(tmp_path, path)
+    #end function
+
+    @classmethod
+    def remove(cls, path):
+        try:
+            os.unlink(path)
+        except FileNotFoundError:
+            pass
+    #end function
+
+#end class
+
+# Writes a target as a tar archive, with the privileges of the user. The
+# manifest has the last word on owners, modes and attributes, and supplies
+# the device nodes that aren't on disk.
+class ArchiveWriter:
+
+    def __init__(self, target_dir, manifest=None):
+        self._target_dir = os.path.realpath(target_dir)
+        self._manifest = manifest or {}
+        self._dirs = set()
+    #end function
+
+    # Every directory comes right before its contents, which is what the
+    # extractor expects.
+    def write(self, fileobj):
+        with tarfile.open(fileobj=fileobj, mode="w|",
+                format=tarfile.PAX_FORMAT) as tar:
+            self._add(tar, ".")
+            pending = ["."]
+
+            while pending:
+                rel_dir = pending.pop()
+                sub_dirs = []
+
+                with os.scandir(os.path.join(self._target_dir, rel_dir)) \
+                        as it:
+                    entries = sorted(it, key=lambda entry: entry.name)
+
+                for entry in entries:
+                    rel_path = os.path.normpath(
+                        os.path.join(rel_dir, entry.name)
+                    )
+                    if self._add(tar, rel_path) and \
+                            entry.is_dir(follow_symlinks=False):
+                        sub_dirs.append(rel_path)
+                #end for
+
+                pending.extend(reversed(sub_dirs))
+            #end while
+
+            for rel_path, attrs in sorted(self._manifest.items()):
+                if "device" in attrs:
+                    self._add_device(tar, rel_path, attrs)
+        #end with
+    #end function
+
+    def _add(self, tar, rel_path):
+        path = os.path.join(self._target_dir, rel_path)
+        st = os.lstat(path)
+        tarinfo = tar.gettarinfo(path, arcname=rel_path)
+
+        # Sockets don't go into archives, the program that made them makes
+        # them again.
+        if tarinfo is None:
+            LOGGER.warning("leaving out socket '{}'.".format(rel_path))
+            return False
+
+        attrs = self._manifest.get(rel_path, {})
+        tarinfo.uid = attrs.get("uid", tarinfo.uid)
+        tarinfo.gid = attrs.get("gid", tarinfo.gid)
+        tarinfo.mode = attrs.get("mode", tarinfo.mode)
+        tarinfo.uname = tarinfo.gname = ""
+        tarinfo.pax_headers = self._pax_headers(path, attrs, st.st_mtime_ns)
+
+        if tarinfo.isreg():
+            with open(path, "rb") as f:
+                tar.addfile(tarinfo, f)
+        else:
+            tar.addfile(tarinfo)
+
+        if tarinfo.isdir():
+            self._dirs.add(rel_path)
+        return True
+    #end function
+
+    # Device nodes only go in where their directory went in and where
+    # nothing else has taken their place.
+    def _add_device(self, tar, rel_path, attrs):
+        if (os.path.dirname(rel_path) or ".") not in self._dirs or \
+                os.path.lexists(os.path.join(self._target_dir, rel_path)):
+            return
+
+        kind, major, minor = attrs["device"]
+
+        tarinfo = tarfile.TarInfo(rel_path)
+        tarinfo.type = tarfile.CHRTYPE if kind == "c" else tarfile.BLKTYPE
+        tarinfo.devmajor, tarinfo.devminor = major, minor
+        tarinfo.uid, tarinfo.gid = attrs["uid"], attrs["gid"]
+        tarinfo.mode = attrs["mode"]
+        tarinfo.mtime = attrs["mtime"] // 1000000000
+        tarinfo.pax_headers = self._pax_headers(None, attrs, attrs["mtime"])
+
+        tar.addfile(tarinfo)
+    #end function
+
+    # Keeps the timestamp down to the nanosecond and the attributes that
+    # the user can read, plus those the manifest knows about.
+    def _pax_headers(self, path, attrs, mtime_ns):
+        sec, nsec = divmod(mtime_ns, 1000000000)
+        pax_headers = {"mtime": "{}.{:09d}".format(sec, nsec)}
+
+        for name in os.listxattr(path, follow_symlinks=False) if path else []:
+            try:
+                value = os.getxattr(path, name, follow_symlinks=False)
+            except OSError:
+                continue
+
+            pax_headers[XATTR_PREFIX + name] = \
+                value.decode("utf-8", "surrogateescape")
+        #end for
+
+        for name, value in attrs.get("xattrs", {}).items():
+            pax_headers[XATTR_PREFIX + name] = value
+
+        return pax_headers
+    #end function
+
+#end class
+
+# Unpacks an archive made by `build-box export` into an empty directory, with
+# the privileges of the user. The archive is read front to back, but files
+# are written out in parallel. Entries of the archive's owner become the
+# user's. Everything else about an entry that the user can't set is kept in a
+# manifest, so that an export of the target gives it back.
+class ArchiveExtractor:
+
+    # Files up to this size are read into memory and written out by the
+    # pool, larger ones are written out while they are read.
+    MAX_BUFFERED = 1024 * 1024
+
+    def __init__(self, target_dir, jobs=None):
+        self._target_dir = target_dir
+        self._jobs = jobs or os.cpu_count() or 1
+        self._owner = None
+        self._known_dirs = set(["."])
+        self._manifest = {}
+        self._dirs = []
+        self._links = []
+    #end function
+
+    # Extracts the archive read from `fileobj` and returns the manifest.
+    # Directories get their modes and timestamps last, deepest first.
+    def extract(self, fileobj):
+        slots = threading.BoundedSemaphore(self._jobs * 4)
+        pending = []
+
+        with concurrent.futures.ThreadPoolExecutor(self._jobs) as pool:
+            try:
+                with tarfile.open(fileobj=fileobj, mode="r|") as tar:
+                    for member in tar:
+                        job = self._extract_member(tar, member)
+                        if not job:
+                            continue
+
+                        slots.acquire()
+                        pending.append(pool.submit(*job))
+                        pending[-1].add_done_callback(
+                            lambda f: slots.release()
+                        )
+
+                        # Fail early if writing something went wrong.
+                        while pending and pending[0].done():
+                            pending.pop(0).result()
+                    #end for
+                #end with
+
+                for future in pending:
+                    future.result()
+            except BaseException:
+                for future in pending:
+                    future.cancel()
+                raise
+            #end try
+
+        for link_path, path in self._links:
+            os.link(link_path, path, follow_symlinks=False)
+
+        for rel_path, mode, mtime_ns in sorted(self._dirs, reverse=True):
+            path = os.path.join(self._target_dir, rel_path)
+            os.chmod(path, mode)
+            os.utime(path, ns=(mtime_ns, mtime_ns))
+        #end for
+
+        return self._manifest
+    #end function
+
+    # Creates the entry for `member` right away, or returns a job for the
+    # pool that does.
+    def _extract_member(self, tar, member):
+        rel_path = self._normalize(member.name)
+        path = os.path.join(self._target_dir, rel_path)
+
+        if rel_path != "." and \
+                (os.path.dirname(rel_path) or ".") not in self._known_dirs:
+            raise BuildBoxError(
+                "archive entry '{}' comes before its directory."
+                .format(member.name)
+            )
+        #end if
+
+        mode = member.mode & 0o7777
+        mtime_ns = self._mtime_ns(member)
+        xattrs = self._xattrs(member, rel_path,
+            in_manifest=member.issym() or member.ischr() or member.isblk())
+
+        # Whatever belongs to somebody else is readable and writable for the
+        # user, or exporting it again would fail.
+        if self._map_owner(member, rel_path, mode):
+            mode |= 0o700 if member.isdir() else 0o600
+
+        if member.isdir():
+            if rel_path != ".":
+                os.mkdir(path, 0o700)
+                self._known_dirs.add(rel_path)
+            self._set_xattrs(path, xattrs)
+            self._dirs.append((rel_path, mode, mtime_ns))
+            return None
+        elif rel_path == ".":
+            raise BuildBoxError("the archive is not a target.")
+        elif member.isreg():
+            fileobj = tar.extractfile(member)
+
+            if member.size <= self.MAX_BUFFERED:
+                return (self._write_file, path, fileobj.read(), False, mode,
+                    mtime_ns, xattrs)
+
+            self._write_file(path, fileobj, member.issparse(), mode,
+                mtime_ns, xattrs)
+        elif member.issym():
+            os.symlink(member.linkname, path)
+            os.utime(path, ns=(mtime_ns, mtime_ns), follow_symlinks=False)
+        elif member.islnk():
+            link_path = os.path.join(
+                self._target_dir, self._normalize(member.linkname)
+            )
+            self._links.append((link_path, path))
+        elif member.isfifo():
+            os.mkfifo(path, 0o600)
+            self._set_xattrs(path, xattrs)
+            os.chmod(path, mode)
+            os.utime(path, ns=(mtime_ns, mtime_ns))
+        elif member.ischr() or member.isblk():
+            self._remember(rel_path, uid=member.uid, gid=member.gid,
+                mode=member.mode & 0o7777, mtime=mtime_ns, device=[
+                    "c" if member.ischr() else "b", member.devmajor,
+                    member.devminor
+                ])
+        else:
+            raise BuildBoxError(
+                "archive entry '{}' is of an unknown type.".format(member.name)
+            )
+        #end if
+
+        return None
+    #end function
+
+    def _write_file(self, path, data, sparse, mode, mtime_ns, xattrs):
+        fd = os.open(
+            path, os.O_WRONLY | os.O_CREAT | os.O_EXCL | os.O_NOFOLLOW, 0o600
+        )
+
+        with os.fdopen(fd, "wb") as f:
+            if isinstance(data, bytes):
+                f.write(data)
+            else:
+                while True:
+                    chunk = data.read(self.MAX_BUFFERED)
+                    if not chunk:
+                        break
+
+                    # Holes stay holes.
+                    if sparse and chunk == bytes(len(chunk)):
+                        f.seek(len(chunk), os.SEEK_CUR)
+                    else:
+                        f.write(chunk)
+                #end while
+
+                f.truncate()
+            #end if
+
+            # Anything written after this would clear set-id bits and bump
+            # the timestamp.
+            f.flush()
+
+            # Writing user attributes takes write permission.
+            self._set_xattrs(f.fileno(), xattrs)
+            os.chmod(f.fileno(), mode)
+            os.utime(f.fileno(), ns=(mtime_ns, mtime_ns))
+        #end with
+    #end function
+
+    # The owner of the archived target is the owner of the archive's top
+    # directory. Entries of anybody else go into the manifest together with
+    # their mode. Returns True for those.
+    def _map_owner(self, member, rel_path, mode):
+        if self._owner is None:
+            self._owner = (member.uid, member.gid)
+        if (member.uid, member.gid) == self._owner:
+            return False
+
+        self._remember(rel_path, uid=member.uid, gid=member.gid, mode=mode)
+        return True
+    #end function
+
+    # Returns the user attributes of `member`. Attributes in other name
+    # spaces need privileges, those go into the manifest. So does everything
+    # if the entry can't have attributes on disk.
+    def _xattrs(self, member, rel_path, in_manifest=False):
+        xattrs = []
+
+        for key, value in member.pax_headers.items():
+            if not key.startswith(XATTR_PREFIX):
+                continue
+
+            name = key[len(XATTR_PREFIX):]
+
+            if in_manifest or not name.startswith("user."):
+                self._manifest.setdefault(rel_path, {}) \
+                    .setdefault("xattrs", {})[name] = value
+                continue
+            #end if
+
+            xattrs.append((name, value.encode("utf-8", "surrogateescape")))
+        #end for
+
+        return xattrs
+    #end function
+
+    def _set_xattrs(self, path, xattrs):
+        for name, value in xattrs:
+            os.setxattr(path, name, value)
+
+    def _remember(self, rel_path, **attrs):
+        self._manifest.setdefault(rel_path, {}).update(attrs)
+
+    # Extended headers have the timestamp down to the nanosecond, but tarfile
+    # turns it into a float.
+    def _mtime_ns(self, member):
+        mtime = member.pax_headers.get("mtime", member.mtime)
+
+        try:
+            return int(decimal.Decimal(mtime) * 1000000000)
+        except decimal.InvalidOperation:
+            return int(member.mtime * 1000000000)
+    #end function
+
+    def _normalize(self, name):
+        rel_path = os.path.normpath(name)
+
+        if rel_path.startswith("/") or rel_path == ".." or \
+                rel_path.startswith("../"):
+            raise BuildBoxError(
+                "archive entry '{}' points outside of the target."
+                .format(name)
+            )
+        #end if
+
+        return rel_path
+    #end function
+
+#end class
@@ -26,11 +26,13 @@
 import os
 import sys
 import getopt
+import keyword
 import textwrap
 
 from yaybondi.buildbox.misc.distribution import Distribution
 from yaybondi.buildbox.misc.paths import Paths
 from yaybondi.buildbox.target import BuildBoxTarget
+from yaybondi.buildbox.usage import DiskUsage
 from yaybondi.buildbox.error import BuildBoxError
 from yaybondi.miscellaneous.switch import switch
 from yaybondi.osimage.util import ImageGeneratorUtils
@@ -41,6 +43,9 @@ EXIT_ERROR = 1
 class BuildBoxCLI:
 
     def execute_command(self, command, *args):
+        # Commands that are Python keywords get a trailing underscore.
+        if keyword.iskeyword(command):
+            command += "_"
         getattr(self, command)(*args)
 
     def create(self, *args):
@@ -50,6 +55,7 @@ class BuildBoxCLI:
                 USAGE:
 
                   build-box create [OPTIONS] <new-target-name> <spec> ...
+                                             [-- <new-target-name> <spec> ...] ...
 
                 OPTIONS:
 
@@ -64,8 +70,27 @@ class BuildBoxCLI:
                   --repo-base <url>      Repository base URL up to and including the
                                          "dists" folder.
 
+                  -j, --jobs <num>       Number of targets to create in parallel, if more
+                                         than one is given (defaults to the number of
+                                         CPUs). Packages are downloaded only once.
+
                   --force                Overwrite an existing target with the same name.
+                  --from-oci <dir>:<tag>
+                                         Unpack the image with the given tag from a local
+                                         OCI image layout instead of installing packages.
+                                         The tag can be left out if there is only one
+                                         image. Specs are optional.
+                  --layered              Store only the differences to a base that is shared
+                                         by all layered targets of the same release,
+                                         architecture and C runtime (or OCI image).
+                  --no-cache             Build the target from scratch and don't keep a
+                                         copy of it. By default, targets made from the
+                                         same inputs are cloned from a cached copy.
                   --no-verify            Do not verify package list signatures.
+                  --size-limit <size>    Don't let the target grow beyond <size> bytes. The
+                                         suffixes K, M, G and T are understood. Requires
+                                         project quotas on the file system and a maximum
+                                         in /var/lib/build-box/quota-max.
                 """  # noqa
             ))
         #end inline function
@@ -81,22 +106,37 @@ class BuildBoxCLI:
                 Paths.target_prefix(),
             "force":
                 False,
+            "layered":
+                False,
+            "from_oci":
+                None,
+            "prebuilt":
+                True,
             "repo_base":
                 "http://archive.yaybondi.com/dists",
+            "size_limit":
+                None,
             "verify":
                 True
         }
 
+        jobs = None
+
         try:
             opts, args = getopt.getopt(
-                args, "a:c:hl:r:t:", [
+                args, "a:c:hj:l:r:t:", [
                     "arch=",
                     "force",
+                    "from-oci=",
                     "help",
+                    "jobs=",
+                    "layered",
                     "libc=",
+                    "no-cache",
                     "no-verify",
                     "release=",
                     "repo-base=",
+                    "size-limit=",
                     "targets="
                 ]
             )
@@ -119,6 +159,16 @@ class BuildBoxCLI:
                 if case("-l", "--libc"):
                     kwargs["libc"] = v.strip()
                     break
+                if case("-j", "--jobs"):
+                    try:
+                        jobs = int(v)
+                        if jobs < 1:
+                            raise ValueError()
+                    except ValueError:
+                        raise BuildBoxError(
+                            "invalid number of jobs: {}".format(v)
+                        )
+                    break
                 if case("-t", "--targets"):
                     kwargs["target_prefix"] = os.path.normpath(
                         os.path.realpath(v.strip())
@@ -127,12 +177,24 @@ class BuildBoxCLI:
                 if case("--force"):
                     kwargs["force"] = True
                     break
+                if case("--layered"):
+                    kwargs["layered"] = True
+                    break
+                if case("--from-oci"):
+                    kwargs["from_oci"] = v.strip()
+                    break
                 if case("--repo-base"):
                     kwargs["repo_base"] = v.strip()
                     break
+                if case("--no-cache"):
+                    kwargs["prebuilt"] = False
+                    break
                 if case("--no-verify"):
                     kwargs["verify"] = False
                     break
+                if case("--size-limit"):
+                    kwargs["size_limit"] = v.strip()
+                    break
             #end for
         #end for
 
@@ -156,20 +218,462 @@ class BuildBoxCLI:
                 .format(release, arch)
             )
 
-        if len(args) < 2:
+        # Several targets are separated by "--".
+        groups = [[]]
+        for arg in args:
+            if arg == "--":
+                groups.append([])
+            else:
+                groups[-1].append(arg)
+        #end for
+
+        targets = []
+
+        for group in groups:
+            if len(group) < (1 if kwargs["from_oci"] else 2):
+                usage()
+                sys.exit(EXIT_ERROR)
+
+            # We collect specfiles here so that we can error out early if
+            # there is a problem with one of them.
+            try:
+                specs = ImageGeneratorUtils.collect_specfiles(
+                    release, libc, arch, *group[1:]
+                )
+            except ImageGeneratorUtils.Error as e:
+                raise BuildBoxError(str(e))
+
+            targets.append((group[0], specs))
+        #end for
+
+        if len(targets) == 1:
+            BuildBoxTarget.create(targets[0][0], *targets[0][1], **kwargs)
+        else:
+            BuildBoxTarget.create_many(targets, jobs, **kwargs)
+    #end function
+
+    def prefetch(self, *args):
+        def usage():
+            print(textwrap.dedent(
+                """
+                USAGE:
+
+                  build-box prefetch [OPTIONS] <spec> ...
+
+                OPTIONS:
+
+                  -h, --help             Print this help message and exit immediately.
+
+                  -r, --release <name>   The name of the release, e.g. "ollie"
+                                         (defaults to latest).
+                  -a, --arch <arch>      The architecture (defaults to host arch).
+                  -l, --libc <libc>      The C runtime ("musl" or "glibc").
+                  -j, --jobs <num>       Number of packages to download in parallel
+                                         (defaults to the number of CPUs).
+
+                  --repo-base <url>      Repository base URL up to and including the
+                                         "dists" folder. May be a file:// URL.
+
+                Downloads all packages that the specs pull in to the package cache, so
+                that `build-box create` with the same options finds them there.
+                Checksums are verified against the package indices.
+                """  # noqa
+            ))
+        #end inline function
+
+        kwargs = {
+            "release":
+                Distribution.latest_release(),
+            "libc":
+                "musl",
+            "arch":
+                "x86_64",
+            "repo_base":
+                "http://archive.yaybondi.com/dists"
+        }
+
+        jobs = None
+
+        try:
+            opts, args = getopt.getopt(
+                args, "a:hj:l:r:", [
+                    "arch=",
+                    "help",
+                    "jobs=",
+                    "libc=",
+                    "release=",
+                    "repo-base="
+                ]
+            )
+        except getopt.GetoptError:
+            usage()
+            sys.exit(EXIT_ERROR)
+
+        for o, v in opts:
+            for case in switch(o):
+                if case("-h", "--help"):
+                    usage()
+                    sys.exit(EXIT_OK)
+                    break
+                if case("-r", "--release"):
+                    kwargs["release"] = v.strip()
+                    break
+                if case("-a", "--arch"):
+                    kwargs["arch"] = v.strip().replace("-", "_")
+                    break
+                if case("-l", "--libc"):
+                    kwargs["libc"] = v.strip()
+                    break
+                if case("-j", "--jobs"):
+                    try:
+                        jobs = int(v)
+                        if jobs < 1:
+                            raise ValueError()
+                    except ValueError:
+                        raise BuildBoxError(
+                            "invalid number of jobs: {}".format(v)
+                        )
+                    break
+                if case("--repo-base"):
+                    kwargs["repo_base"] = v.strip()
+                    break
+            #end for
+        #end for
+
+        release, libc, arch = kwargs["release"], kwargs["libc"], kwargs["arch"]
+
+        if not Distribution.valid_release(release):
+            raise BuildBoxError(
+                'release "{}" not found, run `bondi-distro-info refresh -r`.'
+                .format(release)
+            )
+
+        if not Distribution.valid_libc(release, libc):
+            raise BuildBoxError(
+                'release "{}" does not support C runtime library "{}".'
+                .format(release, libc)
+            )
+
+        if not Distribution.valid_arch(release, arch, libc=libc):
+            raise BuildBoxError(
+                'release "{}" does not support architecture "{}".'
+                .format(release, arch)
+            )
+
+        if len(args) < 1:
             usage()
             sys.exit(EXIT_ERROR)
 
-        # We collect specfiles here so that we can error out early if there is
-        # a problem with one of them.
         try:
             specs = ImageGeneratorUtils.collect_specfiles(
-                release, libc, arch, *args[1:]
+                release, libc, arch, *args
             )
         except ImageGeneratorUtils.Error as e:
             raise BuildBoxError(str(e))
 
-        BuildBoxTarget.create(args[0], *specs, **kwargs)
+        BuildBoxTarget.prefetch(*specs, jobs=jobs, **kwargs)
+    #end function
+
+    def clone(self, *args):
+        def usage():
+            print(textwrap.dedent(
+                """
+                USAGE:
+
+                  build-box clone [OPTIONS] <target-name> <new-target-name>
+
+                OPTIONS:
+
+                  -h, --help             Print this help message and exit immediately.
+
+                  -b, --backend <how>    How to copy the target: "snapshot" (btrfs),
+                                         "reflink", "hardlink" or "copy". The default is
+                                         a snapshot, else reflinks, else a plain copy.
+                  -j, --jobs <num>       Number of files to copy in parallel
+                                         (defaults to the number of CPUs).
+
+                With "hardlink", files below /usr and /tools are shared between the
+                targets. Package upgrades replace them, but changing one of them in
+                place changes it in both targets. It is never picked by default.
+                """  # noqa
+            ))
+
+        kwargs = {
+            "target_prefix":
+                Paths.target_prefix(),
+            "backend":
+                "auto",
+            "jobs":
+                None
+        }
+
+        try:
+            opts, args = getopt.getopt(
+                args, "b:hj:t:", ["backend=", "help", "jobs=", "targets="]
+            )
+        except getopt.GetoptError:
+            usage()
+            sys.exit(EXIT_ERROR)
+
+        for o, v in opts:
+            for case in switch(o):
+                if case("-h", "--help"):
+                    usage()
+                    sys.exit(EXIT_OK)
+                    break
+                if case("-b", "--backend"):
+                    kwargs["backend"] = v.strip()
+                    break
+                if case("-j", "--jobs"):
+                    try:
+                        kwargs["jobs"] = int(v)
+                        if kwargs["jobs"] < 1:
+                            raise ValueError()
+                    except ValueError:
+                        raise BuildBoxError(
+                            "invalid number of jobs: {}".format(v)
+                        )
+                    break
+                if case("-t", "--targets"):
+                    kwargs["target_prefix"] = os.path.normpath(
+                        os.path.realpath(v.strip())
+                    )
+                    break
+            #end for
+        #end for
+
+        if len(args) != 2:
+            usage()
+            sys.exit(EXIT_ERROR)
+
+        BuildBoxTarget.clone(args[0], args[1], **kwargs)
+    #end function
+
+    def rebase(self, *args):
+        def usage():
+            print(textwrap.dedent(
+                """
+                USAGE:
+
+                  build-box rebase [OPTIONS] <target-name>
+
+                OPTIONS:
+
+                  -h, --help                 Print this help message and exit immediately.
+
+                  -o, --onto <target-name>   The target to take changes from (required).
+                  -f, --force                Take the version from the other target also
+                                             for files that were changed locally.
+                  -j, --jobs <num>           Number of files to compare and copy in parallel
+                                             (defaults to the number of CPUs).
+
+                Brings the files that came from the other target up to date, e.g. after
+                a toolchain update, without touching what was installed or changed
+                locally. Targets made with `build-box clone` remember what they were
+                copied from. For other targets, all files that the other target has are
+                overwritten and nothing is removed.
+
+                Don't use the target while it is being rebased.
+                """  # noqa
+            ))
+
+        kwargs = {
+            "target_prefix":
+                Paths.target_prefix(),
+            "force":
+                False,
+            "jobs":
+                None
+        }
+
+        golden_name = None
+
+        try:
+            opts, args = getopt.getopt(
+                args, "fhj:o:t:", ["force", "help", "jobs=", "onto=",
+                    "targets="]
+            )
+        except getopt.GetoptError:
+            usage()
+            sys.exit(EXIT_ERROR)
+
+        for o, v in opts:
+            for case in switch(o):
+                if case("-h", "--help"):
+                    usage()
+                    sys.exit(EXIT_OK)
+                    break
+                if case("-f", "--force"):
+                    kwargs["force"] = True
+                    break
+                if case("-j", "--jobs"):
+                    try:
+                        kwargs["jobs"] = int(v)
+                        if kwargs["jobs"] < 1:
+                            raise ValueError()
+                    except ValueError:
+                        raise BuildBoxError(
+                            "invalid number of jobs: {}".format(v)
+                        )
+                    break
+                if case("-o", "--onto"):
+                    golden_name = v.strip()
+                    break
+                if case("-t", "--targets"):
+                    kwargs["target_prefix"] = os.path.normpath(
+                        os.path.realpath(v.strip())
+                    )
+                    break
+            #end for
+        #end for
+
+        if len(args) != 1 or not golden_name:
+            usage()
+            sys.exit(EXIT_ERROR)
+
+        BuildBoxTarget.rebase(args[0], golden_name, **kwargs)
+    #end function
+
+    def export(self, *args):
+        def usage():
+            print(textwrap.dedent(
+                """
+                USAGE:
+
+                  build-box export [OPTIONS] <target-name>
+
+                OPTIONS:
+
+                  -h, --help          Print this help message and exit immediately.
+
+                  -j, --jobs <num>    Number of compression threads (defaults to the
+                                      number of CPUs).
+
+                Writes the target to stdout as a zstd compressed tar archive, which
+                `build-box import` reads back in, e.g.
+
+                  build-box export foo | ssh otherhost build-box import foo
+
+                The target is read with the privileges of the user and must not be
+                mounted. Owners, device nodes and attributes of an imported target are
+                written the way they were imported.
+                """  # noqa
+            ))
+
+        kwargs = {
+            "target_prefix":
+                Paths.target_prefix(),
+            "jobs":
+                None
+        }
+
+        try:
+            opts, args = getopt.getopt(
+                args, "hj:t:", ["help", "jobs=", "targets="]
+            )
+        except getopt.GetoptError:
+            usage()
+            sys.exit(EXIT_ERROR)
+
+        for o, v in opts:
+            for case in switch(o):
+                if case("-h", "--help"):
+                    usage()
+                    sys.exit(EXIT_OK)
+                    break
+                if case("-j", "--jobs"):
+                    try:
+                        kwargs["jobs"] = int(v)
+                        if kwargs["jobs"] < 1:
+                            raise ValueError()
+                    except ValueError:
+                        raise BuildBoxError(
+                            "invalid number of jobs: {}".format(v)
+                        )
+                    break
+                if case("-t", "--targets"):
+                    kwargs["target_prefix"] = os.path.normpath(
+                        os.path.realpath(v.strip())
+                    )
+                    break
+            #end for
+        #end for
+
+        if len(args) != 1:
+            usage()
+            sys.exit(EXIT_ERROR)
+
+        BuildBoxTarget.export(args[0], **kwargs)
+    #end function
+
+    def import_(self, *args):
+        def usage():
+            print(textwrap.dedent(
+                """
+                USAGE:
+
+                  build-box import [OPTIONS] <new-target-name>
+
+                OPTIONS:
+
+                  -h, --help          Print this help message and exit immediately.
+
+                  -j, --jobs <num>    Number of files to write out in parallel (defaults
+                                      to the number of CPUs).
+
+                Creates a new target from an archive made by `build-box export`, which
+                is read from stdin. Layered targets are imported as flat ones.
+
+                All files of the new target belong to the user. Other owners, device
+                nodes and attributes outside of the user name space are kept on record
+                and go back into the archive when the target is exported.
+                """  # noqa
+            ))
+
+        kwargs = {
+            "target_prefix":
+                Paths.target_prefix(),
+            "jobs":
+                None
+        }
+
+        try:
+            opts, args = getopt.getopt(
+                args, "hj:t:", ["help", "jobs=", "targets="]
+            )
+        except getopt.GetoptError:
+            usage()
+            sys.exit(EXIT_ERROR)
+
+        for o, v in opts:
+            for case in switch(o):
+                if case("-h", "--help"):
+                    usage()
+                    sys.exit(EXIT_OK)
+                    break
+                if case("-j", "--jobs"):
+                    try:
+                        kwargs["jobs"] = int(v)
+                        if kwargs["jobs"] < 1:
+                            raise ValueError()
+                    except ValueError:
+                        raise BuildBoxError(
+                            "invalid number of jobs: {}".format(v)
+                        )
+                    break
+                if case("-t", "--targets"):
+                    kwargs["target_prefix"] = os.path.normpath(
+                        os.path.realpath(v.strip())
+                    )
+                    break
+            #end for
+        #end for
+
+        if len(args) != 1:
+            usage()
+            sys.exit(EXIT_ERROR)
+
+        BuildBoxTarget.import_(args[0], **kwargs)
     #end function
 
     def list(self, *args):
@@ -183,17 +687,22 @@ class BuildBoxCLI:
                 OPTIONS:
 
                   -h, --help      Print this help message and exit immediately.
+
+                  -l, --long      Also print the space each target uses and its size
+                                  limit.
                 """  # noqa
             ))
 
         kwargs = {
+            "long":
+                False,
             "target_prefix":
                 Paths.target_prefix()
         }
 
         try:
             opts, args = getopt.getopt(
-                args, "ht:", ["help", "targets="]
+                args, "hlt:", ["help", "long", "targets="]
             )
         except getopt.GetoptError:
             usage()
@@ -205,6 +714,9 @@ class BuildBoxCLI:
                     usage()
                     sys.exit(EXIT_OK)
                     break
+                if case("-l", "--long"):
+                    kwargs["long"] = True
+                    break
                 if case("-t", "--targets"):
                     kwargs["target_prefix"] = os.path.normpath(
                         os.path.realpath(v.strip())
@@ -282,6 +794,72 @@ class BuildBoxCLI:
         BuildBoxTarget.info(args[0], **kwargs)
     #end function
 
+    def gc(self, *args):
+        def usage():
+            print(textwrap.dedent(
+                """
+                USAGE:
+
+                  build-box gc [OPTIONS] --budget <size>
+
+                OPTIONS:
+
+                  -h, --help            Print this help message and exit immediately.
+
+                  -b, --budget <size>   Delete the least recently used targets and cached
+                                        packages that no target has installed, until all
+                                        of them take up no more than <size> bytes. The
+                                        suffixes K, M, G and T are understood.
+                  -n, --dry-run         Only print what would be deleted.
+
+                Targets that are mounted or in use are never deleted.
+                """  # noqa
+            ))
+
+        kwargs = {
+            "dry_run":
+                False,
+            "target_prefix":
+                Paths.target_prefix()
+        }
+
+        budget = None
+
+        try:
+            opts, args = getopt.getopt(
+                args, "b:hnt:", ["budget=", "dry-run", "help", "targets="]
+            )
+        except getopt.GetoptError:
+            usage()
+            sys.exit(EXIT_ERROR)
+
+        for o, v in opts:
+            for case in switch(o):
+                if case("-h", "--help"):
+                    usage()
+                    sys.exit(EXIT_OK)
+                    break
+                if case("-b", "--budget"):
+                    budget = DiskUsage.parse_size(v)
+                    break
+                if case("-n", "--dry-run"):
+                    kwargs["dry_run"] = True
+                    break
+                if case("-t", "--targets"):
+                    kwargs["target_prefix"] = os.path.normpath(
+                        os.path.realpath(v.strip())
+                    )
+                    break
+            #end for
+        #end for
+
+        if len(args) != 0 or budget is None:
+            usage()
+            sys.exit(EXIT_ERROR)
+
+        BuildBoxTarget.gc(budget, **kwargs)
+    #end function
+
     def delete(self, *args):
         def usage():
             print(textwrap.dedent(
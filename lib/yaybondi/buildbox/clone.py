@@ -0,0 +1,270 @@
+# -*- encoding: utf-8 -*-
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+import concurrent.futures
+import errno
+import fcntl
+import os
+import shutil
+import stat
+import struct
+
+from yaybondi.buildbox.error import BuildBoxError
+
+class TreeCloner:
+
+    # _IOW(0x94, 9, int)
+    FICLONE = 0x40049409
+
+    # _IOW(0x94, 14, struct btrfs_ioctl_vol_args)
+    BTRFS_IOC_SUBVOL_CREATE = 0x5000940e
+
+    # _IOW(0x94, 23, struct btrfs_ioctl_vol_args_v2)
+    BTRFS_IOC_SNAP_CREATE_V2 = 0x50009417
+
+    BTRFS_FIRST_FREE_OBJECTID = 256
+
+    BACKENDS = ["auto", "snapshot", "reflink", "hardlink", "copy"]
+
+    # Package contents below these directories are replaced rather than
+    # modified in place when packages are upgraded. The "hardlink" backend
+    # shares them between clones, but anything else that writes to them in
+    # place changes both trees, so "auto" never does that.
+    IMMUTABLE_DIRS = ["usr", "tools"]
+
+    # What the kernel says when a file system can't share extents.
+    NO_REFLINK_ERRNOS = [
+        errno.EOPNOTSUPP, errno.ENOTTY, errno.EXDEV, errno.EINVAL,
+        errno.ENOSYS
+    ]
+
+    class Whiteout(Exception):
+        pass
+
+    def __init__(self, backend="auto", jobs=None):
+        if backend not in self.BACKENDS:
+            raise BuildBoxError("unknown clone backend: {}".format(backend))
+
+        self._backend = backend
+        self._jobs = jobs or os.cpu_count() or 1
+        self._use_reflink = backend in ["auto", "reflink"]
+        self._use_hardlink = backend == "hardlink"
+    #end function
+
+    # Creates `path` as a btrfs subvolume, so that it can be snapshotted
+    # later. Returns False if the file system doesn't support that.
+    @classmethod
+    def make_subvolume(cls, path):
+        parent, name = os.path.split(os.path.normpath(path))
+
+        args = bytearray(struct.pack("=q4088s", 0, os.fsencode(name)))
+        parent_fd = os.open(parent, os.O_RDONLY | os.O_DIRECTORY)
+
+        try:
+            fcntl.ioctl(parent_fd, cls.BTRFS_IOC_SUBVOL_CREATE, args)
+        except OSError:
+            return False
+        finally:
+            os.close(parent_fd)
+
+        return True
+    #end function
+
+    # Copies the tree at `src` to the new location `dst` and returns the name
+    # of the backend that did the work. Mount points below `src` are left
+    # empty.
+    def clone(self, src, dst):
+        if self._backend in ["auto", "snapshot"]:
+            if self._snapshot(src, dst):
+                return "snapshot"
+            if self._backend == "snapshot":
+                raise BuildBoxError(
+                    "'{}' is not a btrfs subvolume.".format(src)
+                )
+        #end if
+
+        self._copy_tree(src, dst)
+
+        if self._use_reflink:
+            return "reflink"
+        if self._use_hardlink:
+            return "hardlink"
+        return "copy"
+    #end function
+
+    def _snapshot(self, src, dst):
+        st = os.lstat(src)
+
+        # Only the root of a subvolume has this inode number, but other file
+        # systems may use it, too. The ioctl sorts that out.
+        if st.st_ino != self.BTRFS_FIRST_FREE_OBJECTID:
+            return False
+
+        parent, name = os.path.split(os.path.normpath(dst))
+
+        src_fd = os.open(src, os.O_RDONLY | os.O_DIRECTORY)
+        parent_fd = os.open(parent, os.O_RDONLY | os.O_DIRECTORY)
+
+        try:
+            args = bytearray(struct.pack(
+                "=qQQ32s4040s", src_fd, 0, 0, b"", os.fsencode(name)
+            ))
+            fcntl.ioctl(parent_fd, self.BTRFS_IOC_SNAP_CREATE_V2, args)
+        except OSError:
+            return False
+        finally:
+            os.close(parent_fd)
+            os.close(src_fd)
+
+        return True
+    #end function
+
+    def _copy_tree(self, src, dst):
+        root_dev = os.lstat(src).st_dev
+        dirs = [(src, dst, os.lstat(src))]
+
+        os.mkdir(dst, 0o700)
+
+        # Directories are scanned in parallel, too. Each job hands back the
+        # jobs it spawned, so nobody ever waits inside the pool.
+        with concurrent.futures.ThreadPoolExecutor(self._jobs) as pool:
+            pending = [pool.submit(self._copy_dir, pool, src, dst, None,
+                root_dev)]
+
+            try:
+                while pending:
+                    result = pending.pop().result()
+                    if result:
+                        sub_dirs, sub_jobs = result
+                        dirs.extend(sub_dirs)
+                        pending.extend(sub_jobs)
+                #end while
+            except BaseException:
+                for job in pending:
+                    job.cancel()
+                raise
+            #end try
+
+        # Directories get their permissions and timestamps last, deepest
+        # first, since filling them changes both.
+        for src_dir, dst_dir, st in sorted(dirs, key=lambda d: d[1],
+                reverse=True):
+            os.chmod(dst_dir, stat.S_IMODE(st.st_mode))
+            os.utime(dst_dir, ns=(st.st_atime_ns, st.st_mtime_ns))
+    #end function
+
+    def _copy_dir(self, pool, src, dst, top, root_dev):
+        sub_dirs = []
+        sub_jobs = []
+
+        with os.scandir(src) as it:
+            for entry in it:
+                src_path = os.path.join(src, entry.name)
+                dst_path = os.path.join(dst, entry.name)
+                entry_top = top or entry.name
+                st = entry.stat(follow_symlinks=False)
+
+                if stat.S_ISDIR(st.st_mode):
+                    os.mkdir(dst_path, 0o700)
+                    sub_dirs.append((src_path, dst_path, st))
+
+                    # Mounts from the host don't belong to the target.
+                    if st.st_dev == root_dev:
+                        sub_jobs.append(
+                            pool.submit(self._copy_dir, pool, src_path,
+                                dst_path, entry_top, root_dev)
+                        )
+                elif stat.S_ISREG(st.st_mode):
+                    sub_jobs.append(
+                        pool.submit(self._copy_file, src_path, dst_path,
+                            entry_top, st)
+                    )
+                elif stat.S_ISLNK(st.st_mode):
+                    os.symlink(os.readlink(src_path), dst_path)
+                    os.utime(dst_path, ns=(st.st_atime_ns, st.st_mtime_ns),
+                        follow_symlinks=False)
+                elif stat.S_ISFIFO(st.st_mode):
+                    os.mkfifo(dst_path, stat.S_IMODE(st.st_mode))
+                elif stat.S_ISCHR(st.st_mode) and st.st_rdev == 0:
+                    raise TreeCloner.Whiteout(src_path)
+                #end if
+            #end for
+
+        return sub_dirs, sub_jobs
+    #end function
+
+    # Copies a single regular file, sharing extents with the original where
+    # the file system allows that.
+    def copy_file(self, src, dst, st):
+        if self._use_reflink:
+            if self._reflink(src, dst, st):
+                return
+
+        shutil.copy2(src, dst, follow_symlinks=False)
+    #end function
+
+    def _copy_file(self, src, dst, top, st):
+        if self._use_reflink:
+            if self._reflink(src, dst, st):
+                return
+        if self._use_hardlink and top in self.IMMUTABLE_DIRS:
+            os.link(src, dst)
+            return
+
+        shutil.copy2(src, dst, follow_symlinks=False)
+    #end function
+
+    def _reflink(self, src, dst, st):
+        src_fd = os.open(src, os.O_RDONLY | os.O_NOFOLLOW)
+
+        try:
+            dst_fd = os.open(
+                dst, os.O_WRONLY | os.O_CREAT | os.O_EXCL,
+                stat.S_IMODE(st.st_mode)
+            )
+
+            try:
+                fcntl.ioctl(dst_fd, self.FICLONE, src_fd)
+                os.chmod(dst_fd, stat.S_IMODE(st.st_mode))
+                os.utime(dst_fd, ns=(st.st_atime_ns, st.st_mtime_ns))
+            except OSError as e:
+                os.unlink(dst)
+
+                if e.errno not in self.NO_REFLINK_ERRNOS or \
+                        self._backend == "reflink":
+                    raise
+
+                # Not supported here, don't bother trying again.
+                self._use_reflink = False
+                return False
+            finally:
+                os.close(dst_fd)
+        finally:
+            os.close(src_fd)
+
+        return True
+    #end function
+
+#end class
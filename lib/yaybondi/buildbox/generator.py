@@ -23,13 +23,20 @@
 # THE SOFTWARE.
 #
 
+import logging
 import os
 import textwrap
 
+from yaybondi.buildbox.error import BuildBoxError
 from yaybondi.buildbox.misc.paths import Paths
+from yaybondi.buildbox.oci import OCIImage
+from yaybondi.buildbox.pkgcache import PackageCache
+from yaybondi.buildbox.pkgindex import PackageIndex
 from yaybondi.osimage.generator import ImageGenerator
 from yaybondi.osimage.util import ImageGeneratorUtils
 
+LOGGER = logging.getLogger(__name__)
+
 class BuildBoxGenerator(ImageGenerator):
 
     OPKG_FEEDS_TEMPLATE = textwrap.dedent(
@@ -57,9 +64,41 @@ class BuildBoxGenerator(ImageGenerator):
         """
     )
 
+    def __init__(self, **kwargs):
+        super().__init__(**kwargs)
+
+        self._oci_image = None
+        if kwargs.get("from_oci"):
+            self._oci_image = OCIImage(kwargs["from_oci"], self._arch)
+    #end function
+
+    @property
+    def base_name(self):
+        base_name = "{}-{}-{}".format(self._release, self._arch, self._libc)
+
+        # Bases unpacked from an OCI image are shared by all targets made
+        # from the same image.
+        if self._oci_image:
+            base_name += "-oci-{}".format(
+                self._oci_image.digest.split(":", 1)[1][:16]
+            )
+
+        return base_name
+    #end function
+
+    @property
+    def package_cache_dir(self):
+        return os.path.join(
+            Paths.pkg_cache_prefix(), self._release, self._arch, self._libc
+        )
+    #end function
+
     def prepare(self, sysroot, target_id):
-        super().prepare(sysroot)
+        self.prepare_base(sysroot)
+        self.configure_target(sysroot, target_id)
+    #end function
 
+    def configure_target(self, sysroot, target_id):
         etc_target = os.path.join(sysroot, "etc", "target")
         with open(etc_target, "w+", encoding="utf-8") as f:
             f.write(
@@ -67,15 +106,24 @@ class BuildBoxGenerator(ImageGenerator):
                     target_id=target_id, **self.context
                 )
             )
+    #end function
+
+    # Installs everything that doesn't depend on the name of the target, so
+    # that the result can be shared by layered targets.
+    def prepare_base(self, sysroot):
+        if self._oci_image:
+            self._oci_image.unpack(sysroot)
+            os.makedirs(os.path.join(sysroot, "etc", "opkg"), exist_ok=True)
+        else:
+            super().prepare(sysroot)
 
+        # `build-box mount` binds the package cache that /.pkg-cache points
+        # to on /var/cache/opkg.
         opkg_cache_conf = os.path.join(sysroot, "etc", "opkg", "cache.conf")
         with open(opkg_cache_conf, "w+", encoding="utf-8") as f:
-            f.write("option cache_dir /.pkg-cache\n")
+            f.write("option cache_dir /var/cache/opkg\n")
 
-        package_cache = os.path.join(
-            Paths.cache_dir(), "bondi", "pkg-cache", self._release, self._arch,
-                self._libc
-        )
+        package_cache = self.package_cache_dir
 
         if not os.path.exists(package_cache):
             os.makedirs(package_cache, exist_ok=True)
@@ -85,4 +133,66 @@ class BuildBoxGenerator(ImageGenerator):
             os.symlink(package_cache, package_cache_symlink)
     #end function
 
+    # Returns a dictionary that maps the names of the feeds of this kind of
+    # target to their base URLs.
+    @property
+    def feeds(self):
+        return PackageIndex.parse_feeds(
+            self.OPKG_FEEDS_TEMPLATE.format(**self.context)
+        )
+    #end function
+
+    # Everything the spec needs is fetched into the package cache up front,
+    # with one download per package even if several targets are created at
+    # the same time. Packages that another view of the store has already are
+    # linked in, too. Whatever opkg still downloads goes into the store
+    # afterwards.
+    def customize(self, sysroot, specfile):
+        package_cache = PackageCache()
+        index = PackageIndex.from_sysroot(sysroot)
+
+        installed = set()
+        for prefix in ["var", "usr"]:
+            status = os.path.join(sysroot, prefix, "lib", "opkg", "status")
+            installed.update(
+                name for name, _ in PackageCache.installed(status)
+            )
+        #end for
+
+        try:
+            names = index.resolve(PackageIndex.spec_packages(specfile))
+            package_cache.fetch_all(
+                self.package_cache_dir,
+                [index[name] for name in sorted(names - installed)]
+            )
+        except (BuildBoxError, OSError, ValueError) as e:
+            # opkg gets another chance at whatever is missing.
+            LOGGER.warning("prefetching packages failed: {}".format(e))
+        #end try
+
+        package_cache.populate(self.package_cache_dir, index)
+        super().customize(sysroot, specfile)
+        package_cache.dedup([self.package_cache_dir])
+    #end function
+
+    # Downloads everything that the specs in `specfiles` pull in from the
+    # feeds into the package cache, so that creating a target from them later
+    # doesn't have to. Returns the number of packages and how many of them
+    # had to be downloaded.
+    def prefetch(self, specfiles, jobs=None):
+        package_cache = PackageCache(jobs=jobs)
+
+        index = PackageIndex.from_feeds(self.feeds, package_cache)
+
+        names = set()
+        for specfile in specfiles:
+            names.update(index.resolve(PackageIndex.spec_packages(specfile)))
+
+        downloaded = package_cache.fetch_all(
+            self.package_cache_dir, [index[name] for name in sorted(names)]
+        )
+
+        return len(names), downloaded
+    #end function
+
 #end class
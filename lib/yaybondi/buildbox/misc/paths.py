@@ -46,6 +46,11 @@ class Paths:
         return cache_dir
     #end function
 
+    @staticmethod
+    def pkg_cache_prefix():
+        return os.path.join(Paths.cache_dir(), "bondi", "pkg-cache")
+    #end function
+
     @staticmethod
     def target_prefix():
         return os.path.join(
@@ -53,4 +58,60 @@ class Paths:
         )
     #end function
 
+    @staticmethod
+    def base_prefix():
+        return os.path.join(
+            "/var/lib/build-box/users", "{}".format(os.getuid()), "bases"
+        )
+    #end function
+
+    # File system images that can serve as bases. Only an administrator can
+    # put them there.
+    @staticmethod
+    def image_prefix():
+        return "/var/lib/build-box/images"
+    #end function
+
+    @staticmethod
+    def layer_prefix():
+        return os.path.join(
+            "/var/lib/build-box/users", "{}".format(os.getuid()), "layers"
+        )
+    #end function
+
+    @staticmethod
+    def manifest_prefix():
+        return os.path.join(
+            "/var/lib/build-box/users", "{}".format(os.getuid()), "manifests"
+        )
+    #end function
+
+    @staticmethod
+    def ownership_prefix():
+        return os.path.join(
+            "/var/lib/build-box/users", "{}".format(os.getuid()), "ownership"
+        )
+    #end function
+
+    @staticmethod
+    def prebuilt_prefix():
+        return os.path.join(
+            "/var/lib/build-box/users", "{}".format(os.getuid()), "prebuilt"
+        )
+    #end function
+
+    @staticmethod
+    def used_prefix():
+        return os.path.join(
+            "/var/lib/build-box/users", "{}".format(os.getuid()), "used"
+        )
+    #end function
+
+    @staticmethod
+    def usage_cache():
+        return os.path.join(
+            "/var/lib/build-box/users", "{}".format(os.getuid()), "usage.json"
+        )
+    #end function
+
 #end class
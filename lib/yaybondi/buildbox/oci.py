@@ -0,0 +1,381 @@
+# -*- encoding: utf-8 -*-
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+import concurrent.futures
+import hashlib
+import json
+import os
+import re
+import shutil
+import stat
+import subprocess
+import tarfile
+
+from yaybondi.buildbox.error import BuildBoxError
+
+# An image in a local OCI image layout directory, referenced as <dir>:<tag>.
+# The tag may be left out if the layout holds only one image.
+class OCIImage:
+
+    MEDIA_TYPES_INDEX = [
+        "application/vnd.oci.image.index.v1+json",
+        "application/vnd.docker.distribution.manifest.list.v2+json"
+    ]
+
+    REF_NAME_ANNOTATION = "org.opencontainers.image.ref.name"
+
+    # Architecture names used by build-box and their OCI equivalents.
+    PLATFORMS = {
+        "aarch64": ("arm64", None),
+        "armv7a": ("arm", "v7"),
+        "mips64el": ("mips64le", None),
+        "powerpc64le": ("ppc64le", None),
+        "riscv64": ("riscv64", None),
+        "s390x": ("s390x", None),
+        "x86_64": ("amd64", None)
+    }
+
+    WHITEOUT_PREFIX = ".wh."
+    OPAQUE_WHITEOUT = ".wh..wh..opq"
+
+    MAX_SYMLINK_HOPS = 40
+
+    def __init__(self, reference, arch):
+        path, sep, tag = reference.rpartition(":")
+
+        if not sep or not tag or "/" in tag:
+            path, tag = reference, None
+
+        self._path = os.path.realpath(path)
+
+        if not os.path.isfile(os.path.join(self._path, "oci-layout")):
+            raise BuildBoxError(
+                "'{}' is not an OCI image layout.".format(path)
+            )
+
+        self.digest, self._manifest = self._find_manifest(tag, arch)
+    #end function
+
+    # Unpacks all layers on top of each other into `sysroot`. The blobs are
+    # verified up front, in parallel.
+    def unpack(self, sysroot, jobs=None):
+        layers = self._manifest.get("layers", [])
+        dirs = {}
+
+        with concurrent.futures.ThreadPoolExecutor(jobs) as pool:
+            for _ in pool.map(self._verify_blob, layers):
+                pass
+
+        for layer in layers:
+            self._apply_layer(sysroot, layer, dirs)
+
+        # Directories stay writable while layers are unpacked and get their
+        # real permissions and timestamps at the very end.
+        for path, (mode, mtime) in sorted(dirs.items(), reverse=True):
+            try:
+                if not stat.S_ISDIR(os.lstat(path).st_mode):
+                    continue
+            except FileNotFoundError:
+                continue
+
+            os.chmod(path, mode)
+            os.utime(path, (mtime, mtime))
+        #end for
+    #end function
+
+    def _find_manifest(self, tag, arch):
+        with open(os.path.join(self._path, "index.json"), "r",
+                encoding="utf-8") as f:
+            index = json.load(f)
+
+        descriptors = index.get("manifests", [])
+
+        if tag:
+            descriptors = [
+                d for d in descriptors
+                if d.get("annotations", {}).get(self.REF_NAME_ANNOTATION) ==
+                    tag
+            ]
+        #end if
+
+        if not descriptors:
+            raise BuildBoxError(
+                "no image tagged '{}' in '{}'.".format(tag, self._path)
+            )
+
+        descriptor = self._select_platform(descriptors, arch)
+
+        if descriptor.get("mediaType") in self.MEDIA_TYPES_INDEX:
+            nested = json.loads(self._read_blob(descriptor))
+            descriptor = self._select_platform(
+                nested.get("manifests", []), arch
+            )
+        #end if
+
+        return descriptor["digest"], json.loads(self._read_blob(descriptor))
+    #end function
+
+    def _select_platform(self, descriptors, arch):
+        if len(descriptors) == 1:
+            return descriptors[0]
+
+        architecture, variant = self.PLATFORMS.get(arch, (arch, None))
+
+        for descriptor in descriptors:
+            platform = descriptor.get("platform", {})
+
+            if platform.get("os", "linux") != "linux":
+                continue
+            if platform.get("architecture") != architecture:
+                continue
+            if variant and platform.get("variant", variant) != variant:
+                continue
+
+            return descriptor
+        #end for
+
+        raise BuildBoxError(
+            "no unique image for architecture '{}' in '{}'."
+            .format(arch, self._path)
+        )
+    #end function
+
+    def _blob_path(self, digest):
+        if not re.match(r"^sha256:[a-f0-9]{64}$", digest or ""):
+            raise BuildBoxError("unsupported blob digest '{}'.".format(digest))
+
+        return os.path.join(self._path, "blobs", *digest.split(":", 1))
+    #end function
+
+    def _read_blob(self, descriptor):
+        with open(self._blob_path(descriptor["digest"]), "rb") as f:
+            buf = f.read()
+
+        if "sha256:" + hashlib.sha256(buf).hexdigest() != \
+                descriptor["digest"]:
+            raise BuildBoxError(
+                "blob '{}' is corrupt.".format(descriptor["digest"])
+            )
+
+        return buf
+    #end function
+
+    def _verify_blob(self, descriptor):
+        h = hashlib.sha256()
+
+        with open(self._blob_path(descriptor["digest"]), "rb") as f:
+            while True:
+                buf = f.read(1024 * 1024)
+                if not buf:
+                    break
+                h.update(buf)
+            #end while
+
+        if "sha256:" + h.hexdigest() != descriptor["digest"]:
+            raise BuildBoxError(
+                "blob '{}' is corrupt.".format(descriptor["digest"])
+            )
+    #end function
+
+    def _apply_layer(self, sysroot, layer, dirs):
+        media_type = layer.get("mediaType", "")
+        blob = self._blob_path(layer["digest"])
+        proc = None
+
+        if media_type.endswith("zstd"):
+            proc = subprocess.Popen(
+                ["zstd", "--quiet", "--decompress", "--stdout", blob],
+                stdout=subprocess.PIPE
+            )
+            fileobj, mode = proc.stdout, "r|"
+        elif media_type.endswith("gzip"):
+            fileobj, mode = open(blob, "rb"), "r|gz"
+        elif media_type.endswith("tar"):
+            fileobj, mode = open(blob, "rb"), "r|"
+        else:
+            raise BuildBoxError(
+                "unsupported layer type '{}'.".format(media_type)
+            )
+        #end if
+
+        try:
+            # Entries that were added by this layer, which an opaque
+            # whiteout in the same layer must not remove.
+            added = set()
+
+            with tarfile.open(fileobj=fileobj, mode=mode) as tar:
+                for member in tar:
+                    self._apply_member(sysroot, tar, member, added, dirs)
+        finally:
+            fileobj.close()
+            if proc:
+                proc.wait()
+        #end try
+
+        if proc and proc.returncode != 0:
+            raise BuildBoxError(
+                "failed to decompress layer '{}'.".format(layer["digest"])
+            )
+    #end function
+
+    def _apply_member(self, sysroot, tar, member, added, dirs):
+        rel_path = os.path.normpath(member.name.lstrip("/"))
+
+        if rel_path == "." or rel_path.startswith(".."):
+            return
+
+        parent_rel, name = os.path.split(rel_path)
+        parent = self._resolve(sysroot, parent_rel, create=True)
+        path = os.path.join(parent, name)
+
+        if name == self.OPAQUE_WHITEOUT:
+            for entry in os.listdir(parent):
+                if os.path.join(parent_rel, entry) not in added:
+                    self._remove(os.path.join(parent, entry))
+            return
+        #end if
+
+        if name.startswith(self.WHITEOUT_PREFIX):
+            self._remove(
+                os.path.join(parent, name[len(self.WHITEOUT_PREFIX):])
+            )
+            return
+        #end if
+
+        added.add(rel_path)
+
+        # Set-id bits are meaningless for files owned by the user.
+        mode = member.mode & 0o1777
+
+        if member.isdir():
+            if not os.path.isdir(path) or os.path.islink(path):
+                self._remove(path)
+                os.mkdir(path, 0o700)
+
+            os.chmod(path, mode | 0o700)
+            dirs[path] = (mode, member.mtime)
+            return
+        #end if
+
+        self._remove(path)
+
+        if member.isreg():
+            fd = os.open(
+                path, os.O_WRONLY | os.O_CREAT | os.O_EXCL | os.O_NOFOLLOW,
+                0o600
+            )
+
+            with os.fdopen(fd, "wb") as f:
+                shutil.copyfileobj(tar.extractfile(member), f)
+                os.chmod(f.fileno(), mode)
+                os.utime(f.fileno(), (member.mtime, member.mtime))
+        elif member.issym():
+            os.symlink(member.linkname, path)
+            os.utime(path, (member.mtime, member.mtime),
+                follow_symlinks=False)
+        elif member.islnk():
+            link_rel = os.path.normpath(member.linkname.lstrip("/"))
+            if link_rel.startswith(".."):
+                return
+
+            link_parent, link_name = os.path.split(link_rel)
+            os.link(
+                os.path.join(self._resolve(sysroot, link_parent), link_name),
+                path, follow_symlinks=False
+            )
+        elif member.isfifo():
+            os.mkfifo(path, mode)
+        #end if
+
+        # Device nodes can't be created without privileges. Targets get
+        # /dev from the host anyway.
+    #end function
+
+    # Resolves `rel_path` like the kernel would after a chroot to `sysroot`,
+    # so that symlinks from earlier layers can't point outside of it.
+    def _resolve(self, sysroot, rel_path, create=False):
+        parts = [p for p in rel_path.split("/") if p not in ["", "."]]
+        resolved = []
+        hops = 0
+
+        while parts:
+            part = parts.pop(0)
+
+            if part == "..":
+                if resolved:
+                    resolved.pop()
+                continue
+            #end if
+
+            path = os.path.join(sysroot, *resolved, part)
+
+            try:
+                st = os.lstat(path)
+            except FileNotFoundError:
+                if not create:
+                    raise
+                os.mkdir(path, 0o755)
+                resolved.append(part)
+                continue
+            #end try
+
+            if stat.S_ISLNK(st.st_mode):
+                hops += 1
+                if hops > self.MAX_SYMLINK_HOPS:
+                    raise BuildBoxError(
+                        "too many levels of symbolic links in '{}'."
+                        .format(rel_path)
+                    )
+                #end if
+
+                link = os.readlink(path)
+                if link.startswith("/"):
+                    resolved = []
+
+                parts = [
+                    p for p in link.split("/") if p not in ["", "."]
+                ] + parts
+                continue
+            #end if
+
+            resolved.append(part)
+        #end while
+
+        return os.path.join(sysroot, *resolved)
+    #end function
+
+    def _remove(self, path):
+        try:
+            st = os.lstat(path)
+        except FileNotFoundError:
+            return
+
+        if stat.S_ISDIR(st.st_mode):
+            shutil.rmtree(path)
+        else:
+            os.unlink(path)
+    #end function
+
+#end class
@@ -0,0 +1,528 @@
+# -*- encoding: utf-8 -*-
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+import concurrent.futures
+import errno
+import fcntl
+import hashlib
+import json
+import os
+import stat
+import tempfile
+import urllib.error
+import urllib.request
+
+from yaybondi.buildbox.clone import TreeCloner
+from yaybondi.buildbox.error import BuildBoxError
+from yaybondi.buildbox.misc.paths import Paths
+
+# The packages that opkg keeps in the package cache of the user. There is one
+# cache for each combination of release, architecture and C runtime, shared by
+# all targets of that kind.
+#
+# The caches are views into a store of package files keyed by their sha256,
+# below STORE_DIR. Packages that are the same for several combinations, like
+# those of architecture `all` or `tools`, are kept only once and hardlinked
+# into each view. A store object that no view links to anymore is garbage.
+#
+# Downloads go through a lock per checksum below LOCK_DIR, so that concurrent
+# creates fetch each package only once.
+#
+# The package indices of the feeds are kept below INDEX_DIR, together with
+# the validators that the feed sent along, so that they are only downloaded
+# again when they have changed.
+class PackageCache:
+
+    STORE_DIR = ".store"
+    LOCK_DIR = ".locks"
+    INDEX_DIR = ".indices"
+
+    BLOCK_SIZE = 1024 * 1024
+
+    def __init__(self, cache_prefix=None, jobs=None):
+        self._cache_prefix = cache_prefix or Paths.pkg_cache_prefix()
+        self._store_dir = os.path.join(self._cache_prefix, self.STORE_DIR)
+        self._jobs = jobs or os.cpu_count() or 1
+    #end function
+
+    # Returns a list of tuples (path, size, last_use) for all cached packages.
+    # Views that share a package file are accounted for it only once.
+    def packages(self):
+        result = []
+        seen = set()
+
+        for dirpath, dirnames, filenames in os.walk(self._cache_prefix):
+            if dirpath == self._cache_prefix:
+                for hidden in [self.STORE_DIR, self.LOCK_DIR, self.INDEX_DIR]:
+                    if hidden in dirnames:
+                        dirnames.remove(hidden)
+            #end if
+
+            for filename in filenames:
+                if not filename.endswith(".ipk"):
+                    continue
+
+                path = os.path.join(dirpath, filename)
+
+                try:
+                    st = os.lstat(path)
+                except FileNotFoundError:
+                    continue
+
+                if not stat.S_ISREG(st.st_mode):
+                    continue
+
+                size = 0
+                if (st.st_dev, st.st_ino) not in seen:
+                    seen.add((st.st_dev, st.st_ino))
+                    size = st.st_blocks * 512
+                #end if
+
+                result.append((
+                    path, size, max(st.st_atime, st.st_mtime)
+                ))
+            #end for
+        #end for
+
+        return result
+    #end function
+
+    # Deletes the cached package at `path` and its store object, if no other
+    # view links to it anymore. Returns the number of bytes freed.
+    def remove(self, path):
+        try:
+            st = os.lstat(path)
+        except FileNotFoundError:
+            return 0
+
+        store_path = None
+        if st.st_nlink > 1:
+            store_path = self._store_path(self._digest(path))
+
+        os.unlink(path)
+
+        if store_path is None:
+            return st.st_blocks * 512
+
+        try:
+            store_st = os.lstat(store_path)
+        except FileNotFoundError:
+            return 0
+
+        if (store_st.st_dev, store_st.st_ino) != (st.st_dev, st.st_ino) or \
+                store_st.st_nlink > 1:
+            return 0
+
+        os.unlink(store_path)
+        return st.st_blocks * 512
+    #end function
+
+    # Moves the packages in `views`, or in all views, into the store and
+    # replaces copies with hardlinks to the store object. Packages that are
+    # linked already are skipped, so that only new downloads get hashed.
+    # Returns the number of bytes saved.
+    def dedup(self, views=None):
+        if views is None:
+            views = [self._cache_prefix]
+
+        paths = []
+
+        for view in views:
+            for dirpath, dirnames, filenames in os.walk(view):
+                if self.STORE_DIR in dirnames:
+                    dirnames.remove(self.STORE_DIR)
+
+                for filename in filenames:
+                    if filename.endswith(".ipk"):
+                        paths.append(os.path.join(dirpath, filename))
+                #end for
+            #end for
+        #end for
+
+        with concurrent.futures.ThreadPoolExecutor(self._jobs) as pool:
+            return sum(pool.map(self._dedup_file, paths))
+    #end function
+
+    # Links the store objects for all packages in `index`, a PackageIndex,
+    # into `view`, unless it has them already. opkg then finds them in its
+    # cache instead of downloading them again. Returns the number of packages
+    # linked.
+    def populate(self, view, index):
+        linked = 0
+
+        for entry in index.packages():
+            path = os.path.join(view, os.path.basename(entry["filename"]))
+            store_path = self._store_path(entry["sha256"])
+
+            if os.path.lexists(path) or not os.path.exists(store_path):
+                continue
+
+            try:
+                self._link(store_path, path)
+            except FileExistsError:
+                continue
+
+            linked += 1
+        #end for
+
+        return linked
+    #end function
+
+    # Makes the package `entry`, as found in a PackageIndex, available in
+    # `view`. Unless the store has it already, it is downloaded and verified
+    # first. Whoever gets the lock for a checksum first downloads the package,
+    # everybody else waits and then links to it. Returns True if the package
+    # had to be downloaded.
+    def fetch(self, view, entry):
+        digest = entry["sha256"]
+        path = os.path.join(view, os.path.basename(entry["filename"]))
+        store_path = self._store_path(digest)
+        lock_dir = os.path.join(self._cache_prefix, self.LOCK_DIR)
+        downloaded = False
+
+        os.makedirs(lock_dir, exist_ok=True)
+        os.makedirs(os.path.dirname(store_path), exist_ok=True)
+        os.makedirs(view, exist_ok=True)
+
+        with open(os.path.join(lock_dir, digest), "a",
+                encoding="utf-8") as lock_file:
+            fcntl.flock(lock_file, fcntl.LOCK_EX)
+
+            if not os.path.exists(store_path):
+                self._download(entry["url"], store_path, digest)
+                downloaded = True
+
+            if not os.path.lexists(path):
+                try:
+                    self._link(store_path, path)
+                except FileExistsError:
+                    pass
+            #end if
+
+        return downloaded
+    #end function
+
+    # Returns the path of the cached copy of the package index at `url` and
+    # its sha256. The copy is refreshed only if the feed has a new one. Going
+    # by the ETag and Last-Modified the feed sent with the copy, a web server
+    # answers with "not modified". For file:// URLs and servers that ignore
+    # the question, matching validators and size say the same.
+    def fetch_index(self, url):
+        key = hashlib.sha256(url.encode("utf-8")).hexdigest()
+        index_dir = os.path.join(self._cache_prefix, self.INDEX_DIR)
+        lock_dir = os.path.join(self._cache_prefix, self.LOCK_DIR)
+        path = os.path.join(index_dir, key)
+
+        os.makedirs(index_dir, exist_ok=True)
+        os.makedirs(lock_dir, exist_ok=True)
+
+        with open(os.path.join(lock_dir, "index-" + key), "a",
+                encoding="utf-8") as lock_file:
+            fcntl.flock(lock_file, fcntl.LOCK_EX)
+
+            try:
+                with open(path + ".json", "r", encoding="utf-8") as f:
+                    cached = json.load(f)
+                if not os.path.exists(path):
+                    cached = {}
+            except (OSError, ValueError):
+                cached = {}
+            #end try
+
+            request = urllib.request.Request(url)
+
+            if cached.get("etag"):
+                request.add_header("If-None-Match", cached["etag"])
+            if cached.get("last_modified"):
+                request.add_header(
+                    "If-Modified-Since", cached["last_modified"]
+                )
+
+            try:
+                with urllib.request.urlopen(request) as response:
+                    validators = {
+                        "etag": response.headers.get("ETag"),
+                        "last_modified": response.headers.get("Last-Modified"),
+                        "size": response.headers.get("Content-Length"),
+                    }
+
+                    if self._index_unchanged(cached, validators):
+                        return path, cached["sha256"]
+
+                    validators["sha256"] = self._download_index(
+                        response, path
+                    )
+                #end with
+            except urllib.error.HTTPError as e:
+                if e.code == 304 and cached:
+                    return path, cached["sha256"]
+                raise BuildBoxError(
+                    "failed to download '{}': {}".format(url, e)
+                )
+            except (urllib.error.URLError, OSError) as e:
+                raise BuildBoxError(
+                    "failed to download '{}': {}".format(url, e)
+                )
+            #end try
+
+            tmp_path = path + ".json.tmp"
+
+            with open(tmp_path, "w", encoding="utf-8") as f:
+                json.dump(validators, f)
+            os.rename(tmp_path, path + ".json")
+        #end with
+
+        return path, validators["sha256"]
+    #end function
+
+    def _index_unchanged(self, cached, validators):
+        if not cached:
+            return False
+        if validators["etag"]:
+            return validators["etag"] == cached.get("etag")
+        if validators["last_modified"] and validators["size"]:
+            return (validators["last_modified"], validators["size"]) == \
+                (cached.get("last_modified"), cached.get("size"))
+        return False
+    #end function
+
+    # Writes the index read from `response` to `path` and returns its sha256.
+    def _download_index(self, response, path):
+        fd, tmp_path = tempfile.mkstemp(
+            prefix=".download.", dir=os.path.dirname(path)
+        )
+
+        try:
+            h = hashlib.sha256()
+
+            with os.fdopen(fd, "wb") as f:
+                while True:
+                    buf = response.read(self.BLOCK_SIZE)
+                    if not buf:
+                        break
+                    h.update(buf)
+                    f.write(buf)
+                #end while
+
+            os.rename(tmp_path, path)
+        except BaseException:
+            os.unlink(tmp_path)
+            raise
+        #end try
+
+        return h.hexdigest()
+    #end function
+
+    # Deletes the store objects that no view links to. Returns the number of
+    # bytes freed.
+    def sweep(self):
+        freed = 0
+
+        for dirpath, _, filenames in os.walk(self._store_dir):
+            for filename in filenames:
+                path = os.path.join(dirpath, filename)
+
+                try:
+                    st = os.lstat(path)
+                except FileNotFoundError:
+                    continue
+
+                if st.st_nlink > 1:
+                    continue
+
+                os.unlink(path)
+                freed += st.st_blocks * 512
+            #end for
+        #end for
+
+        return freed
+    #end function
+
+    # Returns the (name, version) of the cached package at `path`, as in
+    # <name>_<version>_<arch>.ipk.
+    @classmethod
+    def package_key(cls, path):
+        try:
+            name, version, _ = os.path.basename(path).split("_", 2)
+        except ValueError:
+            return None
+
+        return name, cls._strip_epoch(version)
+    #end function
+
+    # Returns the set of (name, version) of the packages listed in the opkg
+    # status file at `path`.
+    @classmethod
+    def installed(cls, path):
+        result = set()
+        name = version = None
+
+        try:
+            with open(path, "r", encoding="utf-8", errors="replace") as f:
+                for line in f:
+                    line = line.rstrip("\n")
+
+                    if not line:
+                        if name and version:
+                            result.add((name, cls._strip_epoch(version)))
+                        name = version = None
+                    elif line.startswith("Package:"):
+                        name = line.split(":", 1)[1].strip()
+                    elif line.startswith("Version:"):
+                        version = line.split(":", 1)[1].strip()
+                #end for
+        except FileNotFoundError:
+            return result
+
+        if name and version:
+            result.add((name, cls._strip_epoch(version)))
+
+        return result
+    #end function
+
+    def _dedup_file(self, path):
+        try:
+            st = os.lstat(path)
+        except FileNotFoundError:
+            return 0
+
+        if not stat.S_ISREG(st.st_mode) or st.st_nlink > 1:
+            return 0
+
+        store_path = self._store_path(self._digest(path))
+        os.makedirs(os.path.dirname(store_path), exist_ok=True)
+
+        try:
+            os.link(path, store_path)
+            return 0
+        except FileExistsError:
+            pass
+
+        # Another view has the same package already. The copy is replaced
+        # atomically, opkg may be looking at it.
+        tmp_path = os.path.join(
+            os.path.dirname(path),
+            ".#{}.{}".format(os.path.basename(path), os.getpid())
+        )
+
+        try:
+            self._link(store_path, tmp_path)
+            os.rename(tmp_path, path)
+        except BaseException:
+            if os.path.lexists(tmp_path):
+                os.unlink(tmp_path)
+            raise
+        #end try
+
+        return st.st_blocks * 512
+    #end function
+
+    # Hardlinks `src` to `dst`, or clones it where a file can't take any more
+    # links.
+    def _link(self, src, dst):
+        try:
+            os.link(src, dst)
+        except OSError as e:
+            if e.errno != errno.EMLINK:
+                raise
+            TreeCloner("reflink").copy_file(src, dst, os.lstat(src))
+        #end try
+    #end function
+
+    def _store_path(self, digest):
+        return os.path.join(self._store_dir, "sha256", digest[:2], digest)
+    #end function
+
+    def _digest(self, path):
+        h = hashlib.sha256()
+
+        with open(path, "rb") as f:
+            while True:
+                buf = f.read(self.BLOCK_SIZE)
+                if not buf:
+                    break
+                h.update(buf)
+            #end while
+
+        return h.hexdigest()
+    #end function
+
+    # Fetches the packages `entries` into `view` in parallel. Returns the
+    # number of packages that had to be downloaded.
+    def fetch_all(self, view, entries):
+        with concurrent.futures.ThreadPoolExecutor(self._jobs) as pool:
+            return sum(
+                pool.map(lambda entry: self.fetch(view, entry), entries)
+            )
+    #end function
+
+    # Downloads `url` to `store_path`, which only ever appears complete and
+    # with the expected checksum.
+    def _download(self, url, store_path, digest):
+        fd, tmp_path = tempfile.mkstemp(
+            prefix=".download.", dir=os.path.dirname(store_path)
+        )
+
+        try:
+            h = hashlib.sha256()
+
+            with os.fdopen(fd, "wb") as f:
+                with urllib.request.urlopen(url) as response:
+                    while True:
+                        buf = response.read(self.BLOCK_SIZE)
+                        if not buf:
+                            break
+                        h.update(buf)
+                        f.write(buf)
+                    #end while
+
+            if h.hexdigest() != digest:
+                raise BuildBoxError(
+                    "checksum mismatch for '{}'.".format(url)
+                )
+
+            os.chmod(tmp_path, 0o644)
+
+            try:
+                os.link(tmp_path, store_path)
+            except FileExistsError:
+                # The dedup pass got there first.
+                pass
+        except (urllib.error.URLError, OSError) as e:
+            raise BuildBoxError(
+                "failed to download '{}': {}".format(url, e)
+            )
+        finally:
+            os.unlink(tmp_path)
+        #end try
+    #end function
+
+    # File names don't carry the epoch.
+    @classmethod
+    def _strip_epoch(cls, version):
+        return version.split(":", 1)[-1]
+    #end function
+
+#end class
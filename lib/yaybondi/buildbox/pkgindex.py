@@ -0,0 +1,309 @@
+# -*- encoding: utf-8 -*-
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+import gzip
+import os
+import re
+import xml.etree.ElementTree
+
+# The packages that a set of opkg feeds has to offer, as listed in their
+# package indices. Knowing them up front lets us download everything a target
+# is going to need before opkg goes looking for it.
+class PackageIndex:
+
+    # Dependencies that opkg installs along with a package.
+    DEPENDENCY_FIELDS = ["Depends", "Pre-Depends", "Recommends"]
+
+    def __init__(self):
+        self._packages = {}
+        self._providers = {}
+    #end function
+
+    # Builds the index from the package lists that opkg keeps in `sysroot`.
+    # The base URLs of the feeds are taken from the opkg configuration.
+    @classmethod
+    def from_sysroot(cls, sysroot):
+        index = cls()
+        feeds = {}
+
+        opkg_conf_dir = os.path.join(sysroot, "etc", "opkg")
+        if os.path.isdir(opkg_conf_dir):
+            for entry in sorted(os.listdir(opkg_conf_dir)):
+                if entry.endswith(".conf"):
+                    feeds.update(
+                        cls.read_feeds(os.path.join(opkg_conf_dir, entry))
+                    )
+            #end for
+        #end if
+
+        for prefix in ["var", "usr"]:
+            lists_dir = os.path.join(sysroot, prefix, "lib", "opkg", "lists")
+            if not os.path.isdir(lists_dir):
+                continue
+
+            for entry in sorted(os.listdir(lists_dir)):
+                if entry in feeds:
+                    index.add(os.path.join(lists_dir, entry), feeds[entry])
+            #end for
+        #end for
+
+        return index
+    #end function
+
+    # Builds the index from the compressed package indices that the `feeds`
+    # publish, like opkg does for "src/gz" feeds. They are kept in
+    # `package_cache`, a PackageCache. `feeds` maps feed names to their base
+    # URLs, which may be file:// URLs, too.
+    @classmethod
+    def from_feeds(cls, feeds, package_cache):
+        index = cls()
+
+        for name, base_url in feeds.items():
+            path, _ = package_cache.fetch_index(cls.index_url(base_url))
+            index.add(path, base_url)
+        #end for
+
+        return index
+    #end function
+
+    # Returns a dictionary that maps feed names to the sha256 digests of their
+    # current package indices. A new digest means new or updated packages.
+    # Indices that haven't changed since they were last seen aren't
+    # downloaded again.
+    @classmethod
+    def digests(cls, feeds, package_cache):
+        digests = {}
+
+        for name, base_url in feeds.items():
+            _, digests[name] = package_cache.fetch_index(
+                cls.index_url(base_url)
+            )
+        #end for
+
+        return digests
+    #end function
+
+    @classmethod
+    def index_url(cls, base_url):
+        return base_url.rstrip("/") + "/Packages.gz"
+    #end function
+
+    # Returns a dictionary that maps feed names to their base URLs, as found
+    # in the opkg configuration file at `path`.
+    @classmethod
+    def read_feeds(cls, path):
+        with open(path, "r", encoding="utf-8", errors="replace") as f:
+            return cls.parse_feeds(f.read())
+    #end function
+
+    # Like `read_feeds`, for the configuration in the string `conf`.
+    @classmethod
+    def parse_feeds(cls, conf):
+        feeds = {}
+
+        for line in conf.splitlines():
+            fields = line.split()
+            if len(fields) == 3 and fields[0] in ["src", "src/gz"]:
+                feeds[fields[1]] = fields[2]
+        #end for
+
+        return feeds
+    #end function
+
+    # Yields the stanzas of the package index at `path`, which may be
+    # compressed, as dictionaries.
+    @classmethod
+    def parse(cls, path):
+        with open(path, "rb") as f:
+            is_gzip = f.read(2) == b"\x1f\x8b"
+
+        opener = gzip.open if is_gzip else open
+        stanza = {}
+        field = None
+
+        with opener(path, "rt", encoding="utf-8", errors="replace") as f:
+            for line in f:
+                line = line.rstrip("\n")
+
+                if not line.strip():
+                    if stanza:
+                        yield stanza
+                    stanza = {}
+                    field = None
+                elif line[0] in " \t":
+                    if field:
+                        stanza[field] += "\n" + line.strip()
+                elif ":" in line:
+                    field, value = line.split(":", 1)
+                    stanza[field] = value.strip()
+                #end if
+            #end for
+
+        if stanza:
+            yield stanza
+    #end function
+
+    # Returns the names of the packages that the image spec at `path` asks
+    # for. Both XML specs, with `package` elements, and YAML specs, with a
+    # `packages` list, are understood.
+    @classmethod
+    def spec_packages(cls, path):
+        with open(path, "r", encoding="utf-8") as f:
+            content = f.read()
+
+        if content.lstrip().startswith("<"):
+            try:
+                root = xml.etree.ElementTree.fromstring(content)
+            except xml.etree.ElementTree.ParseError:
+                return []
+
+            return [
+                (elem.get("name") or elem.text or "").strip()
+                for elem in root.iter("package")
+                if (elem.get("name") or elem.text or "").strip()
+            ]
+        #end if
+
+        names = []
+        in_packages = False
+
+        for line in content.splitlines():
+            if not line.strip() or line.lstrip().startswith("#"):
+                continue
+
+            if not line[0].isspace() and not line.startswith("-"):
+                in_packages = line.split(":", 1)[0].strip() == "packages"
+                continue
+
+            m = re.match(r"^\s*-\s*(?:name:\s*)?([^\s#:]+)\s*(?:#.*)?$", line)
+            if in_packages and m:
+                names.append(m.group(1).strip("\"'"))
+        #end for
+
+        return names
+    #end function
+
+    # Adds the packages of the index at `path` that belongs to the feed at
+    # `base_url`. Packages listed earlier win.
+    def add(self, path, base_url):
+        for stanza in self.parse(path):
+            name = stanza.get("Package")
+            filename = stanza.get("Filename")
+            digest = (stanza.get("SHA256sum") or "").lower()
+
+            if not name or not filename or name in self._packages:
+                continue
+            if not re.match(r"^[a-f0-9]{64}$", digest):
+                continue
+
+            self._packages[name] = {
+                "filename": filename,
+                "url": base_url.rstrip("/") + "/" +
+                    re.sub(r"^(\./)+", "", filename),
+                "sha256": digest,
+                "size": int(stanza.get("Size", "0") or 0),
+                "depends": self._dependencies(stanza),
+            }
+
+            for provided in self._names(stanza.get("Provides", "")):
+                self._providers.setdefault(provided, name)
+        #end for
+    #end function
+
+    def packages(self):
+        return list(self._packages.values())
+    #end function
+
+    def __contains__(self, name):
+        return name in self._packages
+    #end function
+
+    def __getitem__(self, name):
+        return self._packages[name]
+    #end function
+
+    # Returns the names of the packages that installing `names` pulls in,
+    # including those. Version constraints are not taken into account, and of
+    # alternatives, the first one that is available wins. Names that aren't
+    # in the index are left out.
+    def resolve(self, names):
+        result = set()
+        pending = list(names)
+
+        while pending:
+            name = self._lookup(pending.pop())
+
+            if name is None or name in result:
+                continue
+
+            result.add(name)
+
+            for alternatives in self._packages[name]["depends"]:
+                for alternative in alternatives:
+                    if self._lookup(alternative) is not None:
+                        pending.append(alternative)
+                        break
+                #end for
+            #end for
+        #end while
+
+        return result
+    #end function
+
+    def _lookup(self, name):
+        if name in self._packages:
+            return name
+        return self._providers.get(name)
+    #end function
+
+    def _dependencies(self, stanza):
+        result = []
+
+        for field in self.DEPENDENCY_FIELDS:
+            for clause in stanza.get(field, "").split(","):
+                alternatives = self._names(clause.replace("|", ","))
+                if alternatives:
+                    result.append(alternatives)
+            #end for
+        #end for
+
+        return result
+    #end function
+
+    # Strips version constraints and architecture qualifiers from a comma
+    # separated list of package names.
+    def _names(self, value):
+        result = []
+
+        for item in value.split(","):
+            name = re.sub(r"\(.*?\)", "", item).strip().split(":", 1)[0]
+            if name:
+                result.append(name)
+        #end for
+
+        return result
+    #end function
+
+#end class
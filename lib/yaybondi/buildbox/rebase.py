@@ -0,0 +1,389 @@
+# -*- encoding: utf-8 -*-
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+import concurrent.futures
+import errno
+import gzip
+import hashlib
+import json
+import os
+import shutil
+import stat
+
+from yaybondi.buildbox.clone import TreeCloner
+from yaybondi.buildbox.sysroot import Sysroot
+
+# A manifest maps paths relative to the root of a tree to entries of the form
+# [kind, mode, size, mtime_ns, digest]. The kind is "d", "f" or "l". For files,
+# the digest is the sha256 of the contents, or None if nobody needed it yet.
+# For symlinks, it is the link target.
+#
+# Rebasing is a three-way merge: the manifest that was recorded when the
+# target was cloned from (or last rebased onto) the golden target tells which
+# side changed what.
+class TreeRebaser:
+
+    KIND_DIR = "d"
+    KIND_FILE = "f"
+    KIND_LINK = "l"
+
+    BLOCK_SIZE = 1024 * 1024
+
+    def __init__(self, jobs=None, force=False):
+        self._jobs = jobs or os.cpu_count() or 1
+        self._force = force
+        self._cloner = TreeCloner("auto", self._jobs)
+    #end function
+
+    @classmethod
+    def load_manifest(cls, path):
+        try:
+            with gzip.open(path, "rt", encoding="utf-8") as f:
+                return json.load(f)["entries"]
+        except FileNotFoundError:
+            return None
+    #end function
+
+    @classmethod
+    def save_manifest(cls, path, entries, origin):
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        tmp_path = path + ".tmp"
+
+        with gzip.open(tmp_path, "wt", encoding="utf-8") as f:
+            json.dump({"origin": origin, "entries": entries}, f)
+
+        os.rename(tmp_path, path)
+    #end function
+
+    # Collects the entries of the tree at `root`. Mount points are left out,
+    # they don't belong to the target.
+    def scan(self, root):
+        root = os.path.realpath(root)
+        skip = Sysroot.mount_points_below(root)
+        entries = {}
+
+        with concurrent.futures.ThreadPoolExecutor(self._jobs) as pool:
+            pending = [pool.submit(self._scan_dir, pool, root, "", skip)]
+
+            try:
+                while pending:
+                    sub_entries, sub_jobs = pending.pop().result()
+                    entries.update(sub_entries)
+                    pending.extend(sub_jobs)
+                #end while
+            except BaseException:
+                for job in pending:
+                    job.cancel()
+                raise
+            #end try
+
+        return entries
+    #end function
+
+    # Makes the tree at `target_dir` follow the changes that happened in
+    # `golden_dir` since `baseline` was recorded. Returns the manifest of the
+    # golden tree, which is the baseline for the next rebase, and a summary of
+    # what was done.
+    def rebase(self, target_dir, golden_dir, baseline=None):
+        golden = self.scan(golden_dir)
+        target = self.scan(target_dir)
+
+        # Without a baseline, there is no telling local changes from upstream
+        # ones. Everything the golden target has wins, nothing is removed.
+        has_baseline = baseline is not None
+        baseline = baseline or {}
+
+        self._compute_digests(golden_dir, golden, target_dir, target,
+            baseline)
+
+        updates = []
+        removals = []
+        conflicts = []
+        blocked = set()
+
+        for rel in sorted(golden):
+            if self._is_blocked(rel, blocked):
+                continue
+
+            g = golden[rel]
+            t = target.get(rel)
+            b = baseline.get(rel)
+
+            if t and self._same(g, t):
+                continue
+
+            if b and self._same(g, b):
+                # Only the target changed this, keep it.
+                take = False
+            elif not has_baseline or self._force:
+                take = True
+            elif (t is None and b is None) or \
+                    (t and b and self._same(t, b)):
+                take = True
+            else:
+                take = False
+                conflicts.append(rel)
+            #end if
+
+            if take:
+                updates.append(rel)
+            elif g[0] == self.KIND_DIR and (not t or t[0] != self.KIND_DIR):
+                # Whatever is below a directory that doesn't make it into
+                # the target stays out, too.
+                blocked.add(rel)
+        #end for
+
+        for rel in baseline:
+            if rel in golden or rel not in target:
+                continue
+            if self._is_blocked(rel, blocked):
+                continue
+
+            if self._same(target[rel], baseline[rel]) or self._force:
+                removals.append(rel)
+            else:
+                conflicts.append(rel)
+        #end for
+
+        self._apply(target_dir, golden_dir, golden, target, updates)
+        removed = self._remove(target_dir, target, removals)
+
+        return golden, {
+            "updated": len(updates),
+            "removed": removed,
+            "conflicts": sorted(conflicts)
+        }
+    #end function
+
+    def _scan_dir(self, pool, root, rel_dir, skip):
+        entries = {}
+        sub_jobs = []
+
+        with os.scandir(os.path.join(root, rel_dir)) as it:
+            for entry in it:
+                rel = os.path.join(rel_dir, entry.name)
+                st = entry.stat(follow_symlinks=False)
+
+                if stat.S_ISDIR(st.st_mode):
+                    if entry.path in skip:
+                        continue
+                    entries[rel] = self._entry(self.KIND_DIR, st)
+                    sub_jobs.append(
+                        pool.submit(self._scan_dir, pool, root, rel, skip)
+                    )
+                elif stat.S_ISREG(st.st_mode):
+                    entries[rel] = self._entry(self.KIND_FILE, st)
+                elif stat.S_ISLNK(st.st_mode):
+                    entries[rel] = self._entry(self.KIND_LINK, st,
+                        os.readlink(entry.path))
+                #end if
+            #end for
+
+        return entries, sub_jobs
+    #end function
+
+    def _entry(self, kind, st, digest=None):
+        return [
+            kind, stat.S_IMODE(st.st_mode), st.st_size, st.st_mtime_ns,
+            digest
+        ]
+    #end function
+
+    # Files of the same size but with different timestamps get their contents
+    # compared. The digests are computed in parallel up front, so that the
+    # comparisons that follow are cheap.
+    def _compute_digests(self, golden_dir, golden, target_dir, target,
+            baseline):
+        wanted = {}
+
+        # Digests in the baseline are only known for files that were compared
+        # before. If the target still has the baseline version, comparing
+        # against the target gives the same answer.
+        for rel, g in golden.items():
+            t = target.get(rel)
+            b = baseline.get(rel)
+
+            if self._needs_digest(g, t):
+                wanted[(golden_dir, rel)] = g
+                wanted[(target_dir, rel)] = t
+            if self._needs_digest(g, b) and b[4] is not None:
+                wanted[(golden_dir, rel)] = g
+        #end for
+
+        for rel, t in target.items():
+            b = baseline.get(rel)
+
+            if self._needs_digest(t, b) and b[4] is not None:
+                wanted[(target_dir, rel)] = t
+        #end for
+
+        with concurrent.futures.ThreadPoolExecutor(self._jobs) as pool:
+            jobs = {
+                pool.submit(self._digest, os.path.join(*key)): entry
+                for key, entry in wanted.items()
+            }
+
+            for job in concurrent.futures.as_completed(jobs):
+                jobs[job][4] = job.result()
+    #end function
+
+    def _needs_digest(self, a, b):
+        return bool(b) and a[0] == self.KIND_FILE and \
+            b[0] == self.KIND_FILE and a[2] == b[2] and \
+            a[3] != b[3]
+    #end function
+
+    def _digest(self, path):
+        h = hashlib.sha256()
+
+        with open(path, "rb") as f:
+            while True:
+                buf = f.read(self.BLOCK_SIZE)
+                if not buf:
+                    break
+                h.update(buf)
+            #end while
+
+        return h.hexdigest()
+    #end function
+
+    def _same(self, a, b):
+        if a[0] != b[0] or a[1] != b[1]:
+            return False
+        if a[0] == self.KIND_DIR:
+            return True
+        if a[0] == self.KIND_LINK:
+            return a[4] == b[4]
+        if a[2] != b[2]:
+            return False
+        if a[3] == b[3]:
+            return True
+        return a[4] is not None and a[4] == b[4]
+    #end function
+
+    def _is_blocked(self, rel, blocked):
+        parent = os.path.dirname(rel)
+
+        while parent:
+            if parent in blocked:
+                return True
+            parent = os.path.dirname(parent)
+        #end while
+
+        return False
+    #end function
+
+    def _apply(self, target_dir, golden_dir, golden, target, updates):
+        files = []
+
+        # Directories come first and in order, so that everything has a
+        # place to go to.
+        for rel in updates:
+            g = golden[rel]
+            t = target.get(rel)
+            dst = os.path.join(target_dir, rel)
+
+            if g[0] != self.KIND_DIR:
+                files.append(rel)
+                continue
+
+            if t and t[0] == self.KIND_DIR:
+                os.chmod(dst, g[1])
+                continue
+            if t:
+                os.unlink(dst)
+
+            os.mkdir(dst, g[1])
+        #end for
+
+        with concurrent.futures.ThreadPoolExecutor(self._jobs) as pool:
+            jobs = [
+                pool.submit(self._apply_file, target_dir, golden_dir, rel,
+                    target.get(rel))
+                for rel in files
+            ]
+
+            for job in jobs:
+                job.result()
+    #end function
+
+    # Puts the golden version next to the one in the target and renames it
+    # over, so that a failure never leaves a half-written file behind.
+    def _apply_file(self, target_dir, golden_dir, rel, t):
+        src = os.path.join(golden_dir, rel)
+        dst = os.path.join(target_dir, rel)
+        tmp = os.path.join(
+            os.path.dirname(dst), ".#{}.rebase".format(os.path.basename(dst))
+        )
+
+        if os.path.lexists(tmp):
+            os.unlink(tmp)
+
+        st = os.lstat(src)
+
+        try:
+            if stat.S_ISLNK(st.st_mode):
+                os.symlink(os.readlink(src), tmp)
+                os.utime(tmp, ns=(st.st_atime_ns, st.st_mtime_ns),
+                    follow_symlinks=False)
+            else:
+                self._cloner.copy_file(src, tmp, st)
+
+            if t and t[0] == self.KIND_DIR:
+                shutil.rmtree(dst)
+
+            os.rename(tmp, dst)
+        except BaseException:
+            if os.path.lexists(tmp):
+                os.unlink(tmp)
+            raise
+        #end try
+    #end function
+
+    def _remove(self, target_dir, target, removals):
+        removed = 0
+
+        # Deepest first. Directories that still hold local additions stay.
+        for rel in sorted(removals, reverse=True):
+            path = os.path.join(target_dir, rel)
+
+            try:
+                if target[rel][0] == self.KIND_DIR:
+                    os.rmdir(path)
+                else:
+                    os.unlink(path)
+            except OSError as e:
+                if e.errno not in [errno.ENOENT, errno.ENOTEMPTY]:
+                    raise
+                continue
+            #end try
+
+            removed += 1
+        #end for
+
+        return removed
+    #end function
+
+#end class
@@ -23,7 +23,10 @@
 # THE SOFTWARE.
 #
 
+import fcntl
 import logging
+import os
+import re
 import subprocess
 import sys
 
@@ -34,32 +37,105 @@ LOGGER = logging.getLogger(__name__)
 
 class Sysroot(BaseSysroot):
 
+    # `build-box umount` exits with this status, when it leaves the mounts
+    # to other sessions that still use the target.
+    UMOUNT_BUSY = 253
+
     def __init__(self, sysroot):
         super().__init__(sysroot)
+        self._lease_fd = None
 
     def __enter__(self):
+        # Hold a lease on the mounts while we use them. `build-box umount`
+        # leaves them alone as long as someone else holds one, too.
+        self._lease_fd = os.open(self.sysroot, os.O_RDONLY | os.O_DIRECTORY)
+        fcntl.flock(self._lease_fd, fcntl.LOCK_SH)
+
         cmd = [sys.argv[0], "mount", "-t", self.sysroot, "."]
-        for mountpoint in self.MOUNTPOINTS:
+        for mountpoint in list(self.MOUNTPOINTS) + ["pkg-cache"]:
             cmd.insert(2, "-m")
             cmd.insert(3, mountpoint)
 
         proc = subprocess.run(cmd)
         if proc.returncode != 0:
+            self.release_lease()
             raise BuildBoxError("failed to set up bind mounts.")
 
+        # Mounting a layered target for the first time puts an overlay on top
+        # of the target directory. The lease has to move on to that.
+        lease_stat = os.fstat(self._lease_fd)
+        root_stat = os.stat(self.sysroot)
+
+        if (lease_stat.st_dev, lease_stat.st_ino) != \
+                (root_stat.st_dev, root_stat.st_ino):
+            lease_fd = os.open(self.sysroot, os.O_RDONLY | os.O_DIRECTORY)
+            fcntl.flock(lease_fd, fcntl.LOCK_SH)
+            self.release_lease()
+            self._lease_fd = lease_fd
+        #end if
+
         return self
     #end function
 
     def __exit__(self, exc_type, exc_val, exc_tb):
         self.terminate_processes()
+        self.release_lease()
         self.umount_all()
         return False
     #end function
 
     def umount_all(self):
-        proc = subprocess.run([sys.argv[0], "umount", "-t", self.sysroot, "."])
+        proc = subprocess.run(
+            [sys.argv[0], "umount", "-t", self.sysroot, "."],
+            stderr=subprocess.PIPE
+        )
+        if proc.returncode == self.UMOUNT_BUSY:
+            return
         if proc.returncode != 0:
+            sys.stderr.buffer.write(proc.stderr)
             raise BuildBoxError("failed to release bind mounts.")
     #end function
 
+    def release_lease(self):
+        if self._lease_fd is not None:
+            os.close(self._lease_fd)
+            self._lease_fd = None
+    #end function
+
+    # Returns the mount points below `path`, which don't belong to the tree
+    # when it is copied somewhere else.
+    @classmethod
+    def mount_points_below(cls, path):
+        path = os.path.realpath(path)
+        mount_points = set()
+
+        with open("/proc/self/mounts", "r", encoding="utf-8") as f:
+            for line in f:
+                mount_point = re.sub(
+                    r"\\([0-7]{3})", lambda m: chr(int(m.group(1), 8)),
+                    line.split()[1]
+                )
+                if mount_point.startswith(path + os.sep):
+                    mount_points.add(mount_point)
+            #end for
+
+        return mount_points
+    #end function
+
+    def umount_recursive(self, lazy=False):
+        cmd = [sys.argv[0], "umount", "--all", "-t", self.sysroot, "."]
+        if lazy:
+            cmd.insert(3, "--lazy")
+
+        proc = subprocess.run(cmd, stderr=subprocess.PIPE)
+        if proc.returncode == self.UMOUNT_BUSY:
+            raise BuildBoxError(
+                "target '{}' is still in use."
+                .format(os.path.basename(self.sysroot))
+            )
+        if proc.returncode != 0:
+            sys.stderr.buffer.write(proc.stderr)
+            raise BuildBoxError("failed to release mounts.")
+    #end function
+
 #end class
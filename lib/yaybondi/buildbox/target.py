@@ -23,21 +23,43 @@
 # THE SOFTWARE.
 #
 
+import collections
+import concurrent.futures
+import contextlib
+import fcntl
+import hashlib
 import json
+import logging
+import multiprocessing
 import os
 import re
 import subprocess
 import shutil
 import signal
+import stat
 import sys
+import tarfile
+import tempfile
 
+from yaybondi.buildbox.archive import ArchiveExtractor
+from yaybondi.buildbox.archive import ArchiveManifest
+from yaybondi.buildbox.archive import ArchiveWriter
+from yaybondi.buildbox.clone import TreeCloner
 from yaybondi.buildbox.error import BuildBoxError
 from yaybondi.buildbox.generator import BuildBoxGenerator
 from yaybondi.buildbox.misc.paths import Paths
+from yaybondi.buildbox.pkgcache import PackageCache
+from yaybondi.buildbox.pkgindex import PackageIndex
+from yaybondi.buildbox.rebase import TreeRebaser
 from yaybondi.buildbox.sysroot import Sysroot
+from yaybondi.buildbox.usage import DiskUsage
+
+LOGGER = logging.getLogger(__name__)
 
 class BuildBoxTarget:
 
+    PREBUILT_FORMAT = 1
+
     @classmethod
     def init(cls):
         cmd = [sys.argv[0], "init"]
@@ -84,8 +106,29 @@ class BuildBoxTarget:
             #end if
         #end if
 
+        image_gen = BuildBoxGenerator(**kwargs)
+
+        with cls._prebuilt(image_gen, specs, **kwargs) as prebuilt_dir:
+            if prebuilt_dir and os.path.isdir(prebuilt_dir):
+                cls._create_from_prebuilt(prebuilt_dir, target_name,
+                    image_gen, **kwargs)
+                return
+            #end if
+
+            cls._build(target_dir, target_name, image_gen, specs, **kwargs)
+
+            if prebuilt_dir:
+                cls._store_prebuilt(target_dir, prebuilt_dir)
+    #end function
+
+    @classmethod
+    def _build(cls, target_dir, target_name, image_gen, specs, **kwargs):
         try:
-            os.mkdir(target_dir)
+            # On btrfs, a flat target lives in a subvolume of its own, which
+            # can be cloned with a snapshot.
+            if kwargs.get("layered") or \
+                    not TreeCloner.make_subvolume(target_dir):
+                os.mkdir(target_dir)
         except OSError as e:
             raise BuildBoxError(
                 'failed to create target folder "{}": {}'
@@ -93,52 +136,886 @@ class BuildBoxTarget:
             )
 
         try:
-            image_gen = BuildBoxGenerator(**kwargs)
-            image_gen.prepare(target_dir, target_name)
+            # A baseline left over from an earlier target of the same name
+            # would make `rebase` drop files.
+            cls._forget_baseline(target_name, **kwargs)
+
+            # New files inherit the project id, so it is cheapest to assign
+            # it while the target is still empty.
+            if kwargs.get("layered"):
+                cls._prepare_layers(target_dir, target_name, image_gen,
+                    **kwargs)
+                cls._assign_project(target_name, **kwargs)
+            else:
+                cls._assign_project(target_name, **kwargs)
+                image_gen.prepare(target_dir, target_name)
 
+            # The overlay of a layered target is only assembled on mount.
             with Sysroot(target_dir):
+                if kwargs.get("layered"):
+                    image_gen.configure_target(target_dir, target_name)
                 for specfile in specs:
                     image_gen.customize(target_dir, specfile)
         except (KeyboardInterrupt, Exception):
+            cls._discard(target_name, **kwargs)
+            raise
+        #end try
+    #end function
+
+    # Removes what is left of a target that could not be created. The user
+    # has to wait for that, another Ctrl+C must not get in the way.
+    @classmethod
+    def _discard(cls, target_name, **kwargs):
+        old_sig_handler = signal.signal(signal.SIGINT, signal.SIG_IGN)
+
+        try:
+            cls._delete(target_name, **kwargs)
+        except Exception:
+            pass
+        finally:
+            signal.signal(signal.SIGINT, old_sig_handler)
+    #end function
+
+    # Flat targets that are made from the same inputs come out the same,
+    # except for their name. A copy of the first one is kept under a hash of
+    # the inputs and later targets are cloned from it. Whoever holds the lock
+    # on the hash builds and stores, everybody else waits and then clones.
+    # Yields None if the target can't come from the cache.
+    @classmethod
+    @contextlib.contextmanager
+    def _prebuilt(cls, image_gen, specs, **kwargs):
+        if kwargs.get("layered") or not kwargs.get("prebuilt", True):
+            yield None
+            return
+        #end if
+
+        prebuilt_prefix = kwargs.get(
+            "prebuilt_prefix", Paths.prebuilt_prefix()
+        )
+
+        try:
+            os.makedirs(prebuilt_prefix, exist_ok=True)
+        except OSError as e:
+            raise BuildBoxError(
+                "failed to create prebuilt prefix '{}': {}"
+                .format(prebuilt_prefix, str(e))
+            )
+
+        try:
+            prebuilt_key = cls._prebuilt_key(image_gen, specs, **kwargs)
+        except BuildBoxError as e:
+            LOGGER.warning("not using prebuilt targets: {}".format(e))
+            yield None
+            return
+        #end try
+
+        prebuilt_dir = os.path.join(prebuilt_prefix, prebuilt_key)
+
+        with open(prebuilt_dir + ".lock", "a", encoding="utf-8") as lock_file:
+            fcntl.flock(lock_file, fcntl.LOCK_EX)
+            yield prebuilt_dir
+    #end function
+
+    # The hash covers everything the generator derives the target from: the
+    # base, the generator context with the package feeds, the current package
+    # indices of the feeds, and the contents of the specs in the order in
+    # which they are applied. With the indices in the hash, updates to the
+    # feeds lead to a new prebuilt target instead of a stale one.
+    @classmethod
+    def _prebuilt_key(cls, image_gen, specs, **kwargs):
+        h = hashlib.sha256()
+
+        h.update(
+            json.dumps(
+                {
+                    "format": cls.PREBUILT_FORMAT,
+                    "base": image_gen.base_name,
+                    "context": image_gen.context,
+                    "feeds": image_gen.feeds,
+                    "indices": PackageIndex.digests(
+                        image_gen.feeds, PackageCache()
+                    ),
+                    "verify": kwargs.get("verify", True)
+                },
+                sort_keys=True,
+                default=str
+            ).encode("utf-8")
+        )
+
+        for specfile in specs:
+            with open(specfile, "rb") as f:
+                h.update(hashlib.sha256(f.read()).digest())
+        #end for
+
+        return h.hexdigest()
+    #end function
+
+    # Snapshots and reflinks are copy-on-write, and "auto" never hard links,
+    # so the target can't change the cached tree.
+    @classmethod
+    def _copy_prebuilt(cls, src_dir, dst_dir):
+        return TreeCloner("auto").clone(src_dir, dst_dir)
+    #end function
+
+    @classmethod
+    def _create_from_prebuilt(cls, prebuilt_dir, target_name, image_gen,
+            **kwargs):
+        target_prefix = kwargs.get("target_prefix", Paths.target_prefix())
+        target_dir = os.path.join(target_prefix, target_name)
+
+        try:
+            backend = cls._copy_prebuilt(prebuilt_dir, target_dir)
+
+            cls._forget_baseline(target_name, **kwargs)
+            cls._assign_project(target_name, **kwargs)
+            image_gen.configure_target(target_dir, target_name)
+        except (KeyboardInterrupt, Exception) as e:
+            if os.path.lexists(target_dir):
+                cls._discard(target_name, **kwargs)
+            if isinstance(e, OSError):
+                raise BuildBoxError(
+                    "failed to create target '{}' from the cache: {}"
+                    .format(target_name, e)
+                )
+            raise
+        #end try
+
+        # Last use decides what `gc` evicts first.
+        os.utime(prebuilt_dir)
+
+        LOGGER.info(
+            "created target '{}' from the cache ({})."
+            .format(target_name, backend)
+        )
+    #end function
+
+    # The target is complete at this point, so failing to keep a copy of it
+    # is not worth more than a warning.
+    @classmethod
+    def _store_prebuilt(cls, target_dir, prebuilt_dir):
+        prebuilt_prefix, key = os.path.split(prebuilt_dir)
+        tmp_name = ".{}.tmp".format(key)
+        tmp_dir = os.path.join(prebuilt_prefix, tmp_name)
+
+        try:
+            if os.path.lexists(tmp_dir):
+                cls._delete_prebuilt(tmp_name, prebuilt_prefix)
+            cls._copy_prebuilt(target_dir, tmp_dir)
+            os.rename(tmp_dir, prebuilt_dir)
+        except (OSError, BuildBoxError) as e:
+            LOGGER.warning(
+                "failed to store target in the cache: {}".format(e)
+            )
+            if os.path.lexists(tmp_dir):
+                cls._delete_prebuilt(tmp_name, prebuilt_prefix)
+        #end try
+    #end function
+
+    @classmethod
+    def _delete_prebuilt(cls, name, prebuilt_prefix):
+        proc = subprocess.run(
+            ["build-box-do", "delete", "-t", prebuilt_prefix, name]
+        )
+        return proc.returncode == 0
+    #end function
+
+    # Creates the targets in `targets`, a list of (name, specs) tuples, up to
+    # `jobs` of them at the same time. Each one is created in a process of
+    # its own. Targets of the same kind share their base and package cache,
+    # both are coordinated through locks.
+    @classmethod
+    def create_many(cls, targets, jobs=None, **kwargs):
+        names = [name for name, _ in targets]
+
+        for name in names:
+            cls._target_name_valid_or_raise(name)
+
+        duplicates = sorted(
+            name for name, count in collections.Counter(names).items()
+            if count > 1
+        )
+
+        if duplicates:
+            raise BuildBoxError(
+                "target '{}' given more than once.".format(duplicates[0])
+            )
+
+        jobs = min(jobs or os.cpu_count() or 1, len(targets))
+        context = multiprocessing.get_context("fork")
+        failed = []
+
+        with concurrent.futures.ProcessPoolExecutor(jobs,
+                mp_context=context) as pool:
+            futures = {
+                pool.submit(cls.create, name, *specs, **kwargs): name
+                for name, specs in targets
+            }
+
+            for future in concurrent.futures.as_completed(futures):
+                name = futures[future]
+
+                try:
+                    future.result()
+                except Exception as e:
+                    LOGGER.error(
+                        "failed to create target '{}': {}".format(name, e)
+                    )
+                    failed.append(name)
+                    continue
+                #end try
+
+                LOGGER.info("created target '{}'.".format(name))
+            #end for
+
+        if failed:
+            raise BuildBoxError(
+                "{} of {} targets could not be created."
+                .format(len(failed), len(targets))
+            )
+        #end if
+    #end function
+
+    # Downloads the packages that the `specs` need to the package cache.
+    @classmethod
+    def prefetch(cls, *specs, jobs=None, **kwargs):
+        image_gen = BuildBoxGenerator(**kwargs)
+        num_packages, num_downloaded = image_gen.prefetch(specs, jobs)
+
+        LOGGER.info(
+            "{} packages in the cache, {} of them downloaded."
+            .format(num_packages, num_downloaded)
+        )
+    #end function
+
+    @classmethod
+    def clone(cls, src_name, dst_name, **kwargs):
+        cls._target_name_valid_or_raise(src_name)
+        cls._target_name_valid_or_raise(dst_name)
+
+        target_prefix = kwargs.get("target_prefix", Paths.target_prefix())
+        layer_prefix = kwargs.get("layer_prefix", Paths.layer_prefix())
+
+        src_dir = os.path.normpath(os.path.join(target_prefix, src_name))
+        dst_dir = os.path.normpath(os.path.join(target_prefix, dst_name))
+        dst_layer_dir = os.path.join(layer_prefix, dst_name)
+
+        if not os.path.isdir(src_dir):
+            raise BuildBoxError("target '{}' not found.".format(src_name))
+
+        cls._isdir_and_owned_or_raise(src_dir)
+
+        for path in [dst_dir, dst_layer_dir]:
+            if os.path.lexists(path):
+                raise BuildBoxError(
+                    "'{}' already exists, aborting.".format(path)
+                )
+        #end for
+
+        cloner = TreeCloner(kwargs.get("backend", "auto"), kwargs.get("jobs"))
+        layers = cls._layers(src_dir, **kwargs)
+
+        if kwargs.get("backend") == "hardlink":
+            LOGGER.warning(
+                "files below /usr and /tools are shared with '{}', changing "
+                "one of them in place changes it in both targets."
+                .format(src_name)
+            )
+        #end if
+
+        try:
+            if layers:
+                try:
+                    backend = cls._clone_layers(cloner, src_dir, dst_dir,
+                        layers, **kwargs)
+                except TreeCloner.Whiteout:
+                    # Deletions in the upper layer can't be reproduced
+                    # without privileges. Copy the assembled tree instead.
+                    cls._remove_clone(dst_dir, dst_layer_dir)
+
+                    with Sysroot(src_dir):
+                        backend = cloner.clone(src_dir, dst_dir)
+                        cls._record_baseline(src_name, dst_name, **kwargs)
+                #end try
+            else:
+                backend = cloner.clone(src_dir, dst_dir)
+                cls._record_baseline(src_name, dst_name, **kwargs)
+
+            cls._assign_project(dst_name, **kwargs)
+        except (KeyboardInterrupt, Exception) as e:
             old_sig_handler = signal.signal(signal.SIGINT, signal.SIG_IGN)
 
             try:
-                cls._delete(target_name, **kwargs)
-            except Exception:
-                pass
+                cls._remove_clone(dst_dir, dst_layer_dir)
             finally:
                 signal.signal(signal.SIGINT, old_sig_handler)
 
+            if isinstance(e, OSError):
+                raise BuildBoxError(
+                    "failed to clone target '{}': {}".format(src_name, e)
+                )
+            raise
+        #end try
+
+        return backend
+    #end function
+
+    @classmethod
+    def _clone_layers(cls, cloner, src_dir, dst_dir, layers, **kwargs):
+        layer_prefix = kwargs.get("layer_prefix", Paths.layer_prefix())
+
+        dst_layer_dir = os.path.join(
+            layer_prefix, os.path.basename(dst_dir)
+        )
+
+        os.mkdir(dst_dir)
+        os.mkdir(dst_layer_dir)
+        os.mkdir(os.path.join(dst_layer_dir, "work"))
+
+        backend = cloner.clone(
+            layers[0], os.path.join(dst_layer_dir, "upper")
+        )
+
+        with open(os.path.join(dst_layer_dir, "layer"), "w+",
+                encoding="utf-8") as f:
+            f.write(
+                "sysroot {}\nbase {}\n".format(
+                    os.path.realpath(dst_dir), os.path.basename(layers[1])
+                )
+            )
+
+        return backend
+    #end function
+
+    @classmethod
+    def _remove_clone(cls, dst_dir, dst_layer_dir):
+        for path in [dst_dir, dst_layer_dir]:
+            if os.path.lexists(path):
+                shutil.rmtree(path, ignore_errors=True)
+        #end for
+    #end function
+
+    # Remembers what `src_name` looks like, so that a later `rebase` of
+    # `dst_name` can tell local changes from those made to `src_name`.
+    @classmethod
+    def _record_baseline(cls, src_name, dst_name, **kwargs):
+        target_prefix = kwargs.get("target_prefix", Paths.target_prefix())
+        src_dir = os.path.join(target_prefix, src_name)
+
+        rebaser = TreeRebaser(kwargs.get("jobs"))
+        rebaser.save_manifest(
+            cls._baseline_path(dst_name, **kwargs), rebaser.scan(src_dir),
+            src_name
+        )
+    #end function
+
+    @classmethod
+    def _baseline_path(cls, target_name, **kwargs):
+        manifest_prefix = kwargs.get(
+            "manifest_prefix", Paths.manifest_prefix()
+        )
+        return os.path.join(manifest_prefix, target_name)
+    #end function
+
+    @classmethod
+    def _forget_baseline(cls, target_name, **kwargs):
+        try:
+            os.unlink(cls._baseline_path(target_name, **kwargs))
+        except FileNotFoundError:
+            pass
+    #end function
+
+    @classmethod
+    def rebase(cls, target_name, golden_name, **kwargs):
+        cls._target_name_valid_or_raise(target_name)
+        cls._target_name_valid_or_raise(golden_name)
+
+        target_prefix = kwargs.get("target_prefix", Paths.target_prefix())
+
+        target_dir = os.path.normpath(os.path.join(target_prefix, target_name))
+        golden_dir = os.path.normpath(os.path.join(target_prefix, golden_name))
+
+        if target_dir == golden_dir:
+            raise BuildBoxError("cannot rebase a target onto itself.")
+
+        for name, path in [(target_name, target_dir), (golden_name,
+                golden_dir)]:
+            if not os.path.isdir(path):
+                raise BuildBoxError("target '{}' not found.".format(name))
+            cls._isdir_and_owned_or_raise(path)
+        #end for
+
+        baseline_path = cls._baseline_path(target_name, **kwargs)
+        rebaser = TreeRebaser(kwargs.get("jobs"), kwargs.get("force", False))
+
+        try:
+            baseline = rebaser.load_manifest(baseline_path)
+
+            if baseline is None:
+                LOGGER.warning(
+                    "no record of what '{}' was created from, local changes "
+                    "to files that '{}' has will be overwritten."
+                    .format(target_name, golden_name)
+                )
+            #end if
+
+            with contextlib.ExitStack() as stack:
+                # Layers only show up as one tree while they are mounted.
+                for path in [target_dir, golden_dir]:
+                    if cls._layers(path, **kwargs):
+                        stack.enter_context(Sysroot(path))
+                #end for
+
+                golden, summary = rebaser.rebase(target_dir, golden_dir,
+                    baseline)
+
+            rebaser.save_manifest(baseline_path, golden, golden_name)
+        except (OSError, ValueError) as e:
+            raise BuildBoxError(
+                "failed to rebase target '{}': {}".format(target_name, e)
+            )
+        #end try
+
+        for path in summary["conflicts"]:
+            LOGGER.warning(
+                "'/{}' was changed in both targets, keeping the local "
+                "version.".format(path)
+            )
+        #end for
+
+        LOGGER.info(
+            "{} entries updated, {} removed.".format(
+                summary["updated"], summary["removed"]
+            )
+        )
+
+        return summary
+    #end function
+
+    # Writes the target to stdout as a zstd compressed tar archive. The
+    # directory walk and the compression run in separate processes, and zstd
+    # uses all CPUs unless told otherwise. The walk runs with the privileges
+    # of the user, owners of imported files come from their manifest. Nobody
+    # gets to mount anything into the target while it is being read.
+    @classmethod
+    def export(cls, target_name, **kwargs):
+        cls._target_name_valid_or_raise(target_name)
+
+        target_prefix = kwargs.get("target_prefix", Paths.target_prefix())
+        target_dir = os.path.normpath(os.path.join(target_prefix, target_name))
+
+        if not os.path.isdir(target_dir):
+            raise BuildBoxError("target '{}' not found.".format(target_name))
+
+        cls._isdir_and_owned_or_raise(target_dir)
+
+        if os.isatty(sys.stdout.fileno()):
+            raise BuildBoxError("refusing to write the archive to a terminal.")
+
+        # Layers only show up as one tree while they are put together. The
+        # overlay stays in place afterwards, like after a `run`.
+        if cls._layers(target_dir, **kwargs):
+            proc = subprocess.run([
+                "build-box-do", "mount", "--no-mount", "-t", target_prefix,
+                target_name
+            ])
+            if proc.returncode != 0:
+                raise BuildBoxError(
+                    "failed to put together the layers of target '{}'."
+                    .format(target_name)
+                )
+            #end if
+        #end if
+
+        fd = os.open(target_dir, os.O_RDONLY | os.O_DIRECTORY)
+
+        try:
+            try:
+                fcntl.flock(fd, fcntl.LOCK_EX | fcntl.LOCK_NB)
+            except BlockingIOError:
+                raise BuildBoxError(
+                    "target '{}' is in use.".format(target_name)
+                )
+
+            mount_points = sorted(Sysroot.mount_points_below(target_dir))
+
+            if mount_points:
+                raise BuildBoxError(
+                    "there is something mounted at '{}', unmount the target "
+                    "first.".format(mount_points[0])
+                )
+            #end if
+
+            writer = ArchiveWriter(target_dir, ArchiveManifest.load(
+                cls._ownership_path(target_name, **kwargs), target_dir
+            ))
+
+            proc = subprocess.Popen(
+                [
+                    "zstd", "--quiet", "--stdout",
+                    "--threads={}".format(kwargs.get("jobs") or 0)
+                ],
+                stdin=subprocess.PIPE
+            )
+
+            try:
+                writer.write(proc.stdin)
+            except (tarfile.TarError, OSError) as e:
+                raise BuildBoxError(
+                    "failed to write the archive: {}".format(e)
+                )
+            finally:
+                try:
+                    proc.stdin.close()
+                except OSError:
+                    pass
+                proc.wait()
+            #end try
+
+            if proc.returncode != 0:
+                raise BuildBoxError(
+                    "'zstd' failed with exit status {}."
+                    .format(proc.returncode)
+                )
+            #end if
+        finally:
+            os.close(fd)
+        #end try
+    #end function
+
+    # Creates a new flat target from an archive made by `export`, read from
+    # stdin. Files are written out in parallel and belong to the user. What
+    # else the archive says about them is kept in a manifest for the next
+    # export.
+    @classmethod
+    def import_(cls, target_name, **kwargs):
+        cls._target_name_valid_or_raise(target_name)
+
+        if os.isatty(sys.stdin.fileno()):
+            raise BuildBoxError("expecting the archive on standard input.")
+
+        cls.init()
+
+        target_prefix = kwargs.get("target_prefix", Paths.target_prefix())
+
+        try:
+            os.makedirs(target_prefix, exist_ok=True)
+        except OSError as e:
+            raise BuildBoxError(
+                "failed to create target prefix '{}': {}"
+                .format(target_prefix, str(e))
+            )
+
+        target_dir = os.path.join(target_prefix, target_name)
+
+        if os.path.lexists(target_dir):
+            raise BuildBoxError(
+                "target '{}' already exists, aborting.".format(target_name)
+            )
+
+        try:
+            if not TreeCloner.make_subvolume(target_dir):
+                os.mkdir(target_dir)
+        except OSError as e:
+            raise BuildBoxError(
+                'failed to create target folder "{}": {}'
+                .format(target_dir, e)
+            )
+
+        try:
+            cls._forget_baseline(target_name, **kwargs)
+            cls._assign_project(target_name, **kwargs)
+
+            extractor = ArchiveExtractor(target_dir, jobs=kwargs.get("jobs"))
+
+            proc = subprocess.Popen(
+                ["zstd", "--quiet", "--decompress", "--stdout"],
+                stdout=subprocess.PIPE
+            )
+
+            try:
+                manifest = extractor.extract(proc.stdout)
+                # Whatever comes after the end of the archive is padding.
+                proc.stdout.read()
+
+                ArchiveManifest.save(
+                    cls._ownership_path(target_name, **kwargs), target_dir,
+                    manifest
+                )
+            except (tarfile.TarError, OSError) as e:
+                raise BuildBoxError(
+                    "failed to extract the archive: {}".format(e)
+                )
+            finally:
+                proc.stdout.close()
+                proc.wait()
+            #end try
+
+            if proc.returncode != 0:
+                raise BuildBoxError(
+                    "'zstd' failed with exit status {}."
+                    .format(proc.returncode)
+                )
+            #end if
+        except (KeyboardInterrupt, Exception):
+            cls._discard(target_name, **kwargs)
             raise
         #end try
     #end function
 
+    @classmethod
+    def _ownership_path(cls, target_name, **kwargs):
+        ownership_prefix = kwargs.get(
+            "ownership_prefix", Paths.ownership_prefix()
+        )
+        return os.path.join(ownership_prefix, target_name)
+    #end function
+
+    # Runs `first_cmd | second_cmd` with stdin and stdout inherited.
+    @classmethod
+    def _run_pipeline(cls, first_cmd, second_cmd):
+        procs = []
+
+        try:
+            for cmd in [first_cmd, second_cmd]:
+                procs.append(subprocess.Popen(
+                    cmd,
+                    stdin=procs[0].stdout if procs else None,
+                    stdout=None if procs else subprocess.PIPE
+                ))
+            #end for
+        except OSError as e:
+            raise BuildBoxError(
+                "failed to run '{}': {}".format(cmd[0], e)
+            )
+        finally:
+            if procs:
+                procs[0].stdout.close()
+            if len(procs) == 1:
+                procs[0].kill()
+
+            for proc in reversed(procs):
+                proc.wait()
+        #end try
+
+        # If the second command failed, the first one got a SIGPIPE.
+        for proc, cmd in [(procs[1], second_cmd), (procs[0], first_cmd)]:
+            if proc.returncode != 0:
+                raise BuildBoxError(
+                    "'{}' failed with exit status {}."
+                    .format(cmd[0], proc.returncode)
+                )
+        #end for
+    #end function
+
+    @classmethod
+    def _prepare_base(cls, image_gen, **kwargs):
+        base_prefix = kwargs.get("base_prefix", Paths.base_prefix())
+        base_name = image_gen.base_name
+
+        cls._target_name_valid_or_raise(base_name)
+
+        try:
+            os.makedirs(base_prefix, exist_ok=True)
+        except OSError as e:
+            raise BuildBoxError(
+                "failed to create base prefix '{}': {}"
+                .format(base_prefix, str(e))
+            )
+
+        base_dir = os.path.join(base_prefix, base_name)
+
+        # Whoever gets the lock first installs the base, everybody else
+        # waits and then uses it. Bases are never modified once they are in
+        # place.
+        with open(base_dir + ".lock", "a", encoding="utf-8") as lock_file:
+            fcntl.flock(lock_file, fcntl.LOCK_EX)
+
+            if os.path.isdir(base_dir):
+                return base_dir
+
+            tmp_dir = tempfile.mkdtemp(
+                prefix=".{}.".format(base_name), dir=base_prefix
+            )
+
+            try:
+                os.chmod(tmp_dir, 0o755)
+                image_gen.prepare_base(tmp_dir)
+                os.rename(tmp_dir, base_dir)
+            except (KeyboardInterrupt, Exception):
+                shutil.rmtree(tmp_dir, ignore_errors=True)
+                raise
+            #end try
+
+        return base_dir
+    #end function
+
+    @classmethod
+    def _prepare_layers(cls, target_dir, target_name, image_gen, **kwargs):
+        layer_prefix = kwargs.get("layer_prefix", Paths.layer_prefix())
+        layer_dir = os.path.join(layer_prefix, target_name)
+
+        if os.path.exists(layer_dir):
+            raise BuildBoxError(
+                "layers of an earlier target '{}' are in the way at '{}'."
+                .format(target_name, layer_dir)
+            )
+
+        cls._prepare_base(image_gen, **kwargs)
+
+        try:
+            os.makedirs(os.path.join(layer_dir, "upper"))
+            os.makedirs(os.path.join(layer_dir, "work"))
+
+            with open(os.path.join(layer_dir, "layer"), "w+",
+                    encoding="utf-8") as f:
+                f.write(
+                    "sysroot {}\nbase {}\n".format(
+                        os.path.realpath(target_dir), image_gen.base_name
+                    )
+                )
+        except OSError as e:
+            shutil.rmtree(layer_dir, ignore_errors=True)
+            raise BuildBoxError(
+                "failed to create layers at '{}': {}"
+                .format(layer_dir, str(e))
+            )
+    #end function
+
+    # Gives the target a project id of its own, so that the file system
+    # keeps track of the space it uses. Without a size limit, this is nice to
+    # have, but not worth failing over.
+    @classmethod
+    def _assign_project(cls, target_name, **kwargs):
+        target_prefix = kwargs.get("target_prefix", Paths.target_prefix())
+        size_limit = kwargs.get("size_limit")
+
+        cmd = ["build-box-do", "quota", "--assign", "-t", target_prefix,
+            target_name]
+        if size_limit:
+            cmd[2:3] = ["--limit", size_limit]
+
+        proc = subprocess.run(
+            cmd, stderr=None if size_limit else subprocess.DEVNULL
+        )
+        if proc.returncode != 0 and size_limit:
+            raise BuildBoxError(
+                "failed to limit the size of target '{}'."
+                .format(target_name)
+            )
+    #end function
+
+    @classmethod
+    def _layers(cls, target_dir, **kwargs):
+        layer_prefix = kwargs.get("layer_prefix", Paths.layer_prefix())
+        base_prefix = kwargs.get("base_prefix", Paths.base_prefix())
+        image_prefix = kwargs.get("image_prefix", Paths.image_prefix())
+
+        target_dir = os.path.realpath(target_dir)
+        layer_dir = os.path.join(layer_prefix, os.path.basename(target_dir))
+        layer_info = {}
+
+        try:
+            with open(os.path.join(layer_dir, "layer"), "r",
+                    encoding="utf-8") as f:
+                for line in f:
+                    key, _, value = line.rstrip("\n").partition(" ")
+                    layer_info[key] = value
+                #end for
+        except OSError:
+            return []
+
+        # Layers that were set up for a target of the same name in a
+        # different location are none of our business.
+        if layer_info.get("sysroot") != target_dir or \
+                not layer_info.get("base"):
+            return []
+
+        # Bases that aren't directories of the user are images.
+        base_dir = os.path.join(base_prefix, layer_info["base"])
+        if not os.path.isdir(base_dir):
+            base_dir = os.path.join(image_prefix, layer_info["base"])
+
+        return [os.path.join(layer_dir, "upper"), base_dir]
+    #end function
+
+    # Returns the location of `path` within the target. Unless a layered
+    # target is mounted, it has to be looked up in the individual layers.
+    @classmethod
+    def _lookup(cls, target_dir, *path, **kwargs):
+        for root in [target_dir] + cls._layers(target_dir, **kwargs):
+            full_path = os.path.join(root, *path)
+            if os.path.lexists(full_path):
+                return full_path
+        #end for
+
+        return os.path.join(target_dir, *path)
+    #end function
+
     @classmethod
     def list(cls, **kwargs):
         target_prefix = kwargs.get("target_prefix", Paths.target_prefix())
         if not os.path.isdir(target_prefix):
             return
 
-        for entry in sorted(os.listdir(target_prefix)):
+        entries = [
+            entry for entry in sorted(os.listdir(target_prefix))
+            if os.path.isdir(os.path.join(target_prefix, entry))
+        ]
+
+        usage = {}
+        if kwargs.get("long"):
+            usage = cls._disk_usage(entries, **kwargs)
+        width = max([len(entry) for entry in entries] + [0])
+
+        for entry in entries:
             machine = "defunct"
             libc    = "unknown"
 
-            if not os.path.isdir(os.path.join(target_prefix, entry)):
-                continue
-
-            shell_found = False
+            # The contents of an image can't be checked without mounting it.
+            layers = cls._layers(os.path.join(target_prefix, entry), **kwargs)
+            shell_found = bool(layers) and os.path.isfile(layers[-1])
 
             for prefix in ["usr", "tools"]:
-                shell = os.path.join(target_prefix, entry, prefix, "bin", "sh")
+                shell = cls._lookup(
+                    os.path.join(target_prefix, entry), prefix, "bin", "sh",
+                    **kwargs
+                )
                 if os.path.exists(shell):
                     shell_found = True
                     break
             #end for
 
-            print("{}{}".format(entry, "" if shell_found else " (defunct)"))
+            defunct = "" if shell_found else " (defunct)"
+
+            if kwargs.get("long"):
+                num_bytes, _, limit = usage[entry]
+
+                print("{:<{}}  {:>7}  {:>7}{}".format(
+                    entry, width, DiskUsage.format_size(num_bytes),
+                    DiskUsage.format_size(limit) if limit else "-", defunct
+                ))
+            else:
+                print("{}{}".format(entry, defunct))
+            #end if
         #end for
     #end function
 
+    # The files of a layered target are in its layer directory, unless the
+    # overlay is mounted.
+    @classmethod
+    def _disk_usage(cls, entries, **kwargs):
+        target_prefix = kwargs.get("target_prefix", Paths.target_prefix())
+        roots = {}
+
+        for entry in entries:
+            layers = cls._layers(os.path.join(target_prefix, entry), **kwargs)
+            if layers:
+                roots[entry] = os.path.dirname(layers[0])
+        #end for
+
+        return DiskUsage().measure(target_prefix, entries, roots)
+    #end function
+
     @classmethod
     def info(cls, target_name, **kwargs):
         target_prefix = kwargs.get("target_prefix", Paths.target_prefix())
@@ -151,13 +1028,21 @@ class BuildBoxTarget:
             "sysroot": target_dir
         }
 
-        etc_target = os.path.join(target_dir, "etc", "target")
+        layers = cls._layers(target_dir, **kwargs)
+        if layers and os.path.isfile(layers[-1]) and \
+                not os.path.ismount(target_dir):
+            raise BuildBoxError(
+                "target '{}' is backed by an image, mount it first."
+                .format(target_name)
+            )
+
+        etc_target = cls._lookup(target_dir, "etc", "target", **kwargs)
         if not os.path.exists(etc_target):
             raise BuildBoxError(
                 "target configuration not found at: {}".format(etc_target)
             )
 
-        os_release = os.path.join(target_dir, "etc", "os-release")
+        os_release = cls._lookup(target_dir, "etc", "os-release", **kwargs)
         if not os.path.exists(os_release):
             raise BuildBoxError(
                 "release info not found at: {}".format(os_release)
@@ -180,13 +1065,20 @@ class BuildBoxTarget:
                     except ValueError:
                         continue
 
-        libc_name = os.path.join(
-            target_dir, "usr", "share", "misc", "libc.name"
+        libc_name = cls._lookup(
+            target_dir, "usr", "share", "misc", "libc.name", **kwargs
         )
 
         with open(libc_name, "r", encoding="utf-8") as f:
             info_dict["libc"] = f.read().strip()
 
+        num_bytes, _, limit = cls._disk_usage(
+            [target_name], **kwargs
+        )[target_name]
+
+        info_dict["disk_usage"] = num_bytes
+        info_dict["size_limit"] = limit or 0
+
         key = kwargs.get("key")
         if key:
             try:
@@ -209,6 +1101,231 @@ class BuildBoxTarget:
         #end if
     #end function
 
+    # Deletes the least recently used targets, prebuilt targets and cached
+    # packages that no target has installed, until they fit into `budget`
+    # bytes altogether. Targets that are mounted or in use are skipped.
+    @classmethod
+    def gc(cls, budget, **kwargs):
+        target_prefix = kwargs.get("target_prefix", Paths.target_prefix())
+        dry_run = kwargs.get("dry_run", False)
+
+        names = []
+        if os.path.isdir(target_prefix):
+            names = [
+                entry for entry in sorted(os.listdir(target_prefix))
+                if os.path.isdir(os.path.join(target_prefix, entry))
+            ]
+        #end if
+
+        package_cache = PackageCache()
+
+        # Converting the package caches to the store and dropping what no
+        # cache links to anymore may be enough already.
+        if not dry_run:
+            package_cache.dedup()
+            package_cache.sweep()
+        #end if
+
+        usage = cls._disk_usage(names, **kwargs)
+        installed = {}
+        num_refs = collections.Counter()
+
+        candidates = []
+
+        for name in names:
+            installed[name] = cls._installed_packages(
+                os.path.join(target_prefix, name), **kwargs
+            )
+            num_refs.update(installed[name])
+            candidates.append(
+                ("target", name, usage[name][0], cls._last_use(name, **kwargs))
+            )
+        #end for
+
+        for path, size, last_use in package_cache.packages():
+            candidates.append(("package", path, size, last_use))
+
+        candidates.extend(cls._prebuilt_candidates(**kwargs))
+
+        candidates.sort(key=lambda c: c[3])
+        total = sum(c[2] for c in candidates)
+
+        while total > budget:
+            # Packages become fair game once the last target that has them
+            # installed is gone.
+            victim = next(
+                (
+                    c for c in candidates if c[0] != "package" or
+                        num_refs[PackageCache.package_key(c[1])] == 0
+                ),
+                None
+            )
+
+            if victim is None:
+                break
+
+            candidates.remove(victim)
+            kind, item, size, _ = victim
+
+            if kind == "target":
+                if not cls._evict(item, **kwargs):
+                    continue
+                num_refs.subtract(installed[item])
+            elif kind == "prebuilt":
+                if not cls._evict_prebuilt(item, **kwargs):
+                    continue
+            elif not dry_run:
+                size = package_cache.remove(item)
+            #end if
+
+            LOGGER.info(
+                "{} {} '{}' ({}).".format(
+                    "would delete" if dry_run else "deleted", kind,
+                    item if kind != "package" else os.path.basename(item),
+                    DiskUsage.format_size(size)
+                )
+            )
+
+            total -= size
+        #end while
+
+        if total > budget:
+            LOGGER.warning(
+                "{} in use, which is over the budget.".format(
+                    DiskUsage.format_size(total)
+                )
+            )
+        #end if
+    #end function
+
+    # Prebuilt targets are never modified, so they are measured only once in
+    # a while. Copies in the making are left alone.
+    @classmethod
+    def _prebuilt_candidates(cls, **kwargs):
+        prebuilt_prefix = kwargs.get(
+            "prebuilt_prefix", Paths.prebuilt_prefix()
+        )
+
+        keys = []
+        if os.path.isdir(prebuilt_prefix):
+            keys = [
+                entry for entry in sorted(os.listdir(prebuilt_prefix))
+                if re.match(r"^[a-f0-9]{64}$", entry) and
+                    os.path.isdir(os.path.join(prebuilt_prefix, entry))
+            ]
+        #end if
+
+        if not keys:
+            return []
+
+        usage = DiskUsage().measure(prebuilt_prefix, keys)
+
+        return [
+            (
+                "prebuilt", key, usage[key][0],
+                os.stat(os.path.join(prebuilt_prefix, key)).st_mtime
+            )
+            for key in keys
+        ]
+    #end function
+
+    # Deletes the prebuilt target, unless a target is being created from it
+    # right now.
+    @classmethod
+    def _evict_prebuilt(cls, key, **kwargs):
+        prebuilt_prefix = kwargs.get(
+            "prebuilt_prefix", Paths.prebuilt_prefix()
+        )
+        prebuilt_dir = os.path.join(prebuilt_prefix, key)
+
+        with open(prebuilt_dir + ".lock", "a", encoding="utf-8") as lock_file:
+            try:
+                fcntl.flock(lock_file, fcntl.LOCK_EX | fcntl.LOCK_NB)
+            except BlockingIOError:
+                LOGGER.info(
+                    "skipping prebuilt target '{}', it is in use."
+                    .format(key)
+                )
+                return False
+            #end try
+
+            if kwargs.get("dry_run"):
+                return True
+
+            return cls._delete_prebuilt(key, prebuilt_prefix)
+    #end function
+
+    @classmethod
+    def _last_use(cls, target_name, **kwargs):
+        used_prefix = kwargs.get("used_prefix", Paths.used_prefix())
+        target_prefix = kwargs.get("target_prefix", Paths.target_prefix())
+
+        for path in [os.path.join(used_prefix, target_name),
+                os.path.join(target_prefix, target_name)]:
+            try:
+                return os.stat(path).st_mtime
+            except FileNotFoundError:
+                continue
+        #end for
+
+        return 0
+    #end function
+
+    @classmethod
+    def _installed_packages(cls, target_dir, **kwargs):
+        for prefix in ["var", "usr"]:
+            status = cls._lookup(
+                target_dir, prefix, "lib", "opkg", "status", **kwargs
+            )
+            if os.path.exists(status):
+                return PackageCache.installed(status)
+        #end for
+
+        return set()
+    #end function
+
+    # Deletes the target, unless it is mounted or in use. `build-box-do`
+    # checks again, while holding the lock.
+    @classmethod
+    def _evict(cls, target_name, **kwargs):
+        target_prefix = kwargs.get("target_prefix", Paths.target_prefix())
+        target_dir = os.path.join(target_prefix, target_name)
+
+        if os.path.ismount(target_dir) or \
+                Sysroot.mount_points_below(target_dir):
+            LOGGER.info(
+                "skipping target '{}', it is mounted.".format(target_name)
+            )
+            return False
+        #end if
+
+        fd = os.open(target_dir, os.O_RDONLY | os.O_DIRECTORY)
+
+        try:
+            fcntl.flock(fd, fcntl.LOCK_EX | fcntl.LOCK_NB)
+        except BlockingIOError:
+            LOGGER.info(
+                "skipping target '{}', it is in use.".format(target_name)
+            )
+            return False
+        finally:
+            os.close(fd)
+        #end try
+
+        if kwargs.get("dry_run"):
+            return True
+
+        proc = subprocess.run(
+            ["build-box-do", "delete", "-t", target_prefix, target_name]
+        )
+        if proc.returncode != 0:
+            return False
+
+        cls._forget_baseline(target_name, **kwargs)
+        ArchiveManifest.remove(cls._ownership_path(target_name, **kwargs))
+        return True
+    #end function
+
     @classmethod
     def delete(cls, targets: list, **kwargs):
         for target_name in set(targets):
@@ -226,37 +1343,37 @@ class BuildBoxTarget:
 
         sysroot = Sysroot(target_dir)
         sysroot.terminate_processes()
-        sysroot.umount_all()
-
-        for subdir in ["dev", "proc", "sys"]:
-            full_path = os.path.join(target_dir, subdir)
+        sysroot.umount_recursive()
 
-            if os.path.exists(full_path) and os.listdir(full_path):
-                raise BuildBoxError(
-                    "the '{}' subdirectory is not empty, aborting."
-                    .format(subdir)
-                )
-            #end if
-        #end for
-
-        with open("/proc/mounts", "r", encoding="utf-8") as f:
-            buf = f.read()
+        # build-box-do makes sure that nothing is mounted anymore, moves the
+        # target and its layers to the trash and leaves the rest to a
+        # background process.
+        proc = subprocess.run(
+            ["build-box-do", "delete", "-t", target_prefix, target_name]
+        )
+        if proc.returncode != 0:
+            raise BuildBoxError(
+                "failed to delete target '{}'.".format(target_name)
+            )
 
-        for line in buf.splitlines():
-            _, mountpoint, _, _, _, _ = line.strip().split()
+        cls._forget_baseline(target_name, **kwargs)
+        ArchiveManifest.remove(cls._ownership_path(target_name, **kwargs))
+    #end function
 
-            mountpoint = os.path.normpath(os.path.realpath(mountpoint))
-            if mountpoint.startswith(target_dir + os.sep):
-                raise BuildBoxError(
-                    "there is something mounted at '{}', aborting."
-                    .format(mountpoint)
-                )
-            #end if
-        #end for
+    # Same as the check in build-box-do: the normalized path must be a
+    # directory owned by the user.
+    @classmethod
+    def _isdir_and_owned_or_raise(cls, path):
+        normalized = os.path.realpath(path)
+        st = os.lstat(normalized)
 
-        old_sig_handler = signal.signal(signal.SIGINT, signal.SIG_IGN)
-        shutil.rmtree(target_dir)
-        signal.signal(signal.SIGINT, old_sig_handler)
+        if not stat.S_ISDIR(st.st_mode):
+            raise BuildBoxError("{} is not a directory.".format(path))
+        if st.st_uid != os.getuid():
+            raise BuildBoxError(
+                "directory '{}' is not owned by user id '{}'."
+                .format(path, os.getuid())
+            )
     #end function
 
     @classmethod
@@ -0,0 +1,245 @@
+# -*- encoding: utf-8 -*-
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+import concurrent.futures
+import json
+import os
+import re
+import stat
+import subprocess
+import time
+
+from yaybondi.buildbox.error import BuildBoxError
+from yaybondi.buildbox.misc.paths import Paths
+
+# Reports how much space targets use. Where the file system accounts for it
+# through project quotas, `build-box-do quota` knows right away. Everywhere
+# else, the trees are walked in parallel and the results are cached for a
+# while, because that takes long.
+class DiskUsage:
+
+    MAX_AGE = 600
+
+    def __init__(self, jobs=None, cache_path=None):
+        self._jobs = jobs or os.cpu_count() or 1
+        self._cache_path = cache_path or Paths.usage_cache()
+    #end function
+
+    # Returns a dictionary that maps the names of the given targets to tuples
+    # (bytes, inodes, limit). The limit is None if there is none or it is not
+    # known. `roots` maps target names to the directories that hold their
+    # files, if they are somewhere else than the target directory.
+    def measure(self, target_prefix, names, roots=None):
+        roots = roots or {}
+        result = self._query_quota(target_prefix, names)
+        missing = [name for name in names if name not in result]
+
+        if not missing:
+            return result
+
+        cache = self._load_cache()
+        now = time.time()
+        walk = {}
+
+        for name in missing:
+            root = os.path.realpath(
+                roots.get(name, os.path.join(target_prefix, name))
+            )
+            entry = cache.get(root)
+
+            if entry and now - entry["time"] < self.MAX_AGE:
+                result[name] = (entry["bytes"], entry["inodes"], None)
+            else:
+                walk[name] = root
+        #end for
+
+        for name, root in walk.items():
+            num_bytes, num_inodes = self.walk(root)
+
+            cache[root] = {
+                "time": now, "bytes": num_bytes, "inodes": num_inodes
+            }
+            result[name] = (num_bytes, num_inodes, None)
+        #end for
+
+        if walk:
+            self._save_cache(cache, now)
+
+        return result
+    #end function
+
+    # Adds up the space used by everything below `root`, like `du` would.
+    # Hard links are counted once and mounts are left out.
+    def walk(self, root):
+        try:
+            st = os.lstat(root)
+        except FileNotFoundError:
+            return 0, 0
+
+        root_dev = st.st_dev
+        seen = set()
+        num_bytes = st.st_blocks * 512
+        num_inodes = 1
+
+        with concurrent.futures.ThreadPoolExecutor(self._jobs) as pool:
+            pending = [pool.submit(self._walk_dir, pool, root, root_dev, seen)]
+
+            try:
+                while pending:
+                    sub_bytes, sub_inodes, sub_jobs = pending.pop().result()
+                    num_bytes += sub_bytes
+                    num_inodes += sub_inodes
+                    pending.extend(sub_jobs)
+                #end while
+            except BaseException:
+                for job in pending:
+                    job.cancel()
+                raise
+            #end try
+
+        return num_bytes, num_inodes
+    #end function
+
+    def _walk_dir(self, pool, path, root_dev, seen):
+        num_bytes = 0
+        num_inodes = 0
+        sub_jobs = []
+
+        try:
+            it = os.scandir(path)
+        except (FileNotFoundError, PermissionError):
+            return num_bytes, num_inodes, sub_jobs
+
+        with it:
+            for entry in it:
+                try:
+                    st = entry.stat(follow_symlinks=False)
+                except FileNotFoundError:
+                    continue
+
+                if st.st_dev != root_dev:
+                    continue
+
+                if st.st_nlink > 1 and not stat.S_ISDIR(st.st_mode):
+                    if st.st_ino in seen:
+                        continue
+                    seen.add(st.st_ino)
+                #end if
+
+                num_bytes += st.st_blocks * 512
+                num_inodes += 1
+
+                if stat.S_ISDIR(st.st_mode):
+                    sub_jobs.append(
+                        pool.submit(self._walk_dir, pool, entry.path,
+                            root_dev, seen)
+                    )
+                #end if
+            #end for
+
+        return num_bytes, num_inodes, sub_jobs
+    #end function
+
+    def _query_quota(self, target_prefix, names):
+        result = {}
+
+        if not names:
+            return result
+
+        proc = subprocess.run(
+            ["build-box-do", "quota", "-t", target_prefix] + list(names),
+            stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL,
+            universal_newlines=True
+        )
+
+        if proc.returncode != 0:
+            return result
+
+        for line in proc.stdout.splitlines():
+            try:
+                name, num_bytes, num_inodes, limit = line.rsplit(" ", 3)
+                result[name] = (
+                    int(num_bytes), int(num_inodes), int(limit) or None
+                )
+            except ValueError:
+                continue
+        #end for
+
+        return result
+    #end function
+
+    def _load_cache(self):
+        try:
+            with open(self._cache_path, "r", encoding="utf-8") as f:
+                return json.load(f)
+        except (OSError, ValueError):
+            return {}
+    #end function
+
+    def _save_cache(self, cache, now):
+        cache = {
+            root: entry for root, entry in cache.items()
+            if now - entry["time"] < self.MAX_AGE
+        }
+
+        tmp_path = "{}.{}".format(self._cache_path, os.getpid())
+
+        try:
+            with open(tmp_path, "w", encoding="utf-8") as f:
+                json.dump(cache, f)
+            os.rename(tmp_path, self._cache_path)
+        except OSError:
+            if os.path.exists(tmp_path):
+                os.unlink(tmp_path)
+        #end try
+    #end function
+
+    # Parses a number of bytes with an optional suffix K, M, G or T.
+    @staticmethod
+    def parse_size(size):
+        m = re.match(r"^(\d+)([kmgtKMGT]?)$", size.strip())
+        if not m:
+            raise BuildBoxError("invalid size '{}'.".format(size))
+
+        shift = 10 * (" KMGT".index(m.group(2).upper() or " "))
+        return int(m.group(1)) << shift
+    #end function
+
+    # Formats a number of bytes for humans.
+    @staticmethod
+    def format_size(num_bytes):
+        for unit in ["B", "K", "M", "G", "T"]:
+            if num_bytes < 1024 or unit == "T":
+                break
+            num_bytes /= 1024.0
+        #end for
+
+        if unit == "B":
+            return "{}{}".format(int(num_bytes), unit)
+        return "{:.1f}{}".format(num_bytes, unit)
+    #end function
+
+#end class
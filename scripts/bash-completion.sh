@@ -57,7 +57,7 @@ _build_box_arg_complete() {
         '<fstype>')
             COMPREPLY=(
                 $(
-                    compgen -W "dev proc sys home" -- ${COMP_WORDS[COMP_CWORD]}
+                    compgen -W "dev proc sys home pkg-cache tmp" -- ${COMP_WORDS[COMP_CWORD]}
                 )
             )
             return
@@ -70,6 +70,25 @@ _build_box_arg_complete() {
             )
             return
             ;;
+        '<target-name>')
+            COMPREPLY=(
+                $(
+                    compgen -W "$(
+                        ${COMP_WORDS[0]} list | cut -d' ' -f1
+                    )" -- ${COMP_WORDS[COMP_CWORD]}
+                )
+            )
+            return
+            ;;
+        '<how>')
+            COMPREPLY=(
+                $(
+                    compgen -W "snapshot reflink hardlink copy" \
+                        -- ${COMP_WORDS[COMP_CWORD]}
+                )
+            )
+            return
+            ;;
     esac
 
     local _word_counter=0
@@ -135,7 +154,25 @@ _build_box_arg_complete() {
         fi
     fi
 
+    # The 'session' command comes in several forms, all of which name the
+    # target in the same position
+    if [ "${COMP_WORDS[1]}" = "session" ]; then
+        case "$_varg_counter" in
+            3)
+                _expected_arg="<action>"
+                ;;
+            *)
+                _expected_arg=$(echo "$_expected_arg" | head -n1)
+                ;;
+        esac
+    fi
+
     case "$_expected_arg" in
+        '<action>')
+            COMPREPLY=(
+                $(compgen -W "start stop list" -- ${COMP_WORDS[COMP_CWORD]})
+            )
+            ;;
         '<target-name>')
             COMPREPLY=(
                 $(
@@ -160,26 +197,50 @@ _build_box_opt_complete() {
     local _opts="-h --help"
 
     case "${COMP_WORDS[1]}" in
+        clone)
+            _opts="$_opts -b --backend -j --jobs"
+            ;;
         create)
-            _opts="$_opts -r --release -a --arch -l --libc --force --repo-base --no-verify"
+            _opts="$_opts -r --release -a --arch -l --libc -j --jobs --force --from-oci --layered --repo-base --no-cache --no-verify --size-limit"
             ;;
-        delete|list)
+        delete)
             _opts="$_opts"
             ;;
+        import)
+            _opts="$_opts -j --jobs"
+            ;;
+        list)
+            _opts="$_opts -l --long"
+            ;;
+        export)
+            _opts="$_opts -j --jobs"
+            ;;
+        gc)
+            _opts="$_opts -b --budget -n --dry-run"
+            ;;
+        prefetch)
+            _opts="$_opts -r --release -a --arch -l --libc -j --jobs --repo-base"
+            ;;
+        rebase)
+            _opts="$_opts -o --onto -f --force -j --jobs"
+            ;;
         info)
             _opts="$_opts --json -k --key"
             ;;
         login)
-            _opts="$_opts -m --mount --no-mount --no-file-copy"
+            _opts="$_opts -m --mount --no-mount --no-file-copy --auto-umount --linger --private-mounts --no-session --scratch --shm-size --host-dev"
             ;;
         run)
-            _opts="$_opts --isolate -m --mount --no-mount --no-file-copy"
+            _opts="$_opts --isolate -m --mount --no-mount --no-file-copy --auto-umount --linger --private-mounts --no-session --scratch --shm-size --host-dev --overlay --overlay-tmpfs --commit"
             ;;
         mount)
-            _opts="$_opts -m --mount"
+            _opts="$_opts -m --mount --scratch --shm-size --host-dev"
+            ;;
+        session)
+            _opts="$_opts -m --mount --no-mount --no-file-copy --scratch --shm-size --host-dev"
             ;;
         umount)
-            _opts="$_opts -m --umount"
+            _opts="$_opts -m --umount -a --all -l --lazy -f --force --scratch"
             ;;
     esac
 
@@ -187,7 +248,7 @@ _build_box_opt_complete() {
 }
 
 _build_box_complete() {
-    local _valid_commands="create delete info list login mount run umount"
+    local _valid_commands="clone create delete export gc import info list login mount prefetch rebase run session umount"
 
     case "$COMP_CWORD" in
         1)
@@ -0,0 +1,172 @@
+# -*- encoding: utf-8 -*-
+#
+# The MIT License (MIT)
+#
+# Copyright (c) 2026 Tobias Koch <tobias.koch@gmail.com>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+#
+
+import functools
+import gzip
+import hashlib
+import http.server
+import os
+import tempfile
+import threading
+import unittest
+
+from yaybondi.buildbox.pkgcache import PackageCache
+from yaybondi.buildbox.pkgindex import PackageIndex
+
+STANZA = """\
+Package: {name}
+Version: 1.0
+Filename: ./{name}_1.0_all.ipk
+SHA256sum: {digest}
+Size: 42
+
+"""
+
+# Serves the feed and counts what was sent how often.
+class FeedHandler(http.server.SimpleHTTPRequestHandler):
+
+    def send_response(self, code, message=None):
+        self.server.responses.append(code)
+        super().send_response(code, message)
+
+    def log_message(self, *args):
+        pass
+
+#end class
+
+class PackageIndexDigestsTest(unittest.TestCase):
+
+    def setUp(self):
+        self._tmp_dir = tempfile.TemporaryDirectory()
+        self.feed_dir = os.path.join(self._tmp_dir.name, "feed")
+        self.cache = PackageCache(
+            cache_prefix=os.path.join(self._tmp_dir.name, "cache")
+        )
+        os.mkdir(self.feed_dir)
+        self.write_index("foo")
+    #end function
+
+    def tearDown(self):
+        self._tmp_dir.cleanup()
+
+    def write_index(self, *names, mtime=None):
+        path = os.path.join(self.feed_dir, "Packages.gz")
+
+        with gzip.open(path, "wt", encoding="utf-8") as f:
+            for name in names:
+                f.write(STANZA.format(
+                    name=name,
+                    digest=hashlib.sha256(name.encode("utf-8")).hexdigest()
+                ))
+        #end with
+
+        if mtime is not None:
+            os.utime(path, (mtime, mtime))
+
+        with open(path, "rb") as f:
+            return hashlib.sha256(f.read()).hexdigest()
+    #end function
+
+    def test_digest_is_that_of_the_index(self):
+        digest = self.write_index("foo", "bar")
+        feeds = {"main": "file://" + self.feed_dir}
+
+        self.assertEqual(
+            PackageIndex.digests(feeds, self.cache), {"main": digest}
+        )
+    #end function
+
+    def test_unchanged_file_index_is_not_read_again(self):
+        feeds = {"main": "file://" + self.feed_dir}
+
+        digest = self.write_index("foo", mtime=1000000000)
+        self.assertEqual(PackageIndex.digests(feeds, self.cache)["main"],
+            digest)
+
+        # Same size and timestamp, so the cached copy stands.
+        path = os.path.join(self.feed_dir, "Packages.gz")
+        with open(path, "r+b") as f:
+            f.seek(-1, os.SEEK_END)
+            f.write(b"\xff")
+        os.utime(path, (1000000000, 1000000000))
+
+        self.assertEqual(PackageIndex.digests(feeds, self.cache)["main"],
+            digest)
+
+        new_digest = self.write_index("bar", mtime=1000000100)
+        self.assertEqual(PackageIndex.digests(feeds, self.cache)["main"],
+            new_digest)
+    #end function
+
+    def test_http_feed_is_asked_whether_the_index_changed(self):
+        server = http.server.ThreadingHTTPServer(
+            ("127.0.0.1", 0),
+            functools.partial(FeedHandler, directory=self.feed_dir)
+        )
+        server.responses = []
+        thread = threading.Thread(target=server.serve_forever)
+        thread.start()
+
+        try:
+            feeds = {
+                "main": "http://127.0.0.1:{}/".format(server.server_port)
+            }
+
+            digest = self.write_index("foo", mtime=1000000000)
+            self.assertEqual(PackageIndex.digests(feeds, self.cache),
+                {"main": digest})
+            self.assertEqual(PackageIndex.digests(feeds, self.cache),
+                {"main": digest})
+            self.assertEqual(server.responses, [200, 304])
+
+            new_digest = self.write_index("foo", "bar", mtime=1000000100)
+            self.assertEqual(PackageIndex.digests(feeds, self.cache),
+                {"main": new_digest})
+            self.assertEqual(server.responses, [200, 304, 200])
+        finally:
+            server.shutdown()
+            thread.join()
+            server.server_close()
+        #end try
+    #end function
+
+    def test_index_is_built_from_the_cached_copy(self):
+        feeds = {"main": "file://" + self.feed_dir}
+
+        self.write_index("foo", "bar")
+        PackageIndex.digests(feeds, self.cache)
+        index = PackageIndex.from_feeds(feeds, self.cache)
+
+        self.assertIn("foo", index)
+        self.assertEqual(
+            index["bar"]["url"], "file://" + self.feed_dir + "/bar_1.0_all.ipk"
+        )
+    #end function
+
+#end class
+
+
+if __name__ == "__main__":
+    unittest.main()